@@ -21,16 +21,28 @@
 
 #include <Arduino.h>
 #include "Ethernet.h"
+#include "EthernetConnection.h"
+#include "EthernetDns.h"
+#include "EthernetService.h"
 #include "EthernetManager.h"
 #include "lwip/udp.h"
 #include "lwip/tcp.h"
+#include "lwip/dhcp.h"
 #include "lwip/dns.h"
+#include "lwip/stats.h"
 
 namespace ClearCore {
 extern EthernetManager &EthernetMgr;
 }
 
+EthernetClass::EthernetClass()
+    : m_beginStatus(EthernetAsyncIdle),
+      m_beginStarted(0),
+      m_beginTimeout(0),
+      m_beginHandler(nullptr) {}
+
 int EthernetClass::begin(uint8_t *mac) {
+    EthernetLock lock;
     (void)mac; // Disallow setting the MAC address.
 
     ClearCore::EthernetMgr.Setup();
@@ -43,6 +55,54 @@ int EthernetClass::begin(uint8_t *mac) {
     return dhcpSuccess;
 }
 
+void EthernetClass::beginAsync(uint8_t *mac, uint32_t timeout,
+                               EthernetAsyncHandler handler) {
+    EthernetLock lock;
+    (void)mac; // Disallow setting the MAC address.
+
+    ClearCore::EthernetMgr.Setup();
+
+    m_beginStarted = millis();
+    m_beginTimeout = timeout;
+    m_beginHandler = handler;
+    struct netif *netif = ClearCore::EthernetMgr.MacInterface();
+    if (!netif || dhcp_start(netif) != ERR_OK) {
+        beginFinish(EthernetAsyncFailed);
+        return;
+    }
+    // lwIP carries on with DHCP from its timers; it waits for the link
+    // by itself.
+    m_beginStatus = EthernetAsyncInProgress;
+}
+
+EthernetAsyncStatus EthernetClass::beginStatus() {
+    EthernetLock lock;
+    if (m_beginStatus != EthernetAsyncInProgress) {
+        return m_beginStatus;
+    }
+    ClearCore::EthernetMgr.Refresh();
+    struct netif *netif = ClearCore::EthernetMgr.MacInterface();
+    if (dhcp_supplied_address(netif)) {
+        const ip_addr_t *dns = dns_getserver(0);
+        ClearCore::EthernetMgr.DnsIp(dns->addr);
+        beginFinish(EthernetAsyncSuccess);
+    }
+    else if (millis() - m_beginStarted >= m_beginTimeout) {
+        dhcp_stop(netif);
+        beginFinish(EthernetAsyncFailed);
+    }
+    return m_beginStatus;
+}
+
+void EthernetClass::beginFinish(EthernetAsyncStatus status) {
+    m_beginStatus = status;
+    if (m_beginHandler) {
+        EthernetAsyncHandler handler = m_beginHandler;
+        m_beginHandler = nullptr;
+        handler(status);
+    }
+}
+
 // Begin functions assume that the DNS server and/or gateway will be on the
 // same network with the provided IP with the last value being 1.
 void EthernetClass::begin(uint8_t *mac, IPAddress ip) {
@@ -63,6 +123,7 @@ void EthernetClass::begin(uint8_t *mac, IPAddress ip, IPAddress dns,
 
 void EthernetClass::begin(uint8_t *mac, IPAddress ip, IPAddress dns,
                           IPAddress gateway, IPAddress subnet) {
+    EthernetLock lock;
     (void)mac; // Disallow setting the MAC address.
 
     ClearCore::EthernetMgr.Setup();
@@ -90,7 +151,11 @@ EthernetHardwareStatus EthernetClass::hardwareStatus() {
 }
 
 int EthernetClass::maintain() {
+    EthernetLock lock;
+    beginStatus();
     ClearCore::EthernetMgr.Refresh();
+    EthernetConnections.poll();
+    EthernetServer::dispatchAll();
     // lwIP handles all DHCP state changes (renewal, rebind, etc.)
     // in the background via sys_check_timeouts()
     return 0;
@@ -121,27 +186,35 @@ void EthernetClass::setMACAddress(const uint8_t *mac) {
 }
 
 void EthernetClass::setLocalIP(const IPAddress local_ip) {
+    EthernetLock lock;
     ClearCore::EthernetMgr.LocalIp(uint32_t(local_ip));
 }
 
 void EthernetClass::setSubnetMask(const IPAddress subnet) {
+    EthernetLock lock;
     ClearCore::EthernetMgr.NetmaskIp(uint32_t(subnet));
 }
 
 void EthernetClass::setGatewayIP(const IPAddress gateway) {
+    EthernetLock lock;
     ClearCore::EthernetMgr.GatewayIp(uint32_t(gateway));
 }
 
 void EthernetClass::setDnsServerIP(const IPAddress dns) {
+    EthernetLock lock;
     ClearCore::EthernetMgr.DnsIp(uint32_t(dns));
+    // Answers from the old server may not hold for the new one.
+    EthernetDns.clear();
 }
 
 void EthernetClass::setRetransmissionTimeout(uint16_t milliseconds) {
+    EthernetLock lock;
     milliseconds = constrain(milliseconds, 1, 6553);
     ClearCore::EthernetMgr.RetransmissionTimeout(milliseconds);
 }
 
 void EthernetClass::setRetransmissionCount(uint8_t number) {
+    EthernetLock lock;
     if (number == 0) {
         number = 1; // We should try at least once.
     }
@@ -149,6 +222,87 @@ void EthernetClass::setRetransmissionCount(uint8_t number) {
     ClearCore::EthernetMgr.RetransmissionCount(number);
 }
 
+void EthernetClass::setInterruptService(bool enable, uint8_t periodMs) {
+    ethernetServiceEnable(enable, periodMs);
+}
+
+#if MEM_STATS || MEMP_STATS
+static void poolStats(EthernetPoolStats &pool, const struct stats_mem *mem) {
+    pool.used = mem->used;
+    pool.max = mem->max;
+    pool.size = mem->avail;
+    pool.errors = mem->err;
+}
+#endif
+
+// The lwIP pool behind each EthernetStats pool other than the heap.
+#if MEMP_STATS
+static const memp_t statsPools[EthernetStats::PoolCount] = {
+    MEMP_MAX, MEMP_PBUF_POOL, MEMP_PBUF, MEMP_UDP_PCB, MEMP_TCP_PCB,
+    MEMP_TCP_PCB_LISTEN, MEMP_TCP_SEG
+};
+#endif
+
+EthernetStats EthernetClass::stats() {
+    EthernetLock lock;
+    EthernetStats stats;
+    memset(stats.pools, 0, sizeof(stats.pools));
+#if MEM_STATS
+    poolStats(stats.pools[EthernetStats::Heap], &lwip_stats.mem);
+#endif
+#if MEMP_STATS
+    for (uint8_t i = EthernetStats::PbufPool; i < EthernetStats::PoolCount;
+            i++) {
+        poolStats(stats.pools[i], lwip_stats.memp[statsPools[i]]);
+    }
+#endif
+#if LINK_STATS
+    stats.framesReceived = lwip_stats.link.recv;
+    stats.framesSent = lwip_stats.link.xmit;
+    stats.framesDropped = lwip_stats.link.drop;
+#else
+    stats.framesReceived = stats.framesSent = stats.framesDropped = 0;
+#endif
+#if TCP_STATS
+    stats.tcpSegmentsReceived = lwip_stats.tcp.recv;
+    stats.tcpSegmentsSent = lwip_stats.tcp.xmit;
+    stats.tcpDropped = lwip_stats.tcp.drop;
+#else
+    stats.tcpSegmentsReceived = stats.tcpSegmentsSent = stats.tcpDropped = 0;
+#endif
+#if UDP_STATS
+    stats.udpReceived = lwip_stats.udp.recv;
+    stats.udpSent = lwip_stats.udp.xmit;
+    stats.udpDropped = lwip_stats.udp.drop;
+#else
+    stats.udpReceived = stats.udpSent = stats.udpDropped = 0;
+#endif
+    return stats;
+}
+
+void EthernetClass::resetStats() {
+    EthernetLock lock;
+#if MEM_STATS
+    lwip_stats.mem.max = lwip_stats.mem.used;
+#endif
+#if MEMP_STATS
+    for (uint8_t i = EthernetStats::PbufPool; i < EthernetStats::PoolCount;
+            i++) {
+        struct stats_mem *mem = lwip_stats.memp[statsPools[i]];
+        mem->max = mem->used;
+    }
+#endif
+#if LINK_STATS
+    memset(&lwip_stats.link, 0, sizeof(lwip_stats.link));
+#endif
+#if TCP_STATS
+    memset(&lwip_stats.tcp, 0, sizeof(lwip_stats.tcp));
+#endif
+#if UDP_STATS
+    memset(&lwip_stats.udp, 0, sizeof(lwip_stats.udp));
+#endif
+}
+
 IPAddress EthernetClass::convertIp(ip_addr_t *ip) {
     IPAddress ipAddr = IPAddress(ip->addr);
     return ipAddr;
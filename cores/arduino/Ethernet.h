@@ -37,6 +37,7 @@
 #include "Client.h"
 #include "Server.h"
 #include "lwip/ip_addr.h"
+#include "lwip/udp.h"
 
 enum EthernetLinkStatus {
     Unknown,
@@ -52,17 +53,113 @@ enum EthernetHardwareStatus {
     EthernetBuiltIn
 };
 
+// Progress of beginAsync() and EthernetClient::connectAsync().
+enum EthernetAsyncStatus {
+    EthernetAsyncIdle,
+    EthernetAsyncInProgress,
+    EthernetAsyncSuccess,
+    EthernetAsyncFailed
+};
+
+// Called by Ethernet.maintain() when beginAsync() finishes.
+typedef void (*EthernetAsyncHandler)(EthernetAsyncStatus status);
+
+// A contiguous run of received bytes held in the network stack's buffers.
+struct EthernetSpan {
+    const uint8_t *data;
+    size_t length;
+};
+
+// Usage of one of the network stack's memory pools, or its heap.
+struct EthernetPoolStats {
+    uint16_t used;
+    // Most ever in use at once (since resetStats()).
+    uint16_t max;
+    // Size of the pool.
+    uint16_t size;
+    // Allocations that failed because the pool was empty.
+    uint16_t errors;
+};
+
+// Snapshot of the network stack's resource usage, from Ethernet.stats().
+// Print it for a readable summary, or use writeBinary() to send it
+// compactly: a one-byte tag ('S'), then every field in order as
+// little-endian integers.
+class EthernetStats : public Printable {
+public:
+    enum Pool {
+        Heap,       // Outgoing data and PBUF_RAM buffers
+        PbufPool,   // Received frames
+        Pbuf,       // Buffers referring to data held elsewhere
+        UdpPcb,     // UDP sockets
+        TcpPcb,     // TCP connections
+        TcpListen,  // Listening TCP servers
+        TcpSeg,     // Queued outgoing TCP segments
+        PoolCount
+    };
+
+    EthernetPoolStats pools[PoolCount];
+    uint32_t framesReceived;
+    uint32_t framesSent;
+    uint32_t framesDropped;
+    uint32_t tcpSegmentsReceived;
+    uint32_t tcpSegmentsSent;
+    uint32_t tcpDropped;
+    uint32_t udpReceived;
+    uint32_t udpSent;
+    uint32_t udpDropped;
+
+    virtual size_t printTo(Print &p) const;
+    size_t writeBinary(Print &p) const;
+};
+
+// Statistics of one TCP connection, from EthernetClient::stats(). Byte
+// counts start when the connection is first used through this library.
+// Printing and writeBinary() work as for EthernetStats; the binary tag is
+// 'C'.
+class EthernetClientStats : public Printable {
+public:
+    // Bytes received from the remote host.
+    uint32_t rxBytes;
+    // Bytes sent and acknowledged by the remote host.
+    uint32_t txBytes;
+    // Bytes written but not acknowledged yet.
+    uint32_t txQueued;
+    // Segments sent again because they were not acknowledged in time.
+    uint32_t retransmits;
+    // Smoothed round-trip time and retransmission timeout, in ms. These
+    // are measured in steps of the stack's TCP timer (TCP_SLOW_INTERVAL).
+    uint16_t rttMs;
+    uint16_t rtoMs;
+    // Space left in the remote host's receive window, in bytes.
+    uint16_t sendWindow;
+
+    virtual size_t printTo(Print &p) const;
+    size_t writeBinary(Print &p) const;
+};
+
 class EthernetUDP;
 class EthernetClient;
 class EthernetServer;
 class DhcpClass;
+struct EthernetConnectAttempt;
 
 class EthernetClass {
 public:
+    EthernetClass();
+
     // Initialize the Ethernet shield to use the provided MAC address and
     // gain the rest of the configuration through DHCP.
     // Returns 0 if the DHCP configuration failed, and 1 if it succeeded.
     int begin(uint8_t *mac);
+    // Start the same DHCP configuration as begin(mac) but return at once.
+    // Progress is made by Ethernet.maintain(), which runs handler (if any)
+    // when an address has been assigned or timeout ms have passed; the
+    // link does not need to be up yet. Poll beginStatus() instead of
+    // using a handler if preferred.
+    void beginAsync(uint8_t *mac, uint32_t timeout = 60000,
+                    EthernetAsyncHandler handler = nullptr);
+    EthernetAsyncStatus beginStatus();
     int maintain();
     EthernetLinkStatus linkStatus();
     EthernetHardwareStatus hardwareStatus();
@@ -89,6 +186,20 @@ public:
     void setRetransmissionTimeout(uint16_t milliseconds);
     void setRetransmissionCount(uint8_t number);
 
+    // Service the network stack from the lowest-priority interrupt
+    // (PendSV) every periodMs, so received frames and lwIP's timers are
+    // handled however long loop() takes. maintain() is still needed for
+    // EthernetServer callbacks and timed-out client buffers. EthernetUDP
+    // onPacket() handlers run in the interrupt while this is enabled.
+    // Only use the network stack through this library while it is enabled.
+    void setInterruptService(bool enable, uint8_t periodMs = 1);
+
+    // Resource usage and traffic counters of the network stack.
+    EthernetStats stats();
+    // Restart the pool high-water marks and zero the traffic counters.
+    // Pool allocation failures keep counting from where they were.
+    void resetStats();
+
     // Convert an lwIP IP address type to an Arduino IP address type (IPv4).
     IPAddress convertIp(ip_addr_t *ip);
 
@@ -98,23 +209,90 @@ public:
     friend class EthernetClient;
     friend class EthernetServer;
     friend class EthernetUDP;
+
+private:
+    void beginFinish(EthernetAsyncStatus status);
+
+    EthernetAsyncStatus m_beginStatus;
+    uint32_t m_beginStarted;
+    uint32_t m_beginTimeout;
+    EthernetAsyncHandler m_beginHandler;
 };
 
 extern EthernetClass Ethernet;
 
+// Number of connections made by connectAsync() that can be open, or being
+// opened, at the same time.
+#ifndef ETHERNET_CONNECT_MAX
+#define ETHERNET_CONNECT_MAX 4
+#endif
+
+// First and longest wait between connectAsync() attempts, in ms. The wait
+// doubles after each attempt that fails (e.g. is refused).
+#ifndef ETHERNET_CONNECT_BACKOFF_MS
+#define ETHERNET_CONNECT_BACKOFF_MS 100
+#endif
+#ifndef ETHERNET_CONNECT_BACKOFF_MAX_MS
+#define ETHERNET_CONNECT_BACKOFF_MAX_MS 2000
+#endif
+
+// Most received datagrams an EthernetUDP can hold until they are parsed.
+#ifndef ETHERNET_UDP_RX_QUEUE
+#define ETHERNET_UDP_RX_QUEUE 16
+#endif
+
+// Number of received datagrams each EthernetUDP holds by default; see
+// setReceiveQueueDepth(). Further datagrams are dropped.
+#ifndef ETHERNET_UDP_RX_DEPTH
+#define ETHERNET_UDP_RX_DEPTH 4
+#endif
+
+// Largest datagram payload that can be sent.
+#ifndef ETHERNET_UDP_TX_SIZE
+#define ETHERNET_UDP_TX_SIZE 1472
+#endif
+
+// Number of transmit buffers each EthernetUDP keeps for its outgoing
+// datagrams. Each is allocated on the first send that needs it and then
+// reused, so sending does not allocate once the socket is warmed up.
+#ifndef ETHERNET_UDP_TX_POOL
+#define ETHERNET_UDP_TX_POOL 2
+#endif
+
+// Number of multicast groups each EthernetUDP can join.
+#ifndef ETHERNET_UDP_MAX_GROUPS
+#define ETHERNET_UDP_MAX_GROUPS 4
+#endif
+
+// EthernetUDP receive callback, run for each datagram the socket queues.
+typedef void (*EthernetUDPHandler)(EthernetUDP &udp);
+
 class EthernetUDP : public UDP {
 public:
     EthernetUDP();
+    ~EthernetUDP();
     // Initialize the UDP library and network settings.
     // Start listening on the localPort. Returns 1 if successful,
     // 0 if there are no sockets available to use.
+    // Several sockets can be started on one port, e.g. for different
+    // multicast groups. They share the stack's socket: a multicast datagram
+    // goes to each of them that has joined its group, any other datagram to
+    // the one started first, and the multicast TTL and interface are set for
+    // the port as a whole.
     virtual uint8_t begin(uint16_t localPort);
 
     // initialize, start listening on specified multicast IP address and port.
     // Returns 1 if successful, 0 on failure.
-    virtual uint8_t beginMulticast(IPAddress, uint16_t) {
-        return 0;
-    }
+    virtual uint8_t beginMulticast(IPAddress ip, uint16_t port);
+
+    // Join or leave a multicast group on a socket that has been started with
+    // begin() or beginMulticast(). Datagrams sent to a group are only
+    // received by sockets that have joined it. Returns 1 if successful.
+    uint8_t joinGroup(IPAddress ip);
+    uint8_t leaveGroup(IPAddress ip);
+    // Set the time-to-live of multicast datagrams sent from this socket's
+    // port. The initial value is 1, which keeps them on the local network.
+    void setMulticastTTL(uint8_t ttl);
 
     // Disconnect from the server. Release any resource being used during the
     // UDP session.
@@ -133,6 +311,11 @@ public:
     // the UDP packet started with beginPacket(). Returns 1 if the packet was
     // sent successfully, 0 if there was an error.
     virtual int endPacket();
+    // Send length bytes of data to remotePort at remoteIp as one datagram,
+    // in place of beginPacket(), write() and endPacket(). Returns 1 if the
+    // datagram was sent, 0 if it is too long or no transmit buffer is free.
+    int sendTo(IPAddress remoteIp, uint16_t remotePort, const uint8_t *data,
+               size_t length);
 
     // Write UDP data to the outgoing packet set up with beginPacket(). The
     // packet will not be sent until endPacket() is called.
@@ -170,19 +353,146 @@ public:
     // Finish reading the current packet.
     virtual void flush();
 
+    // Take the next received datagram without copying it, in place of
+    // parsePacket() and read(). Points data at the payload and returns its
+    // length, or returns 0 if nothing has been received. The payload stays
+    // valid until the next call to receive(), parsePacket() or flush().
+    int receive(const uint8_t **data);
+
     // The IP address of the remote connection. Must be called after parsePacket().
     virtual IPAddress remoteIP();
     // The port of the remote connection. Must be called after parsePacket().
     virtual uint16_t remotePort();
+    // micros() when the current packet was handed to this socket by the
+    // network stack. With Ethernet.setInterruptService() that is shortly
+    // after the frame arrived; otherwise it is when the stack was next
+    // serviced, e.g. by Ethernet.maintain() or parsePacket().
+    uint32_t packetTimestamp() {
+        return m_rxPacket.timestamp;
+    }
+
+    // Run handler as soon as each datagram is queued, from within
+    // Ethernet.maintain() (or any other call that services the network
+    // stack). The handler takes the datagram with parsePacket() or
+    // receive(); one it leaves stays queued. Pass nullptr to go back to
+    // polling.
+    void onPacket(EthernetUDPHandler handler);
+    // Set how many received datagrams are held until they are parsed, from
+    // 1 to ETHERNET_UDP_RX_QUEUE. Datagrams that arrive while the queue is
+    // full are dropped. Datagrams already queued are kept.
+    void setReceiveQueueDepth(uint8_t depth);
+    uint8_t receiveQueueDepth() {
+        return m_rxDepth;
+    }
+
+    // Datagrams queued by this socket.
+    uint32_t packetsReceived() {
+        return m_rxReceived;
+    }
+    // Datagrams this socket dropped because its queue was full.
+    uint32_t packetsDroppedQueueFull() {
+        return m_rxDroppedQueueFull;
+    }
+    // Frames the Ethernet interface dropped because no receive buffer was
+    // free, since startup or the last resetCounters() on this socket. Those
+    // frames are dropped before the stack knows which socket they are for,
+    // so this count covers all sockets.
+    uint32_t packetsDroppedNoBuffer();
+    void resetCounters();
 
 private:
-    ClearCore::EthernetUdp m_udp;
+    struct Datagram {
+        struct pbuf *p;
+        ip_addr_t ip;
+        uint16_t port;
+        uint32_t timestamp;
+    };
+
+    bool open();
+    bool isMember(const ip_addr_t *group);
+    void deliver(struct pbuf *p, const ip_addr_t *addr, u16_t port,
+                 uint32_t timestamp);
+    struct pbuf *txAcquire();
+    int txSend(struct pbuf *p, uint16_t length, const ip_addr_t *ip,
+               uint16_t port);
+    static void input(void *arg, struct udp_pcb *pcb, struct pbuf *p,
+                      const ip_addr_t *addr, u16_t port);
+
+    struct udp_pcb *m_pcb;
+
+    Datagram m_rxQueue[ETHERNET_UDP_RX_QUEUE];
+    uint8_t m_rxHead;
+    uint8_t m_rxCount;
+    uint8_t m_rxDepth;
+    uint32_t m_rxReceived;
+    uint32_t m_rxDroppedQueueFull;
+    uint32_t m_rxNoBufferBase;
+    EthernetUDPHandler m_onPacket;
+    bool m_dispatching;
+    Datagram m_rxPacket;
+    uint16_t m_rxOffset;
+
+    struct pbuf *m_txPool[ETHERNET_UDP_TX_POOL];
+    void *m_txPayload[ETHERNET_UDP_TX_POOL];
+    struct pbuf *m_txPacket;
+    uint16_t m_txLength;
+    ip_addr_t m_txIp;
+    uint16_t m_txPort;
+
+    ip_addr_t m_groups[ETHERNET_UDP_MAX_GROUPS];
+    uint8_t m_groupCount;
+
+    // Started sockets, in the order they were started.
+    EthernetUDP *m_nextOpen;
+    static EthernetUDP *m_openList;
 };
 
+// Most clients a callback-driven EthernetServer keeps track of at once.
+#ifndef ETHERNET_SERVER_MAX_CLIENTS
+#define ETHERNET_SERVER_MAX_CLIENTS 8
+#endif
+
+// With no received traffic, how often (ms) a callback-driven server still
+// checks for new connections and connections that have timed out.
+#ifndef ETHERNET_SERVER_POLL_MS
+#define ETHERNET_SERVER_POLL_MS 100
+#endif
+
+// Longest EthernetServer::write() waits for a client to make room for more
+// of the data, in ms.
+#ifndef ETHERNET_SERVER_WRITE_MS
+#define ETHERNET_SERVER_WRITE_MS 1000
+#endif
+
+// Number and size of the buffers EthernetServer::write() and broadcast()
+// share between all clients. A payload is copied into one buffer once and every client's
+// connection refers to it until they have all acknowledged it. Writes that
+// are larger, or made while every buffer is still in use, are copied for
+// each client instead.
+#ifndef ETHERNET_BROADCAST_BUFFERS
+#define ETHERNET_BROADCAST_BUFFERS 4
+#endif
+#ifndef ETHERNET_BROADCAST_SIZE
+#define ETHERNET_BROADCAST_SIZE 512
+#endif
+
+// Outcome of EthernetServer::broadcast() for one client.
+struct EthernetBroadcastResult {
+    IPAddress ip;
+    uint16_t port;
+    bool sent;
+};
+
+// EthernetServer event callback. context points to a per-connection value
+// (initially nullptr) that the callbacks may use to keep their own state.
+typedef void (*EthernetServerHandler)(EthernetClient &client, void **context);
+
 class EthernetServer : public Server {
 public:
     // Create a server that listens for incoming connections on the specified port.
     EthernetServer(uint16_t port = 80);
+    // Stop running the server's callbacks. Connections are left open.
+    ~EthernetServer();
 
     // Tell the server to begin listening for incoming connections.
     virtual void begin();
@@ -195,18 +505,77 @@ public:
     // returned client, since accept() will return it only once.
     virtual EthernetClient accept();
 
-    // Write data to all the clients connected to a server.
+    // Write data to all the clients connected to a server. Each client is
+    // sent all of the data; a client that is short of room is waited for
+    // (servicing the network stack) until it has taken it, or has taken no
+    // more for ETHERNET_SERVER_WRITE_MS. Returns the number of bytes every
+    // client was sent, so size if all of them took all of it, or 0 if there
+    // are no clients.
     virtual size_t write(uint8_t);
     virtual size_t write(const uint8_t *buf, size_t size);
+    // Write data to all the clients connected to the server, without
+    // waiting for any of them. A client that cannot take all of the data
+    // at once (because it is slow to acknowledge what it was sent before)
+    // is skipped. Fills in up to maxResults results, one per client (the
+    // rest get port 0), and returns the number of clients the data was
+    // sent to.
+    uint8_t broadcast(const uint8_t *buf, size_t size,
+                      EthernetBroadcastResult *results = nullptr,
+                      uint8_t maxResults = 0);
 
     // This allows you to use "if (server)" to check if the supplied
     // EthernetServer server is started and connected.
     virtual operator bool();
 
+    // Event-driven operation. Instead of polling available() or accept(),
+    // register callbacks that Ethernet.maintain() runs when a client
+    // connects, when a connected client has data to read, and when a client
+    // disconnects (or is stopped from a callback). Up to
+    // ETHERNET_SERVER_MAX_CLIENTS clients are tracked in a fixed table;
+    // further connections are closed. The server is only examined after a
+    // frame has been received or every ETHERNET_SERVER_POLL_MS, so an idle
+    // server costs next to nothing per loop. Do not mix with available()
+    // and accept(). Clearing all three callbacks (passing nullptr) stops
+    // the server being examined.
+    void onConnect(EthernetServerHandler handler);
+    void onData(EthernetServerHandler handler);
+    void onClose(EthernetServerHandler handler);
+    // Number of clients in the connection table.
+    uint8_t clientCount() {
+        return m_clientCount;
+    }
+
+    // Run the callbacks of every callback-driven server.
+    static void dispatchAll();
+
     using Print::write;
 
 private:
+    struct Connection {
+        ClearCore::EthernetTcpClient tcpClient;
+        void *context;
+        bool open;
+    };
+
+    bool serverClient(struct tcp_pcb *pcb);
+    void updateDispatch();
+    void enableDispatch();
+    void disableDispatch();
+    void dispatch();
+
     ClearCore::EthernetTcpServer m_tcpServer;
+    uint16_t m_port;
+
+    EthernetServerHandler m_onConnect;
+    EthernetServerHandler m_onData;
+    EthernetServerHandler m_onClose;
+    Connection m_connections[ETHERNET_SERVER_MAX_CLIENTS];
+    uint8_t m_clientCount;
+    uint32_t m_rxFramesSeen;
+    uint32_t m_lastDispatch;
+    bool m_dispatching;
+    EthernetServer *m_nextDispatch;
+    static EthernetServer *m_dispatchList;
 };
 
 class EthernetClient : public Client {
@@ -226,10 +595,36 @@ public:
     // -4: INVALID_RESPONSE
     virtual int connect(IPAddress ip, uint16_t port);
     virtual int connect(const char *host, uint16_t port);
-
-    // Write data to the server the client is connected to.
+    // Start connecting without blocking the caller, and keep trying until
+    // connected or timeout ms have passed. Each call to connectStatus()
+    // moves the attempt along: once the link is up it starts the handshake
+    // and returns, and later calls see whether the remote host has
+    // answered, however long that takes. Failed attempts are retried with
+    // exponential backoff. Calling stop() abandons the attempt.
+    void connectAsync(IPAddress ip, uint16_t port, uint32_t timeout = 10000);
+    EthernetAsyncStatus connectStatus();
+
+    // Write data to the server the client is connected to. Waits
+    // (servicing the network stack) until all of the data has been buffered
+    // or queued, the connection closes, or the connection timeout passes
+    // without progress; use availableForWrite() to avoid waiting. Returns
+    // the number of bytes taken.
     virtual size_t write(uint8_t val);
     virtual size_t write(const uint8_t *buf, size_t size);
+    // Write data that will not change for as long as the connection lasts,
+    // such as a constant in flash, without copying it: the network stack
+    // sends straight from buf, including any retransmissions. Any buffered
+    // data is sent first. Waits (servicing the network stack) until all of
+    // the data has been queued, the connection closes, or the connection
+    // timeout passes without progress. Returns the number of bytes queued.
+    size_t writeStatic(const uint8_t *buf, size_t size);
+    size_t writeStatic(const char *str) {
+        return writeStatic((const uint8_t *)str, strlen(str));
+    }
+    // Number of bytes that can be written right now without write() or
+    // writeStatic() having to wait or take less. Any buffered data is sent
+    // first; 0 is returned while some of it is still waiting for room.
+    int availableForWrite();
 
     // Return the number of bytes available for reading (the amount of data that
     // has been written to the client by the server it is connected to).
@@ -240,8 +635,55 @@ public:
     // Read size bytes into the supplied buf from the associated server.
     virtual int read(uint8_t *buf, size_t size);
 
-    // Wait until all outgoing characters in buffer have been sent.
+    // Zero-copy receive. Return the next contiguous run of received bytes
+    // in place, without copying it out of the network stack's buffers. The
+    // span is empty if nothing has been received. It stays valid until
+    // data is next consumed or read.
+    EthernetSpan span();
+    // Fill up to maxSpans spans covering all of the received data, in order.
+    // Returns the number of spans filled.
+    int spans(EthernetSpan *spans, int maxSpans);
+    // Release count bytes from the front of the received data once they
+    // have been used.
+    void consume(size_t count);
+
+    // Send any buffered outgoing data and wait until it has been sent.
     virtual void flush();
+
+    // Outgoing data is collected in a buffer shared by every client object
+    // for the same connection, and sent as one segment when flush() is
+    // called, when the buffer holds at least the threshold number of bytes,
+    // or once the oldest byte has waited the flush timeout. The timeout is
+    // checked by the other client and server calls and by Ethernet.maintain().
+    void setFlushThreshold(uint16_t bytes);
+    void setFlushTimeout(uint16_t milliseconds);
+    // If noDelay is true, send each write() immediately without buffering
+    // and disable Nagle's algorithm on the connection.
+    void setNoDelay(bool noDelay);
+    bool getNoDelay();
+
+    // Per-connection TCP tuning. These settings belong to the connection,
+    // so they can be applied to a client returned by EthernetServer and
+    // last until it is closed.
+
+    // Probe the remote host after idleMs without traffic, every intervalMs,
+    // and drop the connection after probes unanswered probes. Interval and
+    // probe count need LWIP_TCP_KEEPALIVE in the stack's configuration;
+    // otherwise the stack's fixed values are used.
+    void setKeepAlive(bool enable, uint32_t idleMs = 7200000,
+                      uint32_t intervalMs = 75000, uint8_t probes = 9);
+    // Limit the data written but not yet acknowledged to bytes, so that
+    // write() pushes back sooner and little data waits in the stack (for
+    // low latency). 0 (the default) allows the stack's whole send buffer,
+    // TCP_SND_BUF (for throughput).
+    void setSendBufferSize(uint16_t bytes);
+    // Advertise a receive window of at most bytes, between TCP_MSS and the
+    // stack's TCP_WND (the default), so a fast sender cannot get far ahead
+    // of the reader. A smaller window takes effect as data is read.
+    void setReceiveWindow(uint16_t bytes);
+    // Fill in the connection's statistics. Returns false if the client is
+    // not connected.
+    bool stats(EthernetClientStats &stats);
     // Disconnect from the server.
     virtual void stop();
     // Return whether the client is connected. (The client is still considered
@@ -279,6 +721,19 @@ public:
 protected:
     ClearCore::EthernetTcpClient m_tcpClient;
     bool m_dnsInitialized;
+
+private:
+    bool connectStart();
+
+    EthernetAsyncStatus m_connectStatus;
+    // The connection being opened by connectAsync(), if any.
+    EthernetConnectAttempt *m_connectAttempt;
+    IPAddress m_connectIp;
+    uint16_t m_connectPort;
+    uint32_t m_connectStarted;
+    uint32_t m_connectTimeout;
+    uint32_t m_connectRetryAt;
+    uint16_t m_connectBackoff;
 };
 
 #endif
@@ -1,25 +1,159 @@
 #include <Ethernet.h>
+#include "EthernetConnection.h"
+#include "EthernetDns.h"
+#include "EthernetManager.h"
+#include "EthernetService.h"
 #include "EthernetUtils.h"
 #include "IpAddress.h"
+#include "lwip/tcp.h"
+
+namespace ClearCore {
+extern EthernetManager &EthernetMgr;
+}
+
+// A connection opened by connectAsync(). The handshake is reported by lwIP
+// callbacks, which may come after the EthernetClient that started it has
+// been copied, so the attempt is kept here rather than in the client. Once
+// connected, the client adopts the connection through data, which then
+// stays here until the connection has closed and its data has been read.
+struct EthernetConnectAttempt {
+    enum State {
+        Connecting,
+        Connected,
+        Failed
+    };
+
+    ClearCore::TcpData data;
+    State state;
+    // A client is waiting for the outcome.
+    bool claimed;
+};
+
+static EthernetConnectAttempt connectAttempts[ETHERNET_CONNECT_MAX];
+
+static err_t connectDone(void *arg, struct tcp_pcb *pcb, err_t err) {
+    EthernetConnectAttempt *attempt = static_cast<EthernetConnectAttempt *>(arg);
+    if (attempt) {
+        attempt->state = EthernetConnectAttempt::Connected;
+    }
+    return ERR_OK;
+}
+
+// lwIP has freed the pcb: the handshake failed (was refused, or went
+// unanswered), or the connection was reset.
+static void connectError(void *arg, err_t err) {
+    EthernetConnectAttempt *attempt = static_cast<EthernetConnectAttempt *>(arg);
+    if (!attempt) {
+        return;
+    }
+    attempt->data.pcb = nullptr;
+    if (attempt->state == EthernetConnectAttempt::Connecting) {
+        attempt->state = EthernetConnectAttempt::Failed;
+    }
+}
+
+// Received data is appended to the connection's pbuf chain, where
+// ClearCore's read functions find it (see EthernetConnection::state). The
+// end of the stream is left for them to see from the pcb's state.
+static err_t connectReceive(void *arg, struct tcp_pcb *pcb, struct pbuf *p,
+                            err_t err) {
+    EthernetConnectAttempt *attempt = static_cast<EthernetConnectAttempt *>(arg);
+    if (!p) {
+        return ERR_OK;
+    }
+    if (!attempt || attempt->data.pcb != pcb) {
+        tcp_recved(pcb, p->tot_len);
+        pbuf_free(p);
+        return ERR_OK;
+    }
+    if (attempt->data.pbuf) {
+        pbuf_cat(attempt->data.pbuf, p);
+    }
+    else {
+        attempt->data.pbuf = p;
+    }
+    return ERR_OK;
+}
+
+static EthernetConnectAttempt *connectAttemptFree() {
+    for (uint8_t i = 0; i < ETHERNET_CONNECT_MAX; i++) {
+        EthernetConnectAttempt &attempt = connectAttempts[i];
+        if (!attempt.claimed && !attempt.data.pcb && !attempt.data.pbuf) {
+            return &attempt;
+        }
+    }
+    return nullptr;
+}
+
+static EthernetConnectAttempt *connectAttemptOf(ClearCore::TcpData *state) {
+    for (uint8_t i = 0; i < ETHERNET_CONNECT_MAX; i++) {
+        if (&connectAttempts[i].data == state) {
+            return &connectAttempts[i];
+        }
+    }
+    return nullptr;
+}
+
+// Stop lwIP reporting to an attempt, ahead of its connection being closed.
+// One that has not connected yet is given up.
+static void connectDetach(EthernetConnectAttempt *attempt) {
+    struct tcp_pcb *pcb = attempt->data.pcb;
+    attempt->claimed = false;
+    if (!pcb) {
+        return;
+    }
+    tcp_arg(pcb, nullptr);
+    if (attempt->state == EthernetConnectAttempt::Connecting) {
+        tcp_abort(pcb);
+        attempt->data.pcb = nullptr;
+        return;
+    }
+    // lwIP's own handler takes whatever arrives while closing.
+    tcp_recv(pcb, nullptr);
+    tcp_err(pcb, nullptr);
+}
 
 EthernetClient::EthernetClient()
     : m_tcpClient(),
-      m_dnsInitialized(false) {}
+      m_dnsInitialized(false),
+      m_connectStatus(EthernetAsyncIdle),
+      m_connectAttempt(nullptr),
+      m_connectIp(),
+      m_connectPort(0),
+      m_connectStarted(0),
+      m_connectTimeout(0),
+      m_connectRetryAt(0),
+      m_connectBackoff(0) {}
 
 EthernetClient::EthernetClient(ClearCore::EthernetTcpClient tcpClient)
     : m_tcpClient(tcpClient),
-      m_dnsInitialized(false) {}
+      m_dnsInitialized(false),
+      m_connectStatus(EthernetAsyncIdle),
+      m_connectAttempt(nullptr),
+      m_connectIp(),
+      m_connectPort(0),
+      m_connectStarted(0),
+      m_connectTimeout(0),
+      m_connectRetryAt(0),
+      m_connectBackoff(0) {}
 
 int EthernetClient::connect(IPAddress ip, uint16_t port) {
+    EthernetLock lock;
     ClearCore::IpAddress nativeIp = ClearCore::IpAddress(uint32_t(ip));
-    return m_tcpClient.Connect(nativeIp, port) ? 1 : 0;
+    if (!m_tcpClient.Connect(nativeIp, port)) {
+        return 0;
+    }
+    // Start the connection's statistics from here.
+    EthernetConnections.find(m_tcpClient, true);
+    return 1;
 }
 
 int EthernetClient::connect(const char *host, uint16_t port) {
+    EthernetLock lock;
     int result = -1;
     // Attempt to resolve the host.
     ip_addr_t remoteIp = {};
-    err_t err = ClearCore::DnsGetHostByName(host, &remoteIp);
+    err_t err = EthernetDns.resolve(host, &remoteIp);
     IPAddress ip = Ethernet.convertIp(&remoteIp);
 
     switch (err) {
@@ -48,38 +182,418 @@ int EthernetClient::connect(const char *host, uint16_t port) {
     return result;
 }
 
+void EthernetClient::connectAsync(IPAddress ip, uint16_t port,
+                                  uint32_t timeout) {
+    EthernetLock lock;
+    if (m_connectAttempt) {
+        connectDetach(m_connectAttempt);
+        m_connectAttempt = nullptr;
+    }
+    m_connectStatus = EthernetAsyncInProgress;
+    m_connectIp = ip;
+    m_connectPort = port;
+    m_connectStarted = millis();
+    m_connectTimeout = timeout;
+    m_connectRetryAt = m_connectStarted;
+    m_connectBackoff = ETHERNET_CONNECT_BACKOFF_MS;
+}
+
+EthernetAsyncStatus EthernetClient::connectStatus() {
+    EthernetLock lock;
+    if (m_connectStatus != EthernetAsyncInProgress) {
+        return m_connectStatus;
+    }
+    ClearCore::EthernetMgr.Refresh();
+
+    if (m_connectAttempt &&
+            m_connectAttempt->state == EthernetConnectAttempt::Connected) {
+        m_tcpClient = ClearCore::EthernetTcpClient(&m_connectAttempt->data);
+        m_connectAttempt->claimed = false;
+        m_connectAttempt = nullptr;
+        // Start the connection's statistics from here.
+        EthernetConnections.find(m_tcpClient, true);
+        m_connectStatus = EthernetAsyncSuccess;
+        return m_connectStatus;
+    }
+    if (m_connectAttempt &&
+            m_connectAttempt->state == EthernetConnectAttempt::Failed) {
+        m_connectAttempt->claimed = false;
+        m_connectAttempt = nullptr;
+        m_connectRetryAt = millis() + m_connectBackoff;
+        m_connectBackoff = min(m_connectBackoff * 2,
+                               ETHERNET_CONNECT_BACKOFF_MAX_MS);
+    }
+
+    if (millis() - m_connectStarted >= m_connectTimeout) {
+        if (m_connectAttempt) {
+            connectDetach(m_connectAttempt);
+            m_connectAttempt = nullptr;
+        }
+        m_connectStatus = EthernetAsyncFailed;
+        return m_connectStatus;
+    }
+    if (!m_connectAttempt && (int32_t)(millis() - m_connectRetryAt) >= 0 &&
+            !connectStart()) {
+        m_connectRetryAt = millis() + m_connectBackoff;
+    }
+    return m_connectStatus;
+}
+
+// Send the SYN for a new attempt, once the link is up and the interface has
+// an address. lwIP resolves the next hop and retransmits the SYN itself.
+// Returns false if the attempt could not be started.
+bool EthernetClient::connectStart() {
+    struct netif *netif = ClearCore::EthernetMgr.MacInterface();
+    if (!netif || !ClearCore::EthernetMgr.PhyLinkActive() ||
+            ip4_addr_isany_val(*netif_ip4_addr(netif))) {
+        return false;
+    }
+    EthernetConnectAttempt *attempt = connectAttemptFree();
+    struct tcp_pcb *pcb = attempt ? tcp_new() : nullptr;
+    if (!pcb) {
+        return false;
+    }
+    attempt->data = ClearCore::TcpData();
+    attempt->data.pcb = pcb;
+    attempt->state = EthernetConnectAttempt::Connecting;
+    tcp_arg(pcb, attempt);
+    tcp_err(pcb, connectError);
+    tcp_recv(pcb, connectReceive);
+
+    ip_addr_t remote = Ethernet.convertIp(m_connectIp);
+    if (tcp_connect(pcb, &remote, m_connectPort, connectDone) != ERR_OK) {
+        tcp_arg(pcb, nullptr);
+        tcp_abort(pcb);
+        attempt->data.pcb = nullptr;
+        return false;
+    }
+    attempt->claimed = true;
+    m_connectAttempt = attempt;
+    return true;
+}
+
 size_t EthernetClient::write(uint8_t c) {
     return write(&c, 1);
 }
 
+// Buffer or send as much of a write as the connection takes right now.
+static size_t writeSome(EthernetConnection *conn, const uint8_t *buffer,
+                        size_t size) {
+    if (conn->noDelay) {
+        return conn->flush() ? conn->send(buffer, size) : 0;
+    }
+
+    if (size >= conn->txThreshold ||
+            conn->txLength + size > ETHERNET_TX_BUFFER_SIZE) {
+        // Writes at least as large as the threshold gain nothing from being
+        // buffered, so send them directly once earlier data has gone.
+        if (conn->flush() && (size >= conn->txThreshold ||
+                              size > ETHERNET_TX_BUFFER_SIZE)) {
+            return conn->send(buffer, size);
+        }
+    }
+
+    if (conn->txLength == 0) {
+        conn->txQueuedAt = millis();
+    }
+    size_t count = min(size, (size_t)(ETHERNET_TX_BUFFER_SIZE - conn->txLength));
+    memcpy(conn->txBuffer + conn->txLength, buffer, count);
+    conn->txLength += count;
+    if (conn->txLength >= conn->txThreshold) {
+        conn->flush();
+    }
+    return count;
+}
+
 size_t EthernetClient::write(const uint8_t *buffer, size_t size) {
-    return m_tcpClient.Send(buffer, size);
+    EthernetLock lock;
+    EthernetConnection *conn = EthernetConnections.find(m_tcpClient, true);
+    if (!conn) {
+        return m_tcpClient.Send(buffer, size);
+    }
+    // Print callers ignore the count, so take all of it, waiting for room
+    // as writeStatic() does.
+    size_t written = 0;
+    uint32_t lastProgress = millis();
+    while (conn && written < size) {
+        size_t count = writeSome(conn, buffer + written, size - written);
+        if (count) {
+            written += count;
+            lastProgress = millis();
+            continue;
+        }
+        if (millis() - lastProgress >= m_tcpClient.ConnectionTimeout()) {
+            break;
+        }
+        // Wait for acknowledgements to free up room.
+        ClearCore::EthernetMgr.Refresh();
+        conn = EthernetConnections.find(m_tcpClient, false);
+    }
+    return written;
+}
+
+size_t EthernetClient::writeStatic(const uint8_t *buffer, size_t size) {
+    EthernetLock lock;
+    EthernetConnection *conn = EthernetConnections.find(m_tcpClient, true);
+    size_t sent = 0;
+    uint32_t lastProgress = millis();
+    while (conn && sent < size) {
+        uint32_t count = 0;
+        if (conn->flush()) {
+            count = conn->sendStatic(buffer + sent, size - sent);
+        }
+        if (count) {
+            sent += count;
+            lastProgress = millis();
+            continue;
+        }
+        if (millis() - lastProgress >= m_tcpClient.ConnectionTimeout()) {
+            break;
+        }
+        // Wait for acknowledgements to free up room.
+        ClearCore::EthernetMgr.Refresh();
+        conn = EthernetConnections.find(m_tcpClient, false);
+    }
+    return sent;
+}
+
+int EthernetClient::availableForWrite() {
+    EthernetLock lock;
+    EthernetConnections.poll();
+    EthernetConnection *conn = EthernetConnections.find(m_tcpClient, true);
+    // Keep some of the segment queue free, as a long queue of small
+    // segments can run it out before the send buffer is full.
+    if (!conn || !conn->flush() ||
+            tcp_sndqueuelen(conn->pcb) >= TCP_SND_QUEUELEN / 2) {
+        return 0;
+    }
+    return conn->room();
 }
 
 int EthernetClient::available() {
+    EthernetLock lock;
+    EthernetConnections.poll();
     return m_tcpClient.BytesAvailable();
 }
 
 int EthernetClient::read() {
+    EthernetLock lock;
+    EthernetConnections.poll();
     return m_tcpClient.Read();
 }
 
 int EthernetClient::read(uint8_t *buf, size_t size) {
+    EthernetLock lock;
+    EthernetConnections.poll();
     return m_tcpClient.Read(buf, size);
 }
 
+// The unread data starts part way into the connection's pbuf chain, after
+// the bytes that have already been read (see EthernetConnection::state).
+EthernetSpan EthernetClient::span() {
+    EthernetSpan span = {nullptr, 0};
+    spans(&span, 1);
+    return span;
+}
+
+int EthernetClient::spans(EthernetSpan *spans, int maxSpans) {
+    EthernetLock lock;
+    EthernetConnections.poll();
+    ClearCore::TcpData *state = m_tcpClient.ConnectionState();
+    int32_t available = m_tcpClient.BytesAvailable();
+    if (!state || !state->pbuf || available <= 0 || maxSpans <= 0) {
+        return 0;
+    }
+
+    struct pbuf *p = state->pbuf;
+    uint32_t offset = p->tot_len - available;
+    while (p && offset >= p->len) {
+        offset -= p->len;
+        p = p->next;
+    }
+
+    int count = 0;
+    for (; p && count < maxSpans; p = p->next) {
+        if (p->len > offset) {
+            spans[count].data = static_cast<const uint8_t *>(p->payload) + offset;
+            spans[count].length = p->len - offset;
+            count++;
+        }
+        offset = 0;
+    }
+    return count;
+}
+
+void EthernetClient::consume(size_t count) {
+    EthernetLock lock;
+    ClearCore::TcpData *state = m_tcpClient.ConnectionState();
+    int32_t available = m_tcpClient.BytesAvailable();
+    if (!state || !state->pbuf || available <= 0 || count == 0) {
+        return;
+    }
+    if (count >= (size_t)available) {
+        m_tcpClient.FlushInput();
+        return;
+    }
+    // Removing count bytes from the head of the chain moves the bytes
+    // after the read position forward by count, so ClearCore's read
+    // position, which is counted from the head, now falls count bytes
+    // further on. Whole pbufs are freed, and the window is reopened here
+    // as a read would, unless the connection has been reset and its pcb
+    // is gone while the data it received is still readable.
+    state->pbuf = pbuf_free_header(state->pbuf, count);
+    if (state->pcb) {
+        tcp_recved(state->pcb, count);
+    }
+}
+
 // wait until all outgoing data to the client has been sent
 void EthernetClient::flush() {
+    EthernetLock lock;
+    EthernetConnection *conn = EthernetConnections.find(m_tcpClient, false);
+    if (conn) {
+        conn->flush();
+    }
     m_tcpClient.Flush();
 }
 
+void EthernetClient::setFlushThreshold(uint16_t bytes) {
+    EthernetLock lock;
+    EthernetConnection *conn = EthernetConnections.find(m_tcpClient, true);
+    if (conn) {
+        conn->txThreshold = constrain(bytes, 1, ETHERNET_TX_BUFFER_SIZE);
+        if (conn->txLength >= conn->txThreshold) {
+            conn->flush();
+        }
+    }
+}
+
+void EthernetClient::setFlushTimeout(uint16_t milliseconds) {
+    EthernetLock lock;
+    EthernetConnection *conn = EthernetConnections.find(m_tcpClient, true);
+    if (conn) {
+        conn->txTimeout = milliseconds;
+    }
+}
+
+void EthernetClient::setNoDelay(bool noDelay) {
+    EthernetLock lock;
+    EthernetConnection *conn = EthernetConnections.find(m_tcpClient, true);
+    if (!conn) {
+        return;
+    }
+    conn->noDelay = noDelay;
+    if (noDelay) {
+        conn->flush();
+        tcp_nagle_disable(conn->pcb);
+    }
+    else {
+        tcp_nagle_enable(conn->pcb);
+    }
+}
+
+void EthernetClient::setKeepAlive(bool enable, uint32_t idleMs,
+                                  uint32_t intervalMs, uint8_t probes) {
+    EthernetLock lock;
+    EthernetConnection *conn = EthernetConnections.find(m_tcpClient, true);
+    if (!conn) {
+        return;
+    }
+    if (!enable) {
+        ip_reset_option(conn->pcb, SOF_KEEPALIVE);
+        return;
+    }
+    conn->pcb->keep_idle = idleMs;
+#if LWIP_TCP_KEEPALIVE
+    conn->pcb->keep_intvl = intervalMs;
+    conn->pcb->keep_cnt = probes;
+#else
+    (void)intervalMs;
+    (void)probes;
+#endif
+    ip_set_option(conn->pcb, SOF_KEEPALIVE);
+}
+
+void EthernetClient::setSendBufferSize(uint16_t bytes) {
+    EthernetLock lock;
+    EthernetConnection *conn = EthernetConnections.find(m_tcpClient, true);
+    if (conn) {
+        conn->txLimit = bytes;
+    }
+}
+
+void EthernetClient::setReceiveWindow(uint16_t bytes) {
+    EthernetLock lock;
+    EthernetConnection *conn = EthernetConnections.find(m_tcpClient, true);
+    if (!conn) {
+        return;
+    }
+    conn->rxWithhold = TCP_WND - constrain(bytes, TCP_MSS, TCP_WND);
+    if (conn->rxWithheld > conn->rxWithhold) {
+        // Give back what is no longer held, which reopens the window.
+        tcp_recved(conn->pcb, conn->rxWithheld - conn->rxWithhold);
+        conn->rxWithheld = conn->rxWithhold;
+    }
+    conn->withhold();
+}
+
+bool EthernetClient::stats(EthernetClientStats &stats) {
+    EthernetLock lock;
+    EthernetConnections.poll();
+    EthernetConnection *conn = EthernetConnections.find(m_tcpClient, true);
+    if (!conn) {
+        return false;
+    }
+    struct tcp_pcb *pcb = conn->pcb;
+    stats.rxBytes = pcb->rcv_nxt - conn->rxBase;
+    stats.txBytes = pcb->lastack - conn->txBase;
+    stats.txQueued = pcb->snd_lbb - pcb->lastack;
+    stats.retransmits = conn->retransmits;
+    // sa holds eight times the smoothed RTT, both in TCP timer ticks.
+    stats.rttMs = (pcb->sa >> 3) * TCP_SLOW_INTERVAL;
+    stats.rtoMs = pcb->rto * TCP_SLOW_INTERVAL;
+    stats.sendWindow = pcb->snd_wnd;
+    return true;
+}
+
+bool EthernetClient::getNoDelay() {
+    EthernetConnection *conn = EthernetConnections.find(m_tcpClient, false);
+    return conn && conn->noDelay;
+}
+
 void EthernetClient::stop() {
+    EthernetLock lock;
+    EthernetConnection *conn = EthernetConnections.find(m_tcpClient, false);
+    if (conn) {
+        conn->flush();
+        EthernetConnections.release(conn);
+    }
+    if (m_connectAttempt) {
+        connectDetach(m_connectAttempt);
+        m_connectAttempt = nullptr;
+    }
+    EthernetConnectAttempt *attempt =
+        connectAttemptOf(m_tcpClient.ConnectionState());
+    if (attempt) {
+        connectDetach(attempt);
+    }
     m_tcpClient.Close();
+    if (attempt) {
+        // Free for another connection once ClearCore is done with it.
+        attempt->data.pcb = nullptr;
+        if (attempt->data.pbuf) {
+            pbuf_free(attempt->data.pbuf);
+            attempt->data.pbuf = nullptr;
+        }
+    }
+    m_connectStatus = EthernetAsyncIdle;
 }
 
 // A client is considered connected if the connection has been closed but
 // there is still unread data.
 uint8_t EthernetClient::connected() {
+    EthernetLock lock;
+    EthernetConnections.poll();
     if (m_tcpClient.BytesAvailable() > 0 || m_tcpClient.Connected()) {
         return 1;
     }
@@ -87,19 +601,24 @@ uint8_t EthernetClient::connected() {
 }
 
 int EthernetClient::peek() {
+    EthernetLock lock;
+    EthernetConnections.poll();
     return m_tcpClient.Peek();
 }
 
 uint16_t EthernetClient::localPort() {
+    EthernetLock lock;
     return m_tcpClient.LocalPort();
 }
 
 IPAddress EthernetClient::remoteIP() {
+    EthernetLock lock;
     IPAddress ip = IPAddress(uint32_t(m_tcpClient.RemoteIp()));
     return ip;
 }
 
 uint16_t EthernetClient::remotePort() {
+    EthernetLock lock;
     return m_tcpClient.RemotePort();
 }
 
@@ -107,6 +626,7 @@ void EthernetClient::setConnectionTimeout(uint16_t milliseconds) {
     m_tcpClient.ConnectionTimeout(milliseconds);
 }
 EthernetClient::operator bool() {
+    EthernetLock lock;
     return m_tcpClient.ConnectionState() != nullptr;
 }
 
@@ -0,0 +1,188 @@
+#include "EthernetConnection.h"
+#include "EthernetManager.h"
+
+namespace ClearCore {
+extern EthernetManager &EthernetMgr;
+}
+
+volatile uint32_t ethernetRxFrames = 0;
+static netif_input_fn rxInput = nullptr;
+
+bool EthernetConnection::flush() {
+    if (txLength == 0) {
+        return true;
+    }
+    uint32_t sent = send(txBuffer, txLength);
+    if (sent < txLength) {
+        // Keep what the stack could not take for the next attempt.
+        memmove(txBuffer, txBuffer + sent, txLength - sent);
+        txLength -= sent;
+        txQueuedAt = millis();
+        return false;
+    }
+    txLength = 0;
+    return true;
+}
+
+uint32_t EthernetConnection::send(const uint8_t *buffer, uint32_t size) {
+    if (txLimit) {
+        uint32_t queued = pcb->snd_lbb - pcb->lastack;
+        size = queued < txLimit ? min(size, txLimit - queued) : 0;
+        if (!size) {
+            return 0;
+        }
+    }
+    return client.Send(buffer, size);
+}
+
+uint32_t EthernetConnection::sendStatic(const uint8_t *buffer,
+                                        uint32_t size) {
+    size = min(size, room());
+    if (!size) {
+        return 0;
+    }
+    err_t err = tcp_write(pcb, buffer, size, 0);
+    if (err == ERR_MEM && size > pcb->mss) {
+        // Out of queue entries for that many segments; try a single one.
+        size = pcb->mss;
+        err = tcp_write(pcb, buffer, size, 0);
+    }
+    if (err != ERR_OK) {
+        return 0;
+    }
+    tcp_output(pcb);
+    return size;
+}
+
+uint32_t EthernetConnection::room() {
+    uint32_t room = tcp_sndbuf(pcb);
+    if (txLimit) {
+        uint32_t queued = pcb->snd_lbb - pcb->lastack;
+        room = queued < txLimit ? min(room, txLimit - queued) : 0;
+    }
+    return room;
+}
+
+void EthernetConnection::withhold() {
+    if (rxWithheld >= rxWithhold) {
+        return;
+    }
+    // The window already promised is never taken back: lwIP drops data
+    // beyond rcv_nxt + rcv_wnd, so only the part of rcv_wnd not yet
+    // announced to the peer is held. The rest is held by later calls, as
+    // the announced window is used up.
+    if (pcb->rcv_wnd <= pcb->rcv_ann_wnd) {
+        return;
+    }
+    uint16_t take = min((uint32_t)(rxWithhold - rxWithheld),
+                        (uint32_t)(pcb->rcv_wnd - pcb->rcv_ann_wnd));
+    pcb->rcv_wnd -= take;
+    rxWithheld += take;
+}
+
+EthernetConnectionTable::EthernetConnectionTable() : m_entries() {}
+
+EthernetConnection *EthernetConnectionTable::find(
+    ClearCore::EthernetTcpClient &client, bool create) {
+    ClearCore::TcpData *state = client.ConnectionState();
+    if (!state || !state->pcb) {
+        return nullptr;
+    }
+
+    EthernetConnection *empty = nullptr;
+    for (uint8_t i = 0; i < ETHERNET_MAX_CONNECTIONS; i++) {
+        EthernetConnection &conn = m_entries[i];
+        if (conn.state == state) {
+            if (conn.pcb == state->pcb) {
+                return &conn;
+            }
+            // The state was reused for a new connection.
+            release(&conn);
+        }
+        if (!conn.state && !empty) {
+            empty = &conn;
+        }
+    }
+    if (!create || !empty) {
+        return nullptr;
+    }
+
+    empty->state = state;
+    empty->pcb = state->pcb;
+    empty->client = client;
+    empty->txLength = 0;
+    empty->txThreshold = ETHERNET_TX_BUFFER_SIZE;
+    empty->txTimeout = ETHERNET_TX_FLUSH_MS;
+    empty->txQueuedAt = 0;
+    empty->noDelay = false;
+    empty->txLimit = 0;
+    empty->rxWithheld = 0;
+    empty->rxWithhold = 0;
+    empty->rxBase = state->pcb->rcv_nxt;
+    empty->txBase = state->pcb->lastack;
+    empty->retransmits = 0;
+    empty->lastNrtx = state->pcb->nrtx;
+    return empty;
+}
+
+EthernetConnection *EthernetConnectionTable::find(struct tcp_pcb *pcb) {
+    for (uint8_t i = 0; i < ETHERNET_MAX_CONNECTIONS; i++) {
+        if (m_entries[i].state && m_entries[i].pcb == pcb) {
+            return &m_entries[i];
+        }
+    }
+    return nullptr;
+}
+
+void EthernetConnectionTable::release(EthernetConnection *conn) {
+    conn->state = nullptr;
+    conn->pcb = nullptr;
+    conn->txLength = 0;
+}
+
+void EthernetConnectionTable::poll() {
+    for (uint8_t i = 0; i < ETHERNET_MAX_CONNECTIONS; i++) {
+        EthernetConnection &conn = m_entries[i];
+        if (!conn.state) {
+            continue;
+        }
+        if (stale(conn)) {
+            release(&conn);
+            continue;
+        }
+        // lwIP only counts the retransmissions of the oldest unacknowledged
+        // segment, and starts again from zero once it is acknowledged.
+        if (conn.pcb->nrtx > conn.lastNrtx) {
+            conn.retransmits += conn.pcb->nrtx - conn.lastNrtx;
+        }
+        conn.lastNrtx = conn.pcb->nrtx;
+        conn.withhold();
+        if (conn.txLength && millis() - conn.txQueuedAt >= conn.txTimeout) {
+            conn.flush();
+        }
+    }
+}
+
+bool EthernetConnectionTable::stale(EthernetConnection &conn) {
+    return conn.client.ConnectionState() != conn.state ||
+           conn.state->pcb != conn.pcb;
+}
+
+EthernetConnectionTable EthernetConnections;
+
+static err_t countingInput(struct pbuf *p, struct netif *inp) {
+    ethernetRxFrames++;
+    return rxInput(p, inp);
+}
+
+bool ethernetRxHookInstall() {
+    struct netif *netif = ClearCore::EthernetMgr.MacInterface();
+    if (!netif || !netif->input) {
+        return false;
+    }
+    if (netif->input != countingInput) {
+        rxInput = netif->input;
+        netif->input = countingInput;
+    }
+    return true;
+}
@@ -0,0 +1,114 @@
+/*
+ * Per-connection state shared by every EthernetClient that refers to the
+ * same TCP connection.
+ *
+ * EthernetClient objects are small handles that are freely copied (each
+ * call to EthernetServer::available() returns a new one), so anything that
+ * has to persist for the life of a connection lives in this table, keyed by
+ * the ClearCore connection state, rather than in the client object.
+ *
+ * This header is internal to the Ethernet implementation.
+ */
+
+#ifndef ethernet_connection_h_
+#define ethernet_connection_h_
+
+#include <Arduino.h>
+#include "EthernetTcpClient.h"
+#include "lwip/tcp.h"
+
+// Number of TCP connections that can have state at the same time.
+#ifndef ETHERNET_MAX_CONNECTIONS
+#define ETHERNET_MAX_CONNECTIONS 8
+#endif
+
+// Size of each connection's transmit coalescing buffer.
+#ifndef ETHERNET_TX_BUFFER_SIZE
+#define ETHERNET_TX_BUFFER_SIZE 512
+#endif
+
+// Default time buffered transmit data may wait before it is sent, in ms.
+#ifndef ETHERNET_TX_FLUSH_MS
+#define ETHERNET_TX_FLUSH_MS 2
+#endif
+
+struct EthernetConnection {
+    // Send as much buffered data as the stack will take. Returns true if
+    // the buffer is now empty.
+    bool flush();
+    // Send data straight to the stack, no more than the send buffer limit
+    // allows. Returns the number of bytes taken.
+    uint32_t send(const uint8_t *buffer, uint32_t size);
+    // As send(), but the stack refers to the data instead of copying it,
+    // so it must stay unchanged until the remote host acknowledges it.
+    uint32_t sendStatic(const uint8_t *buffer, uint32_t size);
+    // Bytes the stack will take right now, within the send buffer limit.
+    uint32_t room();
+    // Hold back as much of the receive window as the receive window limit
+    // calls for and the stack can spare right now.
+    void withhold();
+
+    // ClearCore's connection state. Its pbuf chain holds the received data
+    // that has not been released yet: the bytes already read, followed by
+    // the BytesAvailable() unread ones. The read position is therefore
+    // pbuf->tot_len - BytesAvailable(), counted from the head of the chain,
+    // and stays correct when bytes are removed from the head.
+    ClearCore::TcpData *state;
+    struct tcp_pcb *pcb;
+    ClearCore::EthernetTcpClient client;
+
+    uint8_t txBuffer[ETHERNET_TX_BUFFER_SIZE];
+    uint16_t txLength;
+    uint16_t txThreshold;
+    uint16_t txTimeout;
+    uint32_t txQueuedAt;
+    bool noDelay;
+
+    // Most unacknowledged bytes allowed in the stack, 0 for no limit.
+    uint16_t txLimit;
+    // Receive window held back from the stack, and how much should be.
+    uint16_t rxWithheld;
+    uint16_t rxWithhold;
+
+    // Sequence numbers when the entry was made, which byte counts are
+    // measured from.
+    uint32_t rxBase;
+    uint32_t txBase;
+    // Retransmissions seen by poll().
+    uint32_t retransmits;
+    uint8_t lastNrtx;
+};
+
+class EthernetConnectionTable {
+public:
+    EthernetConnectionTable();
+
+    // Find the entry for the connection the client refers to. If create is
+    // true a new entry is made when there is none. Returns nullptr if the
+    // client is not connected or the table is full.
+    EthernetConnection *find(ClearCore::EthernetTcpClient &client,
+                             bool create);
+    // Find the entry for a connection by its pcb, if it has one.
+    EthernetConnection *find(struct tcp_pcb *pcb);
+    void release(EthernetConnection *conn);
+
+    // Send buffered data that has waited longer than its timeout, count
+    // retransmissions, and release entries whose connection has gone away.
+    void poll();
+
+private:
+    bool stale(EthernetConnection &conn);
+
+    EthernetConnection m_entries[ETHERNET_MAX_CONNECTIONS];
+};
+
+extern EthernetConnectionTable EthernetConnections;
+
+// Number of frames received on the Ethernet interface. Counted by a hook
+// on the interface's input function, which ethernetRxHookInstall() puts in
+// place (again, if the interface has been set up since). Returns false if
+// the interface does not exist yet, in which case nothing is counted.
+extern volatile uint32_t ethernetRxFrames;
+bool ethernetRxHookInstall();
+
+#endif
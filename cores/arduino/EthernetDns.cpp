@@ -0,0 +1,112 @@
+#include "EthernetDns.h"
+#include "EthernetUtils.h"
+#include "lwip/dns.h"
+
+EthernetDnsCache::EthernetDnsCache() : m_entries() {}
+
+err_t EthernetDnsCache::resolve(const char *host, ip_addr_t *ip) {
+    if (strlen(host) >= ETHERNET_DNS_NAME_LENGTH) {
+        return ClearCore::DnsGetHostByName(host, ip);
+    }
+
+    Entry *entry = find(host);
+    if (entry) {
+        entry->lastUsed = millis();
+        if (entry->refreshing) {
+            // lwIP's query is still outstanding.
+            *ip = entry->ip;
+            return ERR_OK;
+        }
+        // A lookup that timed out failed with ERR_INPROGRESS, and is
+        // remembered like any other failure.
+        if (entry->result != ERR_OK &&
+                millis() - entry->failedAt < ETHERNET_DNS_NEGATIVE_MS) {
+            return entry->result;
+        }
+    }
+    else {
+        entry = victim();
+        strcpy(entry->host, host);
+        // No answer yet; the lookup below sets the result.
+        entry->result = ERR_INPROGRESS;
+        entry->lastUsed = millis();
+        entry->refreshing = false;
+    }
+
+    // lwIP answers at once while the record's TTL lasts, and otherwise
+    // starts a query.
+    err_t err = dns_gethostbyname(host, ip, found, this);
+    if (err == ERR_INPROGRESS) {
+        entry->refreshing = true;
+        if (entry->result == ERR_OK) {
+            // Use the previous answer until the new one arrives.
+            *ip = entry->ip;
+            return ERR_OK;
+        }
+        // Nothing to use meanwhile. lwIP adds ClearCore's lookup to the
+        // query that was just started, and it waits for the answer.
+        err = ClearCore::DnsGetHostByName(host, ip);
+    }
+    entry->refreshing = false;
+    entry->result = err;
+    if (err == ERR_OK) {
+        entry->ip = *ip;
+    }
+    else {
+        entry->failedAt = millis();
+    }
+    return err;
+}
+
+void EthernetDnsCache::clear() {
+    for (uint8_t i = 0; i < ETHERNET_DNS_CACHE_SIZE; i++) {
+        m_entries[i].host[0] = '\0';
+        m_entries[i].refreshing = false;
+    }
+}
+
+EthernetDnsCache::Entry *EthernetDnsCache::find(const char *host) {
+    for (uint8_t i = 0; i < ETHERNET_DNS_CACHE_SIZE; i++) {
+        if (m_entries[i].host[0] && !strcmp(m_entries[i].host, host)) {
+            return &m_entries[i];
+        }
+    }
+    return nullptr;
+}
+
+// An unused entry, or else the least recently used one.
+EthernetDnsCache::Entry *EthernetDnsCache::victim() {
+    Entry *oldest = &m_entries[0];
+    for (uint8_t i = 0; i < ETHERNET_DNS_CACHE_SIZE; i++) {
+        if (!m_entries[i].host[0]) {
+            return &m_entries[i];
+        }
+        if (millis() - m_entries[i].lastUsed > millis() - oldest->lastUsed) {
+            oldest = &m_entries[i];
+        }
+    }
+    return oldest;
+}
+
+// Called by lwIP when a query finishes. ip is nullptr if it failed, in
+// which case the previous answer stops being used and the failure is
+// remembered instead.
+void EthernetDnsCache::found(const char *name, const ip_addr_t *ip,
+                             void *arg) {
+    EthernetDnsCache *cache = static_cast<EthernetDnsCache *>(arg);
+    Entry *entry = cache->find(name);
+    if (!entry || !entry->refreshing) {
+        return;
+    }
+    entry->refreshing = false;
+    if (ip) {
+        entry->ip = *ip;
+        entry->result = ERR_OK;
+    }
+    else {
+        entry->result = ERR_VAL;
+        entry->failedAt = millis();
+    }
+}
+
+EthernetDnsCache EthernetDns;
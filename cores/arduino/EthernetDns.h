@@ -0,0 +1,74 @@
+/*
+ * Host name resolution shared by EthernetClient and EthernetUDP.
+ *
+ * Every lookup goes to lwIP's resolver first. Its table keeps each answer
+ * for the record's TTL, and while it does, the answer comes back at once
+ * without a query. Once the TTL has run out, lwIP queries the DNS server
+ * again in the background, and the address from the previous answer is
+ * used until the new answer arrives, so a reconnect loop or a stream of
+ * sends to a host name is not held up by the refresh. Only lookups with
+ * no previous answer wait for the DNS server. Failed lookups, including
+ * ones that timed out, are remembered for ETHERNET_DNS_NEGATIVE_MS, so they
+ * are not retried on every call either.
+ *
+ * This header is internal to the Ethernet implementation.
+ */
+
+#ifndef ethernet_dns_h_
+#define ethernet_dns_h_
+
+#include <Arduino.h>
+#include "lwip/ip_addr.h"
+#include "lwip/err.h"
+
+// Number of host names whose last answer or failure is kept.
+#ifndef ETHERNET_DNS_CACHE_SIZE
+#define ETHERNET_DNS_CACHE_SIZE 4
+#endif
+
+// Longest host name that is kept, including the terminator. Lookups of
+// longer names always wait for lwIP's resolver.
+#ifndef ETHERNET_DNS_NAME_LENGTH
+#define ETHERNET_DNS_NAME_LENGTH 64
+#endif
+
+// How long a failed lookup is remembered, in ms.
+#ifndef ETHERNET_DNS_NEGATIVE_MS
+#define ETHERNET_DNS_NEGATIVE_MS 5000
+#endif
+
+class EthernetDnsCache {
+public:
+    EthernetDnsCache();
+
+    // Resolve host. Returns ERR_OK and fills in ip if it was resolved, or
+    // the error of the (possibly remembered) failed lookup, as
+    // ClearCore::DnsGetHostByName() does.
+    err_t resolve(const char *host, ip_addr_t *ip);
+    // Forget every kept answer and failure, e.g. after the DNS server
+    // changes.
+    void clear();
+
+private:
+    struct Entry {
+        char host[ETHERNET_DNS_NAME_LENGTH];
+        // The last answer, or the error of the last failed lookup and when
+        // it failed.
+        ip_addr_t ip;
+        err_t result;
+        uint32_t failedAt;
+        uint32_t lastUsed;
+        // lwIP is querying the DNS server for the host.
+        bool refreshing;
+    };
+
+    Entry *find(const char *host);
+    Entry *victim();
+    static void found(const char *name, const ip_addr_t *ip, void *arg);
+
+    Entry m_entries[ETHERNET_DNS_CACHE_SIZE];
+};
+
+extern EthernetDnsCache EthernetDns;
+
+#endif
@@ -0,0 +1,262 @@
+#include "EthernetFile.h"
+#include "EthernetService.h"
+
+EthernetFileServer::EthernetFileServer(uint16_t port)
+    : m_server(port),
+      m_connections(),
+      m_chunk(),
+      m_chunkLength(0),
+      m_listing(nullptr),
+      m_filesSent(0),
+      m_bytesSent(0) {}
+
+void EthernetFileServer::begin() {
+    m_server.begin();
+}
+
+void EthernetFileServer::service() {
+    EthernetLock lock;
+    accept();
+    for (uint8_t i = 0; i < ETHERNET_FILE_MAX_CONNECTIONS; i++) {
+        if (m_connections[i].open) {
+            serviceConnection(m_connections[i]);
+        }
+    }
+}
+
+void EthernetFileServer::accept() {
+    while (true) {
+        EthernetClient client = m_server.accept();
+        if (!client) {
+            return;
+        }
+        Connection *conn = nullptr;
+        for (uint8_t i = 0; i < ETHERNET_FILE_MAX_CONNECTIONS; i++) {
+            if (!m_connections[i].open) {
+                conn = &m_connections[i];
+                break;
+            }
+        }
+        if (!conn) {
+            client.stop();
+            continue;
+        }
+        // Files are written a chunk at a time, and replies a line at a time,
+        // so send each write at once rather than copying it into the
+        // client's buffer first.
+        client.setNoDelay(true);
+        conn->client = client;
+        conn->left = 0;
+        conn->lineLength = 0;
+        conn->overflow = false;
+        conn->lastActivity = millis();
+        conn->open = true;
+    }
+}
+
+void EthernetFileServer::serviceConnection(Connection &conn) {
+    if (conn.left && !pump(conn)) {
+        return;
+    }
+
+    // Take the next request once the last one has been answered.
+    while (!conn.left) {
+        EthernetSpan span = conn.client.span();
+        if (!span.length) {
+            break;
+        }
+        const uint8_t *end = (const uint8_t *)memchr(span.data, '\n',
+                                                     span.length);
+        size_t take = end ? end - span.data + 1 : span.length;
+        size_t room = ETHERNET_FILE_LINE_SIZE - 1 - conn.lineLength;
+        if (take > room) {
+            conn.overflow = true;
+        }
+        else {
+            memcpy(conn.line + conn.lineLength, span.data, take);
+            conn.lineLength += take;
+        }
+        conn.client.consume(take);
+        conn.lastActivity = millis();
+        if (!end) {
+            continue;
+        }
+        if (conn.overflow) {
+            reply(conn, "ERR request too long\n");
+        }
+        else {
+            conn.line[conn.lineLength] = '\0';
+            request(conn);
+        }
+        conn.lineLength = 0;
+        conn.overflow = false;
+        if (conn.left) {
+            pump(conn);
+            if (!conn.open) {
+                return;
+            }
+        }
+    }
+
+    if (!conn.client.connected() ||
+            millis() - conn.lastActivity >= ETHERNET_FILE_IDLE_MS) {
+        close(conn);
+    }
+}
+
+void EthernetFileServer::request(Connection &conn) {
+    // Split off the command; the rest are its arguments.
+    char *save;
+    char *command = strtok_r(conn.line, " \r\n", &save);
+    char *args = strtok_r(nullptr, "\r\n", &save);
+    if (command && !strcmp(command, "GET")) {
+        get(conn, args);
+    }
+    else if (command && !strcmp(command, "LIST")) {
+        list(conn, args);
+    }
+    else {
+        reply(conn, "ERR unknown command\n");
+    }
+}
+
+void EthernetFileServer::get(Connection &conn, char *args) {
+    char *save;
+    char *path = args ? strtok_r(args, " ", &save) : nullptr;
+    char *offsetText = path ? strtok_r(nullptr, " ", &save) : nullptr;
+    if (!path) {
+        reply(conn, "ERR no path\n");
+        return;
+    }
+    SdFsFile file = SdCardFs.open(path, SD_FILE_READ);
+    if (!file || file.isDirectory()) {
+        if (file) {
+            file.close();
+        }
+        reply(conn, "ERR not found\n");
+        return;
+    }
+    uint32_t offset = offsetText ? strtoul(offsetText, nullptr, 10) : 0;
+    if (offset > file.size() || !file.seek(offset)) {
+        file.close();
+        reply(conn, "ERR bad offset\n");
+        return;
+    }
+
+    char line[24];
+    snprintf(line, sizeof(line), "OK %lu\n",
+             (unsigned long)(file.size() - offset));
+    reply(conn, line);
+    conn.left = file.size() - offset;
+    if (conn.left) {
+        conn.file = file;
+    }
+    else {
+        file.close();
+        m_filesSent++;
+    }
+}
+
+void EthernetFileServer::list(Connection &conn, char *args) {
+    const char *path = args && *args ? args : "/";
+    if (strcmp(path, "/")) {
+        SdFsFile directory = SdCardFs.open(path, SD_FILE_READ);
+        bool found = directory && directory.isDirectory();
+        if (directory) {
+            directory.close();
+        }
+        if (!found) {
+            reply(conn, "ERR not found\n");
+            return;
+        }
+    }
+    reply(conn, "OK\n");
+    // The listing is gathered in the chunk buffer, and written out whenever
+    // it fills up.
+    m_listing = &conn;
+    m_chunkLength = 0;
+    SdCardFs.list(path, listEntry, this);
+    m_chunk[m_chunkLength++] = '\n';
+    flushList();
+    m_listing = nullptr;
+}
+
+bool EthernetFileServer::listEntry(const char *name, uint32_t size,
+                                   bool isDirectory, void *context) {
+    EthernetFileServer *server = (EthernetFileServer *)context;
+    char line[32];
+    int length = snprintf(line, sizeof(line), "%s%s %lu\n", name,
+                          isDirectory ? "/" : "", (unsigned long)size);
+    if (length <= 0 || length >= (int)sizeof(line)) {
+        return true;
+    }
+    // Leave room for the empty line that ends the listing.
+    if (server->m_chunkLength + length >= ETHERNET_FILE_CHUNK) {
+        server->flushList();
+    }
+    memcpy(server->m_chunk + server->m_chunkLength, line, length);
+    server->m_chunkLength += length;
+    return true;
+}
+
+void EthernetFileServer::flushList() {
+    // A listing is short; write() waits for room if it has to.
+    m_listing->client.write(m_chunk, m_chunkLength);
+    m_chunkLength = 0;
+}
+
+void EthernetFileServer::reply(Connection &conn, const char *text) {
+    conn.client.write((const uint8_t *)text, strlen(text));
+}
+
+// Send as much of the file as the connection takes. Returns true once all
+// of it has been sent.
+bool EthernetFileServer::pump(Connection &conn) {
+    int room = conn.client.availableForWrite();
+    while (conn.left && room > 0) {
+        // Whole sectors are read straight from the card into the chunk
+        // buffer with one multi-block command; a file sent from an offset
+        // within a sector is first brought to a sector boundary.
+        uint32_t count = min(conn.left, (uint32_t)ETHERNET_FILE_CHUNK);
+        uint32_t misaligned = conn.file.position() % SD_SECTOR_SIZE;
+        if (misaligned) {
+            count = min(count, SD_SECTOR_SIZE - misaligned);
+        }
+        else if (count > (uint32_t)room && room >= SD_SECTOR_SIZE) {
+            count = room - room % SD_SECTOR_SIZE;
+        }
+        if (count > (uint32_t)room) {
+            break;
+        }
+        int read = conn.file.read(m_chunk, count);
+        size_t sent = read > 0 ? conn.client.write(m_chunk, read) : 0;
+        if (read <= 0 || sent < (size_t)read) {
+            // The file cannot be completed; closing tells the client.
+            close(conn);
+            return false;
+        }
+        conn.left -= sent;
+        room -= sent;
+        m_bytesSent += sent;
+        conn.lastActivity = millis();
+    }
+
+    if (conn.left) {
+        if (millis() - conn.lastActivity >= ETHERNET_FILE_IDLE_MS) {
+            close(conn);
+        }
+        return false;
+    }
+    conn.file.close();
+    m_filesSent++;
+    return true;
+}
+
+void EthernetFileServer::close(Connection &conn) {
+    if (conn.file) {
+        conn.file.close();
+    }
+    conn.left = 0;
+    conn.client.stop();
+    conn.open = false;
+}
@@ -0,0 +1,107 @@
+/*
+ * Bulk file transfer from the SD card over TCP.
+ *
+ * A simple line-based protocol, easy to drive from a script or with nc:
+ *
+ *   LIST [directory]\n     OK\n, then one "name size\n" line per entry
+ *                          (directories with a trailing '/'), then an
+ *                          empty line.
+ *   GET path [offset]\n    OK size\n, then size bytes of the file from
+ *                          offset (0 by default) to its end.
+ *
+ * A request that cannot be served is answered with "ERR reason\n". Several
+ * requests can be made, one after the other, on a connection.
+ *
+ * Files are read in runs of whole sectors, each with a single multi-block
+ * command, straight into one buffer that is handed to the network stack:
+ * the data is copied once, from the buffer into the stack's segments. A
+ * file is sent only as fast as the connection takes it, so service() never
+ * waits on a client and several can be served at once.
+ *
+ * The SD card must be mounted with SdCardFs.begin() first.
+ */
+
+#ifndef ETHERNET_FILE_H_
+#define ETHERNET_FILE_H_
+
+#include <Arduino.h>
+#include <Ethernet.h>
+#include "SdFileSystem.h"
+
+// Most clients served at once. Further connections are refused.
+#ifndef ETHERNET_FILE_MAX_CONNECTIONS
+#define ETHERNET_FILE_MAX_CONNECTIONS 2
+#endif
+
+// Size of the reads that files are sent in; a multiple of the sector size.
+#ifndef ETHERNET_FILE_CHUNK
+#define ETHERNET_FILE_CHUNK 4096
+#endif
+
+// Longest request line, including the terminator.
+#ifndef ETHERNET_FILE_LINE_SIZE
+#define ETHERNET_FILE_LINE_SIZE 80
+#endif
+
+// How long a connection may go without a request, or without progress on
+// sending a file, before it is closed, in ms.
+#ifndef ETHERNET_FILE_IDLE_MS
+#define ETHERNET_FILE_IDLE_MS 60000
+#endif
+
+class EthernetFileServer {
+public:
+    EthernetFileServer(uint16_t port);
+
+    // Start listening.
+    void begin();
+
+    // Accept connections, answer requests and send files. Call it from
+    // loop().
+    void service();
+
+    // Files sent completely, and file data bytes sent, since begin().
+    uint32_t filesSent() {
+        return m_filesSent;
+    }
+    uint32_t bytesSent() {
+        return m_bytesSent;
+    }
+
+private:
+    struct Connection {
+        EthernetClient client;
+        // The file being sent, and how much of it is left.
+        SdFsFile file;
+        uint32_t left;
+        char line[ETHERNET_FILE_LINE_SIZE];
+        uint8_t lineLength;
+        // The line was too long and is being skipped.
+        bool overflow;
+        uint32_t lastActivity;
+        bool open;
+    };
+
+    void accept();
+    void serviceConnection(Connection &conn);
+    void request(Connection &conn);
+    void get(Connection &conn, char *args);
+    void list(Connection &conn, char *args);
+    static bool listEntry(const char *name, uint32_t size, bool isDirectory,
+                          void *context);
+    void reply(Connection &conn, const char *text);
+    void flushList();
+    bool pump(Connection &conn);
+    void close(Connection &conn);
+
+    EthernetServer m_server;
+    Connection m_connections[ETHERNET_FILE_MAX_CONNECTIONS];
+    // Shared by the connections, which are served one at a time.
+    uint8_t m_chunk[ETHERNET_FILE_CHUNK] __attribute__((aligned(4)));
+    uint16_t m_chunkLength;
+    Connection *m_listing;
+    uint32_t m_filesSent;
+    uint32_t m_bytesSent;
+};
+
+#endif // ETHERNET_FILE_H_
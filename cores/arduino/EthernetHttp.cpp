@@ -0,0 +1,777 @@
+#include "EthernetHttp.h"
+#include "EthernetService.h"
+
+static const char *reasonPhrase(uint16_t status) {
+    switch (status) {
+        case 200: return "OK";
+        case 204: return "No Content";
+        case 301: return "Moved Permanently";
+        case 302: return "Found";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 408: return "Request Timeout";
+        case 413: return "Payload Too Large";
+        case 431: return "Request Header Fields Too Large";
+        case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        case 503: return "Service Unavailable";
+        default: return "";
+    }
+}
+
+static const char *contentTypeOf(const char *path) {
+    static const char *const types[][2] = {
+        {"htm", "text/html"},
+        {"html", "text/html"},
+        {"css", "text/css"},
+        {"js", "application/javascript"},
+        {"jsn", "application/json"},
+        {"json", "application/json"},
+        {"txt", "text/plain"},
+        {"csv", "text/csv"},
+        {"png", "image/png"},
+        {"jpg", "image/jpeg"},
+        {"gif", "image/gif"},
+        {"svg", "image/svg+xml"},
+        {"ico", "image/x-icon"},
+    };
+    const char *dot = strrchr(path, '.');
+    if (dot && !strchr(dot, '/')) {
+        for (uint8_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+            if (!strcasecmp(dot + 1, types[i][0])) {
+                return types[i][1];
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+static int hexDigit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+// Decode %-escapes (and, in form data, '+' for space) from length
+// characters of in. Returns the decoded length, or -1 if it does not fit in
+// size bytes with a terminator or decodes to a NUL.
+static int urlDecode(const char *in, size_t length, char *out, size_t size,
+                     bool form) {
+    size_t count = 0;
+    for (size_t i = 0; i < length; i++) {
+        char c = in[i];
+        if (c == '%' && i + 2 < length && hexDigit(in[i + 1]) >= 0 &&
+                hexDigit(in[i + 2]) >= 0) {
+            c = hexDigit(in[i + 1]) << 4 | hexDigit(in[i + 2]);
+            i += 2;
+        }
+        else if (c == '+' && form) {
+            c = ' ';
+        }
+        if (c == '\0' || count + 1 >= size) {
+            return -1;
+        }
+        out[count++] = c;
+    }
+    out[count] = '\0';
+    return count;
+}
+
+// Whether a comma-separated header value lists token.
+static bool hasToken(const char *value, const char *token) {
+    size_t length = strlen(token);
+    while (value && *value) {
+        while (*value == ' ' || *value == ',') {
+            value++;
+        }
+        if (!strncasecmp(value, token, length) &&
+                (value[length] == '\0' || value[length] == ',' ||
+                 value[length] == ' ')) {
+            return true;
+        }
+        value = strchr(value, ',');
+    }
+    return false;
+}
+
+EthernetHttpRequest::EthernetHttpRequest()
+    : m_method(HttpOther),
+      m_path(nullptr),
+      m_query(nullptr),
+      m_headers(),
+      m_headerCount(0),
+      m_body(nullptr),
+      m_bodyLength(0),
+      m_remoteIp(),
+      m_http11(false) {}
+
+// Parse a Content-Length value, which must be all digits and fit in 32
+// bits.
+static bool parseLength(const char *text, uint32_t &length) {
+    length = 0;
+    if (!*text) {
+        return false;
+    }
+    for (; *text; text++) {
+        uint8_t digit = *text - '0';
+        if (digit > 9 || length > (UINT32_MAX - digit) / 10) {
+            return false;
+        }
+        length = length * 10 + digit;
+    }
+    return true;
+}
+
+const char *EthernetHttpRequest::header(const char *name) {
+    for (uint8_t i = 0; i < m_headerCount; i++) {
+        if (!strcasecmp(m_headers[i][0], name)) {
+            return m_headers[i][1];
+        }
+    }
+    return nullptr;
+}
+
+// Fields are name=value pairs separated by '&'.
+static bool findArg(const char *fields, size_t length, const char *name,
+                    char *value, size_t size) {
+    size_t nameLength = strlen(name);
+    const char *end = fields + length;
+    while (fields < end) {
+        const char *next = static_cast<const char *>(
+                               memchr(fields, '&', end - fields));
+        if (!next) {
+            next = end;
+        }
+        if ((size_t)(next - fields) > nameLength &&
+                fields[nameLength] == '=' &&
+                !strncmp(fields, name, nameLength)) {
+            const char *start = fields + nameLength + 1;
+            return urlDecode(start, next - start, value, size, true) >= 0;
+        }
+        fields = next + 1;
+    }
+    return false;
+}
+
+bool EthernetHttpRequest::arg(const char *name, char *value, size_t size) {
+    if (findArg(m_query, strlen(m_query), name, value, size)) {
+        return true;
+    }
+    const char *type = header("Content-Type");
+    return type &&
+           !strncasecmp(type, "application/x-www-form-urlencoded", 33) &&
+           findArg(reinterpret_cast<const char *>(m_body), m_bodyLength,
+                   name, value, size);
+}
+
+EthernetHttpResponse::EthernetHttpResponse(EthernetHttpConnection &conn,
+                                           bool head, bool http11)
+    : m_conn(conn),
+      m_state(Idle),
+      m_head(head),
+      m_http11(http11),
+      m_chunked(false),
+      m_failed(false) {}
+
+void EthernetHttpResponse::begin(uint16_t status, const char *contentType,
+                                 int32_t length) {
+    if (m_state != Idle) {
+        return;
+    }
+    m_state = Headers;
+    char line[48];
+    snprintf(line, sizeof(line), "HTTP/1.1 %u ", status);
+    out(line);
+    out(reasonPhrase(status));
+    out("\r\n");
+    if (contentType) {
+        header("Content-Type", contentType);
+    }
+    if (length >= 0) {
+        snprintf(line, sizeof(line), "%ld", (long)length);
+        header("Content-Length", line);
+    }
+    else if (m_http11) {
+        header("Transfer-Encoding", "chunked");
+        m_chunked = !m_head;
+    }
+    else {
+        // Without a length or chunks, closing is what ends the body.
+        m_conn.closeAfter = true;
+    }
+    header("Connection", m_conn.closeAfter ? "close" : "keep-alive");
+}
+
+void EthernetHttpResponse::header(const char *name, const char *value) {
+    if (m_state != Headers) {
+        return;
+    }
+    out(name);
+    out(": ");
+    out(value);
+    out("\r\n");
+}
+
+void EthernetHttpResponse::endHeaders() {
+    out("\r\n");
+    m_state = Body;
+}
+
+size_t EthernetHttpResponse::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t EthernetHttpResponse::write(const uint8_t *buf, size_t size) {
+    if (m_state == Idle) {
+        begin(200, "text/html");
+    }
+    if (m_state == Headers) {
+        endHeaders();
+    }
+    if (m_state != Body) {
+        return 0;
+    }
+    if (m_head || !size) {
+        return size;
+    }
+    if (m_chunked) {
+        char length[12];
+        snprintf(length, sizeof(length), "%x\r\n", (unsigned)size);
+        out(length);
+        out(buf, size);
+        out("\r\n");
+    }
+    else {
+        out(buf, size);
+    }
+    return m_failed ? 0 : size;
+}
+
+void EthernetHttpResponse::sendStatic(uint16_t status,
+                                      const char *contentType,
+                                      const uint8_t *data, size_t length) {
+    if (m_state != Idle) {
+        return;
+    }
+    begin(status, contentType, length);
+    endHeaders();
+    if (!m_head && !m_failed) {
+        m_conn.staticData = data;
+        m_conn.left = length;
+    }
+    m_state = Done;
+}
+
+bool EthernetHttpResponse::sendFile(const char *path,
+                                    const char *contentType) {
+    if (m_state != Idle) {
+        return false;
+    }
+    SdFsFile file = SdCardFs.open(path, SD_FILE_READ);
+    if (!file) {
+        return false;
+    }
+    if (file.isDirectory()) {
+        file.close();
+        return false;
+    }
+    begin(200, contentType ? contentType : contentTypeOf(path), file.size());
+    endHeaders();
+    if (!m_head && !m_failed && file.size()) {
+        m_conn.file = file;
+        m_conn.left = file.size();
+    }
+    else {
+        file.close();
+    }
+    m_state = Done;
+    return true;
+}
+
+void EthernetHttpResponse::sendError(uint16_t status) {
+    if (m_state != Idle) {
+        return;
+    }
+    char body[48];
+    int length = snprintf(body, sizeof(body), "%u %s\n", status,
+                          reasonPhrase(status));
+    begin(status, "text/plain", length);
+    write(body, length);
+    m_state = Done;
+}
+
+void EthernetHttpResponse::end() {
+    if (m_state == Idle) {
+        // The handler did not respond.
+        sendError(500);
+    }
+    if (m_state == Headers) {
+        endHeaders();
+    }
+    if (m_state == Body && m_chunked) {
+        out("0\r\n\r\n");
+    }
+    m_state = Done;
+}
+
+bool EthernetHttpResponse::out(const void *data, size_t size) {
+    if (m_failed) {
+        return false;
+    }
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    if (!m_conn.outputLength) {
+        // Write only what the connection takes now, as write() would wait
+        // for the rest; a browser that is not reading must not hold up the
+        // server.
+        int room = m_conn.client.availableForWrite();
+        size_t count = room > 0 ?
+                       m_conn.client.write(bytes, min(size, (size_t)room)) : 0;
+        bytes += count;
+        size -= count;
+    }
+    if (size > (size_t)(ETHERNET_HTTP_RESPONSE_SIZE - m_conn.outputLength)) {
+        // The rest of the response cannot be sent, so the browser would
+        // misread whatever followed on this connection.
+        m_failed = true;
+        m_conn.closeAfter = true;
+        return false;
+    }
+    memcpy(m_conn.output + m_conn.outputLength, bytes, size);
+    m_conn.outputLength += size;
+    return true;
+}
+
+EthernetHttpServer::EthernetHttpServer(uint16_t port)
+    : m_server(port),
+      m_routes(),
+      m_routeCount(0),
+      m_connections(),
+      m_requests(0) {}
+
+void EthernetHttpServer::begin() {
+    m_server.begin();
+}
+
+EthernetHttpServer::Route *EthernetHttpServer::addRoute(
+    RouteType type, const char *path, EthernetHttpMethod method) {
+    if (m_routeCount >= ETHERNET_HTTP_MAX_ROUTES) {
+        return nullptr;
+    }
+    Route &route = m_routes[m_routeCount++];
+    size_t length = strlen(path);
+    route.type = type;
+    route.path = path;
+    route.prefix = length && path[length - 1] == '*';
+    route.pathLength = route.prefix ? length - 1 : length;
+    route.method = method;
+    route.handler = nullptr;
+    route.data = nullptr;
+    route.length = 0;
+    route.target = nullptr;
+    return &route;
+}
+
+bool EthernetHttpServer::on(const char *path, EthernetHttpHandler handler,
+                            EthernetHttpMethod method) {
+    Route *route = addRoute(RouteHandler, path, method);
+    if (!route) {
+        return false;
+    }
+    route->handler = handler;
+    return true;
+}
+
+bool EthernetHttpServer::serveStatic(const char *path, const uint8_t *data,
+                                     size_t length,
+                                     const char *contentType) {
+    Route *route = addRoute(RouteStatic, path, HttpGet);
+    if (!route) {
+        return false;
+    }
+    route->data = data;
+    route->length = length;
+    route->target = contentType;
+    return true;
+}
+
+bool EthernetHttpServer::serveSd(const char *prefix, const char *directory) {
+    Route *route = addRoute(RouteSd, prefix, HttpGet);
+    if (!route) {
+        return false;
+    }
+    route->prefix = true;
+    route->target = directory;
+    return true;
+}
+
+uint8_t EthernetHttpServer::connectionCount() {
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < ETHERNET_HTTP_MAX_CONNECTIONS; i++) {
+        count += m_connections[i].open;
+    }
+    return count;
+}
+
+void EthernetHttpServer::service() {
+    EthernetLock lock;
+    accept();
+    for (uint8_t i = 0; i < ETHERNET_HTTP_MAX_CONNECTIONS; i++) {
+        if (m_connections[i].open) {
+            serviceConnection(m_connections[i]);
+        }
+    }
+}
+
+void EthernetHttpServer::accept() {
+    while (true) {
+        EthernetClient client = m_server.accept();
+        if (!client) {
+            return;
+        }
+        EthernetHttpConnection *conn = nullptr;
+        for (uint8_t i = 0; i < ETHERNET_HTTP_MAX_CONNECTIONS; i++) {
+            if (!m_connections[i].open) {
+                conn = &m_connections[i];
+                break;
+            }
+        }
+        if (!conn) {
+            client.writeStatic("HTTP/1.1 503 Service Unavailable\r\n"
+                               "Content-Length: 0\r\n"
+                               "Connection: close\r\n\r\n");
+            client.stop();
+            continue;
+        }
+        conn->client = client;
+        conn->length = 0;
+        conn->parsed = false;
+        conn->outputLength = 0;
+        conn->staticData = nullptr;
+        conn->left = 0;
+        conn->closeAfter = false;
+        conn->lastActivity = millis();
+        conn->open = true;
+    }
+}
+
+void EthernetHttpServer::serviceConnection(EthernetHttpConnection &conn) {
+    // The next request waits until the response before it has gone.
+    if ((conn.outputLength || conn.left) && !pump(conn)) {
+        return;
+    }
+    if (conn.closeAfter) {
+        close(conn);
+        return;
+    }
+
+    int available = conn.client.available();
+    if (available > 0 && conn.length < ETHERNET_HTTP_REQUEST_SIZE) {
+        int count = conn.client.read(
+                        reinterpret_cast<uint8_t *>(conn.buffer) + conn.length,
+                        min(available, (int)(ETHERNET_HTTP_REQUEST_SIZE -
+                                             conn.length)));
+        if (count > 0) {
+            conn.length += count;
+            conn.lastActivity = millis();
+        }
+    }
+    if (conn.length) {
+        handle(conn);
+    }
+
+    if (conn.outputLength || conn.left || conn.closeAfter) {
+        // Sending (or closing) carries on next time.
+        return;
+    }
+    if (!conn.client.connected() ||
+            millis() - conn.lastActivity >= ETHERNET_HTTP_IDLE_MS) {
+        close(conn);
+    }
+}
+
+// The request line and headers end at the blank line that the buffer has
+// been checked to contain.
+uint16_t EthernetHttpRequest::parse(char *text) {
+    static const struct {
+        const char *name;
+        EthernetHttpMethod method;
+    } methods[] = {
+        {"GET", HttpGet},
+        {"HEAD", HttpHead},
+        {"POST", HttpPost},
+        {"PUT", HttpPut},
+        {"DELETE", HttpDelete},
+    };
+
+    char *eol = strstr(text, "\r\n");
+    *eol = '\0';
+    char *target = strchr(text, ' ');
+    char *version = target ? strchr(target + 1, ' ') : nullptr;
+    if (!version || strncmp(version + 1, "HTTP/1.", 7)) {
+        return 400;
+    }
+    *target++ = '\0';
+    *version++ = '\0';
+    m_http11 = version[7] != '0';
+    if (*target != '/') {
+        return 400;
+    }
+
+    m_method = HttpOther;
+    for (uint8_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+        if (!strcmp(text, methods[i].name)) {
+            m_method = methods[i].method;
+        }
+    }
+
+    char *query = strchr(target, '?');
+    if (query) {
+        *query++ = '\0';
+    }
+    // The decoded path is never longer, so it is decoded where it is.
+    if (urlDecode(target, strlen(target), target, strlen(target) + 1,
+                  false) < 0) {
+        return 400;
+    }
+    m_path = target;
+    m_query = query ? query : target + strlen(target);
+
+    m_headerCount = 0;
+    char *line = eol + 2;
+    while ((eol = strstr(line, "\r\n")) != line) {
+        *eol = '\0';
+        char *colon = strchr(line, ':');
+        if (!colon || colon == line) {
+            return 400;
+        }
+        *colon = '\0';
+        char *value = colon + 1;
+        while (*value == ' ' || *value == '\t') {
+            value++;
+        }
+        for (char *end = eol; end > value &&
+                (end[-1] == ' ' || end[-1] == '\t'); end--) {
+            end[-1] = '\0';
+        }
+        if (m_headerCount < ETHERNET_HTTP_MAX_HEADERS) {
+            m_headers[m_headerCount][0] = line;
+            m_headers[m_headerCount][1] = value;
+            m_headerCount++;
+        }
+        line = eol + 2;
+    }
+    return 0;
+}
+
+void EthernetHttpServer::handle(EthernetHttpConnection &conn) {
+    EthernetHttpRequest &request = conn.request;
+    uint16_t status = 0;
+    if (!conn.parsed) {
+        conn.buffer[conn.length] = '\0';
+        char *end = strstr(conn.buffer, "\r\n\r\n");
+        if (!end) {
+            if (conn.length < ETHERNET_HTTP_REQUEST_SIZE &&
+                    millis() - conn.lastActivity < ETHERNET_HTTP_IDLE_MS) {
+                return;
+            }
+            status = conn.length < ETHERNET_HTTP_REQUEST_SIZE ? 408 : 431;
+            conn.requestLength = conn.length;
+        }
+        else {
+            uint16_t headerLength = end + 4 - conn.buffer;
+            request = EthernetHttpRequest();
+            status = request.parse(conn.buffer);
+            const char *length = request.header("Content-Length");
+            uint32_t bodyLength = 0;
+            if (!status && length && !parseLength(length, bodyLength)) {
+                status = 400;
+            }
+            else if (!status && request.header("Transfer-Encoding")) {
+                // Chunked request bodies are not supported.
+                status = 501;
+            }
+            else if (!status &&
+                     bodyLength > (uint32_t)(ETHERNET_HTTP_REQUEST_SIZE -
+                                             headerLength)) {
+                status = 413;
+            }
+            request.m_body = reinterpret_cast<uint8_t *>(conn.buffer) +
+                             headerLength;
+            request.m_bodyLength = status ? 0 : bodyLength;
+            request.m_remoteIp = conn.client.remoteIP();
+            conn.requestLength = status ? conn.length :
+                                 headerLength + bodyLength;
+            conn.parsed = true;
+        }
+    }
+    if (!status && conn.length < conn.requestLength) {
+        // Wait for the rest of the body.
+        return;
+    }
+
+    const char *connection = status ? nullptr : request.header("Connection");
+    if (status) {
+        // What follows a bad request cannot be relied on.
+        conn.closeAfter = true;
+    }
+    else if (request.m_http11) {
+        conn.closeAfter = hasToken(connection, "close");
+    }
+    else {
+        conn.closeAfter = !hasToken(connection, "keep-alive");
+    }
+
+    EthernetHttpResponse response(conn, !status && request.m_method == HttpHead,
+                                  status ? true : request.m_http11);
+    if (status) {
+        response.sendError(status);
+    }
+    else {
+        route(request, response);
+    }
+    response.end();
+    m_requests++;
+    // Push out what the response left buffered.
+    conn.client.availableForWrite();
+
+    // Anything after the request is the next one, sent without waiting.
+    memmove(conn.buffer, conn.buffer + conn.requestLength,
+            conn.length - conn.requestLength);
+    conn.length -= conn.requestLength;
+    conn.parsed = false;
+    conn.lastActivity = millis();
+}
+
+void EthernetHttpServer::route(EthernetHttpRequest &request,
+                               EthernetHttpResponse &response) {
+    const char *path = request.path();
+    bool pathMatched = false;
+    for (uint8_t i = 0; i < m_routeCount; i++) {
+        Route &route = m_routes[i];
+        if (route.prefix ? strncmp(path, route.path, route.pathLength) :
+                strcmp(path, route.path)) {
+            continue;
+        }
+        pathMatched = true;
+        EthernetHttpMethod method = request.method();
+        if (route.method != HttpAny && route.method != method &&
+                !(route.method == HttpGet && method == HttpHead)) {
+            continue;
+        }
+        switch (route.type) {
+            case RouteHandler:
+                route.handler(request, response);
+                break;
+            case RouteStatic:
+                response.sendStatic(200, route.target, route.data,
+                                    route.length);
+                break;
+            case RouteSd:
+                serveFile(route, request, response);
+                break;
+        }
+        return;
+    }
+    response.sendError(pathMatched ? 405 : 404);
+}
+
+void EthernetHttpServer::serveFile(Route &route, EthernetHttpRequest &request,
+                                   EthernetHttpResponse &response) {
+    const char *rest = request.path() + route.pathLength;
+    if (strstr(rest, "..")) {
+        response.sendError(403);
+        return;
+    }
+    char path[ETHERNET_HTTP_PATH_SIZE];
+    size_t length = strlen(rest);
+    bool index = !length || rest[length - 1] == '/';
+    if ((size_t)snprintf(path, sizeof(path), "%s%s%s", route.target, rest,
+                         index ? "index.htm" : "") >= sizeof(path) ||
+            !response.sendFile(path)) {
+        response.sendError(404);
+    }
+}
+
+bool EthernetHttpServer::pump(EthernetHttpConnection &conn) {
+    while (conn.outputLength) {
+        int room = conn.client.availableForWrite();
+        size_t sent = room > 0 ?
+                      conn.client.write(conn.output,
+                                        min((size_t)conn.outputLength,
+                                            (size_t)room)) : 0;
+        if (!sent) {
+            break;
+        }
+        memmove(conn.output, conn.output + sent, conn.outputLength - sent);
+        conn.outputLength -= sent;
+        conn.lastActivity = millis();
+    }
+
+    int room = conn.outputLength ? 0 : conn.client.availableForWrite();
+    while (conn.left && room > 0) {
+        uint32_t count = min((uint32_t)room, conn.left);
+        size_t sent;
+        if (conn.staticData) {
+            sent = conn.client.writeStatic(conn.staticData, count);
+            conn.staticData += sent;
+        }
+        else {
+            // Whole chunks keep the file position on sector boundaries, so
+            // the card reads straight into the chunk buffer.
+            uint32_t chunk = min(conn.left,
+                                 (uint32_t)ETHERNET_HTTP_FILE_CHUNK);
+            if (count < chunk) {
+                break;
+            }
+            int read = conn.file.read(m_chunk, chunk);
+            sent = read > 0 ? conn.client.write(m_chunk, read) : 0;
+            if (read <= 0 || sent < (size_t)read) {
+                // The body cannot be completed; closing tells the browser.
+                conn.left = 0;
+                conn.closeAfter = true;
+                break;
+            }
+        }
+        if (!sent) {
+            break;
+        }
+        conn.left -= sent;
+        room -= sent;
+        conn.lastActivity = millis();
+    }
+
+    if ((conn.outputLength || conn.left) &&
+            millis() - conn.lastActivity >= ETHERNET_HTTP_IDLE_MS) {
+        conn.outputLength = 0;
+        conn.left = 0;
+        conn.closeAfter = true;
+    }
+    if (conn.outputLength || conn.left) {
+        return false;
+    }
+    if (conn.file) {
+        conn.file.close();
+    }
+    conn.staticData = nullptr;
+    conn.client.availableForWrite();
+    return true;
+}
+
+void EthernetHttpServer::close(EthernetHttpConnection &conn) {
+    if (conn.file) {
+        conn.file.close();
+    }
+    conn.outputLength = 0;
+    conn.staticData = nullptr;
+    conn.left = 0;
+    conn.client.stop();
+    conn.open = false;
+}
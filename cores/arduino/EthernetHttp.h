@@ -0,0 +1,304 @@
+/*
+ * HTTP/1.1 server on EthernetServer.
+ *
+ * Each connection has a fixed request buffer that requests are parsed in
+ * place in, so serving a request allocates nothing. Requests are matched
+ * against a table of routes: handlers that build a response, constant
+ * content (e.g. pages kept in flash) and directories on the SD card.
+ * Connections stay open between requests unless the browser asks otherwise,
+ * and responses whose length is not known up front are sent with chunked
+ * transfer coding.
+ *
+ * Constant content is sent straight from where it is kept, without being
+ * copied, and SD card files are read a chunk at a time straight into the
+ * network stack. Both, and whatever handlers write, are sent only as fast
+ * as the connection takes them: service() never waits on a browser, so
+ * several can be served at once while loop() keeps running.
+ */
+
+#ifndef ETHERNET_HTTP_H_
+#define ETHERNET_HTTP_H_
+
+#include <Arduino.h>
+#include <Ethernet.h>
+#include "SdFileSystem.h"
+
+// Most browser connections served at once. Further connections are sent
+// 503 Service Unavailable.
+#ifndef ETHERNET_HTTP_MAX_CONNECTIONS
+#define ETHERNET_HTTP_MAX_CONNECTIONS 4
+#endif
+
+// Size of each connection's request buffer, which must hold the request
+// line, the headers and the body of a request.
+#ifndef ETHERNET_HTTP_REQUEST_SIZE
+#define ETHERNET_HTTP_REQUEST_SIZE 1024
+#endif
+
+// Most headers of a request that are kept; the rest are ignored.
+#ifndef ETHERNET_HTTP_MAX_HEADERS
+#define ETHERNET_HTTP_MAX_HEADERS 16
+#endif
+
+// Most routes a server can have.
+#ifndef ETHERNET_HTTP_MAX_ROUTES
+#define ETHERNET_HTTP_MAX_ROUTES 16
+#endif
+
+// Size of the reads that SD card files are sent in.
+#ifndef ETHERNET_HTTP_FILE_CHUNK
+#define ETHERNET_HTTP_FILE_CHUNK 512
+#endif
+
+// Longest SD card path a request can be mapped to, including the
+// terminator.
+#ifndef ETHERNET_HTTP_PATH_SIZE
+#define ETHERNET_HTTP_PATH_SIZE 64
+#endif
+
+// How long a connection may go without a request, or without progress on
+// sending a response, before it is closed, in ms.
+#ifndef ETHERNET_HTTP_IDLE_MS
+#define ETHERNET_HTTP_IDLE_MS 5000
+#endif
+
+// Size of each connection's response buffer, which holds the headers and
+// whatever a handler writes that the connection cannot take yet, until
+// service() sends it.
+#ifndef ETHERNET_HTTP_RESPONSE_SIZE
+#define ETHERNET_HTTP_RESPONSE_SIZE 1024
+#endif
+
+enum EthernetHttpMethod {
+    HttpAny,
+    HttpGet,
+    HttpHead,
+    HttpPost,
+    HttpPut,
+    HttpDelete,
+    HttpOther
+};
+
+// A request, parsed in place in its connection's request buffer. It is
+// only valid while its handler runs.
+class EthernetHttpRequest {
+public:
+    EthernetHttpRequest();
+
+    EthernetHttpMethod method() {
+        return m_method;
+    }
+    // The path, with %-escapes decoded, without the query string.
+    const char *path() {
+        return m_path;
+    }
+    // The query string (after the '?'), still encoded; empty if none.
+    const char *query() {
+        return m_query;
+    }
+    // The value of the named header, or nullptr if the request has none.
+    // Names are not case sensitive.
+    const char *header(const char *name);
+    const uint8_t *body() {
+        return m_body;
+    }
+    size_t bodyLength() {
+        return m_bodyLength;
+    }
+    // Find the named field of the query string, or of a form-encoded body,
+    // and decode its value into value. Returns false if there is none.
+    bool arg(const char *name, char *value, size_t size);
+    IPAddress remoteIP() {
+        return m_remoteIp;
+    }
+
+private:
+    friend class EthernetHttpServer;
+
+    // Parse the request line and headers at the start of text in place.
+    // Returns 0 if they are well formed, otherwise the status to reject
+    // the request with.
+    uint16_t parse(char *text);
+
+    EthernetHttpMethod m_method;
+    char *m_path;
+    char *m_query;
+    const char *m_headers[ETHERNET_HTTP_MAX_HEADERS][2];
+    uint8_t m_headerCount;
+    const uint8_t *m_body;
+    size_t m_bodyLength;
+    IPAddress m_remoteIp;
+    bool m_http11;
+};
+
+// State of one connection to an EthernetHttpServer.
+struct EthernetHttpConnection {
+    EthernetClient client;
+    char buffer[ETHERNET_HTTP_REQUEST_SIZE + 1];
+    uint16_t length;
+    // The request at the front of the buffer, once its headers have
+    // arrived and been parsed.
+    EthernetHttpRequest request;
+    uint16_t requestLength;
+    bool parsed;
+    // Response data waiting for the connection to take it. It goes before
+    // the body being streamed.
+    uint8_t output[ETHERNET_HTTP_RESPONSE_SIZE];
+    uint16_t outputLength;
+    // The response body being streamed: constant data or an SD card file.
+    const uint8_t *staticData;
+    SdFsFile file;
+    uint32_t left;
+    bool closeAfter;
+    uint32_t lastActivity;
+    bool open;
+};
+
+// The response to a request. Start it with begin(), or send a complete
+// one with sendStatic(), sendFile() or sendError(). The server ends it
+// after the handler returns.
+class EthernetHttpResponse : public Print {
+public:
+    // Send the status line and headers. length is the size of the body, or
+    // -1 if it is not known, in which case the body is sent in chunks (or,
+    // to an HTTP/1.0 browser, ended by closing the connection).
+    void begin(uint16_t status, const char *contentType,
+               int32_t length = -1);
+    // Add a header. Only valid between begin() and the first write().
+    void header(const char *name, const char *value);
+
+    // Write to the body. Starts a 200 text/html response if begin() has not
+    // been called. Never waits: what the connection cannot take at once is
+    // kept in the connection's response buffer and sent by service(). A
+    // response that outgrows the buffer fails (write() returns 0) and its
+    // connection is closed once what fitted has been sent, so keep bodies
+    // written this way within ETHERNET_HTTP_RESPONSE_SIZE; stream large
+    // content with sendStatic() or sendFile().
+    virtual size_t write(uint8_t c);
+    virtual size_t write(const uint8_t *buf, size_t size);
+    using Print::write;
+
+    // Send a response whose body is constant (e.g. kept in flash) without
+    // copying it. The body is streamed by the server's service().
+    void sendStatic(uint16_t status, const char *contentType,
+                    const uint8_t *data, size_t length);
+    // Send a file from the SD card, which must be mounted. The body is
+    // streamed by the server's service(). The content type is guessed
+    // from the file name if not given. Returns false (and sends nothing)
+    // if the file cannot be opened.
+    bool sendFile(const char *path, const char *contentType = nullptr);
+    // Send a response with the given status and a short text body.
+    void sendError(uint16_t status);
+    // Finish the response.
+    void end();
+
+    bool started() {
+        return m_state != Idle;
+    }
+
+private:
+    friend class EthernetHttpServer;
+
+    enum State {
+        Idle,
+        Headers,
+        Body,
+        Done
+    };
+
+    EthernetHttpResponse(EthernetHttpConnection &conn, bool head,
+                         bool http11);
+    void endHeaders();
+    bool out(const void *data, size_t size);
+    bool out(const char *text) {
+        return out(text, strlen(text));
+    }
+
+    EthernetHttpConnection &m_conn;
+    State m_state;
+    bool m_head;
+    bool m_http11;
+    bool m_chunked;
+    bool m_failed;
+};
+
+typedef void (*EthernetHttpHandler)(EthernetHttpRequest &request,
+                                    EthernetHttpResponse &response);
+
+class EthernetHttpServer {
+public:
+    EthernetHttpServer(uint16_t port = 80);
+
+    // Start listening for browsers.
+    void begin();
+
+    // Routes are tried in the order they were added. A path ending in '*'
+    // matches every path that starts with the part before it. A request
+    // whose path matches a route but whose method does not gets 405 Method
+    // Not Allowed; one that matches no route gets 404 Not Found. Each of
+    // these returns false if the route table is full.
+
+    // Run handler for requests to path. HttpGet routes also take HEAD
+    // requests; the body written by the handler is then left out.
+    bool on(const char *path, EthernetHttpHandler handler,
+            EthernetHttpMethod method = HttpAny);
+    // Answer GET requests to path with constant content, sent without
+    // being copied.
+    bool serveStatic(const char *path, const uint8_t *data, size_t length,
+                     const char *contentType);
+    // Answer GET requests to paths starting with prefix with the files in
+    // directory on the SD card, e.g. serveSd("/files/", "/www/") maps
+    // /files/a.htm to /www/a.htm. A path ending in '/' is mapped to
+    // index.htm in that directory.
+    bool serveSd(const char *prefix, const char *directory);
+
+    // Accept browsers, handle requests that have arrived and send as much
+    // of the responses being streamed as the connections will take. Call
+    // it from loop(); it does not wait on any browser.
+    void service();
+
+    uint8_t connectionCount();
+    uint32_t requestsServed() {
+        return m_requests;
+    }
+
+private:
+    enum RouteType {
+        RouteHandler,
+        RouteStatic,
+        RouteSd
+    };
+
+    struct Route {
+        RouteType type;
+        const char *path;
+        uint8_t pathLength;
+        bool prefix;
+        EthernetHttpMethod method;
+        EthernetHttpHandler handler;
+        const uint8_t *data;
+        size_t length;
+        // The content type, or the SD card directory.
+        const char *target;
+    };
+
+    Route *addRoute(RouteType type, const char *path,
+                    EthernetHttpMethod method);
+    void accept();
+    void serviceConnection(EthernetHttpConnection &conn);
+    void handle(EthernetHttpConnection &conn);
+    void route(EthernetHttpRequest &request, EthernetHttpResponse &response);
+    void serveFile(Route &route, EthernetHttpRequest &request,
+                   EthernetHttpResponse &response);
+    bool pump(EthernetHttpConnection &conn);
+    void close(EthernetHttpConnection &conn);
+
+    EthernetServer m_server;
+    Route m_routes[ETHERNET_HTTP_MAX_ROUTES];
+    uint8_t m_routeCount;
+    EthernetHttpConnection m_connections[ETHERNET_HTTP_MAX_CONNECTIONS];
+    uint8_t m_chunk[ETHERNET_HTTP_FILE_CHUNK] __attribute__((aligned(4)));
+    uint32_t m_requests;
+};
+
+#endif // ETHERNET_HTTP_H_
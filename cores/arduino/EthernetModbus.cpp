@@ -0,0 +1,507 @@
+#include "EthernetModbus.h"
+#include "EthernetService.h"
+
+// Exception codes.
+#define MODBUS_ILLEGAL_FUNCTION 1
+#define MODBUS_ILLEGAL_ADDRESS  2
+#define MODBUS_ILLEGAL_VALUE    3
+#define MODBUS_DEVICE_FAILURE   4
+
+// Largest response: the MBAP header and a 253-byte PDU.
+#define MODBUS_MAX_ADU 260
+
+EthernetModbusServer::EthernetModbusServer(uint16_t port)
+    : m_server(port),
+      m_tables(),
+      m_bindings(),
+      m_bindingCount(0),
+      m_connections(),
+      m_requests(0),
+      m_exceptions(0) {}
+
+void EthernetModbusServer::begin() {
+    m_server.begin();
+}
+
+EthernetModbusServer::Binding *EthernetModbusServer::add(
+    EthernetModbusTable table, uint16_t address, Kind kind, bool wide) {
+    uint16_t count = wide ? 2 : 1;
+    if (table >= ModbusTableCount ||
+            address + count > ETHERNET_MODBUS_TABLE_SIZE ||
+            m_bindingCount >= ETHERNET_MODBUS_MAX_BINDINGS) {
+        return nullptr;
+    }
+    bool bits = table == ModbusCoils || table == ModbusDiscreteInputs;
+    if (wide && bits) {
+        return nullptr;
+    }
+    for (uint16_t i = 0; i < count; i++) {
+        if (m_tables[table][address + i].binding) {
+            return nullptr;
+        }
+    }
+
+    Binding &binding = m_bindings[m_bindingCount++];
+    binding.kind = kind;
+    binding.field = 0;
+    binding.wide = wide;
+    binding.target = nullptr;
+    binding.reader = nullptr;
+    binding.writer = nullptr;
+    binding.written = 0;
+    for (uint16_t i = 0; i < count; i++) {
+        m_tables[table][address + i].binding = m_bindingCount;
+        m_tables[table][address + i].word = i;
+    }
+    return &binding;
+}
+
+bool EthernetModbusServer::bind(EthernetModbusTable table, uint16_t address,
+                                bool *value) {
+    if (table != ModbusCoils && table != ModbusDiscreteInputs) {
+        return false;
+    }
+    Binding *binding = add(table, address, KindBool, false);
+    if (binding) {
+        binding->target = value;
+    }
+    return binding;
+}
+
+bool EthernetModbusServer::bind(EthernetModbusTable table, uint16_t address,
+                                uint16_t *value) {
+    if (table != ModbusInputRegisters && table != ModbusHoldingRegisters) {
+        return false;
+    }
+    Binding *binding = add(table, address, KindUint16, false);
+    if (binding) {
+        binding->target = value;
+    }
+    return binding;
+}
+
+bool EthernetModbusServer::bind(EthernetModbusTable table, uint16_t address,
+                                int32_t *value) {
+    Binding *binding = add(table, address, KindInt32, true);
+    if (binding) {
+        binding->target = value;
+    }
+    return binding;
+}
+
+bool EthernetModbusServer::bind(EthernetModbusTable table, uint16_t address,
+                                ClearCore::Connector &connector) {
+    Binding *binding = add(table, address, KindConnector, false);
+    if (binding) {
+        binding->target = &connector;
+    }
+    return binding;
+}
+
+bool EthernetModbusServer::bind(EthernetModbusTable table, uint16_t address,
+                                ClearCore::MotorDriver &motor,
+                                EthernetModbusMotorField field) {
+    bool wide = field <= ModbusMotorAccelLimit;
+    Binding *binding = add(table, address, KindMotor, wide);
+    if (binding) {
+        binding->target = &motor;
+        binding->field = field;
+    }
+    return binding;
+}
+
+bool EthernetModbusServer::bind(EthernetModbusTable table, uint16_t address,
+                                EthernetModbusReader reader,
+                                EthernetModbusWriter writer, void *context) {
+    Binding *binding = add(table, address, KindFunction, false);
+    if (binding) {
+        binding->target = context;
+        binding->reader = reader;
+        binding->writer = writer;
+    }
+    return binding;
+}
+
+bool EthernetModbusServer::writable(Binding &binding) {
+    switch (binding.kind) {
+        case KindMotor:
+            return binding.field <= ModbusMotorAccelLimit ||
+                   binding.field == ModbusMotorEnable;
+        case KindFunction:
+            return binding.writer;
+        default:
+            return true;
+    }
+}
+
+int32_t EthernetModbusServer::read(Binding &binding) {
+    switch (binding.kind) {
+        case KindBool:
+            return *static_cast<bool *>(binding.target);
+        case KindUint16:
+            return *static_cast<uint16_t *>(binding.target);
+        case KindInt32:
+            return *static_cast<int32_t *>(binding.target);
+        case KindConnector:
+            return static_cast<ClearCore::Connector *>(binding.target)->State();
+        case KindFunction:
+            return binding.reader ? binding.reader(binding.target) : 0;
+        default:
+            break;
+    }
+
+    ClearCore::MotorDriver *motor =
+        static_cast<ClearCore::MotorDriver *>(binding.target);
+    switch (binding.field) {
+        case ModbusMotorPosition:
+            return motor->PositionRefCommanded();
+        case ModbusMotorVelocity:
+            return motor->VelocityRefCommanded();
+        case ModbusMotorTorque:
+            return (int16_t)(motor->HlfbPercent() * 10);
+        case ModbusMotorEnable:
+            return motor->EnableRequest();
+        case ModbusMotorStepsComplete:
+            return motor->StepsComplete();
+        case ModbusMotorHlfbAsserted:
+            return motor->HlfbState() == ClearCore::MotorDriver::HLFB_ASSERTED;
+        default:
+            return binding.written;
+    }
+}
+
+bool EthernetModbusServer::write(Binding &binding, int32_t value) {
+    switch (binding.kind) {
+        case KindBool:
+            *static_cast<bool *>(binding.target) = value;
+            return true;
+        case KindUint16:
+            *static_cast<uint16_t *>(binding.target) = value;
+            return true;
+        case KindInt32:
+            *static_cast<int32_t *>(binding.target) = value;
+            return true;
+        case KindConnector:
+            return static_cast<ClearCore::Connector *>(binding.target)->State(
+                       value);
+        case KindFunction:
+            return binding.writer && binding.writer(binding.target, value);
+        default:
+            break;
+    }
+
+    ClearCore::MotorDriver *motor =
+        static_cast<ClearCore::MotorDriver *>(binding.target);
+    switch (binding.field) {
+        case ModbusMotorPosition:
+            return motor->Move(value,
+                               ClearCore::MotorDriver::MOVE_TARGET_ABSOLUTE);
+        case ModbusMotorVelocity:
+            return motor->MoveVelocity(value);
+        case ModbusMotorVelocityLimit:
+            motor->VelMax(value);
+            binding.written = value;
+            return true;
+        case ModbusMotorAccelLimit:
+            motor->AccelMax(value);
+            binding.written = value;
+            return true;
+        case ModbusMotorEnable:
+            motor->EnableRequest(value != 0);
+            return true;
+        default:
+            return false;
+    }
+}
+
+uint8_t EthernetModbusServer::connectionCount() {
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < ETHERNET_MODBUS_MAX_CONNECTIONS; i++) {
+        count += m_connections[i].open;
+    }
+    return count;
+}
+
+void EthernetModbusServer::service() {
+    EthernetLock lock;
+    accept();
+    for (uint8_t i = 0; i < ETHERNET_MODBUS_MAX_CONNECTIONS; i++) {
+        if (m_connections[i].open) {
+            serviceConnection(m_connections[i]);
+        }
+    }
+}
+
+void EthernetModbusServer::accept() {
+    while (true) {
+        EthernetClient client = m_server.accept();
+        if (!client) {
+            return;
+        }
+        Connection *conn = nullptr;
+        for (uint8_t i = 0; i < ETHERNET_MODBUS_MAX_CONNECTIONS; i++) {
+            if (!m_connections[i].open) {
+                conn = &m_connections[i];
+                break;
+            }
+        }
+        if (!conn) {
+            client.stop();
+            continue;
+        }
+        // Responses are batched by the server, so send each batch at once.
+        client.setNoDelay(true);
+        conn->client = client;
+        conn->length = 0;
+        conn->lastActivity = millis();
+        conn->open = true;
+    }
+}
+
+void EthernetModbusServer::serviceConnection(Connection &conn) {
+    int available = conn.client.available();
+    if (available > 0 && conn.length < ETHERNET_MODBUS_BUFFER_SIZE) {
+        int count = conn.client.read(
+                        conn.buffer + conn.length,
+                        min(available, (int)(ETHERNET_MODBUS_BUFFER_SIZE -
+                                             conn.length)));
+        if (count > 0) {
+            conn.length += count;
+            conn.lastActivity = millis();
+        }
+    }
+
+    // Answer every complete request, in order, for as long as the
+    // connection has room for the responses.
+    int room = conn.client.availableForWrite();
+    uint16_t offset = 0;
+    uint16_t batchLength = 0;
+    while (conn.length - offset >= 7) {
+        const uint8_t *adu = conn.buffer + offset;
+        uint16_t protocol = adu[2] << 8 | adu[3];
+        uint16_t length = adu[4] << 8 | adu[5];
+        if (protocol != 0 || length < 2 || length > 254) {
+            // Not Modbus; there is no telling where the next request starts.
+            conn.client.stop();
+            conn.open = false;
+            return;
+        }
+        if (conn.length - offset < 6 + length ||
+                batchLength + MODBUS_MAX_ADU > ETHERNET_MODBUS_BUFFER_SIZE ||
+                room < batchLength + MODBUS_MAX_ADU) {
+            break;
+        }
+
+        uint8_t *response = m_batch + batchLength;
+        uint16_t pduLength = respond(adu + 7, length - 1, response + 7);
+        // The transaction and protocol identifiers and the unit are echoed.
+        memcpy(response, adu, 4);
+        response[4] = (pduLength + 1) >> 8;
+        response[5] = pduLength + 1;
+        response[6] = adu[6];
+        batchLength += 7 + pduLength;
+        offset += 6 + length;
+        m_requests++;
+    }
+
+    if (batchLength) {
+        conn.client.write(m_batch, batchLength);
+    }
+    memmove(conn.buffer, conn.buffer + offset, conn.length - offset);
+    conn.length -= offset;
+
+    if (!conn.client.connected() ||
+            millis() - conn.lastActivity >= ETHERNET_MODBUS_IDLE_MS) {
+        conn.client.stop();
+        conn.open = false;
+    }
+}
+
+// Answer one request PDU. Returns the length of the response PDU.
+uint16_t EthernetModbusServer::respond(const uint8_t *pdu, uint16_t length,
+                                       uint8_t *out) {
+    uint8_t function = pdu[0];
+    // Every supported request starts with an address and a count (or value).
+    uint16_t start = length >= 5 ? pdu[1] << 8 | pdu[2] : 0;
+    uint16_t count = length >= 5 ? pdu[3] << 8 | pdu[4] : 0;
+    uint8_t error = 0;
+    uint16_t size = 0;
+
+    switch (function) {
+        case 1:
+        case 2:
+            if (length != 5 || count < 1 || count > 2000) {
+                error = MODBUS_ILLEGAL_VALUE;
+                break;
+            }
+            error = readBits(function == 1 ? ModbusCoils : ModbusDiscreteInputs,
+                             start, count, out + 2);
+            out[1] = (count + 7) / 8;
+            size = 2 + out[1];
+            break;
+        case 3:
+        case 4:
+            if (length != 5 || count < 1 || count > 125) {
+                error = MODBUS_ILLEGAL_VALUE;
+                break;
+            }
+            error = readRegisters(function == 3 ? ModbusHoldingRegisters :
+                                  ModbusInputRegisters, start, count, out + 2);
+            out[1] = count * 2;
+            size = 2 + out[1];
+            break;
+        case 5:
+            if (length != 5 || (count != 0xFF00 && count != 0)) {
+                error = MODBUS_ILLEGAL_VALUE;
+                break;
+            }
+            error = checkWrite(ModbusCoils, start, 1);
+            if (!error && !write(binding(ModbusCoils, start), count != 0)) {
+                error = MODBUS_DEVICE_FAILURE;
+            }
+            memcpy(out, pdu, 5);
+            size = 5;
+            break;
+        case 6:
+            if (length != 5) {
+                error = MODBUS_ILLEGAL_VALUE;
+                break;
+            }
+            error = checkWrite(ModbusHoldingRegisters, start, 1);
+            if (!error && !write(binding(ModbusHoldingRegisters, start),
+                                 (int16_t)count)) {
+                error = MODBUS_DEVICE_FAILURE;
+            }
+            memcpy(out, pdu, 5);
+            size = 5;
+            break;
+        case 15:
+            if (length < 6 || count < 1 || count > 1968 ||
+                    pdu[5] != (count + 7) / 8 || length != 6 + pdu[5]) {
+                error = MODBUS_ILLEGAL_VALUE;
+                break;
+            }
+            error = checkWrite(ModbusCoils, start, count);
+            for (uint16_t i = 0; i < count && !error; i++) {
+                if (!write(binding(ModbusCoils, start + i),
+                           pdu[6 + i / 8] >> (i % 8) & 1)) {
+                    error = MODBUS_DEVICE_FAILURE;
+                }
+            }
+            memcpy(out, pdu, 5);
+            size = 5;
+            break;
+        case 16:
+            if (length < 6 || count < 1 || count > 123 ||
+                    pdu[5] != count * 2 || length != 6 + pdu[5]) {
+                error = MODBUS_ILLEGAL_VALUE;
+                break;
+            }
+            error = checkWrite(ModbusHoldingRegisters, start, count);
+            for (uint16_t i = 0; i < count && !error;) {
+                Binding &b = binding(ModbusHoldingRegisters, start + i);
+                const uint8_t *value = pdu + 6 + i * 2;
+                bool ok;
+                if (b.wide) {
+                    ok = write(b, (int32_t)((uint32_t)value[0] << 24 |
+                                            value[1] << 16 | value[2] << 8 |
+                                            value[3]));
+                    i += 2;
+                }
+                else {
+                    ok = write(b, (int16_t)(value[0] << 8 | value[1]));
+                    i++;
+                }
+                if (!ok) {
+                    error = MODBUS_DEVICE_FAILURE;
+                }
+            }
+            memcpy(out, pdu, 5);
+            size = 5;
+            break;
+        default:
+            error = MODBUS_ILLEGAL_FUNCTION;
+            break;
+    }
+
+    out[0] = function;
+    if (error) {
+        out[0] |= 0x80;
+        out[1] = error;
+        m_exceptions++;
+        return 2;
+    }
+    return size;
+}
+
+uint8_t EthernetModbusServer::readBits(EthernetModbusTable table,
+                                       uint16_t start, uint16_t count,
+                                       uint8_t *out) {
+    if (start + count > ETHERNET_MODBUS_TABLE_SIZE) {
+        return MODBUS_ILLEGAL_ADDRESS;
+    }
+    memset(out, 0, (count + 7) / 8);
+    for (uint16_t i = 0; i < count; i++) {
+        if (!m_tables[table][start + i].binding) {
+            return MODBUS_ILLEGAL_ADDRESS;
+        }
+        if (read(binding(table, start + i))) {
+            out[i / 8] |= 1 << (i % 8);
+        }
+    }
+    return 0;
+}
+
+uint8_t EthernetModbusServer::readRegisters(EthernetModbusTable table,
+                                            uint16_t start, uint16_t count,
+                                            uint8_t *out) {
+    if (start + count > ETHERNET_MODBUS_TABLE_SIZE) {
+        return MODBUS_ILLEGAL_ADDRESS;
+    }
+    Binding *last = nullptr;
+    int32_t value = 0;
+    for (uint16_t i = 0; i < count; i++) {
+        Slot &slot = m_tables[table][start + i];
+        if (!slot.binding) {
+            return MODBUS_ILLEGAL_ADDRESS;
+        }
+        Binding &b = binding(table, start + i);
+        uint16_t word;
+        if (b.wide) {
+            // Both words of a 32-bit value come from a single reading.
+            if (&b != last) {
+                value = read(b);
+                last = &b;
+            }
+            word = slot.word ? value : (uint32_t)value >> 16;
+        }
+        else {
+            word = read(b);
+        }
+        out[i * 2] = word >> 8;
+        out[i * 2 + 1] = word;
+    }
+    return 0;
+}
+
+// Check that every address in the range is bound to something writable
+// and that no 32-bit value is only partly covered.
+uint8_t EthernetModbusServer::checkWrite(EthernetModbusTable table,
+                                         uint16_t start, uint16_t count) {
+    if (start + count > ETHERNET_MODBUS_TABLE_SIZE) {
+        return MODBUS_ILLEGAL_ADDRESS;
+    }
+    for (uint16_t i = 0; i < count; i++) {
+        Slot &slot = m_tables[table][start + i];
+        if (!slot.binding || !writable(binding(table, start + i))) {
+            return MODBUS_ILLEGAL_ADDRESS;
+        }
+        if (binding(table, start + i).wide) {
+            if (slot.word || i + 1 >= count) {
+                return MODBUS_ILLEGAL_ADDRESS;
+            }
+            i++;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,196 @@
+/*
+ * Modbus TCP server on EthernetServer.
+ *
+ * Registers are bound to their sources once, with bind(): variables,
+ * connector states, motor parameters or user functions. Each of the four
+ * Modbus tables is an array indexed by address, so a request reads or
+ * writes its registers without any searching.
+ *
+ * Several masters can be connected at once, and each may pipeline
+ * requests: every complete request received is answered in order on each
+ * service(), for as long as the connection takes the responses. Supported
+ * function codes are 1, 2, 3, 4, 5, 6, 15 and 16.
+ *
+ * 32-bit values take two registers, high word first. They can only be
+ * written as a whole, by one Write Multiple Registers request covering
+ * both, so a motor is never commanded with half of a new value.
+ */
+
+#ifndef ETHERNET_MODBUS_H_
+#define ETHERNET_MODBUS_H_
+
+#include <Arduino.h>
+#include <Ethernet.h>
+#include "Connector.h"
+#include "MotorDriver.h"
+
+// Most masters connected at once. Further connections are refused.
+#ifndef ETHERNET_MODBUS_MAX_CONNECTIONS
+#define ETHERNET_MODBUS_MAX_CONNECTIONS 4
+#endif
+
+// Number of addresses in each table, starting from 0.
+#ifndef ETHERNET_MODBUS_TABLE_SIZE
+#define ETHERNET_MODBUS_TABLE_SIZE 64
+#endif
+
+// Most bindings a server can have, across all tables.
+#ifndef ETHERNET_MODBUS_MAX_BINDINGS
+#define ETHERNET_MODBUS_MAX_BINDINGS 64
+#endif
+
+// Size of each connection's receive buffer; room for a few pipelined
+// requests of the largest size (260 bytes).
+#ifndef ETHERNET_MODBUS_BUFFER_SIZE
+#define ETHERNET_MODBUS_BUFFER_SIZE 1040
+#endif
+
+// How long a master may stay silent before its connection is closed, in
+// ms, so a master that went away does not keep its slot.
+#ifndef ETHERNET_MODBUS_IDLE_MS
+#define ETHERNET_MODBUS_IDLE_MS 60000
+#endif
+
+enum EthernetModbusTable {
+    ModbusCoils,
+    ModbusDiscreteInputs,
+    ModbusInputRegisters,
+    ModbusHoldingRegisters,
+    ModbusTableCount
+};
+
+// Motor values that can be bound. 32-bit values take two registers; in
+// the coil and discrete input tables only the single-bit values can be
+// bound.
+enum EthernetModbusMotorField {
+    // Commanded position (32-bit). Writing it moves to that position.
+    ModbusMotorPosition,
+    // Commanded velocity (32-bit). Writing it starts a velocity move.
+    ModbusMotorVelocity,
+    // Velocity and acceleration limits for moves (32-bit). Read back as
+    // last written through the server, or 0 before then.
+    ModbusMotorVelocityLimit,
+    ModbusMotorAccelLimit,
+    // HLFB measurement, in tenths of a percent (signed).
+    ModbusMotorTorque,
+    // Enable request; 1 or 0.
+    ModbusMotorEnable,
+    // Whether the commanded move has finished. Read only.
+    ModbusMotorStepsComplete,
+    // Whether HLFB is asserted. Read only.
+    ModbusMotorHlfbAsserted
+};
+
+// Read and write functions for a register or bit bound with bind(). The
+// writer returns false to reject the value. Bits are passed as 0 or 1.
+typedef uint16_t (*EthernetModbusReader)(void *context);
+typedef bool (*EthernetModbusWriter)(void *context, uint16_t value);
+
+class EthernetModbusServer {
+public:
+    EthernetModbusServer(uint16_t port = 502);
+
+    void begin();
+
+    // Accept masters and answer every complete request received. Call it
+    // from loop(); it does not wait on any master.
+    void service();
+
+    // Bind address in table to a source. Each returns false if the address
+    // (or, for 32-bit values, the address after it) is out of range or
+    // already bound, if the binding table is full, or if the source does
+    // not fit the table. Sources in the coil and holding register tables
+    // can be written by masters.
+    bool bind(EthernetModbusTable table, uint16_t address, bool *value);
+    bool bind(EthernetModbusTable table, uint16_t address, uint16_t *value);
+    bool bind(EthernetModbusTable table, uint16_t address, int16_t *value) {
+        return bind(table, address, reinterpret_cast<uint16_t *>(value));
+    }
+    bool bind(EthernetModbusTable table, uint16_t address, int32_t *value);
+    // A connector's State(): a digital state, or an analog reading or
+    // output value.
+    bool bind(EthernetModbusTable table, uint16_t address,
+              ClearCore::Connector &connector);
+    bool bind(EthernetModbusTable table, uint16_t address,
+              ClearCore::MotorDriver &motor, EthernetModbusMotorField field);
+    // Pass nullptr as writer for a read-only source.
+    bool bind(EthernetModbusTable table, uint16_t address,
+              EthernetModbusReader reader, EthernetModbusWriter writer,
+              void *context = nullptr);
+
+    uint8_t connectionCount();
+    uint32_t requestsServed() {
+        return m_requests;
+    }
+    // Requests answered with an exception response.
+    uint32_t exceptions() {
+        return m_exceptions;
+    }
+
+private:
+    enum Kind {
+        KindBool,
+        KindUint16,
+        KindInt32,
+        KindConnector,
+        KindMotor,
+        KindFunction
+    };
+
+    struct Binding {
+        uint8_t kind;
+        uint8_t field;
+        bool wide;
+        void *target;
+        EthernetModbusReader reader;
+        EthernetModbusWriter writer;
+        // Last value written, for motor limits that cannot be read back.
+        int32_t written;
+    };
+
+    // Where each address of a table is bound: a binding index (0 for
+    // none, else one more than the index) and, for 32-bit values, which
+    // word.
+    struct Slot {
+        uint8_t binding;
+        uint8_t word;
+    };
+
+    struct Connection {
+        EthernetClient client;
+        uint8_t buffer[ETHERNET_MODBUS_BUFFER_SIZE];
+        uint16_t length;
+        uint32_t lastActivity;
+        bool open;
+    };
+
+    Binding *add(EthernetModbusTable table, uint16_t address, Kind kind,
+                 bool wide);
+    void accept();
+    void serviceConnection(Connection &conn);
+    uint16_t respond(const uint8_t *pdu, uint16_t length, uint8_t *out);
+    uint8_t readBits(EthernetModbusTable table, uint16_t start,
+                     uint16_t count, uint8_t *out);
+    uint8_t readRegisters(EthernetModbusTable table, uint16_t start,
+                          uint16_t count, uint8_t *out);
+    uint8_t checkWrite(EthernetModbusTable table, uint16_t start,
+                       uint16_t count);
+    Binding &binding(EthernetModbusTable table, uint16_t address) {
+        return m_bindings[m_tables[table][address].binding - 1];
+    }
+    bool writable(Binding &binding);
+    int32_t read(Binding &binding);
+    bool write(Binding &binding, int32_t value);
+
+    EthernetServer m_server;
+    Slot m_tables[ModbusTableCount][ETHERNET_MODBUS_TABLE_SIZE];
+    Binding m_bindings[ETHERNET_MODBUS_MAX_BINDINGS];
+    uint8_t m_bindingCount;
+    Connection m_connections[ETHERNET_MODBUS_MAX_CONNECTIONS];
+    // Responses to one connection's pipelined requests, sent in one write.
+    uint8_t m_batch[ETHERNET_MODBUS_BUFFER_SIZE];
+    uint32_t m_requests;
+    uint32_t m_exceptions;
+};
+
+#endif // ETHERNET_MODBUS_H_
@@ -0,0 +1,674 @@
+#include "EthernetMqtt.h"
+#include "EthernetService.h"
+
+#define MQTT_CONNECT     1
+#define MQTT_CONNACK     2
+#define MQTT_PUBLISH     3
+#define MQTT_PUBACK      4
+#define MQTT_SUBSCRIBE   8
+#define MQTT_SUBACK      9
+#define MQTT_PINGREQ     12
+#define MQTT_PINGRESP    13
+#define MQTT_DISCONNECT  14
+
+// MQTT 5 properties that are sent or looked for.
+#define MQTT_PROP_TOPIC_ALIAS_MAX 0x22
+#define MQTT_PROP_TOPIC_ALIAS     0x23
+
+// Number of bytes the remaining length field takes for length.
+static uint8_t lengthSize(uint32_t length) {
+    return length < 128 ? 1 : length < 16384 ? 2 : length < 2097152 ? 3 : 4;
+}
+
+static uint8_t *putLength(uint8_t *p, uint32_t length) {
+    do {
+        uint8_t digit = length & 0x7F;
+        length >>= 7;
+        *p++ = digit | (length ? 0x80 : 0);
+    } while (length);
+    return p;
+}
+
+// Decode a variable byte integer. Returns the number of bytes it takes, or
+// 0 if it is not all in the size bytes at p (or is malformed).
+static uint8_t getLength(const uint8_t *p, size_t size, uint32_t *length) {
+    *length = 0;
+    for (uint8_t i = 0; i < 4 && i < size; i++) {
+        *length |= (uint32_t)(p[i] & 0x7F) << (i * 7);
+        if (!(p[i] & 0x80)) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static uint8_t *putString(uint8_t *p, const void *text, uint16_t length) {
+    *p++ = length >> 8;
+    *p++ = length;
+    memcpy(p, text, length);
+    return p + length;
+}
+
+// Size of the value of MQTT 5 property id at p, or 0 if it is not known.
+static size_t propertySize(uint8_t id, const uint8_t *p, const uint8_t *end) {
+    switch (id) {
+        case 0x01: case 0x17: case 0x19: case 0x24: case 0x25: case 0x28:
+        case 0x29: case 0x2A:
+            return 1;
+        case 0x13: case 0x21: case 0x22: case 0x23:
+            return 2;
+        case 0x02: case 0x11: case 0x18: case 0x27:
+            return 4;
+        case 0x0B: {
+            uint32_t value;
+            return getLength(p, end - p, &value);
+        }
+        case 0x03: case 0x08: case 0x09: case 0x12: case 0x15: case 0x16:
+        case 0x1A: case 0x1C: case 0x1F:
+            return end - p >= 2 ? 2 + (p[0] << 8 | p[1]) : 0;
+        case 0x26:
+            if (end - p >= 2) {
+                size_t name = 2 + (p[0] << 8 | p[1]);
+                if ((size_t)(end - p) >= name + 2) {
+                    return name + 2 + (p[name] << 8 | p[name + 1]);
+                }
+            }
+            return 0;
+        default:
+            return 0;
+    }
+}
+
+EthernetMqttClient::EthernetMqttClient()
+    : m_client(),
+      m_state(Idle),
+      m_ip(),
+      m_port(1883),
+      m_clientId(nullptr),
+      m_user(nullptr),
+      m_password(nullptr),
+      m_version(4),
+      m_keepAlive(60),
+      m_stateSince(0),
+      m_lastSent(0),
+      m_lastHeard(0),
+      m_lastPing(0),
+      m_batch(),
+      m_batchLength(0),
+      m_rx(),
+      m_rxLength(0),
+      m_skip(0),
+      m_topics(),
+      m_topicCount(0),
+      m_aliasMax(0),
+      m_aliasSent(0),
+      m_subscriptions(),
+      m_subscriptionCount(0),
+      m_inFlight(),
+      m_packetId(0),
+      m_onMessage(nullptr),
+      m_published(0),
+      m_dropped(0),
+      m_connections(0) {}
+
+void EthernetMqttClient::begin(IPAddress ip, uint16_t port,
+                               const char *clientId) {
+    m_ip = ip;
+    m_port = port;
+    m_clientId = clientId;
+    // Connect on the first service().
+    m_state = Waiting;
+    m_stateSince = millis() - ETHERNET_MQTT_RETRY_MS;
+}
+
+void EthernetMqttClient::end() {
+    EthernetLock lock;
+    if (m_state == Connected) {
+        uint8_t *p = reserve(2);
+        if (p) {
+            p[0] = MQTT_DISCONNECT << 4;
+            p[1] = 0;
+            flush();
+        }
+    }
+    disconnect();
+    m_state = Idle;
+}
+
+int8_t EthernetMqttClient::addTopic(const char *topic) {
+    if (m_topicCount >= ETHERNET_MQTT_MAX_TOPICS) {
+        return -1;
+    }
+    m_topics[m_topicCount].name = topic;
+    m_topics[m_topicCount].length = strlen(topic);
+    return m_topicCount++;
+}
+
+bool EthernetMqttClient::subscribe(const char *topic, uint8_t qos) {
+    EthernetLock lock;
+    if (m_subscriptionCount >= ETHERNET_MQTT_MAX_SUBSCRIPTIONS) {
+        return false;
+    }
+    Subscription &subscription = m_subscriptions[m_subscriptionCount++];
+    subscription.topic = topic;
+    subscription.qos = qos > 1 ? 1 : qos;
+    if (m_state == Connected) {
+        writeSubscribe(subscription);
+    }
+    return true;
+}
+
+uint8_t EthernetMqttClient::inFlight() {
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < ETHERNET_MQTT_MAX_IN_FLIGHT; i++) {
+        count += m_inFlight[i].packetId != 0;
+    }
+    return count;
+}
+
+bool EthernetMqttClient::publish(int8_t topic, const uint8_t *payload,
+                                 size_t length, uint8_t qos, bool retain) {
+    if (topic < 0 || topic >= m_topicCount) {
+        m_dropped++;
+        return false;
+    }
+    return queue(topic, m_topics[topic].name, m_topics[topic].length, payload,
+                 length, qos, retain);
+}
+
+bool EthernetMqttClient::publish(const char *topic, const uint8_t *payload,
+                                 size_t length, uint8_t qos, bool retain) {
+    return queue(-1, topic, strlen(topic), payload, length, qos, retain);
+}
+
+bool EthernetMqttClient::queue(int8_t handle, const char *topic,
+                               uint16_t topicLength, const uint8_t *payload,
+                               size_t length, uint8_t qos, bool retain) {
+    EthernetLock lock;
+    if (!qos) {
+        if (m_state != Connected ||
+                !writePublish(handle, topic, topicLength, payload, length, 0,
+                              retain, false, 0)) {
+            m_dropped++;
+            return false;
+        }
+        m_published++;
+        return true;
+    }
+
+    // QoS 1 messages are copied so they can be sent again until they are
+    // acknowledged.
+    uint16_t copyLength = handle < 0 ? topicLength : 0;
+    Message *message = nullptr;
+    if (copyLength + length <= ETHERNET_MQTT_MESSAGE_SIZE) {
+        for (uint8_t i = 0; i < ETHERNET_MQTT_MAX_IN_FLIGHT; i++) {
+            if (!m_inFlight[i].packetId) {
+                message = &m_inFlight[i];
+                break;
+            }
+        }
+    }
+    if (!message) {
+        m_dropped++;
+        return false;
+    }
+    message->packetId = nextPacketId();
+    message->topic = handle;
+    message->retain = retain;
+    message->sent = false;
+    message->dup = false;
+    message->topicLength = topicLength;
+    message->payloadLength = length;
+    memcpy(message->data, topic, copyLength);
+    memcpy(message->data + copyLength, payload, length);
+    m_published++;
+    // Keep the messages in order: only send this one now if none are
+    // waiting to be sent ahead of it.
+    sendPending();
+    return true;
+}
+
+// Send the QoS 1 messages that have not been sent on this connection, in
+// the order they were published.
+void EthernetMqttClient::sendPending() {
+    if (m_state != Connected) {
+        return;
+    }
+    while (true) {
+        Message *next = nullptr;
+        for (uint8_t i = 0; i < ETHERNET_MQTT_MAX_IN_FLIGHT; i++) {
+            Message &message = m_inFlight[i];
+            // Packet IDs are handed out in order, wrapping around.
+            if (message.packetId && !message.sent &&
+                    (!next || (int16_t)(message.packetId -
+                                        next->packetId) < 0)) {
+                next = &message;
+            }
+        }
+        if (!next) {
+            return;
+        }
+        const char *topic = next->topic < 0 ?
+                            reinterpret_cast<const char *>(next->data) :
+                            m_topics[next->topic].name;
+        const uint8_t *payload =
+            next->data + (next->topic < 0 ? next->topicLength : 0);
+        if (!writePublish(next->topic, topic, next->topicLength, payload,
+                          next->payloadLength, 1, next->retain, next->dup,
+                          next->packetId)) {
+            return;
+        }
+        next->sent = true;
+    }
+}
+
+uint16_t EthernetMqttClient::nextPacketId() {
+    while (true) {
+        if (!++m_packetId) {
+            continue;
+        }
+        bool used = false;
+        for (uint8_t i = 0; i < ETHERNET_MQTT_MAX_IN_FLIGHT; i++) {
+            used |= m_inFlight[i].packetId == m_packetId;
+        }
+        if (!used) {
+            return m_packetId;
+        }
+    }
+}
+
+// Room for length bytes at the end of the batch, writing out the batch
+// first if needed. Returns nullptr if there is none.
+uint8_t *EthernetMqttClient::reserve(size_t length) {
+    if (m_batchLength + length > ETHERNET_MQTT_BATCH_SIZE &&
+            (!flush() || length > ETHERNET_MQTT_BATCH_SIZE)) {
+        return nullptr;
+    }
+    uint8_t *p = m_batch + m_batchLength;
+    m_batchLength += length;
+    return p;
+}
+
+bool EthernetMqttClient::flush() {
+    EthernetLock lock;
+    if (!m_batchLength) {
+        return true;
+    }
+    if (m_state != Handshaking && m_state != Connected) {
+        return false;
+    }
+    // Only write when the connection takes the whole batch, so the write
+    // neither waits nor splits it.
+    if (m_client.availableForWrite() < m_batchLength) {
+        return false;
+    }
+    m_client.write(m_batch, m_batchLength);
+    m_batchLength = 0;
+    m_lastSent = millis();
+    return true;
+}
+
+bool EthernetMqttClient::writePublish(int8_t handle, const char *topic,
+                                      uint16_t topicLength,
+                                      const uint8_t *payload, size_t length,
+                                      uint8_t qos, bool retain, bool dup,
+                                      uint16_t packetId) {
+    bool alias = m_version == 5 && handle >= 0 && handle < m_aliasMax;
+    // Once an alias is set up, the topic itself is left out.
+    if (alias && m_aliasSent & 1UL << handle) {
+        topicLength = 0;
+    }
+    uint8_t propertyLength = alias ? 3 : 0;
+    uint32_t remaining = 2 + topicLength + (qos ? 2 : 0) + length;
+    if (m_version == 5) {
+        remaining += 1 + propertyLength;
+    }
+    uint8_t *p = reserve(1 + lengthSize(remaining) + remaining);
+    if (!p) {
+        return false;
+    }
+
+    *p++ = MQTT_PUBLISH << 4 | dup << 3 | qos << 1 | retain;
+    p = putLength(p, remaining);
+    p = putString(p, topic, topicLength);
+    if (qos) {
+        *p++ = packetId >> 8;
+        *p++ = packetId;
+    }
+    if (m_version == 5) {
+        *p++ = propertyLength;
+        if (alias) {
+            *p++ = MQTT_PROP_TOPIC_ALIAS;
+            *p++ = (handle + 1) >> 8;
+            *p++ = handle + 1;
+            m_aliasSent |= 1UL << handle;
+        }
+    }
+    memcpy(p, payload, length);
+    return true;
+}
+
+bool EthernetMqttClient::writeConnect() {
+    uint16_t idLength = strlen(m_clientId);
+    uint16_t userLength = m_user ? strlen(m_user) : 0;
+    uint16_t passwordLength = m_password ? strlen(m_password) : 0;
+    uint32_t remaining = 10 + 2 + idLength;
+    if (m_version == 5) {
+        remaining++;
+    }
+    if (m_user) {
+        remaining += 2 + userLength;
+    }
+    if (m_password) {
+        remaining += 2 + passwordLength;
+    }
+    uint8_t *p = reserve(1 + lengthSize(remaining) + remaining);
+    if (!p) {
+        return false;
+    }
+
+    *p++ = MQTT_CONNECT << 4;
+    p = putLength(p, remaining);
+    p = putString(p, "MQTT", 4);
+    *p++ = m_version;
+    // Clean session; unacknowledged messages are resent by the client.
+    *p++ = 0x02 | (m_user ? 0x80 : 0) | (m_password ? 0x40 : 0);
+    *p++ = m_keepAlive >> 8;
+    *p++ = m_keepAlive;
+    if (m_version == 5) {
+        *p++ = 0;
+    }
+    p = putString(p, m_clientId, idLength);
+    if (m_user) {
+        p = putString(p, m_user, userLength);
+    }
+    if (m_password) {
+        putString(p, m_password, passwordLength);
+    }
+    return true;
+}
+
+bool EthernetMqttClient::writeSubscribe(Subscription &subscription) {
+    uint16_t topicLength = strlen(subscription.topic);
+    uint32_t remaining = 2 + 2 + topicLength + 1;
+    if (m_version == 5) {
+        remaining++;
+    }
+    uint8_t *p = reserve(1 + lengthSize(remaining) + remaining);
+    if (!p) {
+        return false;
+    }
+
+    uint16_t packetId = nextPacketId();
+    *p++ = MQTT_SUBSCRIBE << 4 | 0x02;
+    p = putLength(p, remaining);
+    *p++ = packetId >> 8;
+    *p++ = packetId;
+    if (m_version == 5) {
+        *p++ = 0;
+    }
+    p = putString(p, subscription.topic, topicLength);
+    *p = subscription.qos;
+    return true;
+}
+
+void EthernetMqttClient::service() {
+    EthernetLock lock;
+    switch (m_state) {
+        case Idle:
+            return;
+        case Waiting:
+            if (millis() - m_stateSince >= ETHERNET_MQTT_RETRY_MS) {
+                m_client.connectAsync(m_ip, m_port, ETHERNET_MQTT_CONNECT_MS);
+                m_state = Connecting;
+                m_stateSince = millis();
+            }
+            return;
+        case Connecting: {
+            EthernetAsyncStatus status = m_client.connectStatus();
+            if (status == EthernetAsyncInProgress) {
+                return;
+            }
+            if (status != EthernetAsyncSuccess) {
+                disconnect();
+                return;
+            }
+            // Batches are already as large as they should be.
+            m_client.setNoDelay(true);
+            m_rxLength = 0;
+            m_skip = 0;
+            m_aliasMax = 0;
+            m_aliasSent = 0;
+            m_state = Handshaking;
+            m_lastHeard = m_lastPing = millis();
+            if (!writeConnect() || !flush()) {
+                disconnect();
+            }
+            return;
+        }
+        default:
+            break;
+    }
+
+    receive();
+    if (m_state == Handshaking &&
+            millis() - m_stateSince >= ETHERNET_MQTT_CONNECT_MS) {
+        disconnect();
+    }
+    if (m_state != Connected && m_state != Handshaking) {
+        return;
+    }
+    if (!m_client.connected()) {
+        disconnect();
+        return;
+    }
+
+    if (m_state == Connected && m_keepAlive) {
+        uint32_t now = millis();
+        uint32_t keepAliveMs = m_keepAlive * 1000UL;
+        if (now - m_lastHeard >= keepAliveMs * 2) {
+            // The broker has stopped answering pings.
+            disconnect();
+            return;
+        }
+        // Ping when nothing has been sent for the keep alive time, and
+        // also when only QoS 0 messages have been sent, which the broker
+        // does not answer.
+        if ((now - m_lastSent >= keepAliveMs ||
+                now - m_lastHeard >= keepAliveMs) &&
+                now - m_lastPing >= keepAliveMs) {
+            uint8_t *p = reserve(2);
+            if (p) {
+                p[0] = MQTT_PINGREQ << 4;
+                p[1] = 0;
+                m_lastPing = now;
+            }
+        }
+    }
+    sendPending();
+    flush();
+}
+
+void EthernetMqttClient::receive() {
+    int available = m_client.available();
+    while (available > 0 && (m_state == Handshaking || m_state == Connected)) {
+        int count;
+        if (m_skip) {
+            size_t size = available;
+            if (size > ETHERNET_MQTT_RX_SIZE) {
+                size = ETHERNET_MQTT_RX_SIZE;
+            }
+            if (size > m_skip) {
+                size = m_skip;
+            }
+            count = m_client.read(m_rx, size);
+            if (count <= 0) {
+                return;
+            }
+            m_skip -= count;
+            available -= count;
+            continue;
+        }
+        count = m_client.read(m_rx + m_rxLength,
+                              min(available, ETHERNET_MQTT_RX_SIZE -
+                                  m_rxLength));
+        if (count <= 0) {
+            return;
+        }
+        m_rxLength += count;
+        available -= count;
+        m_lastHeard = millis();
+
+        uint16_t offset = 0;
+        while (m_rxLength - offset >= 2) {
+            uint32_t remaining;
+            uint8_t lengthBytes = getLength(m_rx + offset + 1,
+                                            m_rxLength - offset - 1,
+                                            &remaining);
+            if (!lengthBytes) {
+                if (m_rxLength - offset >= 5) {
+                    // Not a valid remaining length.
+                    disconnect();
+                    return;
+                }
+                break;
+            }
+            uint32_t total = 1 + lengthBytes + remaining;
+            if (total > ETHERNET_MQTT_RX_SIZE) {
+                // Too large to handle; throw the rest of it away.
+                m_skip = total - (m_rxLength - offset);
+                offset = m_rxLength;
+                break;
+            }
+            if ((uint32_t)(m_rxLength - offset) < total) {
+                break;
+            }
+            handlePacket(m_rx[offset], m_rx + offset + 1 + lengthBytes,
+                         remaining);
+            if (m_state != Handshaking && m_state != Connected) {
+                return;
+            }
+            offset += total;
+        }
+        memmove(m_rx, m_rx + offset, m_rxLength - offset);
+        m_rxLength -= offset;
+    }
+}
+
+void EthernetMqttClient::handlePacket(uint8_t header, uint8_t *body,
+                                      size_t length) {
+    uint8_t *end = body + length;
+    switch (header >> 4) {
+        case MQTT_CONNACK: {
+            if (length < 2 || body[1] != 0) {
+                // Refused.
+                disconnect();
+                return;
+            }
+            if (m_version == 5) {
+                uint32_t propertiesLength;
+                uint8_t *p = body + 2;
+                p += getLength(p, end - p, &propertiesLength);
+                uint8_t *propertiesEnd = p + propertiesLength;
+                if (propertiesEnd > end) {
+                    propertiesEnd = end;
+                }
+                while (p < propertiesEnd) {
+                    uint8_t id = *p++;
+                    size_t size = propertySize(id, p, propertiesEnd);
+                    if (!size || p + size > propertiesEnd) {
+                        break;
+                    }
+                    if (id == MQTT_PROP_TOPIC_ALIAS_MAX) {
+                        m_aliasMax = p[0] << 8 | p[1];
+                    }
+                    p += size;
+                }
+            }
+            m_state = Connected;
+            m_connections++;
+            for (uint8_t i = 0; i < m_subscriptionCount; i++) {
+                writeSubscribe(m_subscriptions[i]);
+            }
+            sendPending();
+            return;
+        }
+        case MQTT_PUBLISH: {
+            uint8_t qos = header >> 1 & 0x03;
+            if (length < 2) {
+                return;
+            }
+            uint16_t topicLength = body[0] << 8 | body[1];
+            // Everything after the topic is measured from the end of it.
+            if (2 + (size_t)topicLength > length) {
+                return;
+            }
+            uint8_t *p = body + 2 + topicLength;
+            uint16_t packetId = 0;
+            if (qos) {
+                if (p + 2 > end) {
+                    return;
+                }
+                packetId = p[0] << 8 | p[1];
+                p += 2;
+            }
+            if (m_version == 5) {
+                uint32_t propertiesLength;
+                uint8_t lengthBytes = getLength(p, end - p, &propertiesLength);
+                if (!lengthBytes ||
+                        propertiesLength > (size_t)(end - p) - lengthBytes) {
+                    return;
+                }
+                p += lengthBytes + propertiesLength;
+            }
+            if (p > end) {
+                return;
+            }
+            if (m_onMessage) {
+                // Move the topic over its length field to terminate it.
+                memmove(body, body + 2, topicLength);
+                body[topicLength] = '\0';
+                m_onMessage(reinterpret_cast<char *>(body), p, end - p);
+            }
+            if (qos == 1) {
+                uint8_t *ack = reserve(4);
+                if (ack) {
+                    ack[0] = MQTT_PUBACK << 4;
+                    ack[1] = 2;
+                    ack[2] = packetId >> 8;
+                    ack[3] = packetId;
+                }
+            }
+            return;
+        }
+        case MQTT_PUBACK: {
+            if (length < 2) {
+                return;
+            }
+            uint16_t packetId = body[0] << 8 | body[1];
+            for (uint8_t i = 0; i < ETHERNET_MQTT_MAX_IN_FLIGHT; i++) {
+                if (m_inFlight[i].packetId == packetId && m_inFlight[i].sent) {
+                    m_inFlight[i].packetId = 0;
+                }
+            }
+            return;
+        }
+        default:
+            // SUBACK and PINGRESP only show that the broker is there.
+            return;
+    }
+}
+
+// Drop the connection and try again after ETHERNET_MQTT_RETRY_MS.
+void EthernetMqttClient::disconnect() {
+    m_client.stop();
+    m_state = Waiting;
+    m_stateSince = millis();
+    m_batchLength = 0;
+    for (uint8_t i = 0; i < ETHERNET_MQTT_MAX_IN_FLIGHT; i++) {
+        if (m_inFlight[i].sent) {
+            m_inFlight[i].sent = false;
+            m_inFlight[i].dup = true;
+        }
+    }
+}
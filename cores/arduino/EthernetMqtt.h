@@ -0,0 +1,238 @@
+/*
+ * MQTT client (version 3.1.1, or 5) on EthernetClient.
+ *
+ * The client keeps itself connected: service() connects to the broker
+ * without blocking, through EthernetClient::connectAsync(), and reconnects
+ * (re-subscribing and resending unacknowledged messages) whenever the
+ * connection is lost.
+ *
+ * Messages published between calls to service() are collected in one
+ * batch buffer and written together, so a burst of telemetry goes out in
+ * one TCP segment instead of one per message. QoS 1 messages are kept
+ * until the broker acknowledges them, in a window of at most
+ * ETHERNET_MQTT_MAX_IN_FLIGHT messages; publishing while the window is
+ * full fails instead of waiting.
+ *
+ * Topics that are published often can be registered with addTopic() and
+ * published by handle. With MQTT 5, each such topic is sent in full only
+ * once per connection and by a two-byte topic alias after that, up to the
+ * broker's limit on aliases. MQTT 3.1.1 has no topic aliases, so there the
+ * handle only saves looking up the topic's length.
+ */
+
+#ifndef ETHERNET_MQTT_H_
+#define ETHERNET_MQTT_H_
+
+#include <Arduino.h>
+#include <Ethernet.h>
+
+// Size of the buffer that published messages are collected in. The
+// default fills one full-size TCP segment.
+#ifndef ETHERNET_MQTT_BATCH_SIZE
+#define ETHERNET_MQTT_BATCH_SIZE 1460
+#endif
+
+// Size of the receive buffer, which must hold each whole packet received.
+// Larger messages are skipped.
+#ifndef ETHERNET_MQTT_RX_SIZE
+#define ETHERNET_MQTT_RX_SIZE 512
+#endif
+
+// Most QoS 1 messages waiting for acknowledgement at once.
+#ifndef ETHERNET_MQTT_MAX_IN_FLIGHT
+#define ETHERNET_MQTT_MAX_IN_FLIGHT 8
+#endif
+
+// Largest topic and payload, together, of a QoS 1 message.
+#ifndef ETHERNET_MQTT_MESSAGE_SIZE
+#define ETHERNET_MQTT_MESSAGE_SIZE 256
+#endif
+
+// Most topics registered with addTopic(); no more than 32.
+#ifndef ETHERNET_MQTT_MAX_TOPICS
+#define ETHERNET_MQTT_MAX_TOPICS 16
+#endif
+
+// Most subscriptions.
+#ifndef ETHERNET_MQTT_MAX_SUBSCRIPTIONS
+#define ETHERNET_MQTT_MAX_SUBSCRIPTIONS 8
+#endif
+
+// How long connecting to the broker may take, including its answer, in ms.
+#ifndef ETHERNET_MQTT_CONNECT_MS
+#define ETHERNET_MQTT_CONNECT_MS 10000
+#endif
+
+// Wait before trying again after failing to connect, in ms.
+#ifndef ETHERNET_MQTT_RETRY_MS
+#define ETHERNET_MQTT_RETRY_MS 2000
+#endif
+
+// Called by service() for each message received on a subscribed topic.
+typedef void (*EthernetMqttHandler)(const char *topic, const uint8_t *payload,
+                                    size_t length);
+
+class EthernetMqttClient {
+public:
+    EthernetMqttClient();
+
+    // Connect to the broker at ip, as clientId, and stay connected. Nothing
+    // is sent until service() is called. clientId (and the user and
+    // password) must stay valid.
+    void begin(IPAddress ip, uint16_t port = 1883,
+               const char *clientId = "clearcore");
+    // Settings for the next connection. Call them before begin().
+    void setCredentials(const char *user, const char *password) {
+        m_user = user;
+        m_password = password;
+    }
+    // 4 for MQTT 3.1.1 (the default), or 5.
+    void setProtocolVersion(uint8_t version) {
+        m_version = version;
+    }
+    void setKeepAlive(uint16_t seconds) {
+        m_keepAlive = seconds;
+    }
+    // Disconnect and stop reconnecting.
+    void end();
+
+    // Connect or reconnect, handle packets received, keep the connection
+    // alive and send the batch of published messages. Call it from loop();
+    // it does not wait on the broker.
+    void service();
+    bool connected() {
+        return m_state == Connected;
+    }
+
+    // Register a topic to publish by handle. topic must stay valid. Returns
+    // the handle, or -1 if the topic table is full.
+    int8_t addTopic(const char *topic);
+
+    // Add a message to the batch. Returns false if it was not accepted: a
+    // QoS 0 message while not connected or if the connection has no room
+    // for it, a QoS 1 message while the window is full. QoS 1 messages
+    // published while not connected are sent once connected.
+    bool publish(int8_t topic, const uint8_t *payload, size_t length,
+                 uint8_t qos = 0, bool retain = false);
+    bool publish(const char *topic, const uint8_t *payload, size_t length,
+                 uint8_t qos = 0, bool retain = false);
+    bool publish(int8_t topic, const char *payload, uint8_t qos = 0,
+                 bool retain = false) {
+        return publish(topic, (const uint8_t *)payload, strlen(payload), qos,
+                       retain);
+    }
+    bool publish(const char *topic, const char *payload, uint8_t qos = 0,
+                 bool retain = false) {
+        return publish(topic, (const uint8_t *)payload, strlen(payload), qos,
+                       retain);
+    }
+    // Write the batch now rather than at the next service(). Returns false
+    // if the connection has no room for it yet.
+    bool flush();
+
+    // Subscribe to topic (which may hold wildcards) with QoS 0 or 1, now
+    // and on every reconnect. topic must stay valid. Returns false if the
+    // subscription table is full.
+    bool subscribe(const char *topic, uint8_t qos = 0);
+    void onMessage(EthernetMqttHandler handler) {
+        m_onMessage = handler;
+    }
+
+    // QoS 1 messages not acknowledged yet.
+    uint8_t inFlight();
+    // Messages published, messages that publish() did not accept, and
+    // connections made.
+    uint32_t published() {
+        return m_published;
+    }
+    uint32_t dropped() {
+        return m_dropped;
+    }
+    uint32_t connections() {
+        return m_connections;
+    }
+
+private:
+    enum State {
+        Idle,
+        Waiting,
+        Connecting,
+        Handshaking,
+        Connected
+    };
+
+    struct Topic {
+        const char *name;
+        uint16_t length;
+    };
+
+    struct Subscription {
+        const char *topic;
+        uint8_t qos;
+    };
+
+    // A QoS 1 message kept until acknowledged. data holds the topic
+    // (unless it was registered) followed by the payload.
+    struct Message {
+        uint16_t packetId;
+        int8_t topic;
+        bool retain;
+        bool sent;
+        // Sent on an earlier connection, so resent with the DUP flag.
+        bool dup;
+        uint16_t topicLength;
+        uint16_t payloadLength;
+        uint8_t data[ETHERNET_MQTT_MESSAGE_SIZE];
+    };
+
+    bool queue(int8_t handle, const char *topic, uint16_t topicLength,
+               const uint8_t *payload, size_t length, uint8_t qos,
+               bool retain);
+    bool writePublish(int8_t handle, const char *topic, uint16_t topicLength,
+                      const uint8_t *payload, size_t length, uint8_t qos,
+                      bool retain, bool dup, uint16_t packetId);
+    uint8_t *reserve(size_t length);
+    bool writeConnect();
+    bool writeSubscribe(Subscription &subscription);
+    void sendPending();
+    void receive();
+    void handlePacket(uint8_t header, uint8_t *body, size_t length);
+    void disconnect();
+    uint16_t nextPacketId();
+
+    EthernetClient m_client;
+    State m_state;
+    IPAddress m_ip;
+    uint16_t m_port;
+    const char *m_clientId;
+    const char *m_user;
+    const char *m_password;
+    uint8_t m_version;
+    uint16_t m_keepAlive;
+    uint32_t m_stateSince;
+    uint32_t m_lastSent;
+    uint32_t m_lastHeard;
+    uint32_t m_lastPing;
+    uint8_t m_batch[ETHERNET_MQTT_BATCH_SIZE];
+    uint16_t m_batchLength;
+    uint8_t m_rx[ETHERNET_MQTT_RX_SIZE];
+    uint16_t m_rxLength;
+    // Bytes still to be thrown away of a packet too large for m_rx.
+    uint32_t m_skip;
+    Topic m_topics[ETHERNET_MQTT_MAX_TOPICS];
+    uint8_t m_topicCount;
+    // Topic aliases the broker allows, and the registered topics whose
+    // alias has been set up on this connection.
+    uint16_t m_aliasMax;
+    uint32_t m_aliasSent;
+    Subscription m_subscriptions[ETHERNET_MQTT_MAX_SUBSCRIPTIONS];
+    uint8_t m_subscriptionCount;
+    Message m_inFlight[ETHERNET_MQTT_MAX_IN_FLIGHT];
+    uint16_t m_packetId;
+    EthernetMqttHandler m_onMessage;
+    uint32_t m_published;
+    uint32_t m_dropped;
+    uint32_t m_connections;
+};
+
+#endif // ETHERNET_MQTT_H_
@@ -0,0 +1,503 @@
+#include "EthernetSerialBridge.h"
+#include "EthernetService.h"
+
+// Telnet commands (RFC 854).
+#define TELNET_SE 240
+#define TELNET_SB 250
+#define TELNET_WILL 251
+#define TELNET_WONT 252
+#define TELNET_DO 253
+#define TELNET_DONT 254
+#define TELNET_IAC 255
+
+// Telnet options, and the bits that stand for them in the option masks.
+#define TELNET_BINARY 0
+#define TELNET_SGA 3
+#define TELNET_COM_PORT 44
+#define OPTION_BINARY 0x01
+#define OPTION_SGA 0x02
+#define OPTION_COM_PORT 0x04
+
+// COM-PORT-OPTION commands (RFC 2217). The server answers each with the
+// command plus 100.
+#define COM_SIGNATURE 0
+#define COM_SET_BAUDRATE 1
+#define COM_SET_DATASIZE 2
+#define COM_SET_PARITY 3
+#define COM_SET_STOPSIZE 4
+#define COM_SET_CONTROL 5
+#define COM_FLOWCONTROL_SUSPEND 8
+#define COM_FLOWCONTROL_RESUME 9
+#define COM_SET_LINESTATE_MASK 10
+#define COM_SET_MODEMSTATE_MASK 11
+#define COM_PURGE_DATA 12
+#define COM_REPLY 100
+
+// SET-CONTROL values. Those up to FLOW_LAST are about outbound flow
+// control and those from INBOUND_FIRST about inbound flow control; the
+// others ask for or set the break, DTR and RTS states.
+#define COM_CONTROL_FLOW_LAST 3
+#define COM_CONTROL_FLOW_NONE 1
+#define COM_CONTROL_BREAK_REQUEST 4
+#define COM_CONTROL_BREAK_OFF 6
+#define COM_CONTROL_DTR_REQUEST 7
+#define COM_CONTROL_DTR_ON 8
+#define COM_CONTROL_RTS_REQUEST 10
+#define COM_CONTROL_RTS_ON 11
+#define COM_CONTROL_INBOUND_FIRST 13
+#define COM_CONTROL_INBOUND_NONE 14
+// PURGE-DATA values that include the data received from the serial port.
+#define COM_PURGE_RECEIVE 1
+#define COM_PURGE_BOTH 3
+
+static uint8_t dataBits(uint16_t config) {
+    return ((config & SERIAL_DATA_MASK) >> 8) + 4;
+}
+
+static uint8_t optionBit(uint8_t option) {
+    switch (option) {
+        case TELNET_BINARY:
+            return OPTION_BINARY;
+        case TELNET_SGA:
+            return OPTION_SGA;
+        case TELNET_COM_PORT:
+            return OPTION_COM_PORT;
+        default:
+            return 0;
+    }
+}
+
+EthernetSerialBridge::EthernetSerialBridge(Uart &serial, uint16_t port)
+    : m_serial(serial),
+      m_server(port),
+      m_client(),
+      m_connected(false),
+      m_remoteControl(false),
+      m_baudRate(0),
+      m_config(SERIAL_8N1),
+      m_idleUs(0),
+      m_out(),
+      m_outLength(0),
+      m_outSince(0),
+      m_lastReceive(0),
+      m_sendNow(false),
+      m_suspended(false),
+      m_telnet(TelnetData),
+      m_telnetCommand(0),
+      m_sub(),
+      m_subLength(0),
+      m_localOptions(0),
+      m_remoteOptions(0),
+      m_bytesToNetwork(0),
+      m_bytesToSerial(0),
+      m_connections(0) {}
+
+void EthernetSerialBridge::begin(unsigned long baudRate, uint16_t config) {
+    m_baudRate = baudRate;
+    m_config = config;
+    applyConfig();
+    m_server.begin();
+}
+
+void EthernetSerialBridge::applyConfig() {
+    m_serial.begin(m_baudRate, m_config);
+    // Start bit, data bits, parity and stop bits of one character.
+    uint8_t bits = 1 + dataBits(m_config) + 1;
+    if ((m_config & SERIAL_PARITY_MASK) != SERIAL_PARITY_NONE) {
+        bits++;
+    }
+    if ((m_config & SERIAL_STOP_BIT_MASK) == SERIAL_STOP_BIT_2) {
+        bits++;
+    }
+    m_idleUs = (uint64_t)ETHERNET_BRIDGE_IDLE_CHARS * bits * 1000000 /
+               max(m_baudRate, 1UL) + 1;
+}
+
+void EthernetSerialBridge::service() {
+    EthernetLock lock;
+    accept();
+    if (!m_connected) {
+        m_serial.flushInput();
+        return;
+    }
+    toSerial();
+    fromSerial();
+    if (!m_client.connected()) {
+        m_client.stop();
+        m_connected = false;
+    }
+}
+
+void EthernetSerialBridge::accept() {
+    while (true) {
+        EthernetClient client = m_server.accept();
+        if (!client) {
+            return;
+        }
+        if (m_connected) {
+            m_client.stop();
+        }
+        // Writes are made a block at a time, so send each one at once.
+        client.setNoDelay(true);
+        m_client = client;
+        m_connected = true;
+        m_connections++;
+        m_outLength = 0;
+        m_sendNow = false;
+        m_suspended = false;
+        m_telnet = TelnetData;
+        m_localOptions = 0;
+        m_remoteOptions = 0;
+        if (m_remoteControl) {
+            // Offer an 8-bit clean connection both ways, as if the client
+            // had asked for it.
+            negotiate(TELNET_DO, TELNET_BINARY);
+            negotiate(TELNET_WILL, TELNET_BINARY);
+            negotiate(TELNET_DO, TELNET_SGA);
+            m_sendNow = true;
+        }
+    }
+}
+
+// Write what the client sent to the serial port, for as long as the
+// transmit buffer has room.
+void EthernetSerialBridge::toSerial() {
+    int room = m_serial.availableForWrite();
+    while (room > 0) {
+        EthernetSpan span = m_client.span();
+        if (!span.length) {
+            break;
+        }
+        size_t used = 0;
+        while (used < span.length && room > 0) {
+            if (m_telnet != TelnetData) {
+                int data = telnet(span.data[used++]);
+                if (data >= 0) {
+                    m_serial.write((uint8_t)data);
+                    m_bytesToSerial++;
+                    room--;
+                }
+                continue;
+            }
+            // Data runs up to the next Telnet command.
+            const uint8_t *start = span.data + used;
+            size_t limit = min(span.length - used, (size_t)room);
+            const uint8_t *iac = m_remoteControl ?
+                                 (const uint8_t *)memchr(start, TELNET_IAC,
+                                                         limit) : nullptr;
+            size_t run = iac ? iac - start : limit;
+            if (run) {
+                m_serial.write(start, run);
+                m_bytesToSerial += run;
+                room -= run;
+            }
+            used += run;
+            if (iac) {
+                m_telnet = TelnetIac;
+                used++;
+            }
+        }
+        m_client.consume(used);
+    }
+}
+
+// Gather what the serial port received, and send it when due.
+void EthernetSerialBridge::fromSerial() {
+    uint32_t now = micros();
+    uint16_t startLength = m_outLength;
+    if (!m_suspended) {
+        if (!m_remoteControl) {
+            size_t count = m_serial.read(m_out + m_outLength,
+                                         ETHERNET_BRIDGE_BUFFER_SIZE -
+                                         m_outLength);
+            m_outLength += count;
+            m_bytesToNetwork += count;
+        }
+        else {
+            // Each byte may need escaping, so take no more than half the
+            // room left.
+            uint8_t chunk[64];
+            size_t count;
+            do {
+                size_t room = (ETHERNET_BRIDGE_BUFFER_SIZE - m_outLength) / 2;
+                count = m_serial.read(chunk, min(sizeof(chunk), room));
+                for (size_t i = 0; i < count; i++) {
+                    putData(chunk[i]);
+                }
+                m_bytesToNetwork += count;
+            } while (count);
+        }
+    }
+    if (m_outLength != startLength) {
+        if (!startLength) {
+            m_outSince = now;
+        }
+        m_lastReceive = now;
+    }
+    if (!m_outLength) {
+        return;
+    }
+
+    bool due = m_sendNow ||
+               m_outLength > ETHERNET_BRIDGE_BUFFER_SIZE - 2 ||
+               now - m_lastReceive >= m_idleUs ||
+               now - m_outSince >= ETHERNET_BRIDGE_MAX_DELAY_MS * 1000UL;
+    // Wait for room rather than let write() block; the serial data
+    // meanwhile keeps gathering.
+    if (due && m_client.availableForWrite() >= m_outLength) {
+        m_client.write(m_out, m_outLength);
+        m_outLength = 0;
+        m_sendNow = false;
+    }
+}
+
+// Take one byte of a Telnet command. Returns the data byte it stands for,
+// or -1.
+int EthernetSerialBridge::telnet(uint8_t c) {
+    switch (m_telnet) {
+        case TelnetIac:
+            m_telnet = TelnetData;
+            switch (c) {
+                case TELNET_IAC:
+                    return TELNET_IAC;
+                case TELNET_SB:
+                    m_telnet = TelnetSub;
+                    m_subLength = 0;
+                    break;
+                case TELNET_WILL:
+                case TELNET_WONT:
+                case TELNET_DO:
+                case TELNET_DONT:
+                    m_telnet = TelnetOption;
+                    m_telnetCommand = c;
+                    break;
+                default:
+                    // Other commands (NOP, go ahead, ...) mean nothing here.
+                    break;
+            }
+            break;
+        case TelnetOption:
+            m_telnet = TelnetData;
+            negotiate(m_telnetCommand, c);
+            break;
+        case TelnetSub:
+            if (c == TELNET_IAC) {
+                m_telnet = TelnetSubIac;
+            }
+            else if (m_subLength < sizeof(m_sub)) {
+                m_sub[m_subLength++] = c;
+            }
+            break;
+        case TelnetSubIac:
+            if (c == TELNET_IAC) {
+                m_telnet = TelnetSub;
+                if (m_subLength < sizeof(m_sub)) {
+                    m_sub[m_subLength++] = c;
+                }
+                break;
+            }
+            m_telnet = TelnetData;
+            if (c == TELNET_SE && m_subLength >= 2 &&
+                    m_sub[0] == TELNET_COM_PORT) {
+                command(m_sub + 1, m_subLength - 1);
+            }
+            break;
+        default:
+            m_telnet = TelnetData;
+            break;
+    }
+    return -1;
+}
+
+// Handle a request to enable or disable an option (or the client's answer
+// to one of ours). Only changes are answered, so the two sides cannot get
+// into a loop.
+void EthernetSerialBridge::negotiate(uint8_t command, uint8_t option) {
+    uint8_t bit = optionBit(option);
+    uint8_t answer = 0;
+    switch (command) {
+        case TELNET_WILL:
+            if (!bit) {
+                answer = TELNET_DONT;
+            }
+            else if (!(m_remoteOptions & bit)) {
+                m_remoteOptions |= bit;
+                answer = TELNET_DO;
+            }
+            break;
+        case TELNET_WONT:
+            if (m_remoteOptions & bit) {
+                m_remoteOptions &= ~bit;
+                answer = TELNET_DONT;
+            }
+            break;
+        case TELNET_DO:
+            // The client is the one with the COM port option, not this side.
+            if (!(bit & (OPTION_BINARY | OPTION_SGA))) {
+                answer = TELNET_WONT;
+            }
+            else if (!(m_localOptions & bit)) {
+                m_localOptions |= bit;
+                answer = TELNET_WILL;
+            }
+            break;
+        case TELNET_DONT:
+            if (m_localOptions & bit) {
+                m_localOptions &= ~bit;
+                answer = TELNET_WONT;
+            }
+            break;
+        default:
+            break;
+    }
+    if (answer) {
+        put(TELNET_IAC);
+        put(answer);
+        put(option);
+        m_sendNow = true;
+    }
+}
+
+// Carry out a COM-PORT-OPTION command, and answer it with the setting now
+// in effect. A value of 0 only asks for the setting.
+void EthernetSerialBridge::command(const uint8_t *sub, uint8_t length) {
+    if (!length) {
+        return;
+    }
+    uint8_t value = length > 1 ? sub[1] : 0;
+    switch (sub[0]) {
+        case COM_SIGNATURE:
+            reply(COM_SIGNATURE, (const uint8_t *)"ClearCore", 9);
+            break;
+        case COM_SET_BAUDRATE: {
+            if (length == 5) {
+                uint32_t baudRate = (uint32_t)sub[1] << 24 | sub[2] << 16 |
+                                    sub[3] << 8 | sub[4];
+                if (baudRate && baudRate != m_baudRate) {
+                    m_baudRate = baudRate;
+                    applyConfig();
+                }
+            }
+            uint8_t current[4] = {
+                (uint8_t)(m_baudRate >> 24), (uint8_t)(m_baudRate >> 16),
+                (uint8_t)(m_baudRate >> 8), (uint8_t)m_baudRate
+            };
+            reply(COM_SET_BAUDRATE, current, 4);
+            break;
+        }
+        case COM_SET_DATASIZE: {
+            if (value >= 5 && value <= 8) {
+                m_config = (m_config & ~SERIAL_DATA_MASK) |
+                           SERIAL_DATA_5 * (value - 4);
+                applyConfig();
+            }
+            uint8_t current = dataBits(m_config);
+            reply(COM_SET_DATASIZE, &current, 1);
+            break;
+        }
+        case COM_SET_PARITY: {
+            // None, odd and even; mark and space are not supported.
+            static const uint16_t parities[] = {
+                SERIAL_PARITY_NONE, SERIAL_PARITY_ODD, SERIAL_PARITY_EVEN
+            };
+            if (value >= 1 && value <= 3) {
+                m_config = (m_config & ~SERIAL_PARITY_MASK) |
+                           parities[value - 1];
+                applyConfig();
+            }
+            uint8_t current = 1;
+            for (uint8_t i = 0; i < 3; i++) {
+                if ((m_config & SERIAL_PARITY_MASK) == parities[i]) {
+                    current = i + 1;
+                }
+            }
+            reply(COM_SET_PARITY, &current, 1);
+            break;
+        }
+        case COM_SET_STOPSIZE: {
+            // 1 or 2 stop bits; 1.5 is not supported.
+            if (value == 1 || value == 2) {
+                m_config = (m_config & ~SERIAL_STOP_BIT_MASK) |
+                           (value == 2 ? SERIAL_STOP_BIT_2 : SERIAL_STOP_BIT_1);
+                applyConfig();
+            }
+            uint8_t current = (m_config & SERIAL_STOP_BIT_MASK) ==
+                              SERIAL_STOP_BIT_2 ? 2 : 1;
+            reply(COM_SET_STOPSIZE, &current, 1);
+            break;
+        }
+        case COM_SET_CONTROL: {
+            // There is no flow control, and no break, DTR or RTS line;
+            // setting those is taken as done.
+            uint8_t current = value;
+            if (value <= COM_CONTROL_FLOW_LAST) {
+                current = COM_CONTROL_FLOW_NONE;
+            }
+            else if (value >= COM_CONTROL_INBOUND_FIRST) {
+                current = COM_CONTROL_INBOUND_NONE;
+            }
+            else if (value == COM_CONTROL_BREAK_REQUEST) {
+                current = COM_CONTROL_BREAK_OFF;
+            }
+            else if (value == COM_CONTROL_DTR_REQUEST) {
+                current = COM_CONTROL_DTR_ON;
+            }
+            else if (value == COM_CONTROL_RTS_REQUEST) {
+                current = COM_CONTROL_RTS_ON;
+            }
+            reply(COM_SET_CONTROL, &current, 1);
+            break;
+        }
+        case COM_FLOWCONTROL_SUSPEND:
+            m_suspended = true;
+            break;
+        case COM_FLOWCONTROL_RESUME:
+            m_suspended = false;
+            break;
+        case COM_SET_LINESTATE_MASK:
+        case COM_SET_MODEMSTATE_MASK:
+            // No line or modem state changes are reported, whatever the
+            // mask.
+            reply(sub[0], &value, 1);
+            break;
+        case COM_PURGE_DATA:
+            if (value == COM_PURGE_RECEIVE || value == COM_PURGE_BOTH) {
+                m_serial.flushInput();
+            }
+            reply(COM_PURGE_DATA, &value, 1);
+            break;
+        default:
+            break;
+    }
+}
+
+void EthernetSerialBridge::reply(uint8_t command, const uint8_t *value,
+                                 uint8_t length) {
+    put(TELNET_IAC);
+    put(TELNET_SB);
+    put(TELNET_COM_PORT);
+    put(command + COM_REPLY);
+    for (uint8_t i = 0; i < length; i++) {
+        putData(value[i]);
+    }
+    put(TELNET_IAC);
+    put(TELNET_SE);
+    m_sendNow = true;
+}
+
+void EthernetSerialBridge::put(uint8_t c) {
+    if (m_outLength < ETHERNET_BRIDGE_BUFFER_SIZE) {
+        if (!m_outLength) {
+            m_outSince = micros();
+        }
+        m_out[m_outLength++] = c;
+    }
+}
+
+// Add a data byte, escaped if it could be mistaken for a Telnet command.
+void EthernetSerialBridge::putData(uint8_t c) {
+    if (c == TELNET_IAC && m_remoteControl) {
+        put(TELNET_IAC);
+    }
+    put(c);
+}
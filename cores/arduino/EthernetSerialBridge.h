@@ -0,0 +1,146 @@
+/*
+ * Serial-to-Ethernet bridge: a TCP port connected to one of the COM
+ * connectors, for remote access to RS-232 devices.
+ *
+ * One client is bridged at a time. A new connection takes over from the
+ * previous one, so a client that went away without closing its connection
+ * does not lock the port. Data received on the serial port while no client
+ * is connected is discarded.
+ *
+ * Data moves in blocks. Whatever the serial port has received is gathered
+ * into one buffer and sent as a single segment; data from the network is
+ * written to the serial port straight from the network stack's buffers,
+ * as far as the transmit buffer has room, and the rest waits in the TCP
+ * receive window. Gathered serial data is sent when the buffer fills,
+ * when the line has been quiet for ETHERNET_BRIDGE_IDLE_CHARS character
+ * times at the current settings (the end of a message, so request and
+ * response traffic is not held up), or when the oldest byte has waited
+ * ETHERNET_BRIDGE_MAX_DELAY_MS. A continuous stream therefore goes out in
+ * segments that grow with the baud rate.
+ *
+ * With setRemoteControl(true) the connection carries Telnet with the
+ * COM-PORT-OPTION of RFC 2217, so the client can change the baud rate,
+ * data bits, parity and stop bits, and purge the buffers (e.g. pyserial's
+ * rfc2217:// URLs, or a virtual COM port driver). The COM connectors have
+ * no break, DTR or RTS lines; requests for them are acknowledged and
+ * otherwise ignored. Without remote control the connection carries the
+ * raw data.
+ *
+ * The serial ports' receive buffers are small, so call service() often:
+ * at 921600 baud a character arrives every 11 us.
+ */
+
+#ifndef ETHERNET_SERIAL_BRIDGE_H_
+#define ETHERNET_SERIAL_BRIDGE_H_
+
+#include <Arduino.h>
+#include <Ethernet.h>
+
+// Size of the buffer serial data is gathered in; one full-size segment.
+#ifndef ETHERNET_BRIDGE_BUFFER_SIZE
+#define ETHERNET_BRIDGE_BUFFER_SIZE 1460
+#endif
+
+// Gathered serial data is sent once the line has been quiet for this many
+// character times.
+#ifndef ETHERNET_BRIDGE_IDLE_CHARS
+#define ETHERNET_BRIDGE_IDLE_CHARS 3
+#endif
+
+// Longest gathered serial data waits to be sent, in ms.
+#ifndef ETHERNET_BRIDGE_MAX_DELAY_MS
+#define ETHERNET_BRIDGE_MAX_DELAY_MS 10
+#endif
+
+class EthernetSerialBridge {
+public:
+    // Bridge serial (Serial0 or Serial1) to TCP port.
+    EthernetSerialBridge(Uart &serial, uint16_t port);
+
+    // Open the serial port with the given settings, and start listening.
+    void begin(unsigned long baudRate, uint16_t config = SERIAL_8N1);
+    // Take RFC 2217 commands from the client. Call before begin().
+    void setRemoteControl(bool enable) {
+        m_remoteControl = enable;
+    }
+
+    // Accept connections and move data both ways. Call it from loop(), as
+    // often as possible.
+    void service();
+
+    bool connected() {
+        return m_connected;
+    }
+    // Current serial settings, which an RFC 2217 client may have changed.
+    unsigned long baudRate() {
+        return m_baudRate;
+    }
+    uint16_t config() {
+        return m_config;
+    }
+    // Data bytes moved each way, and connections accepted, since begin().
+    uint32_t bytesToNetwork() {
+        return m_bytesToNetwork;
+    }
+    uint32_t bytesToSerial() {
+        return m_bytesToSerial;
+    }
+    uint32_t connections() {
+        return m_connections;
+    }
+
+private:
+    enum TelnetState {
+        TelnetData,
+        TelnetIac,
+        TelnetOption,
+        TelnetSub,
+        TelnetSubIac,
+    };
+
+    void accept();
+    void applyConfig();
+    void toSerial();
+    void fromSerial();
+    int telnet(uint8_t c);
+    void negotiate(uint8_t command, uint8_t option);
+    void command(const uint8_t *sub, uint8_t length);
+    void reply(uint8_t command, const uint8_t *value, uint8_t length);
+    void put(uint8_t c);
+    void putData(uint8_t c);
+
+    Uart &m_serial;
+    EthernetServer m_server;
+    EthernetClient m_client;
+    bool m_connected;
+    bool m_remoteControl;
+
+    unsigned long m_baudRate;
+    uint16_t m_config;
+    // Quiet time on the line that ends a message, in us.
+    uint32_t m_idleUs;
+
+    // Serial data (escaped, with remote control) and Telnet replies
+    // waiting to be sent.
+    uint8_t m_out[ETHERNET_BRIDGE_BUFFER_SIZE];
+    uint16_t m_outLength;
+    uint32_t m_outSince;
+    uint32_t m_lastReceive;
+    bool m_sendNow;
+    // The client asked for serial data to be held back.
+    bool m_suspended;
+
+    TelnetState m_telnet;
+    uint8_t m_telnetCommand;
+    uint8_t m_sub[8];
+    uint8_t m_subLength;
+    // Telnet options in effect, on this side and the client's.
+    uint8_t m_localOptions;
+    uint8_t m_remoteOptions;
+
+    uint32_t m_bytesToNetwork;
+    uint32_t m_bytesToSerial;
+    uint32_t m_connections;
+};
+
+#endif // ETHERNET_SERIAL_BRIDGE_H_
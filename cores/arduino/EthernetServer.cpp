@@ -1,20 +1,145 @@
 #include <Ethernet.h>
+#include "EthernetConnection.h"
+#include "EthernetManager.h"
+#include "EthernetService.h"
+#include "lwip/priv/tcp_priv.h"
 
-EthernetServer::EthernetServer(uint16_t port/* = 80*/) : m_tcpServer(port) {}
+namespace ClearCore {
+extern EthernetManager &EthernetMgr;
+}
+
+EthernetServer *EthernetServer::m_dispatchList = nullptr;
+
+// A payload shared by every connection it was queued on by reference. It
+// may be reused once each of them has acknowledged the payload (its end
+// sequence number) or has gone away.
+struct BroadcastBuffer {
+    uint8_t data[ETHERNET_BROADCAST_SIZE];
+    struct {
+        struct tcp_pcb *pcb;
+        uint16_t remotePort;
+        uint32_t endSeq;
+    } refs[ETHERNET_SERVER_MAX_CLIENTS];
+    uint8_t refCount;
+};
+
+static BroadcastBuffer broadcastBuffers[ETHERNET_BROADCAST_BUFFERS];
+
+static bool pcbActive(struct tcp_pcb *pcb, uint16_t remotePort) {
+    for (struct tcp_pcb *p = tcp_active_pcbs; p; p = p->next) {
+        if (p == pcb) {
+            // A pcb that was freed and reused is for another connection.
+            return p->remote_port == remotePort;
+        }
+    }
+    return false;
+}
+
+static BroadcastBuffer *broadcastBuffer() {
+    for (uint8_t i = 0; i < ETHERNET_BROADCAST_BUFFERS; i++) {
+        BroadcastBuffer &buffer = broadcastBuffers[i];
+        uint8_t r = 0;
+        while (r < buffer.refCount) {
+            struct tcp_pcb *pcb = buffer.refs[r].pcb;
+            if (!pcbActive(pcb, buffer.refs[r].remotePort) ||
+                    TCP_SEQ_GEQ(pcb->lastack, buffer.refs[r].endSeq)) {
+                buffer.refs[r] = buffer.refs[--buffer.refCount];
+            }
+            else {
+                r++;
+            }
+        }
+        if (!buffer.refCount) {
+            return &buffer;
+        }
+    }
+    return nullptr;
+}
+
+// A shared buffer holding a copy of buf, or nullptr if buf is too large or
+// every buffer is in use.
+static BroadcastBuffer *broadcastCopy(const uint8_t *buf, size_t size) {
+    BroadcastBuffer *shared = nullptr;
+    if (size <= ETHERNET_BROADCAST_SIZE) {
+        shared = broadcastBuffer();
+        if (shared) {
+            memcpy(shared->data, buf, size);
+        }
+    }
+    return shared;
+}
+
+// Bytes a client connection can take right now, within the connection's
+// send buffer limit. Some of the segment queue is kept free, as a long
+// queue of small segments can run it out before the send buffer is full.
+static uint32_t clientRoom(struct tcp_pcb *pcb, EthernetConnection *conn) {
+    if (tcp_sndqueuelen(pcb) >= TCP_SND_QUEUELEN / 2) {
+        return 0;
+    }
+    return conn ? conn->room() : tcp_sndbuf(pcb);
+}
+
+// Queue all of buf on a client connection, from the shared copy if there is
+// one, or none of it. Anything the client has buffered must go out first.
+static bool broadcastTo(struct tcp_pcb *pcb, BroadcastBuffer *shared,
+                        const uint8_t *buf, size_t size) {
+    EthernetConnection *conn = EthernetConnections.find(pcb);
+    if ((conn && !conn->flush()) || clientRoom(pcb, conn) < size) {
+        return false;
+    }
+    bool ok;
+    if (shared && shared->refCount < ETHERNET_SERVER_MAX_CLIENTS) {
+        ok = tcp_write(pcb, shared->data, size, 0) == ERR_OK;
+        if (ok) {
+            shared->refs[shared->refCount].pcb = pcb;
+            shared->refs[shared->refCount].remotePort = pcb->remote_port;
+            shared->refs[shared->refCount].endSeq = pcb->snd_lbb;
+            shared->refCount++;
+        }
+    }
+    else {
+        ok = tcp_write(pcb, buf, size, TCP_WRITE_FLAG_COPY) == ERR_OK;
+    }
+    if (ok) {
+        tcp_output(pcb);
+    }
+    return ok;
+}
+
+EthernetServer::EthernetServer(uint16_t port/* = 80*/)
+    : m_tcpServer(port),
+      m_port(port),
+      m_onConnect(nullptr),
+      m_onData(nullptr),
+      m_onClose(nullptr),
+      m_connections(),
+      m_clientCount(0),
+      m_rxFramesSeen(0),
+      m_lastDispatch(0),
+      m_dispatching(false),
+      m_nextDispatch(nullptr) {}
 
 void EthernetServer::begin() {
+    EthernetLock lock;
     m_tcpServer.Begin();
 }
 
 // EthernetServer gives a client only once, regardless of it it has sent data.
 // Then, the user is responsible for keeping track of connected clients.
 EthernetClient EthernetServer::accept() {
-    return EthernetClient(m_tcpServer.Accept());
+    EthernetLock lock;
+    EthernetConnections.poll();
+    EthernetClient client(m_tcpServer.Accept());
+    // Start the connection's statistics from here.
+    EthernetConnections.find(client.m_tcpClient, true);
+    return client;
 }
 
 // EthernetServer manages the clients. A client is only identified and returned
 // when data has been received from the client and is available for reading.
 EthernetClient EthernetServer::available() {
+    EthernetLock lock;
+    EthernetConnections.poll();
     return EthernetClient(m_tcpServer.Available());
 }
 
@@ -23,9 +148,239 @@ size_t EthernetServer::write(uint8_t c) {
 }
 
 size_t EthernetServer::write(const uint8_t *buf, size_t size) {
-    return m_tcpServer.Send(buf, size);
+    EthernetLock lock;
+    EthernetConnections.poll();
+    BroadcastBuffer *shared = broadcastCopy(buf, size);
+
+    // Clients that cannot take all of the data at once are waited for
+    // below, after every other client has been sent it.
+    struct {
+        struct tcp_pcb *pcb;
+        uint16_t remotePort;
+        size_t sent;
+        uint32_t lastProgress;
+    } waiting[ETHERNET_SERVER_MAX_CLIENTS];
+    uint8_t waitCount = 0;
+    bool clients = false;
+    size_t least = size;
+    for (struct tcp_pcb *pcb = tcp_active_pcbs; pcb; pcb = pcb->next) {
+        if (!serverClient(pcb)) {
+            continue;
+        }
+        clients = true;
+        if (broadcastTo(pcb, shared, buf, size)) {
+            continue;
+        }
+        if (waitCount == ETHERNET_SERVER_MAX_CLIENTS) {
+            least = 0;
+            continue;
+        }
+        waiting[waitCount].pcb = pcb;
+        waiting[waitCount].remotePort = pcb->remote_port;
+        waiting[waitCount].sent = 0;
+        waiting[waitCount].lastProgress = millis();
+        waitCount++;
+    }
+
+    // Send the rest to each waiting client as room is made for it, in
+    // pieces if need be, until it has all gone or the client stops taking
+    // any for ETHERNET_SERVER_WRITE_MS.
+    while (waitCount) {
+        ClearCore::EthernetMgr.Refresh();
+        uint8_t i = 0;
+        while (i < waitCount) {
+            struct tcp_pcb *pcb = waiting[i].pcb;
+            size_t &sent = waiting[i].sent;
+            bool done = !pcbActive(pcb, waiting[i].remotePort);
+            if (!done) {
+                EthernetConnection *conn = EthernetConnections.find(pcb);
+                uint32_t room = conn && !conn->flush() ? 0 :
+                                clientRoom(pcb, conn);
+                uint32_t count = min((uint32_t)(size - sent), room);
+                if (count && tcp_write(pcb, buf + sent, count,
+                                       TCP_WRITE_FLAG_COPY) == ERR_OK) {
+                    tcp_output(pcb);
+                    sent += count;
+                    waiting[i].lastProgress = millis();
+                }
+                done = sent == size || millis() - waiting[i].lastProgress >=
+                                       ETHERNET_SERVER_WRITE_MS;
+            }
+            if (done) {
+                least = min(least, sent);
+                waiting[i] = waiting[--waitCount];
+            }
+            else {
+                i++;
+            }
+        }
+    }
+    return clients ? least : 0;
+}
+
+uint8_t EthernetServer::broadcast(const uint8_t *buf, size_t size,
+                                  EthernetBroadcastResult *results,
+                                  uint8_t maxResults) {
+    EthernetLock lock;
+    EthernetConnections.poll();
+    BroadcastBuffer *shared = broadcastCopy(buf, size);
+
+    uint8_t clients = 0;
+    uint8_t sent = 0;
+    for (struct tcp_pcb *pcb = tcp_active_pcbs; pcb; pcb = pcb->next) {
+        if (!serverClient(pcb)) {
+            continue;
+        }
+        // A client that is still working through earlier data is skipped,
+        // not waited for.
+        bool ok = broadcastTo(pcb, shared, buf, size);
+        if (ok) {
+            sent++;
+        }
+        if (clients < maxResults) {
+            results[clients].ip = Ethernet.convertIp(&pcb->remote_ip);
+            results[clients].port = pcb->remote_port;
+            results[clients].sent = ok;
+        }
+        clients++;
+    }
+    for (; clients < maxResults; clients++) {
+        results[clients].port = 0;
+    }
+    return sent;
+}
+
+// Whether pcb is an open connection to this server.
+bool EthernetServer::serverClient(struct tcp_pcb *pcb) {
+    return pcb->local_port == m_port &&
+           (pcb->state == ESTABLISHED || pcb->state == CLOSE_WAIT);
 }
 
 EthernetServer::operator bool() {
+    EthernetLock lock;
     return m_tcpServer.Ready();
-}
\ No newline at end of file
+}
+EthernetServer::~EthernetServer() {
+    EthernetLock lock;
+    disableDispatch();
+}
+
+void EthernetServer::onConnect(EthernetServerHandler handler) {
+    EthernetLock lock;
+    m_onConnect = handler;
+    updateDispatch();
+}
+
+void EthernetServer::onData(EthernetServerHandler handler) {
+    EthernetLock lock;
+    m_onData = handler;
+    updateDispatch();
+}
+
+void EthernetServer::onClose(EthernetServerHandler handler) {
+    EthernetLock lock;
+    m_onClose = handler;
+    updateDispatch();
+}
+
+void EthernetServer::dispatchAll() {
+    EthernetLock lock;
+    for (EthernetServer *server = m_dispatchList; server;
+            server = server->m_nextDispatch) {
+        server->dispatch();
+    }
+}
+
+// Dispatch while any of the callbacks is set.
+void EthernetServer::updateDispatch() {
+    if (m_onConnect || m_onData || m_onClose) {
+        enableDispatch();
+    }
+    else {
+        disableDispatch();
+    }
+}
+
+void EthernetServer::enableDispatch() {
+    if (m_dispatching) {
+        return;
+    }
+    m_dispatching = true;
+    m_nextDispatch = m_dispatchList;
+    m_dispatchList = this;
+    ethernetRxHookInstall();
+}
+
+void EthernetServer::disableDispatch() {
+    if (!m_dispatching) {
+        return;
+    }
+    for (EthernetServer **link = &m_dispatchList; *link;
+            link = &(*link)->m_nextDispatch) {
+        if (*link == this) {
+            *link = m_nextDispatch;
+            break;
+        }
+    }
+    m_nextDispatch = nullptr;
+    m_dispatching = false;
+}
+
+void EthernetServer::dispatch() {
+    // Nothing can have changed unless a frame arrived, apart from
+    // connections timing out, which the periodic check catches.
+    bool hooked = ethernetRxHookInstall();
+    uint32_t frames = ethernetRxFrames;
+    if (hooked && frames == m_rxFramesSeen &&
+            millis() - m_lastDispatch < ETHERNET_SERVER_POLL_MS) {
+        return;
+    }
+    m_rxFramesSeen = frames;
+    m_lastDispatch = millis();
+
+    while (true) {
+        ClearCore::EthernetTcpClient tcpClient = m_tcpServer.Accept();
+        if (!tcpClient.ConnectionState()) {
+            break;
+        }
+        Connection *conn = nullptr;
+        for (uint8_t i = 0; i < ETHERNET_SERVER_MAX_CLIENTS; i++) {
+            if (!m_connections[i].open) {
+                conn = &m_connections[i];
+                break;
+            }
+        }
+        if (!conn) {
+            tcpClient.Close();
+            continue;
+        }
+        EthernetConnections.find(tcpClient, true);
+        conn->tcpClient = tcpClient;
+        conn->context = nullptr;
+        conn->open = true;
+        m_clientCount++;
+        if (m_onConnect) {
+            EthernetClient client(tcpClient);
+            m_onConnect(client, &conn->context);
+        }
+    }
+
+    for (uint8_t i = 0; i < ETHERNET_SERVER_MAX_CLIENTS; i++) {
+        Connection &conn = m_connections[i];
+        if (!conn.open) {
+            continue;
+        }
+        EthernetClient client(conn.tcpClient);
+        if (m_onData && client.available() > 0) {
+            m_onData(client, &conn.context);
+        }
+        if (!client.connected()) {
+            if (m_onClose) {
+                m_onClose(client, &conn.context);
+            }
+            client.stop();
+            conn.open = false;
+            m_clientCount--;
+        }
+    }
+}
@@ -0,0 +1,58 @@
+#include "EthernetService.h"
+#include "EthernetManager.h"
+
+namespace ClearCore {
+extern EthernetManager &EthernetMgr;
+}
+
+static volatile bool serviceEnabled = false;
+static volatile uint8_t servicePeriod = 1;
+static volatile uint8_t serviceTicks = 0;
+static volatile bool servicePending = false;
+static volatile uint8_t lockDepth = 0;
+
+EthernetLock::EthernetLock() {
+    lockDepth++;
+}
+
+EthernetLock::~EthernetLock() {
+    if (--lockDepth == 0 && servicePending) {
+        // PendSV fired while the stack was in use; run it now.
+        SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+    }
+}
+
+void ethernetServiceEnable(bool enable, uint8_t periodMs) {
+    servicePeriod = max(periodMs, (uint8_t)1);
+    if (enable) {
+        NVIC_SetPriority(PendSV_IRQn, (1 << __NVIC_PRIO_BITS) - 1);
+    }
+    serviceEnabled = enable;
+}
+
+bool ethernetServiceEnabled() {
+    return serviceEnabled;
+}
+
+// Called from the SysTick handler every millisecond.
+extern "C" void ethernetTickHook(void) {
+    if (serviceEnabled && ++serviceTicks >= servicePeriod) {
+        serviceTicks = 0;
+        SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+    }
+}
+
+// Called from the PendSV handler. Returns nonzero if PendSV was for us.
+extern "C" int ethernetServiceHook(void) {
+    if (!serviceEnabled) {
+        return 0;
+    }
+    if (lockDepth) {
+        servicePending = true;
+        return 1;
+    }
+    servicePending = false;
+    EthernetLock lock;
+    ClearCore::EthernetMgr.Refresh();
+    return 1;
+}
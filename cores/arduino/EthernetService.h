@@ -0,0 +1,29 @@
+/*
+ * Servicing of the network stack from the PendSV interrupt.
+ *
+ * When enabled with Ethernet.setInterruptService(), the SysTick handler
+ * pends PendSV every few milliseconds and the PendSV handler, at the lowest
+ * interrupt priority, runs EthernetMgr.Refresh() to process received frames
+ * and lwIP's timers. lwIP is not reentrant, so every wrapper function that
+ * uses the stack holds an EthernetLock; if PendSV fires while a lock is
+ * held, servicing is put off until the last lock is released.
+ *
+ * This header is internal to the Ethernet implementation.
+ */
+
+#ifndef ethernet_service_h_
+#define ethernet_service_h_
+
+#include <Arduino.h>
+
+class EthernetLock {
+public:
+    EthernetLock();
+    ~EthernetLock();
+};
+
+// Turn interrupt servicing on (every periodMs) or off.
+void ethernetServiceEnable(bool enable, uint8_t periodMs);
+bool ethernetServiceEnabled();
+
+#endif
@@ -0,0 +1,298 @@
+#include "EthernetSetpoint.h"
+#include "EthernetService.h"
+
+// Ticks are shortened or lengthened by this fraction of a tick to follow
+// the host's clock.
+#define SETPOINT_SLEW 256
+
+static uint32_t get32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+size_t EthernetSetpointStats::printTo(Print &p) const {
+    size_t n = 0;
+    n += p.print(playing ? "playing" : "idle");
+    n += p.print(", level ");
+    n += p.print(level);
+    n += p.print(", jitter ");
+    n += p.print(jitterUs);
+    n += p.print(" us, received ");
+    n += p.print(received);
+    n += p.print(", played ");
+    n += p.print(played);
+    n += p.print(", missed ");
+    n += p.print(missed);
+    n += p.print(" (late ");
+    n += p.print(late);
+    n += p.print(", lost ");
+    n += p.print(lost);
+    n += p.print("), underruns ");
+    n += p.print(underruns);
+    n += p.print(", timeouts ");
+    n += p.print(timeouts);
+    n += p.print(", dropped ");
+    n += p.print(early);
+    n += p.print(" early, ");
+    n += p.print(duplicates);
+    n += p.print(" duplicate, ");
+    n += p.print(invalid);
+    n += p.print(" invalid");
+    return n;
+}
+
+EthernetSetpointStream::EthernetSetpointStream()
+    : m_udp(),
+      m_open(false),
+      m_axes(),
+      m_axisCount(0),
+      m_tickUs(ETHERNET_SETPOINT_TICK_US),
+      m_depth(ETHERNET_SETPOINT_DEPTH),
+      m_underrunAction(SetpointHold),
+      m_state(Idle),
+      m_slots(),
+      m_nextSeq(0),
+      m_highestSeq(0),
+      m_nextTickUs(0),
+      m_levelAverage(0),
+      m_underrun(false),
+      m_missedInRow(0),
+      m_pending(false),
+      m_lastArrivalSeq(0),
+      m_lastArrivalUs(0),
+      m_jitter16(0),
+      m_stats() {}
+
+bool EthernetSetpointStream::attach(uint8_t axis,
+                                    ClearCore::MotorDriver &motor,
+                                    EthernetSetpointMode mode) {
+    if (axis >= ETHERNET_SETPOINT_AXES) {
+        return false;
+    }
+    m_axes[axis].motor = &motor;
+    m_axes[axis].mode = mode;
+    m_axes[axis].pending = false;
+    m_axes[axis].following = false;
+    if (axis >= m_axisCount) {
+        m_axisCount = axis + 1;
+    }
+    return true;
+}
+
+bool EthernetSetpointStream::begin(uint16_t port, uint32_t tickUs,
+                                   uint8_t depth) {
+    m_tickUs = tickUs;
+    m_depth = constrain(depth, 1, ETHERNET_SETPOINT_BUFFER - 1);
+    m_open = m_udp.begin(port);
+    return m_open;
+}
+
+void EthernetSetpointStream::end() {
+    EthernetLock lock;
+    stop();
+    m_udp.stop();
+    m_open = false;
+}
+
+EthernetSetpointStats EthernetSetpointStream::stats() {
+    EthernetLock lock;
+    EthernetSetpointStats stats = m_stats;
+    stats.playing = m_state != Idle;
+    stats.lost = m_stats.missed > m_stats.late ?
+                 m_stats.missed - m_stats.late : 0;
+    stats.level = 0;
+    if (m_state != Idle && (int32_t)(m_highestSeq - m_nextSeq) >= 0) {
+        stats.level = m_highestSeq - m_nextSeq + 1;
+    }
+    stats.jitterUs = m_jitter16 >> 4;
+    return stats;
+}
+
+void EthernetSetpointStream::resetStats() {
+    EthernetLock lock;
+    m_stats = EthernetSetpointStats();
+}
+
+void EthernetSetpointStream::service() {
+    EthernetLock lock;
+    if (!m_open) {
+        return;
+    }
+    receive();
+    // Catch up on every tick that has come due, so a slow pass through
+    // loop() does not shift the ticks after it. Only the last setpoint
+    // reaches the motors.
+    uint32_t now = micros();
+    while (m_state != Idle && (int32_t)(now - m_nextTickUs) >= 0) {
+        m_state = Playing;
+        tick();
+    }
+    if (m_pending) {
+        apply();
+    }
+}
+
+void EthernetSetpointStream::receive() {
+    const uint8_t *data;
+    int length;
+    while ((length = m_udp.receive(&data)) > 0) {
+        if (length != 4 + 4 * m_axisCount) {
+            m_stats.invalid++;
+            continue;
+        }
+        uint32_t arrived = m_udp.packetTimestamp();
+        uint32_t seq = get32(data);
+        m_stats.received++;
+        if (m_state == Idle) {
+            start(seq, arrived);
+        }
+
+        // Jitter: how much the spacing of arrivals differs from the
+        // spacing of the ticks they belong to.
+        int32_t ticks = seq - m_lastArrivalSeq;
+        if (ticks > 0) {
+            int32_t d = (int32_t)(arrived - m_lastArrivalUs) -
+                        ticks * (int32_t)m_tickUs;
+            m_jitter16 += (d < 0 ? -d : d) - ((m_jitter16 + 8) >> 4);
+            m_lastArrivalSeq = seq;
+            m_lastArrivalUs = arrived;
+        }
+
+        int32_t ahead = seq - m_nextSeq;
+        if (ahead < 0) {
+            m_stats.late++;
+            continue;
+        }
+        if (ahead >= ETHERNET_SETPOINT_BUFFER) {
+            m_stats.early++;
+            continue;
+        }
+        Slot &slot = m_slots[seq % ETHERNET_SETPOINT_BUFFER];
+        if (slot.valid && slot.seq == seq) {
+            m_stats.duplicates++;
+            continue;
+        }
+        slot.seq = seq;
+        for (uint8_t i = 0; i < m_axisCount; i++) {
+            slot.values[i] = get32(data + 4 + 4 * i);
+        }
+        slot.valid = true;
+        if ((int32_t)(seq - m_highestSeq) > 0) {
+            m_highestSeq = seq;
+        }
+    }
+}
+
+// Begin a stream with the setpoint seq, which arrived at micros() arrived.
+void EthernetSetpointStream::start(uint32_t seq, uint32_t arrived) {
+    m_state = Buffering;
+    m_nextSeq = seq;
+    m_highestSeq = seq;
+    m_nextTickUs = arrived + m_depth * m_tickUs;
+    m_levelAverage = m_depth * 16;
+    m_underrun = false;
+    m_missedInRow = 0;
+    m_lastArrivalSeq = seq;
+    m_lastArrivalUs = arrived;
+}
+
+void EthernetSetpointStream::tick() {
+    uint16_t level = 0;
+    if ((int32_t)(m_highestSeq - m_nextSeq) >= 0) {
+        level = m_highestSeq - m_nextSeq + 1;
+    }
+
+    Slot &slot = m_slots[m_nextSeq % ETHERNET_SETPOINT_BUFFER];
+    if (slot.valid && slot.seq == m_nextSeq) {
+        slot.valid = false;
+        for (uint8_t i = 0; i < m_axisCount; i++) {
+            Axis &axis = m_axes[i];
+            if (axis.motor &&
+                    (slot.values[i] != axis.value || !axis.following)) {
+                axis.value = slot.values[i];
+                axis.pending = true;
+                m_pending = true;
+            }
+        }
+        m_stats.played++;
+        m_underrun = false;
+        m_missedInRow = 0;
+    }
+    else {
+        m_stats.missed++;
+        if (!m_underrun) {
+            m_underrun = true;
+            m_stats.underruns++;
+            if (m_underrunAction == SetpointDecelerate) {
+                stopMotors();
+            }
+        }
+        if (++m_missedInRow >= ETHERNET_SETPOINT_TIMEOUT_TICKS) {
+            // The stream has ended; the ticks after its end were not
+            // missed. If resetStats() ran since they began, only those
+            // since the reset were counted, and not the underrun.
+            m_stats.missed -= min(m_stats.missed, (uint32_t)m_missedInRow);
+            if (m_stats.underruns) {
+                m_stats.underruns--;
+            }
+            m_stats.timeouts++;
+            stop();
+            return;
+        }
+    }
+    m_nextSeq++;
+
+    // Follow the host's clock: if setpoints pile up, it is running faster
+    // than the ticks, and if they run short, slower. Small differences are
+    // left alone so jitter does not move the ticks about.
+    m_levelAverage += level - (m_levelAverage >> 4);
+    uint32_t period = m_tickUs;
+    if (m_levelAverage > (m_depth + 1) * 16) {
+        period -= m_tickUs / SETPOINT_SLEW;
+    }
+    else if (m_levelAverage + 8 < m_depth * 16) {
+        period += m_tickUs / SETPOINT_SLEW;
+    }
+    m_nextTickUs += period;
+}
+
+void EthernetSetpointStream::apply() {
+    m_pending = false;
+    for (uint8_t i = 0; i < m_axisCount; i++) {
+        Axis &axis = m_axes[i];
+        if (!axis.pending) {
+            continue;
+        }
+        axis.pending = false;
+        axis.following = true;
+        if (axis.mode == SetpointVelocity) {
+            axis.motor->MoveVelocity(axis.value);
+        }
+        else {
+            axis.motor->Move(axis.value,
+                             ClearCore::MotorDriver::MOVE_TARGET_ABSOLUTE);
+        }
+    }
+}
+
+// Decelerate the motors that are following setpoints to a stop. The next
+// setpoint played out starts them again.
+void EthernetSetpointStream::stopMotors() {
+    m_pending = false;
+    for (uint8_t i = 0; i < m_axisCount; i++) {
+        Axis &axis = m_axes[i];
+        if (axis.motor && axis.following) {
+            axis.motor->MoveStopDecel();
+        }
+        axis.pending = false;
+        axis.following = false;
+    }
+}
+
+// End the stream; the next setpoint received starts a new one.
+void EthernetSetpointStream::stop() {
+    stopMotors();
+    m_state = Idle;
+    for (uint16_t i = 0; i < ETHERNET_SETPOINT_BUFFER; i++) {
+        m_slots[i].valid = false;
+    }
+}
@@ -0,0 +1,199 @@
+/*
+ * Setpoint streaming over UDP, for motion generated on a host.
+ *
+ * The host sends one datagram per tick: a 32-bit sequence number followed
+ * by a 32-bit setpoint for each attached axis, in axis order, all
+ * little-endian. Velocity setpoints are in steps per second and are passed
+ * to MoveVelocity(); position setpoints are absolute, in steps, and are
+ * passed to Move().
+ *
+ * Datagrams go into a jitter buffer, a slot per sequence number, and are
+ * played out at a fixed tick: the first setpoint of a stream is played out
+ * a set number of ticks (the depth) after it arrives, and each following
+ * one a tick after the one before. Variation in network delay of less than
+ * the depth therefore does not reach the motors. Datagrams that arrive
+ * after their tick are counted as late and dropped, and ones that arrive
+ * out of order are put in their place. The playout clock follows the
+ * host's: if the buffer stays fuller or emptier than the depth, ticks are
+ * made slightly shorter or longer.
+ *
+ * A tick whose setpoint has not arrived is an underrun: the motors either
+ * hold the last setpoint or decelerate to a stop, as set with
+ * setUnderrun(), until setpoints arrive again. After
+ * ETHERNET_SETPOINT_TIMEOUT_TICKS ticks without a setpoint the stream is
+ * considered over, the motors decelerate to a stop, and the next datagram
+ * starts a new stream.
+ *
+ * service() plays out every tick that has come due, so call it from loop()
+ * at least once a tick. Enable Ethernet.setInterruptService() so datagrams
+ * are received, and their arrival times recorded, however long loop()
+ * takes.
+ */
+
+#ifndef ETHERNET_SETPOINT_H_
+#define ETHERNET_SETPOINT_H_
+
+#include <Arduino.h>
+#include <Ethernet.h>
+#include "Connector.h"
+#include "MotorDriver.h"
+
+// Number of axes a stream can drive.
+#define ETHERNET_SETPOINT_AXES 4
+
+// Default playout tick, in us.
+#ifndef ETHERNET_SETPOINT_TICK_US
+#define ETHERNET_SETPOINT_TICK_US 2000
+#endif
+
+// Default jitter buffer depth, in ticks.
+#ifndef ETHERNET_SETPOINT_DEPTH
+#define ETHERNET_SETPOINT_DEPTH 4
+#endif
+
+// Number of slots in the jitter buffer; how far ahead of playout a
+// setpoint may arrive. A power of 2.
+#ifndef ETHERNET_SETPOINT_BUFFER
+#define ETHERNET_SETPOINT_BUFFER 32
+#endif
+
+// Ticks in a row without a setpoint that end a stream.
+#ifndef ETHERNET_SETPOINT_TIMEOUT_TICKS
+#define ETHERNET_SETPOINT_TIMEOUT_TICKS 100
+#endif
+
+enum EthernetSetpointMode {
+    SetpointVelocity,
+    SetpointPosition
+};
+
+// What the motors do while no setpoint is available.
+enum EthernetSetpointUnderrun {
+    // Keep moving at the last velocity, or towards the last position.
+    SetpointHold,
+    // Stop, at the motors' deceleration limits.
+    SetpointDecelerate
+};
+
+// Stream statistics, from EthernetSetpointStream::stats(). Printing it
+// gives a readable summary.
+class EthernetSetpointStats : public Printable {
+public:
+    // Whether setpoints are being played out.
+    bool playing;
+    // Datagrams received, and ticks played out with their setpoint.
+    uint32_t received;
+    uint32_t played;
+    // Ticks played out without their setpoint; of those, the setpoints
+    // that arrived afterwards, and the ones that never did.
+    uint32_t missed;
+    uint32_t late;
+    uint32_t lost;
+    // Times playout ran out of setpoints, and streams that timed out.
+    uint32_t underruns;
+    uint32_t timeouts;
+    // Datagrams dropped for arriving too far ahead of playout, for
+    // repeating a sequence number, or for having the wrong length.
+    uint32_t early;
+    uint32_t duplicates;
+    uint32_t invalid;
+    // Setpoints waiting to be played out.
+    uint16_t level;
+    // Variation in arrival time against the ticks, smoothed as in RTP
+    // (RFC 3550), in us.
+    uint32_t jitterUs;
+
+    virtual size_t printTo(Print &p) const;
+};
+
+class EthernetSetpointStream {
+public:
+    EthernetSetpointStream();
+
+    // Play out the setpoints for axis (0 to ETHERNET_SETPOINT_AXES - 1; the
+    // position of its value in each datagram) on motor. Call before
+    // begin(). Returns false if axis is out of range.
+    bool attach(uint8_t axis, ClearCore::MotorDriver &motor,
+                EthernetSetpointMode mode);
+    // Start listening on port, playing out a setpoint every tickUs, depth
+    // ticks (1 to ETHERNET_SETPOINT_BUFFER - 1) behind the stream. Returns
+    // false if the socket could not be opened.
+    bool begin(uint16_t port, uint32_t tickUs = ETHERNET_SETPOINT_TICK_US,
+               uint8_t depth = ETHERNET_SETPOINT_DEPTH);
+    // Stop the motors and close the socket.
+    void end();
+    void setUnderrun(EthernetSetpointUnderrun action) {
+        m_underrunAction = action;
+    }
+
+    // Receive setpoints and play out the ticks that have come due.
+    void service();
+
+    bool playing() {
+        return m_state != Idle;
+    }
+    EthernetSetpointStats stats();
+    void resetStats();
+
+private:
+    enum State {
+        Idle,
+        // Waiting for the first setpoint's tick.
+        Buffering,
+        Playing
+    };
+
+    struct Axis {
+        ClearCore::MotorDriver *motor;
+        EthernetSetpointMode mode;
+        int32_t value;
+        // value has not been passed to the motor yet.
+        bool pending;
+        // The motor is following value (rather than stopped by an
+        // underrun or the end of a stream).
+        bool following;
+    };
+
+    struct Slot {
+        uint32_t seq;
+        int32_t values[ETHERNET_SETPOINT_AXES];
+        bool valid;
+    };
+
+    void receive();
+    void start(uint32_t seq, uint32_t arrived);
+    void tick();
+    void apply();
+    void stopMotors();
+    void stop();
+
+    EthernetUDP m_udp;
+    bool m_open;
+    Axis m_axes[ETHERNET_SETPOINT_AXES];
+    uint8_t m_axisCount;
+    uint32_t m_tickUs;
+    uint8_t m_depth;
+    EthernetSetpointUnderrun m_underrunAction;
+
+    State m_state;
+    Slot m_slots[ETHERNET_SETPOINT_BUFFER];
+    // Sequence number of the next tick, and the highest received.
+    uint32_t m_nextSeq;
+    uint32_t m_highestSeq;
+    uint32_t m_nextTickUs;
+    // Average buffer level over recent ticks, in 1/16ths.
+    uint16_t m_levelAverage;
+    bool m_underrun;
+    uint16_t m_missedInRow;
+    // Some axis has a setpoint pending.
+    bool m_pending;
+
+    // For the jitter estimate: the last in-order arrival.
+    uint32_t m_lastArrivalSeq;
+    uint32_t m_lastArrivalUs;
+    uint32_t m_jitter16;
+
+    EthernetSetpointStats m_stats;
+};
+
+#endif // ETHERNET_SETPOINT_H_
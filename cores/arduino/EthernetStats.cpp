@@ -0,0 +1,99 @@
+#include <Ethernet.h>
+
+static size_t writeLittleEndian(Print &p, uint32_t value, uint8_t size) {
+    uint8_t bytes[4];
+    for (uint8_t i = 0; i < size; i++) {
+        bytes[i] = value >> (8 * i);
+    }
+    return p.write(bytes, size);
+}
+
+static const char *const poolNames[EthernetStats::PoolCount] = {
+    "heap", "pbuf pool", "pbuf", "udp pcb", "tcp pcb", "tcp listen",
+    "tcp seg"
+};
+
+size_t EthernetStats::printTo(Print &p) const {
+    size_t n = 0;
+    for (uint8_t i = 0; i < PoolCount; i++) {
+        n += p.print(poolNames[i]);
+        n += p.print(": used ");
+        n += p.print(pools[i].used);
+        n += p.print('/');
+        n += p.print(pools[i].size);
+        n += p.print(", max ");
+        n += p.print(pools[i].max);
+        n += p.print(", errors ");
+        n += p.println(pools[i].errors);
+    }
+    n += p.print("frames: rx ");
+    n += p.print(framesReceived);
+    n += p.print(", tx ");
+    n += p.print(framesSent);
+    n += p.print(", dropped ");
+    n += p.println(framesDropped);
+    n += p.print("tcp: rx ");
+    n += p.print(tcpSegmentsReceived);
+    n += p.print(", tx ");
+    n += p.print(tcpSegmentsSent);
+    n += p.print(", dropped ");
+    n += p.println(tcpDropped);
+    n += p.print("udp: rx ");
+    n += p.print(udpReceived);
+    n += p.print(", tx ");
+    n += p.print(udpSent);
+    n += p.print(", dropped ");
+    n += p.println(udpDropped);
+    return n;
+}
+
+size_t EthernetStats::writeBinary(Print &p) const {
+    size_t n = p.write('S');
+    for (uint8_t i = 0; i < PoolCount; i++) {
+        n += writeLittleEndian(p, pools[i].used, 2);
+        n += writeLittleEndian(p, pools[i].max, 2);
+        n += writeLittleEndian(p, pools[i].size, 2);
+        n += writeLittleEndian(p, pools[i].errors, 2);
+    }
+    n += writeLittleEndian(p, framesReceived, 4);
+    n += writeLittleEndian(p, framesSent, 4);
+    n += writeLittleEndian(p, framesDropped, 4);
+    n += writeLittleEndian(p, tcpSegmentsReceived, 4);
+    n += writeLittleEndian(p, tcpSegmentsSent, 4);
+    n += writeLittleEndian(p, tcpDropped, 4);
+    n += writeLittleEndian(p, udpReceived, 4);
+    n += writeLittleEndian(p, udpSent, 4);
+    n += writeLittleEndian(p, udpDropped, 4);
+    return n;
+}
+
+size_t EthernetClientStats::printTo(Print &p) const {
+    size_t n = 0;
+    n += p.print("rx ");
+    n += p.print(rxBytes);
+    n += p.print(" B, tx ");
+    n += p.print(txBytes);
+    n += p.print(" B (+");
+    n += p.print(txQueued);
+    n += p.print(" queued), retransmits ");
+    n += p.print(retransmits);
+    n += p.print(", rtt ");
+    n += p.print(rttMs);
+    n += p.print(" ms, rto ");
+    n += p.print(rtoMs);
+    n += p.print(" ms, window ");
+    n += p.println(sendWindow);
+    return n;
+}
+
+size_t EthernetClientStats::writeBinary(Print &p) const {
+    size_t n = p.write('C');
+    n += writeLittleEndian(p, rxBytes, 4);
+    n += writeLittleEndian(p, txBytes, 4);
+    n += writeLittleEndian(p, txQueued, 4);
+    n += writeLittleEndian(p, retransmits, 4);
+    n += writeLittleEndian(p, rttMs, 2);
+    n += writeLittleEndian(p, rtoMs, 2);
+    n += writeLittleEndian(p, sendWindow, 2);
+    return n;
+}
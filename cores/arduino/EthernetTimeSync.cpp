@@ -0,0 +1,338 @@
+#include "EthernetTimeSync.h"
+#include "EthernetService.h"
+
+#define NTP_PACKET_SIZE 48
+#define NTP_MODE_CLIENT 3
+#define NTP_MODE_SERVER 4
+// Leap indicator value meaning the server's clock is not synchronized.
+#define NTP_LI_ALARM 3
+// Stratum served while not synchronized to another server.
+#define NTP_STRATUM_LOCAL 10
+
+// Gains of the clock loop, in percent. See extras/host/time_sync_sim.cpp
+// in the Ethernet library for trying others.
+#ifndef TIME_KP_PERCENT
+#define TIME_KP_PERCENT 50
+#endif
+#ifndef TIME_KI_PERCENT
+#define TIME_KI_PERCENT 5
+#endif
+
+// Times are sent as NTP timestamps: 32-bit seconds and 32-bit fraction.
+static void putTimestamp(uint8_t *p, uint64_t us) {
+    uint32_t seconds = us / 1000000;
+    uint32_t fraction = ((us % 1000000) << 32) / 1000000;
+    for (uint8_t i = 0; i < 4; i++) {
+        p[i] = seconds >> (24 - i * 8);
+        p[4 + i] = fraction >> (24 - i * 8);
+    }
+}
+
+static uint64_t getTimestamp(const uint8_t *p) {
+    uint32_t seconds = 0;
+    uint32_t fraction = 0;
+    for (uint8_t i = 0; i < 4; i++) {
+        seconds = seconds << 8 | p[i];
+        fraction = fraction << 8 | p[4 + i];
+    }
+    return seconds * 1000000ULL +
+           (((uint64_t)fraction * 1000000 + 0x80000000UL) >> 32);
+}
+
+static int32_t clamp(int64_t value, int32_t limit) {
+    return value > limit ? limit : value < -limit ? -limit : value;
+}
+
+size_t EthernetTimeStats::printTo(Print &p) const {
+    size_t n = 0;
+    n += p.print(synced ? "synced" : "not synced");
+    n += p.print(", offset ");
+    n += p.print(offsetUs);
+    n += p.print(" us, delay ");
+    n += p.print(delayUs);
+    n += p.print(" us, jitter ");
+    n += p.print(jitterUs);
+    n += p.print(" us, drift ");
+    n += p.print(driftPpb);
+    n += p.print(" ppb, samples ");
+    n += p.print(samples);
+    n += p.print(" (lost ");
+    n += p.print(lost);
+    n += p.print("), steps ");
+    n += p.print(steps);
+    n += p.print(", served ");
+    n += p.print(served);
+    return n;
+}
+
+EthernetTimeSync::EthernetTimeSync()
+    : m_udp(),
+      m_open(false),
+      m_serverIp(),
+      m_serverPort(123),
+      m_pollMs(ETHERNET_TIME_POLL_MS),
+      m_polling(false),
+      m_lastPoll(0),
+      m_waiting(false),
+      m_origin(),
+      m_requestLocal(0),
+      m_localLast(0),
+      m_localHigh(0),
+      m_base(0),
+      m_localBase(0),
+      m_slewEnd(0),
+      m_ratePpb(0),
+      m_driftPpb(0),
+      m_synced(false),
+      m_samples(),
+      m_sampleNext(0),
+      m_lastUsed(0),
+      m_lastError(0),
+      m_syncedAt(0),
+      m_serverStratum(0),
+      m_stats() {}
+
+bool EthernetTimeSync::begin(uint16_t port) {
+    m_open = m_udp.begin(port);
+    return m_open;
+}
+
+void EthernetTimeSync::sync(IPAddress ip, uint16_t port, uint32_t pollMs) {
+    m_serverIp = ip;
+    m_serverPort = port;
+    m_pollMs = pollMs;
+    m_polling = true;
+    m_waiting = false;
+    m_lastPoll = millis() - pollMs;
+}
+
+void EthernetTimeSync::end() {
+    m_udp.stop();
+    m_open = false;
+    m_polling = false;
+}
+
+uint64_t EthernetTimeSync::localMicros() {
+    uint32_t now = micros();
+    if (now < m_localLast) {
+        m_localHigh++;
+    }
+    m_localLast = now;
+    return (uint64_t)m_localHigh << 32 | now;
+}
+
+// Extend a recent micros() value to 64 bits.
+uint64_t EthernetTimeSync::localMicros(uint32_t stamp) {
+    uint64_t now = localMicros();
+    return now - (uint32_t)(m_localLast - stamp);
+}
+
+uint64_t EthernetTimeSync::clock(uint64_t local) {
+    int64_t elapsed = (int64_t)(local - m_localBase);
+    int64_t slewed = (int64_t)(m_slewEnd - m_localBase);
+    if (elapsed <= slewed) {
+        return m_base + elapsed + elapsed * m_ratePpb / 1000000000LL;
+    }
+    return m_base + elapsed + slewed * m_ratePpb / 1000000000LL +
+           (elapsed - slewed) * m_driftPpb / 1000000000LL;
+}
+
+// Restart the clock's segments at local, without changing its time.
+void EthernetTimeSync::rebase(uint64_t local) {
+    m_base = clock(local);
+    if ((int64_t)(m_slewEnd - local) < 0) {
+        m_slewEnd = local;
+        m_ratePpb = m_driftPpb;
+    }
+    m_localBase = local;
+}
+
+uint64_t EthernetTimeSync::syncedMicros64() {
+    EthernetLock lock;
+    return clock(localMicros());
+}
+
+EthernetTimeStats EthernetTimeSync::stats() {
+    EthernetTimeStats stats = m_stats;
+    stats.synced = m_synced;
+    stats.driftPpb = m_driftPpb;
+    return stats;
+}
+
+void EthernetTimeSync::service() {
+    EthernetLock lock;
+    if (!m_open) {
+        return;
+    }
+    uint64_t now = localMicros();
+    if (now - m_localBase >= 0x80000000UL) {
+        // Move the base up now and then, so the rate correction does not
+        // have to be worked out over an ever longer time.
+        rebase(now);
+    }
+
+    while (m_udp.parsePacket() >= NTP_PACKET_SIZE) {
+        uint8_t packet[NTP_PACKET_SIZE];
+        m_udp.read(packet, NTP_PACKET_SIZE);
+        uint64_t received = localMicros(m_udp.packetTimestamp());
+        switch (packet[0] & 0x07) {
+            case NTP_MODE_CLIENT:
+                answer(packet, received);
+                break;
+            case NTP_MODE_SERVER:
+                response(packet, received);
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (!m_polling) {
+        return;
+    }
+    if (m_waiting && millis() - m_lastPoll >= ETHERNET_TIME_TIMEOUT_MS) {
+        m_waiting = false;
+        m_stats.lost++;
+    }
+    // Poll faster until the filter has filled up.
+    uint32_t interval = m_stats.samples < ETHERNET_TIME_FILTER ?
+                        m_pollMs / 4 : m_pollMs;
+    if (!m_waiting && millis() - m_lastPoll >= interval) {
+        request();
+    }
+}
+
+void EthernetTimeSync::request() {
+    uint8_t packet[NTP_PACKET_SIZE] = {};
+    // Version 4, client.
+    packet[0] = 4 << 3 | NTP_MODE_CLIENT;
+    m_lastPoll = millis();
+    // The transmit timestamp is the local time; the server only echoes it.
+    m_requestLocal = localMicros();
+    putTimestamp(packet + 40, m_requestLocal);
+    memcpy(m_origin, packet + 40, sizeof(m_origin));
+    m_waiting = m_udp.sendTo(m_serverIp, m_serverPort, packet,
+                             NTP_PACKET_SIZE);
+}
+
+void EthernetTimeSync::answer(const uint8_t *packet, uint64_t received) {
+    uint8_t reply[NTP_PACKET_SIZE] = {};
+    // Same version as the request, server.
+    reply[0] = (packet[0] & 0x38) | NTP_MODE_SERVER;
+    if (m_synced && m_serverStratum) {
+        reply[1] = min(m_serverStratum + 1, 15);
+        for (uint8_t i = 0; i < 4; i++) {
+            reply[12 + i] = m_serverIp[i];
+        }
+    }
+    else {
+        reply[1] = NTP_STRATUM_LOCAL;
+        memcpy(reply + 12, "LOCL", 4);
+    }
+    reply[2] = packet[2];
+    // Precision: 2^-20 s, about a microsecond.
+    reply[3] = (uint8_t)-20;
+    putTimestamp(reply + 16, clock(m_localBase));
+    memcpy(reply + 24, packet + 40, 8);
+    putTimestamp(reply + 32, clock(received));
+    putTimestamp(reply + 40, clock(localMicros()));
+    if (m_udp.sendTo(m_udp.remoteIP(), m_udp.remotePort(), reply,
+                     NTP_PACKET_SIZE)) {
+        m_stats.served++;
+    }
+}
+
+void EthernetTimeSync::response(const uint8_t *packet, uint64_t received) {
+    // Only take the answer to the request outstanding, from a server that
+    // is synchronized itself.
+    if (!m_waiting || memcmp(packet + 24, m_origin, sizeof(m_origin)) ||
+            packet[0] >> 6 == NTP_LI_ALARM || !packet[1] || packet[1] > 15) {
+        return;
+    }
+    m_waiting = false;
+    m_serverStratum = packet[1];
+
+    uint64_t t1 = m_requestLocal;
+    uint64_t t2 = getTimestamp(packet + 32);
+    uint64_t t3 = getTimestamp(packet + 40);
+    uint64_t t4 = received;
+    int64_t roundTrip = (int64_t)(t4 - t1) - (int64_t)(t3 - t2);
+
+    Sample &sample = m_samples[m_sampleNext];
+    m_sampleNext = (m_sampleNext + 1) % ETHERNET_TIME_FILTER;
+    sample.local = t4;
+    // Assume the two directions took equally long.
+    sample.offset = ((int64_t)(t2 - t1) + (int64_t)(t3 - t4)) / 2;
+    sample.delay = roundTrip < 0 ? 0 : roundTrip;
+    sample.valid = true;
+    m_stats.samples++;
+    update(sample);
+}
+
+void EthernetTimeSync::update(Sample &sample) {
+    // Use the exchange with the shortest round trip, unless it has been
+    // used already.
+    Sample *best = &sample;
+    for (uint8_t i = 0; i < ETHERNET_TIME_FILTER; i++) {
+        if (m_samples[i].valid && m_samples[i].delay < best->delay) {
+            best = &m_samples[i];
+        }
+    }
+    if (m_synced && best->local <= m_lastUsed) {
+        return;
+    }
+
+    // How far the clock is from the server's. The exchange may be several
+    // polls old, and the clock has been corrected since, so the server's
+    // time is carried forward to now at the drift learned so far and
+    // compared with the clock as it is now.
+    uint64_t now = localMicros();
+    int64_t age = (int64_t)(now - best->local);
+    int64_t error = (int64_t)(best->local + best->offset + age +
+                              age * m_driftPpb / 1000000000LL - clock(now));
+    m_stats.offsetUs = clamp(error, INT32_MAX);
+    m_stats.delayUs = best->delay;
+
+    if (!m_synced || error > ETHERNET_TIME_STEP_US ||
+            error < -ETHERNET_TIME_STEP_US) {
+        rebase(now);
+        m_base += error;
+        if (m_synced) {
+            m_stats.steps++;
+        }
+        else {
+            m_syncedAt = best->local;
+        }
+        m_synced = true;
+        m_lastUsed = best->local;
+        m_lastError = 0;
+        return;
+    }
+
+    m_stats.jitterUs = (m_stats.jitterUs * 7 +
+                        (uint32_t)llabs(error - m_lastError)) / 8;
+    m_lastError = error;
+
+    // The error over the time since the last correction is the rate the
+    // clock is still off by, which the integral term learns. The
+    // proportional term works off part of the error over the next poll
+    // interval. The integral gain is small, so one badly delayed exchange
+    // moves the drift little, but that would take minutes to learn a
+    // crystal tens of ppm off. So until then the error is spread over all
+    // the time since synchronizing instead (at least a poll interval),
+    // which averages the rate over every exchange so far.
+    int64_t interval = best->local - m_lastUsed;
+    m_lastUsed = best->local;
+    rebase(now);
+    if (interval > 0) {
+        int64_t span = min((int64_t)(best->local - m_syncedAt),
+                           interval * 100 / TIME_KI_PERCENT);
+        span = max(span, (int64_t)m_pollMs * 1000);
+        m_driftPpb = clamp(m_driftPpb + error * 1000000000LL / span,
+                           ETHERNET_TIME_MAX_RATE_PPB);
+    }
+    int64_t slew = m_pollMs * 1000LL;
+    m_ratePpb = clamp(m_driftPpb + error * 1000000000LL / slew *
+                      TIME_KP_PERCENT / 100, ETHERNET_TIME_MAX_RATE_PPB);
+    m_slewEnd = now + slew;
+}
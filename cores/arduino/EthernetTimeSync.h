@@ -0,0 +1,178 @@
+/*
+ * Network time synchronization (SNTP, RFC 4330) over EthernetUDP.
+ *
+ * Every EthernetTimeSync answers SNTP requests with its own clock, so one
+ * controller in a cell can be the time server for the others. A client,
+ * started with sync(), polls a server (another ClearCore, or any NTP
+ * server) and disciplines its clock to the server's: syncedMicros() is
+ * micros() corrected for both the offset and the drift between the two
+ * crystals. Small offsets are corrected by adjusting the clock's rate, so
+ * it never jumps, and only offsets above ETHERNET_TIME_STEP_US (e.g. when
+ * first synchronizing) step it.
+ *
+ * Requests and responses are timestamped with EthernetUDP's receive
+ * timestamps, taken as each datagram is handed to the socket, and just
+ * before each is sent. Enable Ethernet.setInterruptService() on every
+ * controller for the best accuracy; otherwise the time a datagram waits
+ * for loop() to service the network stack adds to the jitter.
+ *
+ * Of the last ETHERNET_TIME_FILTER exchanges, the one with the shortest
+ * round trip is used, as in NTP's clock filter, since its timestamps were
+ * least delayed by queueing. Its offset drives a proportional-integral
+ * loop: the integral term tracks the drift, and the proportional term
+ * slews the clock by part of the offset over the next poll interval.
+ *
+ * In simulation (extras/host/time_sync_sim.cpp in the Ethernet library),
+ * a client whose crystal is 47 ppm off the server's, polling every second
+ * over a link that loses 10% of datagrams, stays within a few microseconds
+ * of the server when the link is idle. With 20 us of mean queueing delay
+ * each way it stays within about 35 us (3.4 us RMS) after the first
+ * minute.
+ */
+
+#ifndef ETHERNET_TIME_SYNC_H_
+#define ETHERNET_TIME_SYNC_H_
+
+#include <Arduino.h>
+#include <Ethernet.h>
+
+// Default time between requests to the server, in ms.
+#ifndef ETHERNET_TIME_POLL_MS
+#define ETHERNET_TIME_POLL_MS 1000
+#endif
+
+// How long to wait for a response, in ms. A request not answered in time
+// is counted as lost.
+#ifndef ETHERNET_TIME_TIMEOUT_MS
+#define ETHERNET_TIME_TIMEOUT_MS 500
+#endif
+
+// Number of recent exchanges the shortest round trip is picked from.
+#ifndef ETHERNET_TIME_FILTER
+#define ETHERNET_TIME_FILTER 8
+#endif
+
+// Offsets larger than this, in us, step the clock rather than slewing it.
+#ifndef ETHERNET_TIME_STEP_US
+#define ETHERNET_TIME_STEP_US 10000
+#endif
+
+// Most the clock rate is adjusted, in parts per billion.
+#ifndef ETHERNET_TIME_MAX_RATE_PPB
+#define ETHERNET_TIME_MAX_RATE_PPB 500000
+#endif
+
+// Synchronization statistics, from EthernetTimeSync::stats(). Printing it
+// gives a readable summary.
+class EthernetTimeStats : public Printable {
+public:
+    // Whether the clock has been set from the server.
+    bool synced;
+    // Offset of the server's clock from the synchronized clock, as of the
+    // last exchange used, in us.
+    int32_t offsetUs;
+    // Round trip time of that exchange, in us.
+    uint32_t delayUs;
+    // Average change in offset from one exchange used to the next, in us.
+    uint32_t jitterUs;
+    // Estimated rate of the server's clock relative to micros(), in parts
+    // per billion.
+    int32_t driftPpb;
+    // Exchanges completed, requests that got no response, times the clock
+    // was stepped, and requests this controller answered as a server.
+    uint32_t samples;
+    uint32_t lost;
+    uint32_t steps;
+    uint32_t served;
+
+    virtual size_t printTo(Print &p) const;
+};
+
+class EthernetTimeSync {
+public:
+    EthernetTimeSync();
+
+    // Start answering SNTP requests on port. Returns false if the socket
+    // could not be opened.
+    bool begin(uint16_t port = 123);
+    // Synchronize to the SNTP server at ip, polling it every pollMs. Call
+    // after begin().
+    void sync(IPAddress ip, uint16_t port = 123,
+              uint32_t pollMs = ETHERNET_TIME_POLL_MS);
+    void end();
+
+    // Answer requests and send and handle this client's own. Call it from
+    // loop(), and at least once an hour.
+    void service();
+
+    // The synchronized clock, in us. Until the first exchange with the
+    // server it is the same as micros(). When synchronized to a ClearCore
+    // it counts from when the server started; when synchronized to an NTP
+    // server, syncedMicros64() counts from the NTP epoch (1900).
+    uint32_t syncedMicros() {
+        return syncedMicros64();
+    }
+    uint64_t syncedMicros64();
+    bool synced() {
+        return m_synced;
+    }
+
+    EthernetTimeStats stats();
+
+private:
+    struct Sample {
+        // Local time the response arrived, the server's clock minus the
+        // local one at that time, and the exchange's round trip in us.
+        uint64_t local;
+        int64_t offset;
+        uint32_t delay;
+        bool valid;
+    };
+
+    uint64_t localMicros();
+    uint64_t localMicros(uint32_t stamp);
+    uint64_t clock(uint64_t local);
+    void rebase(uint64_t local);
+    void request();
+    void answer(const uint8_t *packet, uint64_t received);
+    void response(const uint8_t *packet, uint64_t received);
+    void update(Sample &sample);
+
+    EthernetUDP m_udp;
+    bool m_open;
+    IPAddress m_serverIp;
+    uint16_t m_serverPort;
+    uint32_t m_pollMs;
+    bool m_polling;
+    uint32_t m_lastPoll;
+    bool m_waiting;
+    // The transmit timestamp of the request waiting for a response, as
+    // sent; the response must echo it.
+    uint8_t m_origin[8];
+    uint64_t m_requestLocal;
+
+    // micros() extended to 64 bits.
+    uint32_t m_localLast;
+    uint32_t m_localHigh;
+
+    // The clock is base at localBase, and advances from there at
+    // 1 + rate parts per billion of local time until slewEnd, when the
+    // latest correction has been worked off, and at 1 + drift after that.
+    uint64_t m_base;
+    uint64_t m_localBase;
+    uint64_t m_slewEnd;
+    int32_t m_ratePpb;
+    int32_t m_driftPpb;
+    bool m_synced;
+
+    Sample m_samples[ETHERNET_TIME_FILTER];
+    uint8_t m_sampleNext;
+    uint64_t m_lastUsed;
+    int64_t m_lastError;
+    // Local time of the exchange first synchronized to.
+    uint64_t m_syncedAt;
+    uint8_t m_serverStratum;
+    EthernetTimeStats m_stats;
+};
+
+#endif // ETHERNET_TIME_SYNC_H_
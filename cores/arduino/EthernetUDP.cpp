@@ -1,28 +1,263 @@
 #include <Ethernet.h>
+#include "EthernetDns.h"
+#include "EthernetManager.h"
+#include "EthernetService.h"
 #include "EthernetUdp.h"
 #include "EthernetUtils.h"
 #include "IpAddress.h"
+#include "lwip/igmp.h"
+#include "lwip/stats.h"
 
+namespace ClearCore {
+extern EthernetManager &EthernetMgr;
+}
+
+#if LWIP_IGMP
+// Number of groups using each bit of the GMAC multicast hash filter.
+static uint8_t hashUsers[64];
+
+// The GMAC hashes a destination MAC address into 6 bits by XORing every
+// sixth bit of it, starting from bit 0 of the first byte.
+static uint8_t multicastHash(const uint8_t *mac) {
+    uint8_t hash = 0;
+    for (uint8_t bit = 0; bit < 48; bit++) {
+        if (mac[bit / 8] & (1 << (bit % 8))) {
+            hash ^= 1 << (bit % 6);
+        }
+    }
+    return hash;
+}
+
+// Let frames for the group's MAC address (01:00:5E plus the low 23 bits of
+// the group address) through the GMAC's hash filter.
+static err_t gmacMacFilter(struct netif *netif, const ip4_addr_t *group,
+                           enum netif_mac_filter_action action) {
+    (void)netif;
+    uint8_t mac[6] = {
+        0x01, 0x00, 0x5E,
+        (uint8_t)(ip4_addr2(group) & 0x7F),
+        ip4_addr3(group),
+        ip4_addr4(group)
+    };
+    uint8_t hash = multicastHash(mac);
+    if (action == NETIF_ADD_MAC_FILTER) {
+        hashUsers[hash]++;
+    }
+    else if (hashUsers[hash]) {
+        hashUsers[hash]--;
+    }
 
-EthernetUDP::EthernetUDP(): m_udp() {}
+    uint32_t bit = 1UL << (hash & 31);
+    volatile uint32_t &reg = (hash < 32) ? GMAC->HRB.reg : GMAC->HRT.reg;
+    if (hashUsers[hash]) {
+        reg |= bit;
+    }
+    else {
+        reg &= ~bit;
+    }
+    GMAC->NCFGR.reg |= GMAC_NCFGR_MTIHEN;
+    return ERR_OK;
+}
+
+// The Ethernet interface, with IGMP enabled on it.
+static struct netif *multicastInterface() {
+    struct netif *netif = ClearCore::EthernetMgr.MacInterface();
+    if (!netif) {
+        return nullptr;
+    }
+    if (!netif->igmp_mac_filter) {
+        netif_set_igmp_mac_filter(netif, gmacMacFilter);
+    }
+    if (!(netif->flags & NETIF_FLAG_IGMP)) {
+        netif->flags |= NETIF_FLAG_IGMP;
+        igmp_start(netif);
+    }
+    return netif;
+}
+#endif
+
+EthernetUDP *EthernetUDP::m_openList = nullptr;
+
+EthernetUDP::EthernetUDP()
+    : m_pcb(nullptr),
+      m_rxQueue(),
+      m_rxHead(0),
+      m_rxCount(0),
+      m_rxDepth(ETHERNET_UDP_RX_DEPTH),
+      m_rxReceived(0),
+      m_rxDroppedQueueFull(0),
+      m_rxNoBufferBase(0),
+      m_onPacket(nullptr),
+      m_dispatching(false),
+      m_rxPacket(),
+      m_rxOffset(0),
+      m_txPool(),
+      m_txPayload(),
+      m_txPacket(nullptr),
+      m_txLength(0),
+      m_txIp(),
+      m_txPort(0),
+      m_groups(),
+      m_groupCount(0),
+      m_nextOpen(nullptr) {}
+
+EthernetUDP::~EthernetUDP() {
+    stop();
+}
 
 uint8_t EthernetUDP::begin(uint16_t localPort) {
-    return m_udp.Begin(localPort) ? 1 : 0;
+    EthernetLock lock;
+    stop();
+    // lwIP hands each datagram to one socket, so sockets on the same port
+    // share one and input() sorts the datagrams out between them.
+    EthernetUDP **link = &m_openList;
+    for (; *link; link = &(*link)->m_nextOpen) {
+        if (localPort && (*link)->m_pcb->local_port == localPort) {
+            m_pcb = (*link)->m_pcb;
+        }
+    }
+    if (!m_pcb) {
+        m_pcb = udp_new();
+        if (!m_pcb) {
+            return 0;
+        }
+        if (udp_bind(m_pcb, IP_ADDR_ANY, localPort) != ERR_OK) {
+            udp_remove(m_pcb);
+            m_pcb = nullptr;
+            return 0;
+        }
+        udp_set_multicast_ttl(m_pcb, 1);
+        udp_recv(m_pcb, input, nullptr);
+    }
+    *link = this;
+    return 1;
+}
+
+uint8_t EthernetUDP::beginMulticast(IPAddress ip, uint16_t port) {
+    if (!begin(port)) {
+        return 0;
+    }
+    if (!joinGroup(ip)) {
+        stop();
+        return 0;
+    }
+    return 1;
+}
+
+uint8_t EthernetUDP::joinGroup(IPAddress ip) {
+    EthernetLock lock;
+#if LWIP_IGMP
+    ip_addr_t group = Ethernet.convertIp(ip);
+    if (!m_pcb || !ip_addr_ismulticast(&group)) {
+        return 0;
+    }
+    if (isMember(&group)) {
+        return 1;
+    }
+    if (m_groupCount == ETHERNET_UDP_MAX_GROUPS) {
+        return 0;
+    }
+    struct netif *netif = multicastInterface();
+    if (!netif || igmp_joingroup_netif(netif, ip_2_ip4(&group)) != ERR_OK) {
+        return 0;
+    }
+    // Send to the group from this interface's address.
+    udp_set_multicast_netif_addr(m_pcb, netif_ip4_addr(netif));
+    m_groups[m_groupCount++] = group;
+    return 1;
+#else
+    (void)ip;
+    return 0;
+#endif
+}
+
+uint8_t EthernetUDP::leaveGroup(IPAddress ip) {
+    EthernetLock lock;
+#if LWIP_IGMP
+    ip_addr_t group = Ethernet.convertIp(ip);
+    for (uint8_t i = 0; i < m_groupCount; i++) {
+        if (!ip_addr_cmp(&m_groups[i], &group)) {
+            continue;
+        }
+        struct netif *netif = multicastInterface();
+        if (netif) {
+            igmp_leavegroup_netif(netif, ip_2_ip4(&group));
+        }
+        m_groups[i] = m_groups[--m_groupCount];
+        return 1;
+    }
+#else
+    (void)ip;
+#endif
+    return 0;
+}
+
+void EthernetUDP::setMulticastTTL(uint8_t ttl) {
+    EthernetLock lock;
+    if (open()) {
+        udp_set_multicast_ttl(m_pcb, ttl);
+    }
 }
 
 void EthernetUDP::stop() {
-    m_udp.End();
+    EthernetLock lock;
+    while (m_groupCount) {
+        leaveGroup(Ethernet.convertIp(&m_groups[m_groupCount - 1]));
+    }
+    if (m_pcb) {
+        bool shared = false;
+        for (EthernetUDP **link = &m_openList; *link;) {
+            if (*link == this) {
+                *link = m_nextOpen;
+                continue;
+            }
+            shared |= (*link)->m_pcb == m_pcb;
+            link = &(*link)->m_nextOpen;
+        }
+        m_nextOpen = nullptr;
+        if (!shared) {
+            udp_remove(m_pcb);
+        }
+        m_pcb = nullptr;
+    }
+    flush();
+    while (m_rxCount) {
+        pbuf_free(m_rxQueue[m_rxHead].p);
+        m_rxHead = (m_rxHead + 1) % ETHERNET_UDP_RX_QUEUE;
+        m_rxCount--;
+    }
+    m_txPacket = nullptr;
+    for (uint8_t i = 0; i < ETHERNET_UDP_TX_POOL; i++) {
+        if (m_txPool[i]) {
+            // Anything still queued in the stack keeps its own reference.
+            pbuf_free(m_txPool[i]);
+            m_txPool[i] = nullptr;
+        }
+    }
 }
 
 int EthernetUDP::beginPacket(IPAddress ip, uint16_t port) {
-    ClearCore::IpAddress nativeIp = ClearCore::IpAddress(uint32_t(ip));
-    return m_udp.Connect(nativeIp, port) ? 1 : 0;
+    EthernetLock lock;
+    if (!open()) {
+        return 0;
+    }
+    if (!m_txPacket) {
+        m_txPacket = txAcquire();
+        if (!m_txPacket) {
+            return 0;
+        }
+    }
+    m_txLength = 0;
+    m_txIp = Ethernet.convertIp(ip);
+    m_txPort = port;
+    return 1;
 }
 
 int EthernetUDP::beginPacket(const char *host, uint16_t remotePort) {
+    EthernetLock lock;
     // Attempt to resolve the host.
     ip_addr_t remoteIp = {};
-    if (ClearCore::DnsGetHostByName(host, &remoteIp) != ERR_OK) {
+    if (EthernetDns.resolve(host, &remoteIp) != ERR_OK) {
         return 0; // Unable to resolve hostname or timed out.
     }
 
@@ -32,7 +267,28 @@ int EthernetUDP::beginPacket(const char *host, uint16_t remotePort) {
 }
 
 int EthernetUDP::endPacket() {
-    return m_udp.PacketSend() ? 1 : 0;
+    EthernetLock lock;
+    if (!m_txPacket || !m_pcb) {
+        return 0;
+    }
+    struct pbuf *p = m_txPacket;
+    m_txPacket = nullptr;
+    return txSend(p, m_txLength, &m_txIp, m_txPort);
+}
+
+int EthernetUDP::sendTo(IPAddress remoteIp, uint16_t remotePort,
+                        const uint8_t *data, size_t length) {
+    EthernetLock lock;
+    if (length > ETHERNET_UDP_TX_SIZE || !open()) {
+        return 0;
+    }
+    struct pbuf *p = txAcquire();
+    if (!p) {
+        return 0;
+    }
+    memcpy(p->payload, data, length);
+    ip_addr_t ip = Ethernet.convertIp(remoteIp);
+    return txSend(p, length, &ip, remotePort);
 }
 
 size_t EthernetUDP::write(uint8_t c) {
@@ -40,15 +296,35 @@ size_t EthernetUDP::write(uint8_t c) {
 }
 
 size_t EthernetUDP::write(const uint8_t *buffer, size_t size) {
-    return m_udp.PacketWrite(buffer, size);
+    if (!m_txPacket) {
+        return 0;
+    }
+    size = min(size, (size_t)(ETHERNET_UDP_TX_SIZE - m_txLength));
+    memcpy(static_cast<uint8_t *>(m_txPacket->payload) + m_txLength, buffer,
+           size);
+    m_txLength += size;
+    return size;
 }
 
 int EthernetUDP::parsePacket() {
-    return m_udp.PacketParse();
+    EthernetLock lock;
+    flush();
+    if (!m_rxCount && !m_dispatching) {
+        // Give the stack a chance to deliver anything that has arrived.
+        ClearCore::EthernetMgr.Refresh();
+        if (!m_rxCount) {
+            return 0;
+        }
+    }
+    m_rxPacket = m_rxQueue[m_rxHead];
+    m_rxHead = (m_rxHead + 1) % ETHERNET_UDP_RX_QUEUE;
+    m_rxCount--;
+    m_rxOffset = 0;
+    return m_rxPacket.p->tot_len;
 }
 
 int EthernetUDP::available() {
-    return m_udp.BytesAvailable();
+    return m_rxPacket.p ? m_rxPacket.p->tot_len - m_rxOffset : 0;
 }
 
 int EthernetUDP::read() {
@@ -57,22 +333,202 @@ int EthernetUDP::read() {
 }
 
 int EthernetUDP::read(unsigned char *buffer, size_t len) {
-    return m_udp.PacketRead(buffer, len);
+    EthernetLock lock;
+    if (!m_rxPacket.p) {
+        return -1;
+    }
+    uint16_t count = pbuf_copy_partial(m_rxPacket.p, buffer,
+                                       min(len, (size_t)available()),
+                                       m_rxOffset);
+    m_rxOffset += count;
+    return count;
 }
 
 int EthernetUDP::peek() {
-    return m_udp.Peek();
+    EthernetLock lock;
+    if (!available()) {
+        return -1;
+    }
+    return pbuf_get_at(m_rxPacket.p, m_rxOffset);
 }
 
 void EthernetUDP::flush() {
-    m_udp.PacketFlush();
+    EthernetLock lock;
+    if (m_rxPacket.p) {
+        pbuf_free(m_rxPacket.p);
+        m_rxPacket.p = nullptr;
+    }
+    m_rxOffset = 0;
+}
+
+int EthernetUDP::receive(const uint8_t **data) {
+    EthernetLock lock;
+    if (!parsePacket()) {
+        return 0;
+    }
+    if (m_rxPacket.p->next) {
+        // The datagram arrived in more than one buffer; gather it into one.
+        // This is the only case that copies.
+        struct pbuf *p = pbuf_coalesce(m_rxPacket.p, PBUF_RAW);
+        if (p == m_rxPacket.p) {
+            flush();
+            return 0;
+        }
+        m_rxPacket.p = p;
+    }
+    *data = static_cast<const uint8_t *>(m_rxPacket.p->payload);
+    m_rxOffset = m_rxPacket.p->len;
+    return m_rxPacket.p->len;
 }
 
 IPAddress EthernetUDP::remoteIP() {
-    IPAddress ip = IPAddress(uint32_t(m_udp.RemoteIp()));
-    return ip;
+    return Ethernet.convertIp(&m_rxPacket.ip);
 }
 
 uint16_t EthernetUDP::remotePort() {
-    return m_udp.RemotePort();
-}
\ No newline at end of file
+    return m_rxPacket.port;
+}
+
+void EthernetUDP::onPacket(EthernetUDPHandler handler) {
+    m_onPacket = handler;
+}
+
+void EthernetUDP::setReceiveQueueDepth(uint8_t depth) {
+    m_rxDepth = constrain(depth, 1, ETHERNET_UDP_RX_QUEUE);
+}
+
+// Pool buffer allocation failures, which is where the Ethernet driver
+// drops frames it has no buffer for.
+static uint32_t noBufferCount() {
+#if MEMP_STATS
+    return lwip_stats.memp[MEMP_PBUF_POOL]->err;
+#else
+    return 0;
+#endif
+}
+
+uint32_t EthernetUDP::packetsDroppedNoBuffer() {
+    // The stack's counter is 16 bits, so this stays right as long as it is
+    // read at least once every 65535 drops.
+    return (uint16_t)(noBufferCount() - m_rxNoBufferBase);
+}
+
+void EthernetUDP::resetCounters() {
+    m_rxReceived = 0;
+    m_rxDroppedQueueFull = 0;
+    m_rxNoBufferBase = noBufferCount();
+}
+
+// Make sure there is a socket to send from, on any free local port if
+// begin() has not been called.
+bool EthernetUDP::open() {
+    return m_pcb || begin(0);
+}
+
+bool EthernetUDP::isMember(const ip_addr_t *group) {
+    for (uint8_t i = 0; i < m_groupCount; i++) {
+        if (ip_addr_cmp(&m_groups[i], group)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Find a transmit buffer the stack has finished with, allocating one if the
+// pool is not full yet. The buffer is reset to hold a full-size datagram.
+struct pbuf *EthernetUDP::txAcquire() {
+    for (uint8_t i = 0; i < ETHERNET_UDP_TX_POOL; i++) {
+        struct pbuf *p = m_txPool[i];
+        if (!p) {
+            p = pbuf_alloc(PBUF_TRANSPORT, ETHERNET_UDP_TX_SIZE, PBUF_RAM);
+            if (!p) {
+                return nullptr;
+            }
+            m_txPool[i] = p;
+            m_txPayload[i] = p->payload;
+            return p;
+        }
+        // A buffer still waiting in the stack (e.g. for ARP) holds another
+        // reference; one being filled by beginPacket() is in m_txPacket.
+        if (p->ref == 1 && p != m_txPacket) {
+            // Sending moved the payload pointer back over the headers the
+            // stack added in the space reserved for them.
+            p->payload = m_txPayload[i];
+            p->len = p->tot_len = ETHERNET_UDP_TX_SIZE;
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+// Send the first length bytes of a buffer from the pool. The buffer stays
+// in the pool.
+int EthernetUDP::txSend(struct pbuf *p, uint16_t length, const ip_addr_t *ip,
+                        uint16_t port) {
+    if (!m_pcb) {
+        return 0;
+    }
+    p->len = p->tot_len = length;
+    return udp_sendto(m_pcb, p, ip, port) == ERR_OK ? 1 : 0;
+}
+
+// Called by lwIP for each datagram that arrives on a started port.
+void EthernetUDP::input(void *arg, struct udp_pcb *pcb, struct pbuf *p,
+                        const ip_addr_t *addr, u16_t port) {
+    (void)arg;
+    // Timestamp first, as close to the frame's arrival as this gets.
+    uint32_t timestamp = micros();
+    if (!p) {
+        return;
+    }
+    // A multicast datagram goes to every socket on the port that has joined
+    // its group, each holding its own reference to it, and anything else to
+    // the socket started first.
+    const ip_addr_t *dest = ip_current_dest_addr();
+    bool multicast = ip_addr_ismulticast(dest);
+    EthernetUDP *next;
+    for (EthernetUDP *udp = m_openList; udp; udp = next) {
+        // The handler deliver() runs may stop this socket.
+        next = udp->m_nextOpen;
+        if (udp->m_pcb != pcb || (multicast && !udp->isMember(dest))) {
+            continue;
+        }
+        pbuf_ref(p);
+        udp->deliver(p, addr, port, timestamp);
+        if (!multicast) {
+            break;
+        }
+    }
+    pbuf_free(p);
+}
+
+// Queue a received datagram, or drop it if the queue is full, and run the
+// handler.
+void EthernetUDP::deliver(struct pbuf *p, const ip_addr_t *addr, u16_t port,
+                          uint32_t timestamp) {
+    if (m_rxCount >= m_rxDepth) {
+        m_rxDroppedQueueFull++;
+        pbuf_free(p);
+        return;
+    }
+    Datagram &datagram = m_rxQueue[(m_rxHead + m_rxCount) %
+                                   ETHERNET_UDP_RX_QUEUE];
+    datagram.p = p;
+    datagram.ip = *addr;
+    datagram.port = port;
+    datagram.timestamp = timestamp;
+    m_rxCount++;
+    m_rxReceived++;
+
+    if (m_onPacket && !m_dispatching) {
+        // Keep calling the handler while it takes datagrams, so it also
+        // sees any left from before.
+        m_dispatching = true;
+        uint8_t count;
+        do {
+            count = m_rxCount;
+            m_onPacket(*this);
+        } while (m_rxCount && m_rxCount < count);
+        m_dispatching = false;
+    }
+}
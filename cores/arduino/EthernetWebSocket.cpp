@@ -0,0 +1,480 @@
+#include "EthernetWebSocket.h"
+#include "EthernetService.h"
+
+#define WS_OP_TEXT   0x1
+#define WS_OP_BINARY 0x2
+#define WS_OP_CLOSE  0x8
+#define WS_OP_PING   0x9
+#define WS_OP_PONG   0xA
+
+#define WS_CLOSE_NORMAL      1000
+#define WS_CLOSE_GOING_AWAY  1001
+#define WS_CLOSE_PROTOCOL    1002
+#define WS_CLOSE_UNSUPPORTED 1003
+#define WS_CLOSE_TOO_BIG     1009
+
+static uint32_t rol(uint32_t value, uint8_t bits) {
+    return value << bits | value >> (32 - bits);
+}
+
+static void sha1Block(uint32_t hash[5], const uint8_t *block) {
+    uint32_t w[80];
+    for (uint8_t i = 0; i < 16; i++) {
+        w[i] = (uint32_t)block[i * 4] << 24 | block[i * 4 + 1] << 16 |
+               block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    }
+    for (uint8_t i = 16; i < 80; i++) {
+        w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    uint32_t a = hash[0], b = hash[1], c = hash[2], d = hash[3], e = hash[4];
+    for (uint8_t i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        }
+        else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        }
+        else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        }
+        else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        uint32_t temp = rol(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rol(b, 30);
+        b = a;
+        a = temp;
+    }
+    hash[0] += a;
+    hash[1] += b;
+    hash[2] += c;
+    hash[3] += d;
+    hash[4] += e;
+}
+
+// SHA-1 is only used for the handshake, where RFC 6455 requires it.
+static void sha1(const uint8_t *data, size_t length, uint8_t digest[20]) {
+    uint32_t hash[5] = {
+        0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0
+    };
+    size_t done = 0;
+    for (; length - done >= 64; done += 64) {
+        sha1Block(hash, data + done);
+    }
+    uint8_t tail[128] = {};
+    size_t rest = length - done;
+    memcpy(tail, data + done, rest);
+    tail[rest] = 0x80;
+    size_t tailLength = rest < 56 ? 64 : 128;
+    uint64_t bits = (uint64_t)length * 8;
+    for (uint8_t i = 0; i < 8; i++) {
+        tail[tailLength - 1 - i] = bits >> (i * 8);
+    }
+    for (size_t i = 0; i < tailLength; i += 64) {
+        sha1Block(hash, tail + i);
+    }
+    for (uint8_t i = 0; i < 20; i++) {
+        digest[i] = hash[i / 4] >> (24 - (i % 4) * 8);
+    }
+}
+
+static void base64(const uint8_t *data, size_t length, char *out) {
+    static const char digits[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    for (size_t i = 0; i < length; i += 3) {
+        uint32_t group = (uint32_t)data[i] << 16;
+        if (i + 1 < length) {
+            group |= data[i + 1] << 8;
+        }
+        if (i + 2 < length) {
+            group |= data[i + 2];
+        }
+        *out++ = digits[group >> 18 & 0x3F];
+        *out++ = digits[group >> 12 & 0x3F];
+        *out++ = i + 1 < length ? digits[group >> 6 & 0x3F] : '=';
+        *out++ = i + 2 < length ? digits[group & 0x3F] : '=';
+    }
+    *out = '\0';
+}
+
+EthernetWebSocketServer::EthernetWebSocketServer(uint16_t port,
+                                                 const char *path)
+    : m_server(port),
+      m_path(path),
+      m_clients(),
+      m_frame(),
+      m_onMessage(nullptr),
+      m_sampler(nullptr),
+      m_samplePeriod(0),
+      m_lastSample(0),
+      m_pingInterval(ETHERNET_WS_PING_MS),
+      m_framesSent(0),
+      m_framesDropped(0) {}
+
+void EthernetWebSocketServer::begin() {
+    m_server.begin();
+}
+
+void EthernetWebSocketServer::stream(EthernetWebSocketSampler sampler,
+                                     uint16_t periodMs) {
+    m_sampler = sampler;
+    m_samplePeriod = periodMs;
+    m_lastSample = millis();
+}
+
+uint8_t EthernetWebSocketServer::clientCount() {
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < ETHERNET_WS_MAX_CLIENTS; i++) {
+        count += m_clients[i].open && m_clients[i].upgraded;
+    }
+    return count;
+}
+
+void EthernetWebSocketServer::service() {
+    EthernetLock lock;
+    accept();
+    for (uint8_t i = 0; i < ETHERNET_WS_MAX_CLIENTS; i++) {
+        if (m_clients[i].open) {
+            serviceClient(m_clients[i]);
+        }
+    }
+
+    if (m_sampler && millis() - m_lastSample >= m_samplePeriod) {
+        m_lastSample += m_samplePeriod;
+        if (millis() - m_lastSample >= m_samplePeriod) {
+            // Fallen behind; skip the samples that were missed.
+            m_lastSample = millis();
+        }
+        // The sample is taken straight into the frame buffer.
+        size_t length = m_sampler(m_frame + 4, ETHERNET_WS_FRAME_SIZE);
+        if (length) {
+            broadcast(m_frame + 4, length, true);
+        }
+    }
+}
+
+bool EthernetWebSocketServer::send(uint8_t client, const uint8_t *data,
+                                   size_t length, bool binary) {
+    EthernetLock lock;
+    if (client >= ETHERNET_WS_MAX_CLIENTS || !m_clients[client].open ||
+            !m_clients[client].upgraded || length > ETHERNET_WS_FRAME_SIZE) {
+        return false;
+    }
+    if (data != m_frame + 4) {
+        memcpy(m_frame + 4, data, length);
+    }
+    size_t frameLength;
+    const uint8_t *frame = frameHeader(binary ? WS_OP_BINARY : WS_OP_TEXT,
+                                       length, &frameLength);
+    return sendFrame(m_clients[client], frame, frameLength);
+}
+
+uint8_t EthernetWebSocketServer::broadcast(const uint8_t *data, size_t length,
+                                           bool binary) {
+    EthernetLock lock;
+    if (length > ETHERNET_WS_FRAME_SIZE) {
+        return 0;
+    }
+    // The frame is built once and written to each client as it is.
+    if (data != m_frame + 4) {
+        memcpy(m_frame + 4, data, length);
+    }
+    size_t frameLength;
+    const uint8_t *frame = frameHeader(binary ? WS_OP_BINARY : WS_OP_TEXT,
+                                       length, &frameLength);
+    uint8_t sent = 0;
+    for (uint8_t i = 0; i < ETHERNET_WS_MAX_CLIENTS; i++) {
+        Client &client = m_clients[i];
+        if (client.open && client.upgraded &&
+                sendFrame(client, frame, frameLength)) {
+            sent++;
+        }
+    }
+    return sent;
+}
+
+// The payload is at m_frame + 4; the header goes just before it.
+const uint8_t *EthernetWebSocketServer::frameHeader(uint8_t opcode,
+                                                    size_t length,
+                                                    size_t *frameLength) {
+    uint8_t *header;
+    if (length < 126) {
+        header = m_frame + 2;
+        header[1] = length;
+    }
+    else {
+        header = m_frame;
+        header[1] = 126;
+        header[2] = length >> 8;
+        header[3] = length;
+    }
+    header[0] = 0x80 | opcode;
+    *frameLength = m_frame + 4 + length - header;
+    return header;
+}
+
+bool EthernetWebSocketServer::sendFrame(Client &client, const uint8_t *frame,
+                                        size_t length) {
+    // A client that cannot take the whole frame now is behind; it misses
+    // this frame rather than having it queued.
+    if (client.client.availableForWrite() < (int)length) {
+        m_framesDropped++;
+        return false;
+    }
+    client.client.write(frame, length);
+    m_framesSent++;
+    return true;
+}
+
+void EthernetWebSocketServer::sendControl(Client &client, uint8_t opcode,
+                                          const uint8_t *data, size_t length) {
+    uint8_t frame[2 + 125];
+    length = min(length, (size_t)125);
+    frame[0] = 0x80 | opcode;
+    frame[1] = length;
+    if (length) {
+        memcpy(frame + 2, data, length);
+    }
+    if (client.client.availableForWrite() >= (int)(length + 2)) {
+        client.client.write(frame, length + 2);
+    }
+}
+
+void EthernetWebSocketServer::close(Client &client, uint16_t status) {
+    if (client.upgraded) {
+        uint8_t payload[2] = {(uint8_t)(status >> 8), (uint8_t)status};
+        sendControl(client, WS_OP_CLOSE, payload, sizeof(payload));
+    }
+    client.client.stop();
+    client.open = false;
+}
+
+void EthernetWebSocketServer::accept() {
+    while (true) {
+        EthernetClient client = m_server.accept();
+        if (!client) {
+            return;
+        }
+        Client *slot = nullptr;
+        for (uint8_t i = 0; i < ETHERNET_WS_MAX_CLIENTS; i++) {
+            if (!m_clients[i].open) {
+                slot = &m_clients[i];
+                break;
+            }
+        }
+        if (!slot) {
+            client.stop();
+            continue;
+        }
+        slot->client = client;
+        slot->length = 0;
+        slot->upgraded = false;
+        slot->lastHeard = millis();
+        slot->lastPing = slot->lastHeard;
+        slot->open = true;
+    }
+}
+
+void EthernetWebSocketServer::serviceClient(Client &client) {
+    int available = client.client.available();
+    if (available > 0 && client.length < ETHERNET_WS_BUFFER_SIZE) {
+        int count = client.client.read(
+                        client.buffer + client.length,
+                        min(available, (int)(ETHERNET_WS_BUFFER_SIZE -
+                                             client.length)));
+        if (count > 0) {
+            client.length += count;
+            client.lastHeard = millis();
+        }
+    }
+    if (!client.upgraded) {
+        handshake(client);
+    }
+    while (client.open && client.upgraded && frame(client)) {
+        continue;
+    }
+    if (!client.open) {
+        return;
+    }
+    if (!client.client.connected()) {
+        client.client.stop();
+        client.open = false;
+        return;
+    }
+
+    uint32_t quiet = millis() - client.lastHeard;
+    if (!client.upgraded) {
+        if (quiet >= m_pingInterval) {
+            // Never completed the handshake.
+            close(client, 0);
+        }
+    }
+    else if (quiet >= 2 * m_pingInterval) {
+        // Did not answer the ping.
+        close(client, WS_CLOSE_GOING_AWAY);
+    }
+    else if (quiet >= m_pingInterval &&
+             millis() - client.lastPing >= m_pingInterval) {
+        sendControl(client, WS_OP_PING, nullptr, 0);
+        client.lastPing = millis();
+    }
+}
+
+void EthernetWebSocketServer::handshake(Client &client) {
+    char *text = reinterpret_cast<char *>(client.buffer);
+    text[client.length] = '\0';
+    char *end = strstr(text, "\r\n\r\n");
+    if (!end) {
+        if (client.length >= ETHERNET_WS_BUFFER_SIZE) {
+            close(client, 0);
+        }
+        return;
+    }
+    end[2] = '\0';
+
+    size_t pathLength = strlen(m_path);
+    bool valid = !strncmp(text, "GET ", 4) &&
+                 !strncmp(text + 4, m_path, pathLength) &&
+                 (text[4 + pathLength] == ' ' || text[4 + pathLength] == '?');
+    bool upgrade = false;
+    bool version = false;
+    const char *key = nullptr;
+    char *line = strstr(text, "\r\n");
+    while (valid && line && line[2]) {
+        line += 2;
+        char *eol = strstr(line, "\r\n");
+        *eol = '\0';
+        char *value = strchr(line, ':');
+        if (value) {
+            *value++ = '\0';
+            while (*value == ' ') {
+                value++;
+            }
+            if (!strcasecmp(line, "Upgrade")) {
+                upgrade = !strcasecmp(value, "websocket");
+            }
+            else if (!strcasecmp(line, "Sec-WebSocket-Version")) {
+                version = !strcmp(value, "13");
+            }
+            else if (!strcasecmp(line, "Sec-WebSocket-Key")) {
+                key = value;
+            }
+        }
+        *eol = '\r';
+        line = eol;
+    }
+
+    if (!valid || !upgrade || !version || !key || strlen(key) > 24) {
+        client.client.writeStatic("HTTP/1.1 400 Bad Request\r\n"
+                                  "Sec-WebSocket-Version: 13\r\n"
+                                  "Content-Length: 0\r\n"
+                                  "Connection: close\r\n\r\n");
+        close(client, 0);
+        return;
+    }
+
+    char keyText[24 + 36 + 1];
+    strcpy(keyText, key);
+    strcat(keyText, "258EAFA5-E914-47DA-95CA-C5AB0DC85B11");
+    uint8_t digest[20];
+    sha1(reinterpret_cast<uint8_t *>(keyText), strlen(keyText), digest);
+    char accept[29];
+    base64(digest, sizeof(digest), accept);
+    char response[160];
+    int length = snprintf(response, sizeof(response),
+                          "HTTP/1.1 101 Switching Protocols\r\n"
+                          "Upgrade: websocket\r\n"
+                          "Connection: Upgrade\r\n"
+                          "Sec-WebSocket-Accept: %s\r\n\r\n", accept);
+    // Each frame is written whole, so send every write at once, and cap
+    // what may queue up for this client.
+    client.client.setNoDelay(true);
+    client.client.setSendBufferSize(ETHERNET_WS_MAX_QUEUED);
+    client.client.write(reinterpret_cast<uint8_t *>(response), length);
+    client.upgraded = true;
+
+    size_t used = end + 4 - text;
+    memmove(client.buffer, client.buffer + used, client.length - used);
+    client.length -= used;
+}
+
+// Handle the frame at the front of the buffer, if all of it has arrived.
+// Returns true if a frame was handled.
+bool EthernetWebSocketServer::frame(Client &client) {
+    uint8_t *data = client.buffer;
+    if (client.length < 2) {
+        return false;
+    }
+    bool fin = data[0] & 0x80;
+    uint8_t opcode = data[0] & 0x0F;
+    uint32_t length = data[1] & 0x7F;
+    size_t header = 2;
+    if (length == 126) {
+        if (client.length < 4) {
+            return false;
+        }
+        length = data[2] << 8 | data[3];
+        header = 4;
+    }
+    else if (length == 127) {
+        close(client, WS_CLOSE_TOO_BIG);
+        return false;
+    }
+    if (!(data[1] & 0x80)) {
+        // Frames from clients must be masked.
+        close(client, WS_CLOSE_PROTOCOL);
+        return false;
+    }
+    size_t frameLength = header + 4 + length;
+    if (frameLength > ETHERNET_WS_BUFFER_SIZE) {
+        close(client, WS_CLOSE_TOO_BIG);
+        return false;
+    }
+    if (client.length < frameLength) {
+        return false;
+    }
+
+    const uint8_t *mask = data + header;
+    uint8_t *payload = data + header + 4;
+    for (uint32_t i = 0; i < length; i++) {
+        payload[i] ^= mask[i & 3];
+    }
+
+    switch (opcode) {
+        case WS_OP_TEXT:
+        case WS_OP_BINARY:
+            if (!fin) {
+                close(client, WS_CLOSE_UNSUPPORTED);
+                return false;
+            }
+            if (m_onMessage) {
+                m_onMessage(&client - m_clients, payload, length,
+                            opcode == WS_OP_BINARY);
+            }
+            break;
+        case WS_OP_CLOSE:
+            close(client, length >= 2 ? payload[0] << 8 | payload[1] :
+                  WS_CLOSE_NORMAL);
+            return false;
+        case WS_OP_PING:
+            sendControl(client, WS_OP_PONG, payload, length);
+            break;
+        case WS_OP_PONG:
+            break;
+        default:
+            close(client, WS_CLOSE_UNSUPPORTED);
+            return false;
+    }
+
+    memmove(client.buffer, client.buffer + frameLength,
+            client.length - frameLength);
+    client.length -= frameLength;
+    return true;
+}
@@ -0,0 +1,145 @@
+/*
+ * WebSocket server (RFC 6455) on EthernetServer.
+ *
+ * Browsers connect with the usual HTTP upgrade handshake and then exchange
+ * messages in WebSocket frames. The server is meant for pushing live data:
+ * a sampler registered with stream() is run at a fixed rate and its sample
+ * is sent to every client as one binary frame, built once for all of them.
+ *
+ * Sending never waits on a client. Each client's unacknowledged data is
+ * capped at ETHERNET_WS_MAX_QUEUED, and a frame that the client cannot take
+ * in full right now is dropped for that client (and counted) instead, so a
+ * slow browser sees a lower update rate rather than an ever growing delay,
+ * and does not hold up the others or loop().
+ *
+ * Clients are pinged when they have been quiet for the ping interval, and
+ * closed if they stay quiet for another one. Fragmented messages are not
+ * supported.
+ */
+
+#ifndef ETHERNET_WEB_SOCKET_H_
+#define ETHERNET_WEB_SOCKET_H_
+
+#include <Arduino.h>
+#include <Ethernet.h>
+
+// Most clients connected at once. Further connections are refused.
+#ifndef ETHERNET_WS_MAX_CLIENTS
+#define ETHERNET_WS_MAX_CLIENTS 4
+#endif
+
+// Size of each client's receive buffer, which must hold the upgrade
+// request and then each whole frame received. Larger frames close the
+// connection.
+#ifndef ETHERNET_WS_BUFFER_SIZE
+#define ETHERNET_WS_BUFFER_SIZE 512
+#endif
+
+// Largest message payload that can be sent.
+#ifndef ETHERNET_WS_FRAME_SIZE
+#define ETHERNET_WS_FRAME_SIZE 512
+#endif
+
+// Most bytes sent to a client that it may leave unacknowledged. Frames
+// that would go beyond this are dropped for that client.
+#ifndef ETHERNET_WS_MAX_QUEUED
+#define ETHERNET_WS_MAX_QUEUED 2048
+#endif
+
+// Default time a client may be quiet before it is pinged, in ms.
+#ifndef ETHERNET_WS_PING_MS
+#define ETHERNET_WS_PING_MS 10000
+#endif
+
+// Called by service() for each text or binary message received. client
+// identifies the sender for send().
+typedef void (*EthernetWebSocketHandler)(uint8_t client, const uint8_t *data,
+                                         size_t length, bool binary);
+
+// Called by service() at the stream() rate to fill in a sample of up to
+// size bytes. Returns the sample's length, or 0 to send nothing this time.
+typedef size_t (*EthernetWebSocketSampler)(uint8_t *buffer, size_t size);
+
+class EthernetWebSocketServer {
+public:
+    // Serve WebSocket connections on port, to requests for path.
+    EthernetWebSocketServer(uint16_t port = 81, const char *path = "/");
+
+    void begin();
+
+    // Accept clients, complete handshakes, handle received frames, ping
+    // quiet clients and take samples that are due. Call it from loop(); it
+    // does not wait on any client.
+    void service();
+
+    // Send a message to one client, or to every client. A client that
+    // cannot take the whole frame right now is skipped. send() returns
+    // whether the message was sent; broadcast() returns the number of
+    // clients it was sent to.
+    bool send(uint8_t client, const uint8_t *data, size_t length,
+              bool binary = true);
+    uint8_t broadcast(const uint8_t *data, size_t length, bool binary = true);
+    uint8_t broadcast(const char *text) {
+        return broadcast(reinterpret_cast<const uint8_t *>(text),
+                         strlen(text), false);
+    }
+
+    // Run sampler every periodMs and broadcast its sample as a binary
+    // message. If service() falls behind, missed samples are skipped.
+    // Pass nullptr to stop.
+    void stream(EthernetWebSocketSampler sampler, uint16_t periodMs);
+    void onMessage(EthernetWebSocketHandler handler) {
+        m_onMessage = handler;
+    }
+    void setPingInterval(uint32_t milliseconds) {
+        m_pingInterval = milliseconds;
+    }
+
+    uint8_t clientCount();
+    // Messages sent, counting each client separately, and messages dropped
+    // for clients that were not keeping up.
+    uint32_t framesSent() {
+        return m_framesSent;
+    }
+    uint32_t framesDropped() {
+        return m_framesDropped;
+    }
+
+private:
+    struct Client {
+        EthernetClient client;
+        uint8_t buffer[ETHERNET_WS_BUFFER_SIZE + 1];
+        uint16_t length;
+        bool open;
+        bool upgraded;
+        uint32_t lastHeard;
+        uint32_t lastPing;
+    };
+
+    void accept();
+    void serviceClient(Client &client);
+    void handshake(Client &client);
+    bool frame(Client &client);
+    const uint8_t *frameHeader(uint8_t opcode, size_t length,
+                               size_t *frameLength);
+    bool sendFrame(Client &client, const uint8_t *frame, size_t length);
+    void sendControl(Client &client, uint8_t opcode, const uint8_t *data,
+                     size_t length);
+    void close(Client &client, uint16_t status);
+
+    EthernetServer m_server;
+    const char *m_path;
+    Client m_clients[ETHERNET_WS_MAX_CLIENTS];
+    // A frame being sent: header and payload together, so it goes out in
+    // one write.
+    uint8_t m_frame[ETHERNET_WS_FRAME_SIZE + 4];
+    EthernetWebSocketHandler m_onMessage;
+    EthernetWebSocketSampler m_sampler;
+    uint16_t m_samplePeriod;
+    uint32_t m_lastSample;
+    uint32_t m_pingInterval;
+    uint32_t m_framesSent;
+    uint32_t m_framesDropped;
+};
+
+#endif // ETHERNET_WEB_SOCKET_H_
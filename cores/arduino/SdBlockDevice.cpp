@@ -0,0 +1,416 @@
+#include "SdBlockDevice.h"
+
+// SD commands used in SPI mode.
+#define SD_CMD0     0   // GO_IDLE_STATE
+#define SD_CMD8     8   // SEND_IF_COND
+#define SD_CMD9     9   // SEND_CSD
+#define SD_CMD12    12  // STOP_TRANSMISSION
+#define SD_CMD16    16  // SET_BLOCKLEN
+#define SD_CMD17    17  // READ_SINGLE_BLOCK
+#define SD_CMD18    18  // READ_MULTIPLE_BLOCK
+#define SD_CMD24    24  // WRITE_BLOCK
+#define SD_CMD25    25  // WRITE_MULTIPLE_BLOCK
+#define SD_CMD55    55  // APP_CMD
+#define SD_CMD58    58  // READ_OCR
+#define SD_ACMD23   23  // SET_WR_BLK_ERASE_COUNT
+#define SD_ACMD41   41  // SD_SEND_OP_COND
+
+#define SD_R1_READY         0x00
+#define SD_R1_IDLE          0x01
+#define SD_R1_ILLEGAL_CMD   0x04
+
+#define SD_TOKEN_DATA       0xFE    // Single block read/write, multi-block read
+#define SD_TOKEN_MULTI      0xFC    // Multi-block write
+#define SD_TOKEN_STOP       0xFD    // End of multi-block write
+#define SD_DATA_RES_MASK    0x1F
+#define SD_DATA_RES_OK      0x05
+
+#define SD_INIT_TIMEOUT_MS  2000
+#define SD_READ_TIMEOUT_MS  300
+#define SD_WRITE_TIMEOUT_MS 600
+
+SdBlockDevice::SdBlockDevice(SPIClass &spi)
+    : m_spi(&spi),
+      m_settings(SD_SPI_INIT_CLOCK, MSBFIRST, SPI_MODE0),
+      m_type(SD_CARD_NONE),
+      m_selected(false),
+      m_xfer(XFER_IDLE),
+      m_async(ASYNC_IDLE),
+      m_asyncStart(0) {}
+
+bool SdBlockDevice::begin(uint32_t clockHz) {
+    m_type = SD_CARD_NONE;
+    m_xfer = XFER_IDLE;
+    m_async = ASYNC_IDLE;
+    m_settings = SPISettings(SD_SPI_INIT_CLOCK, MSBFIRST, SPI_MODE0);
+    m_spi->begin();
+
+    // The card needs at least 74 clocks with chip select high to enter
+    // native mode before it will accept CMD0.
+    m_spi->beginTransaction(m_settings);
+    m_spi->endTransaction();
+    for (uint8_t i = 0; i < 10; i++) {
+        spiReceive();
+    }
+
+    select();
+    uint32_t start = millis();
+    while (command(SD_CMD0, 0) != SD_R1_IDLE) {
+        if (millis() - start > SD_INIT_TIMEOUT_MS) {
+            deselect();
+            return false;
+        }
+    }
+
+    SdCardType type = SD_CARD_V1;
+    if (!(command(SD_CMD8, 0x1AA) & SD_R1_ILLEGAL_CMD)) {
+        uint8_t r7[4];
+        for (uint8_t i = 0; i < 4; i++) {
+            r7[i] = spiReceive();
+        }
+        if (r7[3] != 0xAA) {
+            deselect();
+            return false;
+        }
+        type = SD_CARD_V2;
+    }
+
+    // Only v2 cards may be told that the host supports high capacity.
+    uint32_t hcs = (type == SD_CARD_V2) ? 0x40000000 : 0;
+    start = millis();
+    while (appCommand(SD_ACMD41, hcs) != SD_R1_READY) {
+        if (millis() - start > SD_INIT_TIMEOUT_MS) {
+            deselect();
+            return false;
+        }
+    }
+
+    if (type == SD_CARD_V2) {
+        if (command(SD_CMD58, 0) != SD_R1_READY) {
+            deselect();
+            return false;
+        }
+        uint8_t ocr = spiReceive();
+        for (uint8_t i = 0; i < 3; i++) {
+            spiReceive();
+        }
+        if (ocr & 0x40) {
+            type = SD_CARD_HC;
+        }
+    }
+    if (type != SD_CARD_HC && command(SD_CMD16, SD_SECTOR_SIZE) != SD_R1_READY) {
+        deselect();
+        return false;
+    }
+    deselect();
+
+    m_type = type;
+    m_settings = SPISettings(clockHz, MSBFIRST, SPI_MODE0);
+    return true;
+}
+
+void SdBlockDevice::end() {
+    if (m_xfer == XFER_READ) {
+        readStop();
+    }
+    else if (m_xfer == XFER_WRITE) {
+        writeStop();
+    }
+    m_type = SD_CARD_NONE;
+}
+
+uint32_t SdBlockDevice::sectorCount() {
+    if (m_type == SD_CARD_NONE || m_xfer != XFER_IDLE) {
+        return 0;
+    }
+    uint8_t csd[16];
+    select();
+    bool ok = command(SD_CMD9, 0) == SD_R1_READY && readBlock(csd, sizeof(csd));
+    deselect();
+    if (!ok) {
+        return 0;
+    }
+
+    if ((csd[0] >> 6) == 1) {
+        // CSD version 2.0: capacity is (C_SIZE + 1) * 512 KB.
+        uint32_t cSize = ((uint32_t)(csd[7] & 0x3F) << 16) |
+                         ((uint32_t)csd[8] << 8) | csd[9];
+        return (cSize + 1) << 10;
+    }
+    uint32_t cSize = ((uint32_t)(csd[6] & 0x03) << 10) |
+                     ((uint32_t)csd[7] << 2) | (csd[8] >> 6);
+    uint8_t cSizeMult = ((csd[9] & 0x03) << 1) | (csd[10] >> 7);
+    uint8_t readBlLen = csd[5] & 0x0F;
+    return (cSize + 1) << (cSizeMult + readBlLen + 2 - 9);
+}
+
+bool SdBlockDevice::readSector(uint32_t sector, uint8_t *dst) {
+    if (m_type == SD_CARD_NONE || m_xfer != XFER_IDLE) {
+        return false;
+    }
+    select();
+    bool ok = command(SD_CMD17, address(sector)) == SD_R1_READY &&
+              readBlock(dst, SD_SECTOR_SIZE);
+    deselect();
+    return ok;
+}
+
+bool SdBlockDevice::writeSector(uint32_t sector, const uint8_t *src) {
+    if (m_type == SD_CARD_NONE || m_xfer != XFER_IDLE) {
+        return false;
+    }
+    select();
+    bool ok = command(SD_CMD24, address(sector)) == SD_R1_READY &&
+              writeBlock(SD_TOKEN_DATA, src) &&
+              waitNotBusy(SD_WRITE_TIMEOUT_MS);
+    deselect();
+    return ok;
+}
+
+bool SdBlockDevice::readSectors(uint32_t sector, uint8_t *dst,
+                                uint32_t count) {
+    if (count == 1) {
+        return readSector(sector, dst);
+    }
+    if (!readStart(sector)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < count; i++, dst += SD_SECTOR_SIZE) {
+        if (!readData(dst)) {
+            readStop();
+            return false;
+        }
+    }
+    return readStop();
+}
+
+bool SdBlockDevice::writeSectors(uint32_t sector, const uint8_t *src,
+                                 uint32_t count) {
+    if (count == 1) {
+        return writeSector(sector, src);
+    }
+    if (!writeStart(sector, count)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < count; i++, src += SD_SECTOR_SIZE) {
+        if (!writeData(src)) {
+            writeStop();
+            return false;
+        }
+    }
+    return writeStop();
+}
+
+bool SdBlockDevice::readStart(uint32_t sector) {
+    if (m_type == SD_CARD_NONE || m_xfer != XFER_IDLE) {
+        return false;
+    }
+    select();
+    if (command(SD_CMD18, address(sector)) != SD_R1_READY) {
+        deselect();
+        return false;
+    }
+    m_xfer = XFER_READ;
+    return true;
+}
+
+bool SdBlockDevice::readData(uint8_t *dst) {
+    if (m_xfer != XFER_READ) {
+        return false;
+    }
+    return readBlock(dst, SD_SECTOR_SIZE);
+}
+
+bool SdBlockDevice::readStop() {
+    if (m_xfer != XFER_READ) {
+        return false;
+    }
+    m_xfer = XFER_IDLE;
+    bool ok = command(SD_CMD12, 0) == SD_R1_READY;
+    deselect();
+    return ok;
+}
+
+bool SdBlockDevice::writeStart(uint32_t sector, uint32_t eraseCount) {
+    if (m_type == SD_CARD_NONE || m_xfer != XFER_IDLE) {
+        return false;
+    }
+    select();
+    // Pre-erasing is only a hint, so a failure here is not fatal.
+    if (eraseCount > 1) {
+        appCommand(SD_ACMD23, eraseCount);
+    }
+    if (command(SD_CMD25, address(sector)) != SD_R1_READY) {
+        deselect();
+        return false;
+    }
+    m_xfer = XFER_WRITE;
+    return true;
+}
+
+bool SdBlockDevice::writeData(const uint8_t *src) {
+    if (m_xfer != XFER_WRITE || !waitAsync()) {
+        return false;
+    }
+    return writeBlock(SD_TOKEN_MULTI, src) && waitNotBusy(SD_WRITE_TIMEOUT_MS);
+}
+
+bool SdBlockDevice::writeStop() {
+    if (m_xfer != XFER_WRITE) {
+        return false;
+    }
+    m_xfer = XFER_IDLE;
+    bool ok = waitAsync() && waitNotBusy(SD_WRITE_TIMEOUT_MS);
+    if (ok) {
+        m_spi->transfer(SD_TOKEN_STOP);
+        spiReceive();
+        ok = waitNotBusy(SD_WRITE_TIMEOUT_MS);
+    }
+    deselect();
+    return ok;
+}
+
+bool SdBlockDevice::writeDataAsync(uint8_t *buf) {
+    if (m_xfer != XFER_WRITE || m_async != ASYNC_IDLE) {
+        return false;
+    }
+    m_spi->transfer(SD_TOKEN_MULTI);
+    m_spi->transfer(buf, buf, SD_SECTOR_SIZE, false);
+    m_async = ASYNC_DMA;
+    return true;
+}
+
+SdAsyncStatus SdBlockDevice::writeDataPoll() {
+    switch (m_async) {
+        case ASYNC_DMA:
+            if (m_spi->transferBusy()) {
+                return SD_ASYNC_BUSY;
+            }
+            m_spi->waitForTransfer();
+            // Dummy CRC, then the data response.
+            spiReceive();
+            spiReceive();
+            if ((spiReceive() & SD_DATA_RES_MASK) != SD_DATA_RES_OK) {
+                m_async = ASYNC_IDLE;
+                return SD_ASYNC_ERROR;
+            }
+            m_async = ASYNC_PROGRAMMING;
+            m_asyncStart = millis();
+            // fall through
+        case ASYNC_PROGRAMMING:
+            if (spiReceive() != 0xFF) {
+                if (millis() - m_asyncStart > SD_WRITE_TIMEOUT_MS) {
+                    m_async = ASYNC_IDLE;
+                    return SD_ASYNC_ERROR;
+                }
+                return SD_ASYNC_BUSY;
+            }
+            m_async = ASYNC_IDLE;
+            return SD_ASYNC_DONE;
+        default:
+            return SD_ASYNC_DONE;
+    }
+}
+
+uint8_t SdBlockDevice::command(uint8_t cmd, uint32_t arg) {
+    if (cmd != SD_CMD0 && cmd != SD_CMD12) {
+        waitNotBusy(SD_READ_TIMEOUT_MS);
+    }
+
+    uint8_t frame[6] = {
+        (uint8_t)(0x40 | cmd),
+        (uint8_t)(arg >> 24),
+        (uint8_t)(arg >> 16),
+        (uint8_t)(arg >> 8),
+        (uint8_t)arg,
+        // Only CMD0 and CMD8 are checked for a valid CRC in SPI mode.
+        (uint8_t)(cmd == SD_CMD0 ? 0x95 : (cmd == SD_CMD8 ? 0x87 : 0x01))
+    };
+    m_spi->transfer(frame, sizeof(frame));
+
+    // CMD12 is followed by a stuff byte before the response.
+    if (cmd == SD_CMD12) {
+        spiReceive();
+    }
+
+    uint8_t r1 = 0xFF;
+    for (uint8_t i = 0; i < 10 && (r1 & 0x80); i++) {
+        r1 = spiReceive();
+    }
+    return r1;
+}
+
+uint8_t SdBlockDevice::appCommand(uint8_t cmd, uint32_t arg) {
+    command(SD_CMD55, 0);
+    return command(cmd, arg);
+}
+
+bool SdBlockDevice::waitNotBusy(uint32_t timeoutMs) {
+    uint32_t start = millis();
+    while (spiReceive() != 0xFF) {
+        if (millis() - start > timeoutMs) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Finish any sector started with writeDataAsync().
+bool SdBlockDevice::waitAsync() {
+    SdAsyncStatus status;
+    while ((status = writeDataPoll()) == SD_ASYNC_BUSY) {
+        continue;
+    }
+    return status == SD_ASYNC_DONE;
+}
+
+bool SdBlockDevice::waitStartToken(uint8_t *token) {
+    uint32_t start = millis();
+    while ((*token = spiReceive()) == 0xFF) {
+        if (millis() - start > SD_READ_TIMEOUT_MS) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SdBlockDevice::readBlock(uint8_t *dst, size_t len) {
+    uint8_t token;
+    if (!waitStartToken(&token) || token != SD_TOKEN_DATA) {
+        return false;
+    }
+    // Clock out 0xFF while the block is received into the same buffer.
+    memset(dst, 0xFF, len);
+    m_spi->transfer(dst, len);
+    // Discard the CRC.
+    spiReceive();
+    spiReceive();
+    return true;
+}
+
+bool SdBlockDevice::writeBlock(uint8_t token, const uint8_t *src) {
+    m_spi->transfer(token);
+    // SPI transfers always store what is received; the card's replies to
+    // the data go to a sink so src is clocked out as it is.
+    m_spi->transfer(src, m_sink, SD_SECTOR_SIZE);
+    // Dummy CRC.
+    spiReceive();
+    spiReceive();
+    return (spiReceive() & SD_DATA_RES_MASK) == SD_DATA_RES_OK;
+}
+
+void SdBlockDevice::select() {
+    if (!m_selected) {
+        m_spi->beginTransaction(m_settings);
+        m_selected = true;
+    }
+}
+
+void SdBlockDevice::deselect() {
+    if (m_selected) {
+        m_spi->endTransaction();
+        m_selected = false;
+        // One extra byte lets the card release its data out line.
+        spiReceive();
+    }
+}
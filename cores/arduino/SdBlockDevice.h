@@ -0,0 +1,127 @@
+/*
+ * SD card sector access over SPI for the Teknic ClearCore.
+ *
+ * Talks the SD SPI-mode protocol directly over an SPIClass port (SPI2, the
+ * on-board micro SD socket, by default). Runs of sectors are moved with a
+ * single READ_MULTIPLE_BLOCK (CMD18) or WRITE_MULTIPLE_BLOCK (CMD25) command
+ * instead of one command per sector, and each 512 byte block is clocked as a
+ * single SPI buffer transfer.
+ *
+ * Do not mix this driver with the Arduino SD library on the same card; both
+ * keep their own view of the file system.
+ */
+
+#ifndef SD_BLOCK_DEVICE_H_
+#define SD_BLOCK_DEVICE_H_
+
+#include <Arduino.h>
+#include <SPI.h>
+#include "SdSectorDevice.h"
+
+// SPI clock used once the card has been initialized.
+#ifndef SD_SPI_CLOCK
+#define SD_SPI_CLOCK MAX_SPI
+#endif
+
+// SPI clock used while the card is being initialized (must be <= 400 kHz).
+#define SD_SPI_INIT_CLOCK 400000
+
+typedef enum {
+    SD_CARD_NONE,
+    SD_CARD_V1,     // Standard capacity, SD spec v1.x (byte addressed).
+    SD_CARD_V2,     // Standard capacity, SD spec v2.0 (byte addressed).
+    SD_CARD_HC      // High/extended capacity (block addressed).
+} SdCardType;
+
+typedef enum {
+    SD_ASYNC_DONE,
+    SD_ASYNC_BUSY,
+    SD_ASYNC_ERROR
+} SdAsyncStatus;
+
+class SdBlockDevice : public SdSectorDevice {
+public:
+    SdBlockDevice(SPIClass &spi);
+
+    // Initialize the card. Returns true if the card is ready for use.
+    bool begin(uint32_t clockHz = SD_SPI_CLOCK);
+    void end();
+
+    SdCardType type() {
+        return m_type;
+    }
+    // Number of 512 byte sectors on the card, or 0 if it could not be read.
+    uint32_t sectorCount();
+
+    // Read or write a single sector.
+    virtual bool readSector(uint32_t sector, uint8_t *dst);
+    virtual bool writeSector(uint32_t sector, const uint8_t *src);
+
+    // Read or write count consecutive sectors. More than one sector is
+    // transferred with a single multi-block command.
+    virtual bool readSectors(uint32_t sector, uint8_t *dst, uint32_t count);
+    virtual bool writeSectors(uint32_t sector, const uint8_t *src,
+                              uint32_t count);
+
+    // Streaming interface for transfers that do not fit in one buffer.
+    // Start a multi-block transfer at the given sector, move one sector per
+    // readData()/writeData() call, then stop the transfer. eraseCount is an
+    // optional hint of how many sectors will be written.
+    bool readStart(uint32_t sector);
+    bool readData(uint8_t *dst);
+    bool readStop();
+    bool writeStart(uint32_t sector, uint32_t eraseCount = 0);
+    bool writeData(const uint8_t *src);
+    bool writeStop();
+
+    // Non-blocking form of writeData(). Sends the data token and starts a
+    // background DMA transfer of one sector from buf, which is overwritten
+    // with the bytes clocked back from the card. Call writeDataPoll() until
+    // it stops returning SD_ASYNC_BUSY before reusing buf or writing the
+    // next sector; it also waits out the card's programming time without
+    // blocking.
+    bool writeDataAsync(uint8_t *buf);
+    SdAsyncStatus writeDataPoll();
+
+    // The SPI port the card is attached to.
+    SPIClass &spi() {
+        return *m_spi;
+    }
+
+private:
+    uint8_t command(uint8_t cmd, uint32_t arg);
+    uint8_t appCommand(uint8_t cmd, uint32_t arg);
+    bool waitNotBusy(uint32_t timeoutMs);
+    bool waitAsync();
+    bool waitStartToken(uint8_t *token);
+    bool readBlock(uint8_t *dst, size_t len);
+    bool writeBlock(uint8_t token, const uint8_t *src);
+    uint32_t address(uint32_t sector) {
+        return m_type == SD_CARD_HC ? sector : sector << 9;
+    }
+    void select();
+    void deselect();
+    uint8_t spiReceive() {
+        return m_spi->transfer(0xFF);
+    }
+
+    SPIClass *m_spi;
+    SPISettings m_settings;
+    SdCardType m_type;
+    bool m_selected;
+    enum {
+        XFER_IDLE,
+        XFER_READ,
+        XFER_WRITE
+    } m_xfer;
+    enum {
+        ASYNC_IDLE,
+        ASYNC_DMA,
+        ASYNC_PROGRAMMING
+    } m_async;
+    uint32_t m_asyncStart;
+    // Receives what the card clocks back while a sector is written.
+    uint8_t m_sink[SD_SECTOR_SIZE];
+};
+
+#endif // SD_BLOCK_DEVICE_H_
@@ -0,0 +1,22 @@
+#include "SdFileSystem.h"
+
+bool SdFileSystem::begin(uint32_t clockHz) {
+    if (!m_card) {
+        return false;
+    }
+    m_mounted = false;
+    if (!m_card->begin(clockHz)) {
+        return false;
+    }
+    return mount();
+}
+
+void SdFileSystem::end() {
+    unmount();
+    if (m_card) {
+        m_card->end();
+    }
+}
+
+SdBlockDevice SdCard(SPI2);
+SdFileSystem SdCardFs(SdCard);
@@ -0,0 +1,1318 @@
+#include "SdFileSystem.h"
+
+#define DIR_ENTRY_SIZE      32
+#define DIR_ENTRY_FREE      0xE5
+#define DIR_ENTRY_END       0x00
+
+#define ATTR_READ_ONLY      0x01
+#define ATTR_VOLUME_ID      0x08
+#define ATTR_DIRECTORY      0x10
+#define ATTR_ARCHIVE        0x20
+#define ATTR_LONG_NAME      0x0F
+
+#define FAT32_MASK          0x0FFFFFFF
+
+#define INVALID_CLUSTER     0xFFFFFFFF
+
+// FAT32 FSInfo sector signatures and fields.
+#define FSINFO_LEAD_SIG     0x41615252
+#define FSINFO_STRUCT_SIG   0x61417272
+#define FSINFO_FREE_COUNT   488
+#define FSINFO_NEXT_FREE    492
+#define FSINFO_UNKNOWN      0xFFFFFFFF
+
+#define INDEX_USED          0x01
+#define INDEX_DELETED       0x02
+#define INDEX_DIRECTORY     0x04
+#define INDEX_WALKED        0x08
+
+static inline uint16_t le16(const uint8_t *p) {
+    return (uint16_t)p[0] | ((uint16_t)p[1] << 8);
+}
+
+static inline uint32_t le32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void put16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static inline void put32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+// Convert one path component of length len to a space padded 8.3 name.
+static bool shortName(const char *str, size_t len, uint8_t *name) {
+    memset(name, ' ', 11);
+    if (len == 1 && str[0] == '.') {
+        name[0] = '.';
+        return true;
+    }
+    if (len == 2 && str[0] == '.' && str[1] == '.') {
+        name[0] = name[1] = '.';
+        return true;
+    }
+
+    uint8_t i = 0;
+    uint8_t limit = 8;
+    for (size_t n = 0; n < len; n++) {
+        char c = str[n];
+        if (c == '.' && limit == 8) {
+            i = 8;
+            limit = 11;
+            continue;
+        }
+        if (c <= ' ' || c == '.' || strchr("\"*+,/:;<=>?[\\]|", c) || i >= limit) {
+            return false;
+        }
+        name[i++] = (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+    }
+    return name[0] != ' ';
+}
+
+// Format a space padded 8.3 name as "NAME.EXT".
+static void printableName(const uint8_t *name, char *str) {
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < 11; i++) {
+        if (name[i] == ' ') {
+            continue;
+        }
+        if (i == 8) {
+            str[n++] = '.';
+        }
+        str[n++] = name[i];
+    }
+    str[n] = '\0';
+}
+
+SdSectorCache::SdSectorCache(SdSectorDevice &device, uint8_t *storage,
+                             uint8_t sectors)
+    : m_device(&device),
+      m_storage(storage),
+      m_count(sectors),
+      m_entries(),
+      m_clock(0),
+      m_mirrorFirst(0),
+      m_mirrorCount(0),
+      m_mirrorStride(0),
+      m_mirrorCopies(1),
+      m_hits(0),
+      m_misses(0) {}
+
+bool SdSectorCache::buffer(uint8_t *storage, uint8_t sectors) {
+    if (!storage || sectors == 0 || sectors > SD_CACHE_MAX_SECTORS) {
+        return false;
+    }
+    if (!flush()) {
+        return false;
+    }
+    invalidate();
+    m_storage = storage;
+    m_count = sectors;
+    return true;
+}
+
+void SdSectorCache::mirror(uint32_t first, uint32_t count, uint32_t stride,
+                           uint8_t copies) {
+    m_mirrorFirst = first;
+    m_mirrorCount = count;
+    m_mirrorStride = stride;
+    m_mirrorCopies = copies;
+}
+
+uint8_t *SdSectorCache::get(uint32_t sector, bool forWrite) {
+    return slot(sector, true, forWrite);
+}
+
+uint8_t *SdSectorCache::claim(uint32_t sector) {
+    return slot(sector, false, true);
+}
+
+bool SdSectorCache::flush() {
+    bool ok = true;
+    for (uint8_t i = 0; i < m_count; i++) {
+        if (m_entries[i].valid && m_entries[i].dirty) {
+            ok &= writeBack(m_entries[i], m_storage + i * SD_SECTOR_SIZE);
+        }
+    }
+    return ok;
+}
+
+void SdSectorCache::invalidate() {
+    for (uint8_t i = 0; i < SD_CACHE_MAX_SECTORS; i++) {
+        m_entries[i].valid = false;
+        m_entries[i].dirty = false;
+    }
+}
+
+uint8_t *SdSectorCache::slot(uint32_t sector, bool load, bool forWrite) {
+    m_clock++;
+    uint8_t victim = 0;
+    for (uint8_t i = 0; i < m_count; i++) {
+        Entry &entry = m_entries[i];
+        if (entry.valid && entry.sector == sector) {
+            m_hits++;
+            entry.lastUse = m_clock;
+            entry.dirty |= forWrite;
+            return m_storage + i * SD_SECTOR_SIZE;
+        }
+        // Prefer an empty slot, then the least recently used one.
+        if (!m_entries[victim].valid) {
+            continue;
+        }
+        if (!entry.valid || entry.lastUse < m_entries[victim].lastUse) {
+            victim = i;
+        }
+    }
+
+    m_misses++;
+    Entry &entry = m_entries[victim];
+    uint8_t *data = m_storage + victim * SD_SECTOR_SIZE;
+    if (entry.valid && entry.dirty && !writeBack(entry, data)) {
+        return nullptr;
+    }
+    entry.valid = false;
+    if (load && !m_device->readSector(sector, data)) {
+        return nullptr;
+    }
+    entry.sector = sector;
+    entry.lastUse = m_clock;
+    entry.valid = true;
+    entry.dirty = forWrite;
+    return data;
+}
+
+bool SdSectorCache::writeBack(Entry &entry, const uint8_t *data) {
+    if (!m_device->writeSector(entry.sector, data)) {
+        return false;
+    }
+    if (entry.sector >= m_mirrorFirst &&
+            entry.sector < m_mirrorFirst + m_mirrorCount) {
+        for (uint8_t i = 1; i < m_mirrorCopies; i++) {
+            if (!m_device->writeSector(entry.sector + i * m_mirrorStride, data)) {
+                return false;
+            }
+        }
+    }
+    entry.dirty = false;
+    return true;
+}
+
+SdFsFile::SdFsFile()
+    : m_fs(nullptr),
+      m_firstCluster(0),
+      m_cluster(0),
+      m_clusterIndex(0),
+      m_pos(0),
+      m_size(0),
+      m_dirSector(0),
+      m_dirOffset(0),
+      m_flags(0),
+      m_isDir(false),
+      m_entryDirty(false),
+      m_name() {}
+
+int SdFsFile::read(void *buf, size_t nbyte) {
+    if (!m_fs || m_isDir || !(m_flags & SD_O_READ)) {
+        return -1;
+    }
+    if (nbyte > m_size - m_pos) {
+        nbyte = m_size - m_pos;
+    }
+
+    uint8_t *dst = static_cast<uint8_t *>(buf);
+    size_t left = nbyte;
+    uint32_t sectorsPerCluster = 1UL << m_fs->m_clusterShift;
+    while (left) {
+        if (!seekCluster(m_pos, false)) {
+            return -1;
+        }
+        uint32_t offset = m_pos & (SD_SECTOR_SIZE - 1);
+        uint32_t sector = currentSector();
+        size_t n;
+
+        if (offset == 0 && left >= SD_SECTOR_SIZE) {
+            // Gather as many whole sectors as are physically contiguous and
+            // read them with one multi-block transfer.
+            uint32_t wanted = left / SD_SECTOR_SIZE;
+            uint32_t run = sectorsPerCluster -
+                           ((m_pos / SD_SECTOR_SIZE) & (sectorsPerCluster - 1));
+            while (run < wanted) {
+                uint32_t next;
+                if (!m_fs->fatGet(m_cluster, &next) || next != m_cluster + 1) {
+                    break;
+                }
+                m_cluster = next;
+                m_clusterIndex++;
+                run += sectorsPerCluster;
+            }
+            if (run > wanted) {
+                run = wanted;
+            }
+            if (!m_fs->dataFlush() ||
+                    !m_fs->m_device->readSectors(sector, dst, run)) {
+                return -1;
+            }
+            n = run * SD_SECTOR_SIZE;
+        }
+        else {
+            uint8_t *data = m_fs->dataSector(sector, false);
+            if (!data) {
+                return -1;
+            }
+            n = min((size_t)(SD_SECTOR_SIZE - offset), left);
+            memcpy(dst, data + offset, n);
+        }
+        dst += n;
+        left -= n;
+        m_pos += n;
+    }
+    return nbyte;
+}
+
+int SdFsFile::read() {
+    uint8_t val;
+    return read(&val, 1) == 1 ? val : -1;
+}
+
+int SdFsFile::peek() {
+    uint32_t pos = m_pos;
+    uint32_t cluster = m_cluster;
+    uint32_t clusterIndex = m_clusterIndex;
+    int val = read();
+    m_pos = pos;
+    m_cluster = cluster;
+    m_clusterIndex = clusterIndex;
+    return val;
+}
+
+int SdFsFile::available() {
+    if (!m_fs || m_isDir) {
+        return 0;
+    }
+    uint32_t left = m_size - m_pos;
+    return left > INT32_MAX ? INT32_MAX : (int)left;
+}
+
+void SdFsFile::flush() {
+    sync();
+}
+
+size_t SdFsFile::write(const uint8_t *buf, size_t size) {
+    if (!m_fs || m_isDir || !(m_flags & SD_O_WRITE)) {
+        setWriteError();
+        return 0;
+    }
+    if ((m_flags & SD_O_APPEND) && m_pos != m_size) {
+        seek(m_size);
+    }
+
+    const uint8_t *src = buf;
+    size_t left = size;
+    uint32_t sectorsPerCluster = 1UL << m_fs->m_clusterShift;
+    while (left) {
+        if (!seekCluster(m_pos, true)) {
+            break;
+        }
+        uint32_t offset = m_pos & (SD_SECTOR_SIZE - 1);
+        uint32_t sector = currentSector();
+        size_t n;
+
+        if (offset == 0 && left >= SD_SECTOR_SIZE) {
+            // Extend the run into following clusters while they are (or can
+            // be allocated) physically contiguous.
+            uint32_t wanted = left / SD_SECTOR_SIZE;
+            uint32_t run = sectorsPerCluster -
+                           ((m_pos / SD_SECTOR_SIZE) & (sectorsPerCluster - 1));
+            while (run < wanted) {
+                uint32_t next;
+                if (!m_fs->fatGet(m_cluster, &next)) {
+                    break;
+                }
+                if (m_fs->isEndOfChain(next) &&
+                        !m_fs->allocate(1, m_cluster, &next)) {
+                    break;
+                }
+                if (next != m_cluster + 1) {
+                    break;
+                }
+                m_cluster = next;
+                m_clusterIndex++;
+                run += sectorsPerCluster;
+            }
+            if (run > wanted) {
+                run = wanted;
+            }
+            m_fs->dataInvalidate(sector, run);
+            if (!m_fs->m_device->writeSectors(sector, src, run)) {
+                break;
+            }
+            n = run * SD_SECTOR_SIZE;
+        }
+        else {
+            uint8_t *data = m_fs->dataSector(sector, true);
+            if (!data) {
+                break;
+            }
+            n = min((size_t)(SD_SECTOR_SIZE - offset), left);
+            memcpy(data + offset, src, n);
+        }
+        src += n;
+        left -= n;
+        m_pos += n;
+        if (m_pos > m_size) {
+            m_size = m_pos;
+        }
+        m_entryDirty = true;
+    }
+
+    if (left) {
+        setWriteError();
+    }
+    return size - left;
+}
+
+size_t SdFsFile::write(uint8_t val) {
+    return write(&val, 1);
+}
+
+bool SdFsFile::seek(uint32_t pos) {
+    if (!m_fs || m_isDir || pos > m_size) {
+        return false;
+    }
+    m_pos = pos;
+    return true;
+}
+
+bool SdFsFile::sync() {
+    if (!m_fs) {
+        return false;
+    }
+    bool ok = m_fs->dataFlush();
+    if (m_entryDirty) {
+        SdFileSystem::DirEntry entry;
+        entry.sector = m_dirSector;
+        entry.offset = m_dirOffset;
+        entry.firstCluster = m_firstCluster;
+        entry.size = m_size;
+        uint8_t *data = m_fs->m_cache.get(m_dirSector, true);
+        if (data) {
+            memcpy(entry.name, data + m_dirOffset, sizeof(entry.name));
+            entry.attributes = data[m_dirOffset + 11] | ATTR_ARCHIVE;
+            ok &= m_fs->writeEntry(entry);
+            m_entryDirty = false;
+        }
+        else {
+            ok = false;
+        }
+    }
+    return m_fs->flushMetadata() && ok;
+}
+
+void SdFsFile::close() {
+    sync();
+    m_fs = nullptr;
+}
+
+bool SdFsFile::preAllocate(uint32_t length) {
+    if (!m_fs || m_isDir || !(m_flags & SD_O_WRITE) || m_firstCluster ||
+            length == 0) {
+        return false;
+    }
+    uint32_t count = (length + m_fs->clusterSize() - 1) /
+                     m_fs->clusterSize();
+    if (!m_fs->allocate(count, 0, &m_firstCluster)) {
+        return false;
+    }
+    m_cluster = 0;
+    m_size = length;
+    m_entryDirty = true;
+    return sync();
+}
+
+bool SdFsFile::truncate(uint32_t length) {
+    if (!m_fs || m_isDir || !(m_flags & SD_O_WRITE) || length > m_size) {
+        return false;
+    }
+    if (!m_fs->dataFlush()) {
+        return false;
+    }
+    if (m_firstCluster) {
+        if (length == 0) {
+            if (!m_fs->freeChain(m_firstCluster)) {
+                return false;
+            }
+            m_firstCluster = 0;
+        }
+        else {
+            uint32_t last = m_firstCluster;
+            for (uint32_t i = (length - 1) / m_fs->clusterSize(); i > 0; i--) {
+                if (!m_fs->fatGet(last, &last) || last < 2 ||
+                        m_fs->isEndOfChain(last)) {
+                    return false;
+                }
+            }
+            uint32_t next;
+            if (!m_fs->fatGet(last, &next)) {
+                return false;
+            }
+            if (!m_fs->isEndOfChain(next) &&
+                    (!m_fs->fatPut(last, m_fs->endOfChain()) ||
+                     !m_fs->freeChain(next))) {
+                return false;
+            }
+        }
+        // The staging buffer may hold a sector that was just freed.
+        m_fs->m_dataValid = false;
+    }
+    m_size = length;
+    if (m_pos > length) {
+        m_pos = length;
+    }
+    m_cluster = 0;
+    m_entryDirty = true;
+    return sync();
+}
+
+bool SdFsFile::contiguousRange(uint32_t *firstSector, uint32_t *lastSector) {
+    if (!m_fs || m_firstCluster < 2) {
+        return false;
+    }
+    uint32_t cluster = m_firstCluster;
+    while (true) {
+        uint32_t next;
+        if (!m_fs->fatGet(cluster, &next)) {
+            return false;
+        }
+        if (m_fs->isEndOfChain(next)) {
+            break;
+        }
+        if (next != cluster + 1) {
+            return false;
+        }
+        cluster = next;
+    }
+    *firstSector = m_fs->clusterSector(m_firstCluster);
+    *lastSector = m_fs->clusterSector(cluster) +
+                  (1UL << m_fs->m_clusterShift) - 1;
+    return true;
+}
+
+// Make m_cluster the cluster holding byte pos, extending the chain if
+// allocate is set.
+bool SdFsFile::seekCluster(uint32_t pos, bool allocate) {
+    uint32_t index = pos >> (9 + m_fs->m_clusterShift);
+    if (m_firstCluster == 0) {
+        if (!allocate || !m_fs->allocate(1, 0, &m_firstCluster)) {
+            return false;
+        }
+        m_entryDirty = true;
+        m_cluster = 0;
+    }
+    if (m_cluster == 0 || index < m_clusterIndex) {
+        m_cluster = m_firstCluster;
+        m_clusterIndex = 0;
+    }
+    while (m_clusterIndex < index) {
+        uint32_t next;
+        if (!m_fs->fatGet(m_cluster, &next)) {
+            return false;
+        }
+        if (m_fs->isEndOfChain(next)) {
+            if (!allocate || !m_fs->allocate(1, m_cluster, &next)) {
+                return false;
+            }
+        }
+        else if (next < 2) {
+            return false;
+        }
+        m_cluster = next;
+        m_clusterIndex++;
+    }
+    return true;
+}
+
+uint32_t SdFsFile::currentSector() {
+    uint32_t mask = (1UL << m_fs->m_clusterShift) - 1;
+    return m_fs->clusterSector(m_cluster) + ((m_pos / SD_SECTOR_SIZE) & mask);
+}
+
+SdFileSystem::SdFileSystem(SdBlockDevice &card)
+    : SdFileSystem(static_cast<SdSectorDevice &>(card)) {
+    m_card = &card;
+}
+
+SdFileSystem::SdFileSystem(SdSectorDevice &device)
+    : m_card(nullptr),
+      m_device(&device),
+      m_cache(device, m_cacheStorage, SD_CACHE_SECTORS),
+      m_dataSectorNum(0),
+      m_dataValid(false),
+      m_dataDirty(false),
+      m_mounted(false),
+      m_fatType(0),
+      m_clusterShift(0),
+      m_fatStart(0),
+      m_fatSectors(0),
+      m_rootStart(0),
+      m_rootSectors(0),
+      m_rootCluster(0),
+      m_dataStart(0),
+      m_clusterCount(0),
+      m_allocHint(2),
+      m_fsInfoSector(0),
+      m_freeCount(FSINFO_UNKNOWN),
+      m_fsInfoDirty(false),
+      m_index(nullptr),
+      m_indexSlots(0),
+      m_indexUsed(0),
+      m_indexValid(false) {}
+
+bool SdFileSystem::mount() {
+    m_mounted = false;
+    m_dataValid = false;
+    m_dataDirty = false;
+    m_cache.invalidate();
+
+    // Sector 0 is either a volume boot record or an MBR whose first
+    // partition holds the volume.
+    uint8_t *mbr = m_cache.get(0, false);
+    if (!mbr || le16(mbr + 510) != 0xAA55) {
+        return false;
+    }
+    if ((mbr[0] == 0xEB || mbr[0] == 0xE9) && le16(mbr + 11) == SD_SECTOR_SIZE) {
+        m_mounted = mountVolume(0);
+    }
+    else {
+        m_mounted = mountVolume(le32(mbr + 446 + 8));
+    }
+    if (m_mounted && m_index) {
+        indexBuild();
+    }
+    return m_mounted;
+}
+
+void SdFileSystem::unmount() {
+    if (m_mounted) {
+        sync();
+    }
+    m_mounted = false;
+    m_indexValid = false;
+}
+
+bool SdFileSystem::cacheBuffer(uint8_t *storage, uint8_t sectors) {
+    return m_cache.buffer(storage, sectors);
+}
+
+bool SdFileSystem::indexBuffer(SdIndexEntry *table, uint16_t slots) {
+    m_index = table;
+    m_indexSlots = table ? slots : 0;
+    m_indexValid = false;
+    if (!m_index || !m_mounted) {
+        return m_index != nullptr;
+    }
+    return indexBuild();
+}
+
+bool SdFileSystem::mountVolume(uint32_t volumeStart) {
+    uint8_t *bpb = m_cache.get(volumeStart, false);
+    if (!bpb || le16(bpb + 11) != SD_SECTOR_SIZE) {
+        return false;
+    }
+    uint8_t sectorsPerCluster = bpb[13];
+    uint8_t fatCount = bpb[16];
+    uint16_t reserved = le16(bpb + 14);
+    uint16_t rootEntries = le16(bpb + 17);
+    uint32_t totalSectors = le16(bpb + 19) ? le16(bpb + 19) : le32(bpb + 32);
+    m_fatSectors = le16(bpb + 22) ? le16(bpb + 22) : le32(bpb + 36);
+    m_rootCluster = le32(bpb + 44);
+    uint16_t fsInfo = le16(bpb + 48);
+
+    if (sectorsPerCluster == 0 || (sectorsPerCluster & (sectorsPerCluster - 1)) ||
+            fatCount == 0 || m_fatSectors == 0) {
+        return false;
+    }
+    m_clusterShift = 0;
+    while ((1U << m_clusterShift) < sectorsPerCluster) {
+        m_clusterShift++;
+    }
+
+    m_fatStart = volumeStart + reserved;
+    m_rootStart = m_fatStart + fatCount * m_fatSectors;
+    m_rootSectors = (rootEntries * DIR_ENTRY_SIZE + SD_SECTOR_SIZE - 1) /
+                    SD_SECTOR_SIZE;
+    m_dataStart = m_rootStart + m_rootSectors;
+    m_clusterCount = (totalSectors - (m_dataStart - volumeStart)) >>
+                     m_clusterShift;
+
+    // The cluster count alone determines the FAT type. FAT12 volumes are
+    // too small to be found on SD cards and are not supported.
+    if (m_clusterCount < 4085) {
+        return false;
+    }
+    if (m_clusterCount < 65525) {
+        m_fatType = 16;
+        m_rootCluster = 0;
+    }
+    else {
+        m_fatType = 32;
+    }
+    m_allocHint = 2;
+    m_fsInfoSector = 0;
+    m_freeCount = FSINFO_UNKNOWN;
+    m_fsInfoDirty = false;
+    m_cache.mirror(m_fatStart, m_fatSectors, m_fatSectors, fatCount);
+
+    // A FAT32 volume's FSInfo sector holds the free cluster count and where
+    // to start looking for free clusters. Both are only hints; they are
+    // used if they are plausible and kept up to date from here on.
+    if (m_fatType == 32 && fsInfo && fsInfo < reserved) {
+        uint8_t *info = m_cache.get(volumeStart + fsInfo, false);
+        if (info && le32(info) == FSINFO_LEAD_SIG &&
+                le32(info + 484) == FSINFO_STRUCT_SIG) {
+            m_fsInfoSector = volumeStart + fsInfo;
+            m_freeCount = le32(info + FSINFO_FREE_COUNT);
+            if (m_freeCount > m_clusterCount) {
+                m_freeCount = FSINFO_UNKNOWN;
+            }
+            uint32_t next = le32(info + FSINFO_NEXT_FREE);
+            if (next >= 2 && next <= m_clusterCount + 1) {
+                m_allocHint = next;
+            }
+        }
+    }
+    return true;
+}
+
+SdFsFile SdFileSystem::open(const char *path, uint8_t flags) {
+    SdFsFile file;
+    if (!m_mounted) {
+        return file;
+    }
+
+    DirEntry entry;
+    uint32_t parent;
+    uint8_t leaf[11];
+    if (!lookup(path, &entry, &parent, leaf)) {
+        if (!(flags & SD_O_CREATE) || !(flags & SD_O_WRITE) ||
+                parent == INVALID_CLUSTER || !findFree(parent, &entry)) {
+            return file;
+        }
+        uint8_t *data = m_cache.get(entry.sector, true);
+        if (!data) {
+            return file;
+        }
+        memset(data + entry.offset, 0, DIR_ENTRY_SIZE);
+        memcpy(entry.name, leaf, sizeof(entry.name));
+        entry.attributes = ATTR_ARCHIVE;
+        entry.firstCluster = 0;
+        entry.size = 0;
+        if (!writeEntry(entry) || !flushMetadata()) {
+            return file;
+        }
+        if (m_indexValid) {
+            indexInsert(parent, leaf, entry.sector, entry.offset, false);
+        }
+    }
+    else if (flags & SD_O_WRITE) {
+        if (entry.attributes & (ATTR_DIRECTORY | ATTR_READ_ONLY)) {
+            return file;
+        }
+        if ((flags & SD_O_TRUNC) && entry.firstCluster) {
+            dataFlush();
+            if (!freeChain(entry.firstCluster)) {
+                return file;
+            }
+            m_dataValid = false;
+            entry.firstCluster = 0;
+            entry.size = 0;
+            if (!writeEntry(entry) || !flushMetadata()) {
+                return file;
+            }
+        }
+    }
+
+    file.m_fs = this;
+    file.m_firstCluster = entry.firstCluster;
+    file.m_size = entry.size;
+    file.m_dirSector = entry.sector;
+    file.m_dirOffset = entry.offset;
+    file.m_flags = flags;
+    file.m_isDir = entry.attributes & ATTR_DIRECTORY;
+    printableName(entry.name, file.m_name);
+    if (flags & SD_O_APPEND) {
+        file.m_pos = file.m_size;
+    }
+    return file;
+}
+
+bool SdFileSystem::exists(const char *path) {
+    DirEntry entry;
+    return m_mounted && lookup(path, &entry, nullptr, nullptr);
+}
+
+bool SdFileSystem::remove(const char *path) {
+    DirEntry entry;
+    uint32_t parent;
+    uint8_t leaf[11];
+    if (!m_mounted || !lookup(path, &entry, &parent, leaf) ||
+            entry.sector == 0 || (entry.attributes & ATTR_DIRECTORY)) {
+        return false;
+    }
+    if (!dataFlush()) {
+        return false;
+    }
+    if (entry.firstCluster && !freeChain(entry.firstCluster)) {
+        return false;
+    }
+    m_dataValid = false;
+
+    uint8_t *data = m_cache.get(entry.sector, true);
+    if (!data) {
+        return false;
+    }
+    data[entry.offset] = DIR_ENTRY_FREE;
+    // Drop any long name entries that precede it in the same sector.
+    for (int16_t offset = entry.offset - DIR_ENTRY_SIZE;
+            offset >= 0 && data[offset + 11] == ATTR_LONG_NAME;
+            offset -= DIR_ENTRY_SIZE) {
+        data[offset] = DIR_ENTRY_FREE;
+    }
+    indexRemove(parent, entry);
+    return flushMetadata();
+}
+
+bool SdFileSystem::list(const char *path, SdListCallback cb, void *context) {
+    DirEntry dir;
+    if (!m_mounted || !lookup(path, &dir, nullptr, nullptr) ||
+            !(dir.attributes & ATTR_DIRECTORY)) {
+        return false;
+    }
+
+    uint32_t sector;
+    char name[13];
+    for (uint32_t index = 0; dirSector(dir.firstCluster, index, &sector);
+            index++) {
+        uint8_t *data = m_cache.get(sector, false);
+        if (!data) {
+            return false;
+        }
+        for (uint16_t offset = 0; offset < SD_SECTOR_SIZE;
+                offset += DIR_ENTRY_SIZE) {
+            uint8_t *e = data + offset;
+            if (e[0] == DIR_ENTRY_END) {
+                return true;
+            }
+            if (e[0] == DIR_ENTRY_FREE || e[0] == '.' ||
+                    e[11] == ATTR_LONG_NAME || (e[11] & ATTR_VOLUME_ID)) {
+                continue;
+            }
+            printableName(e, name);
+            if (!cb(name, le32(e + 28), e[11] & ATTR_DIRECTORY, context)) {
+                return true;
+            }
+            // The callback may have used the cache; reload the sector.
+            data = m_cache.get(sector, false);
+            if (!data) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool SdFileSystem::sync() {
+    bool ok = dataFlush();
+    return flushMetadata() && ok;
+}
+
+// Write the FSInfo hints into their sector if the FAT has changed, then
+// write back the cached FAT and directory sectors.
+bool SdFileSystem::flushMetadata() {
+    if (m_fsInfoDirty && m_fsInfoSector) {
+        uint8_t *info = m_cache.get(m_fsInfoSector, true);
+        if (!info) {
+            return false;
+        }
+        put32(info + FSINFO_FREE_COUNT, m_freeCount);
+        put32(info + FSINFO_NEXT_FREE, m_allocHint);
+    }
+    m_fsInfoDirty = false;
+    return m_cache.flush();
+}
+
+bool SdFileSystem::fatGet(uint32_t cluster, uint32_t *value) {
+    if (cluster < 2 || cluster > m_clusterCount + 1) {
+        return false;
+    }
+    uint32_t offset = cluster * (m_fatType == 16 ? 2 : 4);
+    uint8_t *data = m_cache.get(m_fatStart + offset / SD_SECTOR_SIZE, false);
+    if (!data) {
+        return false;
+    }
+    offset &= SD_SECTOR_SIZE - 1;
+    *value = (m_fatType == 16) ? le16(data + offset) :
+             (le32(data + offset) & FAT32_MASK);
+    return true;
+}
+
+bool SdFileSystem::fatPut(uint32_t cluster, uint32_t value) {
+    if (cluster < 2 || cluster > m_clusterCount + 1) {
+        return false;
+    }
+    uint32_t offset = cluster * (m_fatType == 16 ? 2 : 4);
+    uint8_t *data = m_cache.get(m_fatStart + offset / SD_SECTOR_SIZE, true);
+    if (!data) {
+        return false;
+    }
+    offset &= SD_SECTOR_SIZE - 1;
+    if (m_fatType == 16) {
+        put16(data + offset, (uint16_t)value);
+    }
+    else {
+        // The top four bits of a FAT32 entry are reserved.
+        put32(data + offset, (le32(data + offset) & ~FAT32_MASK) |
+              (value & FAT32_MASK));
+    }
+    return true;
+}
+
+// Allocate count physically contiguous clusters, chain them together and,
+// if prev is non-zero, link them to the end of prev's chain.
+bool SdFileSystem::allocate(uint32_t count, uint32_t prev, uint32_t *first) {
+    if (count == 0 || count > m_clusterCount) {
+        return false;
+    }
+    uint32_t lastCluster = m_clusterCount + 1;
+    // Appending right after prev keeps a growing file contiguous.
+    uint32_t start = (prev >= 2 && prev < lastCluster) ? prev + 1 : m_allocHint;
+    if (start < 2 || start > lastCluster) {
+        start = 2;
+    }
+
+    uint32_t cluster = start;
+    uint32_t runStart = 0;
+    uint32_t runLength = 0;
+    for (uint32_t scanned = 0; scanned < m_clusterCount; scanned++) {
+        if (cluster > lastCluster) {
+            // Runs cannot wrap around the end of the FAT.
+            cluster = 2;
+            runLength = 0;
+        }
+        uint32_t value;
+        if (!fatGet(cluster, &value)) {
+            return false;
+        }
+        if (value != 0) {
+            runLength = 0;
+        }
+        else if (runLength++ == 0) {
+            runStart = cluster;
+        }
+        if (runLength == count) {
+            break;
+        }
+        cluster++;
+    }
+    if (runLength != count) {
+        return false;
+    }
+
+    uint32_t eoc = endOfChain();
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t c = runStart + i;
+        if (!fatPut(c, (i == count - 1) ? eoc : c + 1)) {
+            return false;
+        }
+    }
+    if (prev >= 2 && !fatPut(prev, runStart)) {
+        return false;
+    }
+    m_allocHint = runStart + count;
+    if (m_freeCount != FSINFO_UNKNOWN) {
+        m_freeCount -= count;
+    }
+    m_fsInfoDirty = true;
+    *first = runStart;
+    return true;
+}
+
+bool SdFileSystem::freeChain(uint32_t cluster) {
+    while (cluster >= 2 && !isEndOfChain(cluster)) {
+        uint32_t next;
+        if (!fatGet(cluster, &next) || !fatPut(cluster, 0)) {
+            return false;
+        }
+        if (cluster < m_allocHint) {
+            m_allocHint = cluster;
+        }
+        if (m_freeCount != FSINFO_UNKNOWN) {
+            m_freeCount++;
+        }
+        m_fsInfoDirty = true;
+        cluster = next;
+    }
+    return true;
+}
+
+// Find the sector holding the index'th sector of a directory. Cluster 0
+// is the fixed FAT16 root directory.
+bool SdFileSystem::dirSector(uint32_t dirCluster, uint32_t index,
+                             uint32_t *sector) {
+    if (dirCluster == 0) {
+        if (index >= m_rootSectors) {
+            return false;
+        }
+        *sector = m_rootStart + index;
+        return true;
+    }
+    uint32_t cluster = dirCluster;
+    for (uint32_t i = index >> m_clusterShift; i > 0; i--) {
+        if (!fatGet(cluster, &cluster) || isEndOfChain(cluster) || cluster < 2) {
+            return false;
+        }
+    }
+    *sector = clusterSector(cluster) + (index & ((1UL << m_clusterShift) - 1));
+    return true;
+}
+
+bool SdFileSystem::findEntry(uint32_t dirCluster, const uint8_t *name,
+                             DirEntry *entry) {
+    if (m_indexValid) {
+        return indexFind(dirCluster, name, entry);
+    }
+
+    uint32_t sector;
+    for (uint32_t index = 0; dirSector(dirCluster, index, &sector); index++) {
+        uint8_t *data = m_cache.get(sector, false);
+        if (!data) {
+            return false;
+        }
+        for (uint16_t offset = 0; offset < SD_SECTOR_SIZE;
+                offset += DIR_ENTRY_SIZE) {
+            uint8_t *e = data + offset;
+            if (e[0] == DIR_ENTRY_END) {
+                return false;
+            }
+            if (e[0] == DIR_ENTRY_FREE || e[11] == ATTR_LONG_NAME ||
+                    (e[11] & ATTR_VOLUME_ID) || memcmp(e, name, 11)) {
+                continue;
+            }
+            fillEntry(sector, offset, e, entry);
+            return true;
+        }
+    }
+    return false;
+}
+
+void SdFileSystem::fillEntry(uint32_t sector, uint16_t offset,
+                             const uint8_t *e, DirEntry *entry) {
+    entry->sector = sector;
+    entry->offset = offset;
+    memcpy(entry->name, e, sizeof(entry->name));
+    entry->attributes = e[11];
+    entry->firstCluster = ((uint32_t)le16(e + 20) << 16) | le16(e + 26);
+    entry->size = le32(e + 28);
+    // ".." refers to the root directory with cluster 0.
+    if ((entry->attributes & ATTR_DIRECTORY) && entry->firstCluster == 0) {
+        entry->firstCluster = m_rootCluster;
+    }
+}
+
+bool SdFileSystem::findFree(uint32_t dirCluster, DirEntry *entry) {
+    uint32_t sector;
+    uint32_t index = 0;
+    for (; dirSector(dirCluster, index, &sector); index++) {
+        uint8_t *data = m_cache.get(sector, false);
+        if (!data) {
+            return false;
+        }
+        for (uint16_t offset = 0; offset < SD_SECTOR_SIZE;
+                offset += DIR_ENTRY_SIZE) {
+            if (data[offset] == DIR_ENTRY_END || data[offset] == DIR_ENTRY_FREE) {
+                entry->sector = sector;
+                entry->offset = offset;
+                return true;
+            }
+        }
+    }
+    if (dirCluster == 0) {
+        // The FAT16 root directory cannot grow.
+        return false;
+    }
+
+    // Grow the directory by one zeroed cluster.
+    uint32_t last = dirCluster;
+    uint32_t next;
+    while (fatGet(last, &next) && !isEndOfChain(next) && next >= 2) {
+        last = next;
+    }
+    uint32_t cluster;
+    if (!allocate(1, last, &cluster)) {
+        return false;
+    }
+    uint32_t first = clusterSector(cluster);
+    for (uint32_t i = 0; i < (1UL << m_clusterShift); i++) {
+        uint8_t *data = m_cache.claim(first + i);
+        if (!data) {
+            return false;
+        }
+        memset(data, 0, SD_SECTOR_SIZE);
+    }
+    entry->sector = first;
+    entry->offset = 0;
+    return true;
+}
+
+// Resolve path to its directory entry. If parent is given it receives the
+// cluster of the containing directory (or INVALID_CLUSTER if the path to it
+// does not exist) and leaf the 8.3 name of the last component, so a missing
+// file can be created.
+bool SdFileSystem::lookup(const char *path, DirEntry *entry, uint32_t *parent,
+                          uint8_t *leaf) {
+    if (parent) {
+        *parent = INVALID_CLUSTER;
+    }
+
+    // The root directory has no entry of its own.
+    entry->sector = 0;
+    entry->offset = 0;
+    memset(entry->name, ' ', sizeof(entry->name));
+    entry->name[0] = '/';
+    entry->attributes = ATTR_DIRECTORY;
+    entry->firstCluster = m_rootCluster;
+    entry->size = 0;
+
+    while (*path == '/') {
+        path++;
+    }
+    while (*path) {
+        const char *end = path;
+        while (*end && *end != '/') {
+            end++;
+        }
+        uint8_t name[11];
+        if (!(entry->attributes & ATTR_DIRECTORY) ||
+                !shortName(path, end - path, name)) {
+            return false;
+        }
+        uint32_t dir = entry->firstCluster;
+        bool last = true;
+        for (const char *p = end; *p; p++) {
+            if (*p != '/') {
+                last = false;
+                break;
+            }
+        }
+        if (last && parent) {
+            *parent = dir;
+            memcpy(leaf, name, sizeof(name));
+        }
+        if (!findEntry(dir, name, entry)) {
+            return false;
+        }
+        path = end;
+        while (*path == '/') {
+            path++;
+        }
+    }
+    return true;
+}
+
+bool SdFileSystem::writeEntry(const DirEntry &entry) {
+    uint8_t *data = m_cache.get(entry.sector, true);
+    if (!data) {
+        return false;
+    }
+    uint8_t *e = data + entry.offset;
+    memcpy(e, entry.name, sizeof(entry.name));
+    e[11] = entry.attributes;
+    put16(e + 20, (uint16_t)(entry.firstCluster >> 16));
+    put16(e + 26, (uint16_t)entry.firstCluster);
+    put32(e + 28, entry.size);
+    return true;
+}
+
+// FNV-1a over the directory cluster and the 8.3 name.
+uint32_t SdFileSystem::indexHash(uint32_t dirCluster, const uint8_t *name) {
+    uint32_t hash = 2166136261UL;
+    for (uint8_t i = 0; i < 4; i++) {
+        hash = (hash ^ (uint8_t)(dirCluster >> (8 * i))) * 16777619UL;
+    }
+    for (uint8_t i = 0; i < 11; i++) {
+        hash = (hash ^ name[i]) * 16777619UL;
+    }
+    return hash;
+}
+
+// Index every entry of every directory on the volume. Subdirectories are
+// found in the table itself and walked until a pass finds none left.
+bool SdFileSystem::indexBuild() {
+    m_indexValid = false;
+    m_indexUsed = 0;
+    memset(m_index, 0, m_indexSlots * sizeof(SdIndexEntry));
+    if (m_indexSlots < 2 || !indexWalk(m_rootCluster)) {
+        return false;
+    }
+
+    bool walked = true;
+    while (walked) {
+        walked = false;
+        for (uint16_t i = 0; i < m_indexSlots; i++) {
+            SdIndexEntry &slot = m_index[i];
+            if ((slot.flags & (INDEX_DIRECTORY | INDEX_WALKED)) !=
+                    INDEX_DIRECTORY) {
+                continue;
+            }
+            slot.flags |= INDEX_WALKED;
+            uint8_t *data = m_cache.get(slot.sector, false);
+            if (!data) {
+                return false;
+            }
+            DirEntry dir;
+            fillEntry(slot.sector, slot.offset, data + slot.offset, &dir);
+            if (!indexWalk(dir.firstCluster)) {
+                return false;
+            }
+            walked = true;
+        }
+    }
+    m_indexValid = true;
+    return true;
+}
+
+bool SdFileSystem::indexWalk(uint32_t dirCluster) {
+    uint32_t sector;
+    for (uint32_t index = 0; dirSector(dirCluster, index, &sector); index++) {
+        uint8_t *data = m_cache.get(sector, false);
+        if (!data) {
+            return false;
+        }
+        for (uint16_t offset = 0; offset < SD_SECTOR_SIZE;
+                offset += DIR_ENTRY_SIZE) {
+            const uint8_t *e = data + offset;
+            if (e[0] == DIR_ENTRY_END) {
+                return true;
+            }
+            if (e[0] == DIR_ENTRY_FREE || e[11] == ATTR_LONG_NAME ||
+                    (e[11] & ATTR_VOLUME_ID)) {
+                continue;
+            }
+            // "." and ".." are indexed so they resolve, but not walked.
+            bool isDir = (e[11] & ATTR_DIRECTORY) && e[0] != '.';
+            if (!indexInsert(dirCluster, e, sector, offset, isDir)) {
+                return false;
+            }
+            // Inserting does not touch the cache, so data is still valid.
+        }
+    }
+    return true;
+}
+
+bool SdFileSystem::indexFind(uint32_t dirCluster, const uint8_t *name,
+                             DirEntry *entry) {
+    uint32_t hash = indexHash(dirCluster, name);
+    for (uint16_t n = 0, i = hash % m_indexSlots; n < m_indexSlots;
+            n++, i = (i + 1) % m_indexSlots) {
+        SdIndexEntry &slot = m_index[i];
+        if (!slot.flags) {
+            return false;
+        }
+        if (!(slot.flags & INDEX_USED) || slot.hash != hash ||
+                slot.dirCluster != dirCluster) {
+            continue;
+        }
+        // Confirm the name against the entry itself in case of a collision.
+        uint8_t *data = m_cache.get(slot.sector, false);
+        if (!data) {
+            return false;
+        }
+        if (!memcmp(data + slot.offset, name, 11)) {
+            fillEntry(slot.sector, slot.offset, data + slot.offset, entry);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Add an entry known not to be in the index. If the table is full the
+// index is dropped and lookups fall back to walking directories.
+bool SdFileSystem::indexInsert(uint32_t dirCluster, const uint8_t *name,
+                               uint32_t sector, uint16_t offset, bool isDir) {
+    // Always leave one empty slot so that probing terminates.
+    if (m_indexUsed + 1 >= m_indexSlots) {
+        m_indexValid = false;
+        return false;
+    }
+    uint32_t hash = indexHash(dirCluster, name);
+    uint16_t i = hash % m_indexSlots;
+    while (m_index[i].flags & INDEX_USED) {
+        i = (i + 1) % m_indexSlots;
+    }
+    if (!m_index[i].flags) {
+        m_indexUsed++;
+    }
+    m_index[i].hash = hash;
+    m_index[i].dirCluster = dirCluster;
+    m_index[i].sector = sector;
+    m_index[i].offset = offset;
+    m_index[i].flags = INDEX_USED | (isDir ? INDEX_DIRECTORY : 0);
+    return true;
+}
+
+void SdFileSystem::indexRemove(uint32_t dirCluster, const DirEntry &entry) {
+    if (!m_indexValid) {
+        return;
+    }
+    uint32_t hash = indexHash(dirCluster, entry.name);
+    for (uint16_t n = 0, i = hash % m_indexSlots; n < m_indexSlots;
+            n++, i = (i + 1) % m_indexSlots) {
+        SdIndexEntry &slot = m_index[i];
+        if (!slot.flags) {
+            return;
+        }
+        if ((slot.flags & INDEX_USED) && slot.sector == entry.sector &&
+                slot.offset == entry.offset) {
+            slot.flags = INDEX_DELETED;
+            return;
+        }
+    }
+}
+
+uint8_t *SdFileSystem::dataSector(uint32_t sector, bool forWrite) {
+    if (!m_dataValid || m_dataSectorNum != sector) {
+        if (!dataFlush() || !m_device->readSector(sector, m_data)) {
+            m_dataValid = false;
+            return nullptr;
+        }
+        m_dataSectorNum = sector;
+        m_dataValid = true;
+    }
+    m_dataDirty |= forWrite;
+    return m_data;
+}
+
+bool SdFileSystem::dataFlush() {
+    if (m_dataValid && m_dataDirty) {
+        if (!m_device->writeSector(m_dataSectorNum, m_data)) {
+            return false;
+        }
+        m_dataDirty = false;
+    }
+    return true;
+}
+
+void SdFileSystem::dataInvalidate(uint32_t first, uint32_t count) {
+    if (m_dataValid && m_dataSectorNum >= first &&
+            m_dataSectorNum < first + count) {
+        m_dataValid = false;
+        m_dataDirty = false;
+    }
+}
+
@@ -0,0 +1,329 @@
+/*
+ * FAT16/FAT32 file access on the ClearCore SD card.
+ *
+ * Built on SdBlockDevice. FAT and directory sectors go through a small LRU
+ * write-back cache so that walking a cluster chain or a directory does not
+ * re-read the same sector from the card. File data that covers whole sectors
+ * bypasses the cache and is moved straight between the card and the caller's
+ * buffer with multi-block transfers; only partial sectors are staged in RAM.
+ *
+ * The file system only needs an SdSectorDevice, so it can also be mounted
+ * on other storage, such as a disk image on a PC (see
+ * libraries/SD/extras/host).
+ *
+ * File names use the 8.3 format, like the Arduino SD library.
+ */
+
+#ifndef SD_FILE_SYSTEM_H_
+#define SD_FILE_SYSTEM_H_
+
+#include <Arduino.h>
+#include "SdBlockDevice.h"
+
+// Number of sectors in the default metadata cache.
+#ifndef SD_CACHE_SECTORS
+#define SD_CACHE_SECTORS 4
+#endif
+
+// Largest cache that can be supplied with SdFileSystem::cacheBuffer().
+#ifndef SD_CACHE_MAX_SECTORS
+#define SD_CACHE_MAX_SECTORS 16
+#endif
+
+// File open flags.
+#define SD_O_READ       0x01
+#define SD_O_WRITE      0x02
+#define SD_O_CREATE     0x04
+#define SD_O_APPEND     0x08
+#define SD_O_TRUNC      0x10
+
+#define SD_FILE_READ    (SD_O_READ)
+#define SD_FILE_WRITE   (SD_O_READ | SD_O_WRITE | SD_O_CREATE | SD_O_APPEND)
+
+class SdFileSystem;
+
+// One slot of the directory index. See SdFileSystem::indexBuffer().
+struct SdIndexEntry {
+    uint32_t hash;
+    uint32_t dirCluster;
+    uint32_t sector;
+    uint16_t offset;
+    uint8_t flags;
+};
+
+// Called once per entry by SdFileSystem::list(). Return false to stop.
+typedef bool (*SdListCallback)(const char *name, uint32_t size,
+                               bool isDirectory, void *context);
+
+class SdSectorCache {
+public:
+    SdSectorCache(SdSectorDevice &device, uint8_t *storage, uint8_t sectors);
+
+    // Use the supplied storage (sectors * 512 bytes) for the cache. Any dirty
+    // sectors in the old storage are written back first.
+    bool buffer(uint8_t *storage, uint8_t sectors);
+
+    // Sectors in the range [first, first + count) are written to each of the
+    // copies spaced stride sectors apart when they are written back.
+    void mirror(uint32_t first, uint32_t count, uint32_t stride,
+                uint8_t copies);
+
+    // Return the cached contents of a sector, reading it from the card on a
+    // miss. If forWrite is true the sector is marked dirty and is written
+    // back on eviction or flush(). Returns nullptr on a card error.
+    uint8_t *get(uint32_t sector, bool forWrite);
+    // Same as get() but for a sector that will be completely overwritten,
+    // so it is not read from the card on a miss.
+    uint8_t *claim(uint32_t sector);
+
+    bool flush();
+    void invalidate();
+
+    uint32_t hits() {
+        return m_hits;
+    }
+    uint32_t misses() {
+        return m_misses;
+    }
+
+private:
+    struct Entry {
+        uint32_t sector;
+        uint32_t lastUse;
+        bool valid;
+        bool dirty;
+    };
+
+    uint8_t *slot(uint32_t sector, bool load, bool forWrite);
+    bool writeBack(Entry &entry, const uint8_t *data);
+
+    SdSectorDevice *m_device;
+    uint8_t *m_storage;
+    uint8_t m_count;
+    Entry m_entries[SD_CACHE_MAX_SECTORS];
+    uint32_t m_clock;
+    uint32_t m_mirrorFirst;
+    uint32_t m_mirrorCount;
+    uint32_t m_mirrorStride;
+    uint8_t m_mirrorCopies;
+    uint32_t m_hits;
+    uint32_t m_misses;
+};
+
+class SdFsFile : public Stream {
+public:
+    SdFsFile();
+
+    // Read up to nbyte bytes into buf. Whole sectors are read directly from
+    // the card into buf with a single multi-block transfer per contiguous run
+    // of clusters. Returns the number of bytes read, or -1 on error.
+    int read(void *buf, size_t nbyte);
+    virtual int read();
+    virtual int peek();
+    virtual int available();
+    virtual void flush();
+
+    // Write nbyte bytes from buf. Whole sectors are written directly to the
+    // card with multi-block transfers.
+    virtual size_t write(const uint8_t *buf, size_t size);
+    virtual size_t write(uint8_t val);
+    using Print::write;
+
+    bool seek(uint32_t pos);
+    uint32_t position() {
+        return m_pos;
+    }
+    uint32_t size() {
+        return m_size;
+    }
+    const char *name() {
+        return m_name;
+    }
+    bool isDirectory() {
+        return m_isDir;
+    }
+    // Write back any buffered data and the directory entry.
+    bool sync();
+    void close();
+
+    // Allocate length bytes of physically contiguous clusters to an empty
+    // file and set its size to length, so that it can later be written
+    // sector by sector without touching the FAT.
+    bool preAllocate(uint32_t length);
+    // Shrink the file to length bytes and free the clusters beyond it.
+    bool truncate(uint32_t length);
+
+    // If the file's clusters are contiguous on the card, return the first
+    // and last sector they occupy.
+    bool contiguousRange(uint32_t *firstSector, uint32_t *lastSector);
+
+    operator bool() {
+        return m_fs != nullptr;
+    }
+
+private:
+    friend class SdFileSystem;
+
+    bool seekCluster(uint32_t pos, bool allocate);
+    uint32_t currentSector();
+
+    SdFileSystem *m_fs;
+    uint32_t m_firstCluster;
+    uint32_t m_cluster;
+    uint32_t m_clusterIndex;
+    uint32_t m_pos;
+    uint32_t m_size;
+    uint32_t m_dirSector;
+    uint16_t m_dirOffset;
+    uint8_t m_flags;
+    bool m_isDir;
+    bool m_entryDirty;
+    char m_name[13];
+};
+
+class SdFileSystem {
+public:
+    // A file system on the SD card.
+    SdFileSystem(SdBlockDevice &card);
+    // A file system on other storage. Mount it with mount() rather than
+    // begin().
+    SdFileSystem(SdSectorDevice &device);
+
+    // Initialize the card and mount the first FAT16/FAT32 volume on it.
+    bool begin(uint32_t clockHz = SD_SPI_CLOCK);
+    void end();
+
+    // Mount the first FAT16/FAT32 volume on storage that is ready for use,
+    // and unmount it again after writing everything back. begin() and end()
+    // do this for the card.
+    bool mount();
+    void unmount();
+
+    // Replace the default metadata cache with caller supplied storage of
+    // sectors * 512 bytes (up to SD_CACHE_MAX_SECTORS). May be called before
+    // or after begin().
+    bool cacheBuffer(uint8_t *storage, uint8_t sectors);
+
+    // Keep a hash index of every directory entry on the card in the
+    // supplied table, so that open(), exists() and remove() find an entry
+    // with a single sector read instead of walking its directory. The index
+    // is built when the card is mounted (or now, if it already is) and kept
+    // up to date as files are created and removed. Allow about one and a
+    // half slots per file and directory on the card; if the table fills up
+    // the index is dropped and lookups walk directories as before. Pass
+    // nullptr to stop using an index.
+    bool indexBuffer(SdIndexEntry *table, uint16_t slots);
+    bool indexed() {
+        return m_indexValid;
+    }
+
+    SdFsFile open(const char *path, uint8_t flags = SD_FILE_READ);
+    bool exists(const char *path);
+    bool remove(const char *path);
+    // Call cb for each entry in the directory at path ("/" for the root).
+    bool list(const char *path, SdListCallback cb, void *context);
+    // Write back all cached FAT and directory sectors.
+    bool sync();
+
+    uint32_t clusterSize() {
+        return (uint32_t)SD_SECTOR_SIZE << m_clusterShift;
+    }
+    uint8_t fatType() {
+        return m_fatType;
+    }
+    // The card the file system is on, or nullptr if it is on other
+    // storage.
+    SdBlockDevice *card() {
+        return m_card;
+    }
+    SdSectorCache &cache() {
+        return m_cache;
+    }
+
+private:
+    friend class SdFsFile;
+
+    struct DirEntry {
+        uint32_t sector;
+        uint16_t offset;
+        uint8_t name[11];
+        uint8_t attributes;
+        uint32_t firstCluster;
+        uint32_t size;
+    };
+
+    bool mountVolume(uint32_t volumeStart);
+    uint32_t clusterSector(uint32_t cluster) {
+        return m_dataStart + ((cluster - 2) << m_clusterShift);
+    }
+    bool isEndOfChain(uint32_t cluster) {
+        return cluster >= (m_fatType == 16 ? 0xFFF8 : 0x0FFFFFF8);
+    }
+    uint32_t endOfChain() {
+        return m_fatType == 16 ? 0xFFFF : 0x0FFFFFFF;
+    }
+    bool fatGet(uint32_t cluster, uint32_t *value);
+    bool fatPut(uint32_t cluster, uint32_t value);
+    bool allocate(uint32_t count, uint32_t prev, uint32_t *first);
+    bool freeChain(uint32_t cluster);
+    bool flushMetadata();
+
+    bool dirSector(uint32_t dirCluster, uint32_t index, uint32_t *sector);
+    bool findEntry(uint32_t dirCluster, const uint8_t *name, DirEntry *entry);
+    bool findFree(uint32_t dirCluster, DirEntry *entry);
+    bool lookup(const char *path, DirEntry *entry, uint32_t *parent,
+                uint8_t *leaf);
+    bool writeEntry(const DirEntry &entry);
+    void fillEntry(uint32_t sector, uint16_t offset, const uint8_t *e,
+                   DirEntry *entry);
+
+    uint32_t indexHash(uint32_t dirCluster, const uint8_t *name);
+    bool indexBuild();
+    bool indexWalk(uint32_t dirCluster);
+    bool indexFind(uint32_t dirCluster, const uint8_t *name, DirEntry *entry);
+    bool indexInsert(uint32_t dirCluster, const uint8_t *name,
+                     uint32_t sector, uint16_t offset, bool isDir);
+    void indexRemove(uint32_t dirCluster, const DirEntry &entry);
+
+    // Single-sector staging buffer for partial file data sectors.
+    uint8_t *dataSector(uint32_t sector, bool forWrite);
+    bool dataFlush();
+    void dataInvalidate(uint32_t first, uint32_t count);
+
+    SdBlockDevice *m_card;
+    SdSectorDevice *m_device;
+    uint8_t m_cacheStorage[SD_CACHE_SECTORS * SD_SECTOR_SIZE];
+    SdSectorCache m_cache;
+    uint8_t m_data[SD_SECTOR_SIZE];
+    uint32_t m_dataSectorNum;
+    bool m_dataValid;
+    bool m_dataDirty;
+
+    bool m_mounted;
+    uint8_t m_fatType;
+    uint8_t m_clusterShift;
+    uint32_t m_fatStart;
+    uint32_t m_fatSectors;
+    uint32_t m_rootStart;
+    uint32_t m_rootSectors;
+    uint32_t m_rootCluster;
+    uint32_t m_dataStart;
+    uint32_t m_clusterCount;
+    uint32_t m_allocHint;
+    // FAT32 FSInfo sector (0 if none) and the free cluster count kept for
+    // it (0xFFFFFFFF if unknown).
+    uint32_t m_fsInfoSector;
+    uint32_t m_freeCount;
+    bool m_fsInfoDirty;
+
+    SdIndexEntry *m_index;
+    uint16_t m_indexSlots;
+    uint16_t m_indexUsed;
+    bool m_indexValid;
+};
+
+// The on-board micro SD socket, and the file system on it.
+extern SdBlockDevice SdCard;
+extern SdFileSystem SdCardFs;
+
+#endif // SD_FILE_SYSTEM_H_
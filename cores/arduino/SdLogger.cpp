@@ -0,0 +1,174 @@
+#include "SdLogger.h"
+#include "sync.h"
+
+#define SECTORS_PER_BUFFER (SD_LOGGER_BUFFER_SIZE / SD_SECTOR_SIZE)
+
+SdLogger::SdLogger(SdFileSystem &fs)
+    : m_fs(&fs),
+      m_file(),
+      m_ready(0),
+      m_fill(0),
+      m_fillCount(0),
+      m_send(0),
+      m_sendSector(0),
+      m_sending(false),
+      m_sectorCount(0),
+      m_sectorsWritten(0),
+      m_bytesQueued(0),
+      m_records(0),
+      m_dropped(0),
+      m_active(false),
+      m_error(false) {}
+
+bool SdLogger::begin(const char *path, uint32_t maxBytes) {
+    if (m_active) {
+        return false;
+    }
+
+    // Logging streams straight to the card.
+    if (!m_fs->card()) {
+        return false;
+    }
+    uint32_t firstSector;
+    uint32_t lastSector;
+    m_file = m_fs->open(path, SD_O_READ | SD_O_WRITE | SD_O_CREATE | SD_O_TRUNC);
+    if (!m_file || !m_file.preAllocate(maxBytes) ||
+            !m_file.contiguousRange(&firstSector, &lastSector)) {
+        m_file.close();
+        return false;
+    }
+
+    m_ready = 0;
+    m_fill = 0;
+    m_fillCount = 0;
+    m_send = 0;
+    m_sendSector = 0;
+    m_sending = false;
+    m_sectorCount = (maxBytes + SD_SECTOR_SIZE - 1) / SD_SECTOR_SIZE;
+    m_sectorsWritten = 0;
+    m_bytesQueued = 0;
+    m_records = 0;
+    m_dropped = 0;
+    m_error = false;
+
+    // Telling the card how much is coming lets it pre-erase the run.
+    if (!m_fs->card()->writeStart(firstSector, m_sectorCount)) {
+        m_file.close();
+        return false;
+    }
+    m_active = true;
+    return true;
+}
+
+bool SdLogger::log(const void *record, uint16_t size) {
+    bool queued = false;
+    synchronized {
+        int32_t space = (SD_LOGGER_BUFFERS - m_ready) * SD_LOGGER_BUFFER_SIZE -
+                        m_fillCount;
+        if (m_active && size <= space &&
+                m_bytesQueued + size <= m_sectorCount * SD_SECTOR_SIZE) {
+            const uint8_t *src = static_cast<const uint8_t *>(record);
+            uint16_t left = size;
+            while (left) {
+                uint16_t n = min(left, (uint16_t)(SD_LOGGER_BUFFER_SIZE -
+                                                  m_fillCount));
+                memcpy(&m_buffers[m_fill][m_fillCount], src, n);
+                src += n;
+                left -= n;
+                m_fillCount += n;
+                if (m_fillCount == SD_LOGGER_BUFFER_SIZE) {
+                    m_ready++;
+                    m_fill = (m_fill + 1) % SD_LOGGER_BUFFERS;
+                    m_fillCount = 0;
+                }
+            }
+            m_bytesQueued += size;
+            m_records++;
+            queued = true;
+        }
+        else {
+            m_dropped++;
+        }
+    }
+    return queued;
+}
+
+void SdLogger::service() {
+    if (m_active) {
+        pump();
+    }
+}
+
+bool SdLogger::end() {
+    if (!m_active) {
+        return false;
+    }
+    synchronized {
+        m_active = false;
+    }
+
+    // Drain the full buffers, then write the partial one padded out to a
+    // whole sector.
+    while (!m_error && (m_sending || m_ready)) {
+        pump();
+    }
+    SdBlockDevice &device = *m_fs->card();
+    uint16_t tail = m_fillCount;
+    if (!m_error && tail) {
+        uint8_t *buf = m_buffers[m_fill];
+        uint16_t sectors = (tail + SD_SECTOR_SIZE - 1) / SD_SECTOR_SIZE;
+        memset(buf + tail, 0, sectors * SD_SECTOR_SIZE - tail);
+        for (uint16_t i = 0; i < sectors && !m_error; i++) {
+            if (device.writeData(buf + i * SD_SECTOR_SIZE)) {
+                m_sectorsWritten++;
+            }
+            else {
+                m_error = true;
+            }
+        }
+    }
+    bool ok = device.writeStop() && !m_error;
+
+    // Only keep what actually reached the card.
+    uint32_t length = min(m_bytesQueued, m_sectorsWritten * SD_SECTOR_SIZE);
+    ok &= m_file.truncate(length);
+    m_file.close();
+    return ok;
+}
+
+// Advance the background transfer by at most one sector.
+void SdLogger::pump() {
+    if (m_error) {
+        return;
+    }
+    SdBlockDevice &device = *m_fs->card();
+    if (m_sending) {
+        SdAsyncStatus status = device.writeDataPoll();
+        if (status == SD_ASYNC_BUSY) {
+            return;
+        }
+        m_sending = false;
+        if (status == SD_ASYNC_ERROR) {
+            m_error = true;
+            return;
+        }
+        m_sectorsWritten++;
+        if (++m_sendSector == SECTORS_PER_BUFFER) {
+            m_sendSector = 0;
+            m_send = (m_send + 1) % SD_LOGGER_BUFFERS;
+            synchronized {
+                m_ready--;
+            }
+        }
+    }
+    if (m_ready == 0) {
+        return;
+    }
+    // The DMA transfer overwrites the sector it sends, which is fine since
+    // the buffer is not released to log() until all of it has been sent.
+    if (!device.writeDataAsync(&m_buffers[m_send][m_sendSector * SD_SECTOR_SIZE])) {
+        m_error = true;
+        return;
+    }
+    m_sending = true;
+}
@@ -0,0 +1,101 @@
+/*
+ * High rate binary data logging to the ClearCore SD card.
+ *
+ * The log file is pre-allocated as one contiguous run of clusters when
+ * logging starts, so records can be streamed to the card with a single
+ * open-ended multi-block write and the FAT never has to be touched while
+ * logging. Records are copied into one of two RAM buffers; full buffers are
+ * sent to the card a sector at a time by background DMA from service().
+ *
+ * log() never waits on the card. If both buffers are full, or the file is
+ * full, the record is dropped and counted instead. log() may be called from
+ * an interrupt handler; service() must be called regularly from loop().
+ *
+ * While a log is open the card is held by the logger, and other SdCardFs
+ * operations fail until end() is called.
+ */
+
+#ifndef SD_LOGGER_H_
+#define SD_LOGGER_H_
+
+#include <Arduino.h>
+#include "SdFileSystem.h"
+
+// Size of each of the two record buffers. Must be a multiple of 512.
+#ifndef SD_LOGGER_BUFFER_SIZE
+#define SD_LOGGER_BUFFER_SIZE (8 * SD_SECTOR_SIZE)
+#endif
+
+#define SD_LOGGER_BUFFERS 2
+
+class SdLogger {
+public:
+    SdLogger(SdFileSystem &fs = SdCardFs);
+
+    // Create (or replace) the file at path with room for maxBytes of
+    // records and start logging to it. The file system must already be
+    // mounted with SdCardFs.begin().
+    bool begin(const char *path, uint32_t maxBytes);
+
+    // Queue a record. Returns false if the record was dropped.
+    bool log(const void *record, uint16_t size);
+    template<typename T>
+    bool log(const T &record) {
+        return log(&record, sizeof(T));
+    }
+
+    // Move buffered records to the card. Does not block.
+    void service();
+
+    // Write out any buffered records, set the file size to the number of
+    // bytes logged and close the file. This waits for the card.
+    bool end();
+
+    bool active() {
+        return m_active;
+    }
+    // True if the card reported a write error. Records queued after an
+    // error are kept in RAM until the buffers fill, then dropped.
+    bool error() {
+        return m_error;
+    }
+    uint32_t recordsLogged() {
+        return m_records;
+    }
+    uint32_t recordsDropped() {
+        return m_dropped;
+    }
+    uint32_t bytesLogged() {
+        return m_bytesQueued;
+    }
+    uint32_t capacity() {
+        return m_sectorCount * SD_SECTOR_SIZE;
+    }
+
+private:
+    void pump();
+
+    SdFileSystem *m_fs;
+    SdFsFile m_file;
+    uint8_t m_buffers[SD_LOGGER_BUFFERS][SD_LOGGER_BUFFER_SIZE]
+    __attribute__((aligned(4)));
+
+    // Buffers are filled in order by log(); m_ready counts the full ones
+    // waiting to be sent, starting at m_send.
+    volatile uint8_t m_ready;
+    volatile uint8_t m_fill;
+    volatile uint16_t m_fillCount;
+    uint8_t m_send;
+    uint16_t m_sendSector;
+    bool m_sending;
+
+    uint32_t m_sectorCount;
+    uint32_t m_sectorsWritten;
+    volatile uint32_t m_bytesQueued;
+    volatile uint32_t m_records;
+    volatile uint32_t m_dropped;
+    volatile bool m_active;
+    bool m_error;
+};
+
+#endif // SD_LOGGER_H_
@@ -0,0 +1,29 @@
+/*
+ * Sector storage that an SdFileSystem can be mounted on.
+ *
+ * SdBlockDevice implements it for the SD card. Other implementations let
+ * the file system code run elsewhere, e.g. on a disk image on a PC, where
+ * it can be tested and benchmarked without a card.
+ */
+
+#ifndef SD_SECTOR_DEVICE_H_
+#define SD_SECTOR_DEVICE_H_
+
+#include <stdint.h>
+
+#define SD_SECTOR_SIZE 512
+
+class SdSectorDevice {
+public:
+    // Read or write a single sector.
+    virtual bool readSector(uint32_t sector, uint8_t *dst) = 0;
+    virtual bool writeSector(uint32_t sector, const uint8_t *src) = 0;
+
+    // Read or write count consecutive sectors.
+    virtual bool readSectors(uint32_t sector, uint8_t *dst,
+                             uint32_t count) = 0;
+    virtual bool writeSectors(uint32_t sector, const uint8_t *src,
+                              uint32_t count) = 0;
+};
+
+#endif // SD_SECTOR_DEVICE_H_
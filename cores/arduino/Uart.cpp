@@ -93,6 +93,18 @@ int Uart::read() {
     return m_serial ? m_serial->CharGet() : -1;
 }
 
+size_t Uart::read(uint8_t *buffer, size_t size) {
+    if (!m_serial) {
+        return 0;
+    }
+    int32_t available = m_serial->AvailableForRead();
+    size_t count = available > 0 ? min(size, (size_t)available) : 0;
+    for (size_t i = 0; i < count; i++) {
+        buffer[i] = m_serial->CharGet();
+    }
+    return count;
+}
+
 size_t Uart::write(const uint8_t data) {
     if (m_serial) {
         m_serial->SendChar(data);
@@ -104,6 +116,16 @@ size_t Uart::write(const uint8_t data) {
     return 0;
 }
 
+size_t Uart::write(const uint8_t *buffer, size_t size) {
+    if (!m_serial) {
+        return 0;
+    }
+    for (size_t i = 0; i < size; i++) {
+        m_serial->SendChar(buffer[i]);
+    }
+    return size;
+}
+
 uint8_t Uart::extractNbStopBit(uint16_t config) {
     switch (config & SERIAL_STOP_BIT_MASK) {
         case SERIAL_STOP_BIT_1:
@@ -35,9 +35,15 @@ public:
     int availableForWrite();
     int peek();
     int read();
+    // Read up to size bytes that have already been received into buffer,
+    // without waiting for more. Returns the number of bytes read.
+    size_t read(uint8_t *buffer, size_t size);
     void flush();
     void flushInput();
     size_t write(const uint8_t data);
+    // Queue size bytes for transmission. Only waits if there is less room
+    // than that in the transmit buffer (see availableForWrite()).
+    size_t write(const uint8_t *buffer, size_t size);
     void ttl(bool newState);
     bool ttl();
     using Print::write; // pull in write(str) and write(buf, size) from Print
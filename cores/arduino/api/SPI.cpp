@@ -162,6 +162,10 @@ void SPIClass::waitForTransfer(void) {
     m_serial->SpiAsyncWaitComplete();
 }
 
+bool SPIClass::transferBusy(void) {
+    return m_serial->SpiAsyncStatus();
+}
+
 void SPIClass::attachInterrupt() {
     // Should be enableInterrupt()
 }
@@ -75,6 +75,8 @@ public:
     void transfer(const void *txbuf, void *rxbuf, size_t count,
                   bool block = true);
     void waitForTransfer(void);
+    // Returns true while a non-blocking transfer is still in progress.
+    bool transferBusy(void);
 
     // Transaction Functions
     void usingInterrupt(int interruptNumber);
@@ -56,3 +56,14 @@ static void __halt() {
 }
 void svcHook(void)    __attribute__ ((weak, alias("__halt")));
 void pendSVHook(void) __attribute__ ((weak, alias("__halt")));
+
+/**
+ * Ethernet service hooks
+ *
+ * ethernetTickHook() is called from the SysTick handler every millisecond,
+ * and ethernetServiceHook() from the PendSV handler before pendSVHook().
+ * The Ethernet library provides them to service the network stack from
+ * PendSV. ethernetServiceHook() returns true if it handled the interrupt.
+ */
+void ethernetTickHook(void) __attribute__ ((weak, alias("__empty")));
+int ethernetServiceHook(void) __attribute__ ((weak, alias("__false")));
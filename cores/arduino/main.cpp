@@ -57,12 +57,25 @@ int main(void) {
 /* Default Arduino systick handler */
 extern "C" int sysTickHook(void);
 extern "C" void SysTick_DefaultHandler(void);
+extern "C" void ethernetTickHook(void);
 
 extern "C" void SysTick_Handler(void) __attribute__((weak));
 extern "C" void SysTick_Handler(void) {
     ClearCore::SysMgr.SysTickUpdate();
+    ethernetTickHook();
     if (sysTickHook()) {
         return;
     }
     SysTick_DefaultHandler();
-}
\ No newline at end of file
+}
+
+extern "C" int ethernetServiceHook(void);
+extern "C" void pendSVHook(void);
+
+extern "C" void PendSV_Handler(void) __attribute__((weak));
+extern "C" void PendSV_Handler(void) {
+    if (ethernetServiceHook()) {
+        return;
+    }
+    pendSVHook();
+}
@@ -304,6 +304,13 @@ bool usingDhcp = true;
 // The ClearCore will operate as a TCP client using this object
 EthernetClient client;
 
+// Tune a new connection to notice within a few seconds if the server goes
+// away. Replies are left buffered, so each one goes out as a single segment
+// when loop() flushes it.
+void tuneConnection() {
+  client.setKeepAlive(true, 5000, 1000, 3);
+}
+
 // Select the baud rate to match the target serial device
 #define baudRate 9600
 
@@ -398,6 +405,7 @@ void setup() {
         Serial.println("Failed to connect to server. Retrying...");
   }
   else{
+    tuneConnection();
     client.println("Setup successful");
     client.println("Send 'h' to receive a list of valid commands"); 
   }
@@ -430,6 +438,8 @@ void loop() {
           Serial.println("Failed to connect to server. Retrying...");
           startTime = millis();
         }
+      } else {
+        tuneConnection();
       }
     } else {
     // read and store the input character by character
@@ -816,6 +826,9 @@ void loop() {
 
       } // switch(command letter)
     } // if (inputValid)
+
+    // replies are buffered; send everything written above as one segment
+    client.flush();
   } // if(!client.connected()) else
 }
 
@@ -834,7 +847,10 @@ void loop() {
 */
  void SendFeedback(int32_t messageNumber){
   // send either the verbose message or only the message number, based on verboseFeedback bool
-  if (verboseFeedback){
+  if (verboseFeedback && messageNumber == FB_HELP){
+    // the help text is a constant, so send it without copying it
+    client.writeStatic(msg_help);
+  } else if (verboseFeedback){
     client.println(FeedbackMessages[messageNumber].message);
   } else {
     client.println(FeedbackMessages[messageNumber].number);
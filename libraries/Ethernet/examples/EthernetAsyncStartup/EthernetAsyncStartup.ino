@@ -0,0 +1,98 @@
+/*
+ * Title: EthernetAsyncStartup
+ *
+ * Objective:
+ *    This example demonstrates how to bring up the network and connect to a
+ *    server without blocking loop(), so machine supervision keeps running
+ *    while the network comes up or recovers from a cable being unplugged.
+ *
+ * Description:
+ *    DHCP is started with Ethernet.beginAsync(), which returns at once and
+ *    completes in the background while Ethernet.maintain() is called. When
+ *    an address has been assigned, the client connects to a server with
+ *    connectAsync(), checking connectStatus() each pass through loop(). If
+ *    the connection drops (e.g. the cable is unplugged), connecting starts
+ *    over.
+ *    Meanwhile, loop() keeps mirroring input DI-6 on output IO-0 and counts
+ *    how many passes it makes per second, which is printed to the USB
+ *    serial port to show that it is never held up.
+ *
+ * Setup:
+ * 1. Set serverIp and SERVER_PORT to a TCP server on the network, e.g. a
+ *    ClearCore running EthernetTCPServer_callbacks.
+ *
+ * Links:
+ * ** ClearCore Documentation: https://teknic-inc.github.io/ClearCore-library/
+ * ** ClearCore Manual: https://www.teknic.com/files/downloads/clearcore_user_manual.pdf
+ *
+ * Copyright (c) 2020 Teknic Inc. This work is free to use, copy and distribute under the terms of
+ * the standard MIT permissive software license which can be found at https://opensource.org/licenses/MIT
+ */
+
+#include <Ethernet.h>
+
+// The server to connect to.
+IPAddress serverIp(192, 168, 0, 100);
+#define SERVER_PORT 8888
+
+byte mac[6];
+EthernetClient client;
+
+bool networkUp = false;
+bool connecting = false;
+uint32_t loopCount = 0;
+uint32_t lastReportMs = 0;
+
+void networkStarted(EthernetAsyncStatus status) {
+    if (status == EthernetAsyncSuccess) {
+        Serial.print("DHCP assigned the address ");
+        Serial.println(Ethernet.localIP());
+        networkUp = true;
+    }
+    else {
+        Serial.println("DHCP timed out; trying again.");
+        Ethernet.beginAsync(mac, 60000, networkStarted);
+    }
+}
+
+void setup() {
+    Serial.begin(9600);
+
+    pinMode(IO0, OUTPUT);
+
+    // Returns immediately; networkStarted() is called from maintain().
+    Ethernet.beginAsync(mac, 60000, networkStarted);
+}
+
+void loop() {
+    // The machine keeps being supervised whatever the network is doing.
+    digitalWrite(IO0, digitalRead(DI6));
+    loopCount++;
+
+    Ethernet.maintain();
+
+    if (networkUp && !client.connected()) {
+        if (!connecting) {
+            client.connectAsync(serverIp, SERVER_PORT);
+            connecting = true;
+        }
+        EthernetAsyncStatus status = client.connectStatus();
+        if (status == EthernetAsyncSuccess) {
+            Serial.println("Connected to the server.");
+            client.println("Hello server");
+            client.flush();
+            connecting = false;
+        }
+        else if (status == EthernetAsyncFailed) {
+            Serial.println("Could not connect; trying again.");
+            connecting = false;
+        }
+    }
+
+    if (millis() - lastReportMs >= 1000) {
+        lastReportMs = millis();
+        Serial.print("Loops per second: ");
+        Serial.println(loopCount);
+        loopCount = 0;
+    }
+}
@@ -0,0 +1,107 @@
+/*
+ * Title: EthernetConnectionBenchmark
+ *
+ * Objective:
+ *    This example measures TCP connection setup time, and latency with
+ *    many clients connected at once.
+ *
+ * Description:
+ *    A callback-driven server on TCP port 9003. Each client is greeted
+ *    with a single '>' as soon as it has been accepted, so the time from
+ *    starting to connect to receiving the greeting is the whole setup
+ *    time. After that, everything the client sends is sent back. Up to
+ *    ETHERNET_SERVER_MAX_CLIENTS clients are served at once; further
+ *    connections are closed.
+ *    The number of connections accepted, open and closed is printed to
+ *    the USB serial port once a second.
+ *
+ * Setup:
+ * 1. Run the host-side driver from a Linux PC on the same network:
+ *        python3 extras/ethernet_bench.py <ClearCore IP> connections
+ *    (extras/ is in the Ethernet library's folder). It connects and
+ *    disconnects repeatedly, then holds several connections open and
+ *    exchanges messages on all of them, and reports the percentiles of
+ *    the setup and round-trip times.
+ *
+ * Links:
+ * ** ClearCore Documentation: https://teknic-inc.github.io/ClearCore-library/
+ * ** ClearCore Manual: https://www.teknic.com/files/downloads/clearcore_user_manual.pdf
+ *
+ * Copyright (c) 2020 Teknic Inc. This work is free to use, copy and distribute under the terms of
+ * the standard MIT permissive software license which can be found at https://opensource.org/licenses/MIT
+ */
+
+#include <Ethernet.h>
+
+#define CONNECTION_PORT 9003
+
+EthernetServer server(CONNECTION_PORT);
+
+uint32_t accepted = 0;
+uint32_t closed = 0;
+uint32_t lastReportMs = 0;
+
+void clientConnected(EthernetClient &client, void **context) {
+    accepted++;
+    client.setNoDelay(true);
+    client.write('>');
+}
+
+void clientData(EthernetClient &client, void **context) {
+    EthernetSpan span = client.span();
+    while (span.length) {
+        client.write(span.data, span.length);
+        client.consume(span.length);
+        span = client.span();
+    }
+}
+
+void clientClosed(EthernetClient &client, void **context) {
+    closed++;
+}
+
+void setup() {
+    Serial.begin(9600);
+    uint32_t timeout = 5000;
+    uint32_t startTime = millis();
+    while (!Serial && millis() - startTime < timeout) {
+        continue;
+    }
+
+    // Make sure the physical link is up before continuing.
+    while (Ethernet.linkStatus() == LinkOFF) {
+        Serial.println("The Ethernet cable is unplugged...");
+        delay(1000);
+    }
+
+    byte mac[6];
+    if (!Ethernet.begin(mac)) {
+        Serial.println("DHCP configuration was unsuccessful!");
+        while (true) {
+            // TCP will not work without a configured IP address.
+            continue;
+        }
+    }
+    Serial.print("Local IP: ");
+    Serial.println(Ethernet.localIP());
+
+    server.onConnect(clientConnected);
+    server.onData(clientData);
+    server.onClose(clientClosed);
+    server.begin();
+}
+
+void loop() {
+    // Runs the callbacks.
+    Ethernet.maintain();
+
+    if (millis() - lastReportMs >= 1000) {
+        lastReportMs = millis();
+        Serial.print("Accepted: ");
+        Serial.print(accepted);
+        Serial.print(", open: ");
+        Serial.print(server.clientCount());
+        Serial.print(", closed: ");
+        Serial.println(closed);
+    }
+}
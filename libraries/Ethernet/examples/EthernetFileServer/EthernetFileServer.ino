@@ -0,0 +1,93 @@
+/*
+ * Title: EthernetFileServer
+ *
+ * Objective:
+ *    This example demonstrates how to pull log files off the SD card over
+ *    the network.
+ *
+ * Description:
+ *    The files on the SD card are served on TCP port 2100 (see
+ *    EthernetFile.h for the protocol). While a file is being sent, the
+ *    transfer rate is printed to the USB serial port once a second.
+ *
+ * Setup:
+ * 1. Insert a FAT16 or FAT32 formatted micro SD card with some files on it
+ *    (e.g. logs written by the HighRateLogger example).
+ * 2. List the files, and fetch one, from a PC:
+ *        printf 'LIST\n' | nc <ClearCore IP> 2100
+ *        printf 'GET /LOG.BIN\n' | nc <ClearCore IP> 2100 > log.bin
+ *    The file data follows the "OK <size>" line.
+ * 3. To measure the transfer rate on the PC's side, fetch a large file
+ *    through pv (printf 'GET /LOG.BIN\n' | nc <ClearCore IP> 2100 |
+ *    pv > /dev/null), or time the transfer and divide the size by it.
+ *
+ * Links:
+ * ** ClearCore Documentation: https://teknic-inc.github.io/ClearCore-library/
+ * ** ClearCore Manual: https://www.teknic.com/files/downloads/clearcore_user_manual.pdf
+ *
+ * Copyright (c) 2020 Teknic Inc. This work is free to use, copy and distribute under the terms of
+ * the standard MIT permissive software license which can be found at https://opensource.org/licenses/MIT
+ */
+
+#include <Ethernet.h>
+#include <EthernetFile.h>
+
+EthernetFileServer server(2100);
+
+uint32_t lastBytes = 0;
+uint32_t lastReportMs = 0;
+
+void setup() {
+    Serial.begin(9600);
+    uint32_t timeout = 5000;
+    uint32_t startTime = millis();
+    while (!Serial && millis() - startTime < timeout) {
+        continue;
+    }
+
+    if (!SdCardFs.begin()) {
+        Serial.println("No SD card was found!");
+        while (true) {
+            // There is nothing to serve without a card.
+            continue;
+        }
+    }
+
+    // Make sure the physical link is up before continuing.
+    while (Ethernet.linkStatus() == LinkOFF) {
+        Serial.println("The Ethernet cable is unplugged...");
+        delay(1000);
+    }
+
+    byte mac[6];
+    if (!Ethernet.begin(mac)) {
+        Serial.println("DHCP configuration was unsuccessful!");
+        while (true) {
+            // TCP will not work without a configured IP address.
+            continue;
+        }
+    }
+    Serial.print("Local IP: ");
+    Serial.println(Ethernet.localIP());
+
+    server.begin();
+}
+
+void loop() {
+    server.service();
+    Ethernet.maintain();
+
+    if (millis() - lastReportMs >= 1000) {
+        uint32_t bytes = server.bytesSent();
+        uint32_t elapsedMs = millis() - lastReportMs;
+        lastReportMs = millis();
+        if (bytes != lastBytes) {
+            // Bytes per ms is kB/s.
+            Serial.print("Sending at ");
+            Serial.print((bytes - lastBytes) / elapsedMs);
+            Serial.print(" kB/s, files sent: ");
+            Serial.println(server.filesSent());
+        }
+        lastBytes = bytes;
+    }
+}
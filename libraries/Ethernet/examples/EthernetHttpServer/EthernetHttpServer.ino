@@ -0,0 +1,140 @@
+/*
+ * Title: EthernetHttpServer
+ *
+ * Objective:
+ *    This example demonstrates how to give a ClearCore a web interface with
+ *    EthernetHttpServer, serving pages from flash and the SD card alongside
+ *    live data, without holding up loop().
+ *
+ * Description:
+ *    This example serves:
+ *      /             a page kept in flash, sent without being copied
+ *      /api/status   the state of input DI-6 and the reading of A-12 as
+ *                    JSON, built on each request (sent in chunks, as its
+ *                    length is not known up front)
+ *      /api/output   sets output IO-0 from a form field, e.g.
+ *                    /api/output?on=1
+ *      /files/...    the files in the /www directory of the SD card
+ *    Browsers keep their connections open between requests, and several
+ *    can be served at once. Large files are sent only as fast as each
+ *    browser takes them, so loop() keeps running; the number of passes it
+ *    makes per second is printed to the USB serial port to show this.
+ *
+ * Setup:
+ * 1. Optionally, put files to serve in a /www directory on an SD card and
+ *    insert it in the ClearCore.
+ * 2. Browse to the address printed to the USB serial port. To check the
+ *    server from a PC, and measure its requests per second, run
+ *      python3 http_check.py <address>
+ *    from the library's extras directory. The same checks can be run
+ *    without a ClearCore, against this sketch built for the PC, with
+ *    "make check" in extras/host.
+ *
+ * Links:
+ * ** ClearCore Documentation: https://teknic-inc.github.io/ClearCore-library/
+ * ** ClearCore Manual: https://www.teknic.com/files/downloads/clearcore_user_manual.pdf
+ *
+ * Copyright (c) 2020 Teknic Inc. This work is free to use, copy and distribute under the terms of
+ * the standard MIT permissive software license which can be found at https://opensource.org/licenses/MIT
+ */
+
+#include <Ethernet.h>
+#include <EthernetHttp.h>
+
+// The home page, kept in flash.
+const char indexPage[] =
+    "<!DOCTYPE html>\n"
+    "<html><head><title>ClearCore</title></head><body>\n"
+    "<h1>ClearCore</h1>\n"
+    "<p>Status: <span id=\"status\"></span></p>\n"
+    "<p><a href=\"/api/output?on=1\">IO-0 on</a> "
+    "<a href=\"/api/output?on=0\">IO-0 off</a></p>\n"
+    "<script>\n"
+    "setInterval(function() {\n"
+    "  fetch('/api/status').then(r => r.text()).then(t =>\n"
+    "    document.getElementById('status').textContent = t);\n"
+    "}, 500);\n"
+    "</script>\n"
+    "</body></html>\n";
+
+EthernetHttpServer server(80);
+
+uint32_t loopCount = 0;
+uint32_t lastReportMs = 0;
+
+void status(EthernetHttpRequest &request, EthernetHttpResponse &response) {
+    response.begin(200, "application/json");
+    response.print("{\"di6\": ");
+    response.print(digitalRead(DI6));
+    response.print(", \"a12\": ");
+    response.print(analogRead(A12));
+    response.print("}");
+}
+
+void output(EthernetHttpRequest &request, EthernetHttpResponse &response) {
+    char value[4];
+    if (!request.arg("on", value, sizeof(value))) {
+        response.sendError(400);
+        return;
+    }
+    digitalWrite(IO0, value[0] == '1');
+    response.begin(200, "text/plain");
+    response.print("IO-0 is ");
+    response.println(value[0] == '1' ? "on" : "off");
+}
+
+void setup() {
+    Serial.begin(9600);
+    uint32_t timeout = 5000;
+    uint32_t startTime = millis();
+    while (!Serial && millis() - startTime < timeout) {
+        continue;
+    }
+
+    pinMode(IO0, OUTPUT);
+
+    // Make sure the physical link is up before continuing.
+    while (Ethernet.linkStatus() == LinkOFF) {
+        Serial.println("The Ethernet cable is unplugged...");
+        delay(1000);
+    }
+
+    byte mac[6];
+    if (!Ethernet.begin(mac)) {
+        Serial.println("DHCP configuration was unsuccessful!");
+        while (true) {
+            // TCP will not work without a configured IP address.
+            continue;
+        }
+    }
+    Serial.print("Browse to http://");
+    Serial.println(Ethernet.localIP());
+
+    if (!SdCardFs.begin()) {
+        Serial.println("No SD card; /files/ will not be served.");
+    }
+
+    server.serveStatic("/", (const uint8_t *)indexPage,
+                       sizeof(indexPage) - 1, "text/html");
+    server.on("/api/status", status, HttpGet);
+    server.on("/api/output", output, HttpGet);
+    server.serveSd("/files/", "/www/");
+    server.begin();
+}
+
+void loop() {
+    server.service();
+    Ethernet.maintain();
+
+    loopCount++;
+    if (millis() - lastReportMs >= 1000) {
+        lastReportMs = millis();
+        Serial.print("Loops per second: ");
+        Serial.print(loopCount);
+        Serial.print(", browsers: ");
+        Serial.print(server.connectionCount());
+        Serial.print(", requests: ");
+        Serial.println(server.requestsServed());
+        loopCount = 0;
+    }
+}
@@ -0,0 +1,84 @@
+/*
+ * Title: EthernetInterruptService
+ *
+ * Objective:
+ *    This example demonstrates how to keep the network responsive while
+ *    loop() is busy for long stretches, by servicing the network stack from
+ *    an interrupt.
+ *
+ * Description:
+ *    Ethernet.setInterruptService(true) makes the lowest-priority interrupt
+ *    (PendSV) process received frames and the network stack's timers every
+ *    millisecond, instead of only when Ethernet.maintain() or another
+ *    Ethernet function is called.
+ *    This example echoes UDP datagrams sent to port 8888 back to their
+ *    sender from an onPacket() handler, which then runs in that interrupt.
+ *    loop() deliberately blocks for 200 ms at a time, yet datagrams are
+ *    still answered within a millisecond or two. Ping the ClearCore to see
+ *    the same effect on ICMP.
+ *
+ * Setup:
+ * 1. Send UDP datagrams to port 8888 of the ClearCore, e.g. with
+ *    "socat - UDP4-DATAGRAM:<ClearCore address>:8888" on a PC.
+ *
+ * Links:
+ * ** ClearCore Documentation: https://teknic-inc.github.io/ClearCore-library/
+ * ** ClearCore Manual: https://www.teknic.com/files/downloads/clearcore_user_manual.pdf
+ *
+ * Copyright (c) 2020 Teknic Inc. This work is free to use, copy and distribute under the terms of
+ * the standard MIT permissive software license which can be found at https://opensource.org/licenses/MIT
+ */
+
+#include <Ethernet.h>
+
+#define LOCAL_PORT 8888
+
+EthernetUDP Udp;
+
+// Runs in the PendSV interrupt; keep it short.
+void echo(EthernetUDP &udp) {
+    const uint8_t *data;
+    int length = udp.receive(&data);
+    if (length > 0) {
+        udp.sendTo(udp.remoteIP(), udp.remotePort(), data, length);
+    }
+}
+
+void setup() {
+    Serial.begin(9600);
+    uint32_t timeout = 5000;
+    uint32_t startTime = millis();
+    while (!Serial && millis() - startTime < timeout) {
+        continue;
+    }
+
+    // Make sure the physical link is up before continuing.
+    while (Ethernet.linkStatus() == LinkOFF) {
+        Serial.println("The Ethernet cable is unplugged...");
+        delay(1000);
+    }
+
+    byte mac[6];
+    if (!Ethernet.begin(mac)) {
+        Serial.println("DHCP configuration was unsuccessful!");
+        while (true) {
+            // UDP will not work without a configured IP address.
+            continue;
+        }
+    }
+    Serial.print("Local IP address: ");
+    Serial.println(Ethernet.localIP());
+
+    Udp.begin(LOCAL_PORT);
+    Udp.onPacket(echo);
+
+    Ethernet.setInterruptService(true);
+}
+
+void loop() {
+    // Stand-in for a long computation; the network keeps working meanwhile.
+    delay(200);
+
+    Serial.print("Datagrams echoed: ");
+    Serial.println(Udp.packetsReceived());
+}
@@ -0,0 +1,132 @@
+/*
+ * Title: EthernetModbusServer
+ *
+ * Objective:
+ *    This example demonstrates how to make the ClearCore a Modbus TCP
+ *    server, so a PLC, HMI or SCADA system can read its I/O and command a
+ *    motor.
+ *
+ * Description:
+ *    The server's register map is set up once in setup(); each request is
+ *    then answered straight from the bound connectors and motor:
+ *
+ *    Coils
+ *      0       IO-0 output state
+ *    Discrete inputs
+ *      0       DI-6 state
+ *      1       M-0 move finished
+ *    Input registers
+ *      0       A-12 reading
+ *      1       M-0 HLFB torque, in tenths of a percent
+ *      2-3     M-0 commanded velocity (32-bit, high word first)
+ *      4       Number of masters connected
+ *    Holding registers
+ *      0-1     M-0 commanded position (32-bit); writing it moves there
+ *      2-3     M-0 velocity limit (32-bit), read back as last written
+ *      4-5     M-0 acceleration limit (32-bit), read back as last written
+ *      6       M-0 enable (1 or 0)
+ *      7       A general purpose register
+ *
+ *    Several masters can be connected at once, and requests they send
+ *    without waiting for earlier responses are all answered on the next
+ *    service(). The number of requests served is printed to the USB serial
+ *    port once a second.
+ *
+ * Setup:
+ * 1. Optionally, connect a ClearPath motor to M-0 with HLFB set to
+ *    "ASG-Position w/Measured Torque", and an analog source to A-12.
+ * 2. Connect a Modbus TCP client to port 502 of the address printed to the
+ *    USB serial port. To check every function code, the exception
+ *    responses and pipelining from a PC, and measure transactions per
+ *    second, run
+ *      python3 modbus_check.py <address>
+ *    from the library's extras directory. The same checks can be run
+ *    without a ClearCore, against this sketch built for the PC, with
+ *    "make check" in extras/host.
+ *
+ * Links:
+ * ** ClearCore Documentation: https://teknic-inc.github.io/ClearCore-library/
+ * ** ClearCore Manual: https://www.teknic.com/files/downloads/clearcore_user_manual.pdf
+ *
+ * Copyright (c) 2020 Teknic Inc. This work is free to use, copy and distribute under the terms of
+ * the standard MIT permissive software license which can be found at https://opensource.org/licenses/MIT
+ */
+
+#include <Ethernet.h>
+#include <EthernetModbus.h>
+
+EthernetModbusServer modbus(502);
+
+// A register the masters can use for their own purposes.
+uint16_t generalRegister = 0;
+
+uint32_t lastReportMs = 0;
+
+uint16_t readConnectionCount(void *context) {
+    return modbus.connectionCount();
+}
+
+void setup() {
+    Serial.begin(9600);
+    uint32_t timeout = 5000;
+    uint32_t startTime = millis();
+    while (!Serial && millis() - startTime < timeout) {
+        continue;
+    }
+
+    // Make sure the physical link is up before continuing.
+    while (Ethernet.linkStatus() == LinkOFF) {
+        Serial.println("The Ethernet cable is unplugged...");
+        delay(1000);
+    }
+
+    byte mac[6];
+    if (!Ethernet.begin(mac)) {
+        Serial.println("DHCP configuration was unsuccessful!");
+        while (true) {
+            // TCP will not work without a configured IP address.
+            continue;
+        }
+    }
+    Serial.print("Modbus TCP server at ");
+    Serial.println(Ethernet.localIP());
+
+    pinMode(IO0, OUTPUT);
+
+    // Motor setup. The velocity and acceleration limits are left for the
+    // masters to write before they command moves.
+    MotorMgr.MotorModeSet(MotorManager::MOTOR_ALL,
+                          Connector::CPM_MODE_STEP_AND_DIR);
+    ConnectorM0.HlfbMode(MotorDriver::HLFB_MODE_HAS_BIPOLAR_PWM);
+    ConnectorM0.HlfbCarrier(MotorDriver::HLFB_CARRIER_482_HZ);
+
+    modbus.bind(ModbusCoils, 0, ConnectorIO0);
+    modbus.bind(ModbusDiscreteInputs, 0, ConnectorDI6);
+    modbus.bind(ModbusDiscreteInputs, 1, ConnectorM0, ModbusMotorStepsComplete);
+    modbus.bind(ModbusInputRegisters, 0, ConnectorA12);
+    modbus.bind(ModbusInputRegisters, 1, ConnectorM0, ModbusMotorTorque);
+    modbus.bind(ModbusInputRegisters, 2, ConnectorM0, ModbusMotorVelocity);
+    modbus.bind(ModbusInputRegisters, 4, readConnectionCount, nullptr);
+    modbus.bind(ModbusHoldingRegisters, 0, ConnectorM0, ModbusMotorPosition);
+    modbus.bind(ModbusHoldingRegisters, 2, ConnectorM0,
+                ModbusMotorVelocityLimit);
+    modbus.bind(ModbusHoldingRegisters, 4, ConnectorM0, ModbusMotorAccelLimit);
+    modbus.bind(ModbusHoldingRegisters, 6, ConnectorM0, ModbusMotorEnable);
+    modbus.bind(ModbusHoldingRegisters, 7, &generalRegister);
+    modbus.begin();
+}
+
+void loop() {
+    modbus.service();
+    Ethernet.maintain();
+
+    if (millis() - lastReportMs >= 1000) {
+        lastReportMs = millis();
+        Serial.print("Masters: ");
+        Serial.print(modbus.connectionCount());
+        Serial.print(", requests: ");
+        Serial.print(modbus.requestsServed());
+        Serial.print(", exceptions: ");
+        Serial.println(modbus.exceptions());
+    }
+}
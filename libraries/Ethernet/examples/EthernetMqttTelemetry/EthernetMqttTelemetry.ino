@@ -0,0 +1,148 @@
+/*
+ * Title: EthernetMqttTelemetry
+ *
+ * Objective:
+ *    This example demonstrates how to publish machine telemetry to an MQTT
+ *    broker, and take commands from it, without holding up loop().
+ *
+ * Description:
+ *    Every PUBLISH_PERIOD_MS the commanded position and HLFB torque of the
+ *    motor on M-0 and the reading of A-12 are published with QoS 0. The
+ *    messages of one period go out together in a single TCP segment. Each
+ *    change of DI-6 is published with QoS 1, so the broker is sure to get
+ *    it even across a reconnect.
+ *    Messages published to "clearcore/cmd/io0" set the IO-0 output ("1"
+ *    or "0").
+ *    The client connects, and reconnects whenever the connection is lost,
+ *    in the background. The number of messages published and dropped is
+ *    printed to the USB serial port once a second.
+ *
+ * Setup:
+ * 1. Run an MQTT broker (e.g. mosquitto) on the network, and set
+ *    brokerIp below to its address. To use topic aliases, which make
+ *    messages on the telemetry topics smaller, set MQTT_VERSION to 5.
+ * 2. Optionally, connect a ClearPath motor with HLFB set to "ASG-Position
+ *    w/Measured Torque" to M-0, and an analog source to A-12.
+ * 3. Watch the messages with e.g. mosquitto_sub -v -t 'clearcore/#', and
+ *    set the output with mosquitto_pub -t clearcore/cmd/io0 -m 1. To check
+ *    the client's QoS, batching, topic aliases and resending after a
+ *    reconnect, run
+ *      python3 mqtt_check.py
+ *    from the library's extras directory, on the PC brokerIp points to, in
+ *    place of the broker. The same checks can be run without a ClearCore,
+ *    against this sketch built for the PC, with "make check" in
+ *    extras/host.
+ *
+ * Links:
+ * ** ClearCore Documentation: https://teknic-inc.github.io/ClearCore-library/
+ * ** ClearCore Manual: https://www.teknic.com/files/downloads/clearcore_user_manual.pdf
+ *
+ * Copyright (c) 2020 Teknic Inc. This work is free to use, copy and distribute under the terms of
+ * the standard MIT permissive software license which can be found at https://opensource.org/licenses/MIT
+ */
+
+#include <Ethernet.h>
+#include <EthernetMqtt.h>
+
+// Time between telemetry messages, in ms.
+#define PUBLISH_PERIOD_MS 100
+
+// 4 for MQTT 3.1.1, or 5.
+#ifndef MQTT_VERSION
+#define MQTT_VERSION 4
+#endif
+
+// The broker's address.
+IPAddress brokerIp(192, 168, 1, 10);
+
+EthernetMqttClient mqtt;
+
+int8_t positionTopic;
+int8_t torqueTopic;
+int8_t analogTopic;
+int8_t inputTopic;
+
+bool lastInput = false;
+uint32_t lastPublishMs = 0;
+uint32_t lastReportMs = 0;
+
+void messageReceived(const char *topic, const uint8_t *payload,
+                     size_t length) {
+    if (!strcmp(topic, "clearcore/cmd/io0") && length == 1) {
+        digitalWrite(IO0, payload[0] == '1');
+    }
+}
+
+void publishValue(int8_t topic, int32_t value, uint8_t qos = 0) {
+    char text[12];
+    itoa(value, text, 10);
+    mqtt.publish(topic, text, qos);
+}
+
+void setup() {
+    Serial.begin(9600);
+    uint32_t timeout = 5000;
+    uint32_t startTime = millis();
+    while (!Serial && millis() - startTime < timeout) {
+        continue;
+    }
+
+    // Make sure the physical link is up before continuing.
+    while (Ethernet.linkStatus() == LinkOFF) {
+        Serial.println("The Ethernet cable is unplugged...");
+        delay(1000);
+    }
+
+    byte mac[6];
+    if (!Ethernet.begin(mac)) {
+        Serial.println("DHCP configuration was unsuccessful!");
+        while (true) {
+            // TCP will not work without a configured IP address.
+            continue;
+        }
+    }
+
+    pinMode(IO0, OUTPUT);
+
+    positionTopic = mqtt.addTopic("clearcore/m0/position");
+    torqueTopic = mqtt.addTopic("clearcore/m0/torque");
+    analogTopic = mqtt.addTopic("clearcore/a12");
+    inputTopic = mqtt.addTopic("clearcore/di6");
+
+    mqtt.setProtocolVersion(MQTT_VERSION);
+    mqtt.onMessage(messageReceived);
+    mqtt.subscribe("clearcore/cmd/#", 1);
+    mqtt.begin(brokerIp, 1883, "clearcore");
+}
+
+void loop() {
+    mqtt.service();
+    Ethernet.maintain();
+
+    if (mqtt.connected() && millis() - lastPublishMs >= PUBLISH_PERIOD_MS) {
+        lastPublishMs = millis();
+        publishValue(positionTopic, ConnectorM0.PositionRefCommanded());
+        publishValue(torqueTopic, ConnectorM0.HlfbPercent() * 10);
+        publishValue(analogTopic, analogRead(A12));
+        // The three messages are sent together by the next service().
+    }
+
+    bool input = digitalRead(DI6);
+    if (input != lastInput) {
+        // Kept until the broker acknowledges it, across reconnects.
+        if (mqtt.publish(inputTopic, input ? "1" : "0", 1)) {
+            lastInput = input;
+        }
+    }
+
+    if (millis() - lastReportMs >= 1000) {
+        lastReportMs = millis();
+        Serial.print(mqtt.connected() ? "Connected" : "Not connected");
+        Serial.print(", published: ");
+        Serial.print(mqtt.published());
+        Serial.print(", dropped: ");
+        Serial.print(mqtt.dropped());
+        Serial.print(", waiting for acknowledgement: ");
+        Serial.println(mqtt.inFlight());
+    }
+}
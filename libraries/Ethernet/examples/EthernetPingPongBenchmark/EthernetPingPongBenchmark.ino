@@ -0,0 +1,116 @@
+/*
+ * Title: EthernetPingPongBenchmark
+ *
+ * Objective:
+ *    This example measures request/response latency over TCP and UDP.
+ *
+ * Description:
+ *    Every datagram received on UDP port 9002 is sent straight back to its
+ *    sender, from the network stack's interrupt, so the round trip does not
+ *    depend on how long loop() takes. Data received from a client on TCP
+ *    port 9002 is likewise sent back as soon as loop() sees it, without
+ *    waiting to be coalesced with more data. The round-trip times are
+ *    measured by the host-side driver.
+ *    loop() also does some unrelated busy work, standing in for an
+ *    application, so the cost of servicing the network from loop() (for
+ *    TCP) against the interrupt (for UDP) shows up in the results. Set
+ *    BUSY_US to 0 to measure the stack alone.
+ *
+ * Setup:
+ * 1. Run the host-side driver from a Linux PC on the same network:
+ *        python3 extras/ethernet_bench.py <ClearCore IP> ping-pong udp
+ *        python3 extras/ethernet_bench.py <ClearCore IP> ping-pong tcp
+ *    (extras/ is in the Ethernet library's folder). It reports the
+ *    percentiles of the round-trip times.
+ *
+ * Links:
+ * ** ClearCore Documentation: https://teknic-inc.github.io/ClearCore-library/
+ * ** ClearCore Manual: https://www.teknic.com/files/downloads/clearcore_user_manual.pdf
+ *
+ * Copyright (c) 2020 Teknic Inc. This work is free to use, copy and distribute under the terms of
+ * the standard MIT permissive software license which can be found at https://opensource.org/licenses/MIT
+ */
+
+#include <Ethernet.h>
+
+#define PING_PORT 9002
+
+// Time loop() spends on other work each pass, in us.
+#define BUSY_US 200
+
+EthernetUDP udp;
+EthernetServer server(PING_PORT);
+EthernetClient client;
+
+uint32_t lastReportMs = 0;
+uint32_t tcpPongs = 0;
+volatile uint32_t udpPongs = 0;
+
+void pong(EthernetUDP &socket) {
+    const uint8_t *data;
+    int length = socket.receive(&data);
+    if (length > 0 &&
+            socket.sendTo(socket.remoteIP(), socket.remotePort(), data,
+                          length)) {
+        udpPongs++;
+    }
+}
+
+void setup() {
+    Serial.begin(9600);
+    uint32_t timeout = 5000;
+    uint32_t startTime = millis();
+    while (!Serial && millis() - startTime < timeout) {
+        continue;
+    }
+
+    // Make sure the physical link is up before continuing.
+    while (Ethernet.linkStatus() == LinkOFF) {
+        Serial.println("The Ethernet cable is unplugged...");
+        delay(1000);
+    }
+
+    byte mac[6];
+    if (!Ethernet.begin(mac)) {
+        Serial.println("DHCP configuration was unsuccessful!");
+        while (true) {
+            // TCP and UDP will not work without a configured IP address.
+            continue;
+        }
+    }
+    Serial.print("Local IP: ");
+    Serial.println(Ethernet.localIP());
+
+    udp.begin(PING_PORT);
+    udp.onPacket(pong);
+    server.begin();
+    // Run pong() from the interrupt, as each datagram arrives.
+    Ethernet.setInterruptService(true);
+}
+
+void loop() {
+    Ethernet.maintain();
+
+    if (!client.connected()) {
+        client.stop();
+        client = server.accept();
+        client.setNoDelay(true);
+    }
+    EthernetSpan span = client.span();
+    if (span.length && client.availableForWrite() >= (int)span.length) {
+        client.write(span.data, span.length);
+        client.consume(span.length);
+        tcpPongs++;
+    }
+
+    // Other work.
+    delayMicroseconds(BUSY_US);
+
+    if (millis() - lastReportMs >= 1000) {
+        lastReportMs = millis();
+        Serial.print("UDP responses: ");
+        Serial.print(udpPongs);
+        Serial.print(", TCP responses: ");
+        Serial.println(tcpPongs);
+    }
+}
@@ -0,0 +1,101 @@
+/*
+ * Title: EthernetSerialBridge
+ *
+ * Objective:
+ *    This example demonstrates how to reach an RS-232 device connected to
+ *    COM-0 over the network.
+ *
+ * Description:
+ *    COM-0 is bridged to TCP port 2217. With REMOTE_CONTROL set to true
+ *    the port speaks RFC 2217, so the client can change the baud rate and
+ *    framing; otherwise it carries the raw serial data at SERIAL_BAUD.
+ *    The data rate each way is printed to the USB serial port once a
+ *    second.
+ *
+ * Setup:
+ * 1. Connect the RS-232 device to COM-0 (in RS-232 mode, the default).
+ * 2. Set REMOTE_CONTROL to match the client. With remote control, use an
+ *    RFC 2217 client such as pyserial:
+ *        serial.serial_for_url("rfc2217://<ClearCore IP>:2217",
+ *                              baudrate=921600)
+ *    or a virtual COM port driver that supports RFC 2217. Without it, any
+ *    TCP client (e.g. nc <ClearCore IP> 2217) will do.
+ * 3. To measure the bridge's throughput, jumper COM-0's transmit and
+ *    receive lines together instead of connecting a device, and have the
+ *    client send a continuous stream at 921600 baud and read it back. The
+ *    printed rates show how much of the line's 92160 bytes/s (8N1) gets
+ *    through each way.
+ *
+ * Links:
+ * ** ClearCore Documentation: https://teknic-inc.github.io/ClearCore-library/
+ * ** ClearCore Manual: https://www.teknic.com/files/downloads/clearcore_user_manual.pdf
+ *
+ * Copyright (c) 2020 Teknic Inc. This work is free to use, copy and distribute under the terms of
+ * the standard MIT permissive software license which can be found at https://opensource.org/licenses/MIT
+ */
+
+#include <Ethernet.h>
+#include <EthernetSerialBridge.h>
+
+// Baud rate COM-0 starts at.
+#define SERIAL_BAUD 921600
+
+// Take RFC 2217 commands from the client.
+#define REMOTE_CONTROL true
+
+EthernetSerialBridge bridge(Serial0, 2217);
+
+uint32_t lastToNetwork = 0;
+uint32_t lastToSerial = 0;
+uint32_t lastReportMs = 0;
+
+void setup() {
+    Serial.begin(9600);
+    uint32_t timeout = 5000;
+    uint32_t startTime = millis();
+    while (!Serial && millis() - startTime < timeout) {
+        continue;
+    }
+
+    // Make sure the physical link is up before continuing.
+    while (Ethernet.linkStatus() == LinkOFF) {
+        Serial.println("The Ethernet cable is unplugged...");
+        delay(1000);
+    }
+
+    byte mac[6];
+    if (!Ethernet.begin(mac)) {
+        Serial.println("DHCP configuration was unsuccessful!");
+        while (true) {
+            // TCP will not work without a configured IP address.
+            continue;
+        }
+    }
+    Serial.print("Local IP: ");
+    Serial.println(Ethernet.localIP());
+
+    bridge.setRemoteControl(REMOTE_CONTROL);
+    bridge.begin(SERIAL_BAUD);
+}
+
+void loop() {
+    // Keep loop() short: COM-0 only buffers a few characters.
+    bridge.service();
+    Ethernet.maintain();
+
+    if (millis() - lastReportMs >= 1000) {
+        lastReportMs = millis();
+        uint32_t toNetwork = bridge.bytesToNetwork();
+        uint32_t toSerial = bridge.bytesToSerial();
+        Serial.print(bridge.connected() ? "Connected" : "Not connected");
+        Serial.print(", baud: ");
+        Serial.print(bridge.baudRate());
+        Serial.print(", to network: ");
+        Serial.print(toNetwork - lastToNetwork);
+        Serial.print(" bytes/s, to serial: ");
+        Serial.print(toSerial - lastToSerial);
+        Serial.println(" bytes/s");
+        lastToNetwork = toNetwork;
+        lastToSerial = toSerial;
+    }
+}
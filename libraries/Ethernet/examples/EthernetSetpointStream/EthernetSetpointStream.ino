@@ -0,0 +1,131 @@
+/*
+ * Title: EthernetSetpointStream
+ *
+ * Objective:
+ *    This example demonstrates how to drive motors from a trajectory
+ *    generated on a PC, streamed to the ClearCore as setpoints over UDP.
+ *
+ * Description:
+ *    The PC sends a datagram every 2 ms to port 9100: a 32-bit sequence
+ *    number, counting up by one per datagram, then a velocity setpoint for
+ *    M-0 (steps per second) and an absolute position setpoint for M-1
+ *    (steps), all little-endian. The setpoints are held in a jitter buffer
+ *    and played out every 2 ms, 4 ticks (8 ms) behind the stream, so
+ *    variations in network delay of up to 8 ms do not reach the motors.
+ *    If setpoints stop arriving, the motors keep their last setpoint, or
+ *    decelerate to a stop if DECELERATE_ON_UNDERRUN is true; once the
+ *    stream has been silent for 200 ms, they decelerate to a stop and the
+ *    next datagram starts a new stream.
+ *    The stream statistics (buffer level, arrival jitter, late and lost
+ *    setpoints) are printed to the USB serial port once a second. Use them
+ *    to pick the depth: raise it while setpoints are arriving late.
+ *
+ * Setup:
+ * 1. Connect ClearPath motors to M-0 and M-1, with HLFB set to
+ *    "ASG-Position w/Measured Torque". M-2 and M-3 can be added the same
+ *    way, as further setpoints in each datagram.
+ * 2. Stream setpoints from the PC. A minimal stream in Python, a sine wave
+ *    on both axes:
+ *        import math, socket, struct, time
+ *        s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+ *        start = time.perf_counter()
+ *        for seq in range(100000):
+ *            t = seq * 0.002
+ *            s.sendto(struct.pack('<Iii', seq,
+ *                                 int(5000 * math.cos(t)),
+ *                                 int(5000 * math.sin(t))),
+ *                     ('<ClearCore IP>', 9100))
+ *            while time.perf_counter() < start + t + 0.002:
+ *                pass
+ *
+ * Links:
+ * ** ClearCore Documentation: https://teknic-inc.github.io/ClearCore-library/
+ * ** ClearCore Manual: https://www.teknic.com/files/downloads/clearcore_user_manual.pdf
+ *
+ * Copyright (c) 2020 Teknic Inc. This work is free to use, copy and distribute under the terms of
+ * the standard MIT permissive software license which can be found at https://opensource.org/licenses/MIT
+ */
+
+#include <Ethernet.h>
+#include <EthernetSetpoint.h>
+
+// Stop the motors when setpoints run out, rather than hold the last ones.
+#define DECELERATE_ON_UNDERRUN false
+
+#define SETPOINT_PORT 9100
+#define TICK_US 2000
+#define DEPTH 4
+
+EthernetSetpointStream setpoints;
+
+uint32_t lastReportMs = 0;
+
+void setup() {
+    Serial.begin(9600);
+    uint32_t timeout = 5000;
+    uint32_t startTime = millis();
+    while (!Serial && millis() - startTime < timeout) {
+        continue;
+    }
+
+    // Make sure the physical link is up before continuing.
+    while (Ethernet.linkStatus() == LinkOFF) {
+        Serial.println("The Ethernet cable is unplugged...");
+        delay(1000);
+    }
+
+    byte mac[6];
+    if (!Ethernet.begin(mac)) {
+        Serial.println("DHCP configuration was unsuccessful!");
+        while (true) {
+            // UDP will not work without a configured IP address.
+            continue;
+        }
+    }
+    Serial.print("Setpoint stream at ");
+    Serial.print(Ethernet.localIP());
+    Serial.print(":");
+    Serial.println(SETPOINT_PORT);
+
+    // Receive and timestamp setpoints as they arrive, even while loop() is
+    // busy printing.
+    Ethernet.setInterruptService(true);
+
+    MotorMgr.MotorModeSet(MotorManager::MOTOR_ALL,
+                          Connector::CPM_MODE_STEP_AND_DIR);
+    ConnectorM0.HlfbMode(MotorDriver::HLFB_MODE_HAS_BIPOLAR_PWM);
+    ConnectorM0.HlfbCarrier(MotorDriver::HLFB_CARRIER_482_HZ);
+    ConnectorM1.HlfbMode(MotorDriver::HLFB_MODE_HAS_BIPOLAR_PWM);
+    ConnectorM1.HlfbCarrier(MotorDriver::HLFB_CARRIER_482_HZ);
+    // The limits shape the motion between setpoints: high enough to follow
+    // the trajectory, low enough to smooth the steps between ticks.
+    ConnectorM0.VelMax(20000);
+    ConnectorM0.AccelMax(200000);
+    ConnectorM1.VelMax(20000);
+    ConnectorM1.AccelMax(200000);
+    ConnectorM0.EnableRequest(true);
+    ConnectorM1.EnableRequest(true);
+
+    setpoints.attach(0, ConnectorM0, SetpointVelocity);
+    setpoints.attach(1, ConnectorM1, SetpointPosition);
+    if (DECELERATE_ON_UNDERRUN) {
+        setpoints.setUnderrun(SetpointDecelerate);
+    }
+    if (!setpoints.begin(SETPOINT_PORT, TICK_US, DEPTH)) {
+        Serial.println("Could not open the setpoint port!");
+        while (true) {
+            continue;
+        }
+    }
+}
+
+void loop() {
+    // Called far more often than once a tick; setpoints are played out
+    // when their tick comes due.
+    setpoints.service();
+
+    if (millis() - lastReportMs >= 1000) {
+        lastReportMs = millis();
+        Serial.println(setpoints.stats());
+    }
+}
@@ -0,0 +1,106 @@
+/*
+ * Title: EthernetStatistics
+ *
+ * Objective:
+ *    This example demonstrates how to monitor the network stack's memory
+ *    pools and the health of a TCP connection, to size buffers and track
+ *    down throughput problems.
+ *
+ * Description:
+ *    This example connects to a TCP server and keeps sending it data. Every
+ *    five seconds it prints the network stack's statistics (memory pool
+ *    usage, high-water marks, allocation failures and traffic counters) and
+ *    the connection's statistics (bytes sent and received, retransmissions
+ *    and round-trip time) to the USB serial port.
+ *    Set sendBinary to true to send both as compact binary records over the
+ *    connection instead, for logging by the server.
+ *
+ * Setup:
+ * 1. Set serverIp and SERVER_PORT to a TCP server on the network, e.g. a
+ *    ClearCore running EthernetTCPServer_callbacks, or a PC running
+ *    "socat TCP-LISTEN:8888,fork -".
+ *
+ * Links:
+ * ** ClearCore Documentation: https://teknic-inc.github.io/ClearCore-library/
+ * ** ClearCore Manual: https://www.teknic.com/files/downloads/clearcore_user_manual.pdf
+ *
+ * Copyright (c) 2020 Teknic Inc. This work is free to use, copy and distribute under the terms of
+ * the standard MIT permissive software license which can be found at https://opensource.org/licenses/MIT
+ */
+
+#include <Ethernet.h>
+
+// The server to connect to.
+IPAddress serverIp(192, 168, 0, 100);
+#define SERVER_PORT 8888
+
+// Send the statistics to the server in binary instead of printing them.
+bool sendBinary = false;
+
+EthernetClient client;
+uint32_t lastReportMs = 0;
+
+void setup() {
+    Serial.begin(9600);
+    uint32_t timeout = 5000;
+    uint32_t startTime = millis();
+    while (!Serial && millis() - startTime < timeout) {
+        continue;
+    }
+
+    // Make sure the physical link is up before continuing.
+    while (Ethernet.linkStatus() == LinkOFF) {
+        Serial.println("The Ethernet cable is unplugged...");
+        delay(1000);
+    }
+
+    byte mac[6];
+    if (!Ethernet.begin(mac)) {
+        Serial.println("DHCP configuration was unsuccessful!");
+        while (true) {
+            // TCP will not work without a configured IP address.
+            continue;
+        }
+    }
+    Serial.print("Local IP address: ");
+    Serial.println(Ethernet.localIP());
+}
+
+void loop() {
+    if (!client.connected()) {
+        client.stop();
+        if (!client.connect(serverIp, SERVER_PORT)) {
+            delay(1000);
+            return;
+        }
+    }
+
+    // Keep some traffic flowing.
+    client.println("The quick brown fox jumps over the lazy dog.");
+
+    if (millis() - lastReportMs >= 5000) {
+        lastReportMs = millis();
+        EthernetStats stats = Ethernet.stats();
+        EthernetClientStats connection;
+        bool connected = client.stats(connection);
+        if (sendBinary) {
+            stats.writeBinary(client);
+            if (connected) {
+                connection.writeBinary(client);
+            }
+            client.flush();
+        }
+        else {
+            Serial.println("Network stack:");
+            Serial.print(stats);
+            if (connected) {
+                Serial.print("Connection: ");
+                Serial.print(connection);
+            }
+        }
+        // Watch the high-water marks from this report on.
+        Ethernet.resetStats();
+    }
+
+    Ethernet.maintain();
+}
@@ -0,0 +1,97 @@
+/*
+ * Title: EthernetTCPServer_broadcast
+ *
+ * Objective:
+ *    This example demonstrates how to push the same status frame to many
+ *    TCP clients at once, such as several dashboards watching a machine.
+ *
+ * Description:
+ *    This example configures a ClearCore device as a TCP server on port
+ *    8888. Ten times per second it builds a status line (uptime, the state
+ *    of inputs DI-6 to DI-8 and the analog reading of A-12) and sends it to
+ *    every connected client with broadcast(). The frame is copied once into
+ *    a buffer shared by all of the connections, and a client that is not
+ *    keeping up is skipped instead of holding up the others. The clients
+ *    that missed a frame are printed to the USB serial port.
+ *
+ * Setup:
+ * 1. Connect one or more clients to port 8888 of the ClearCore, e.g. with
+ *    "socat - TCP:<ClearCore address>:8888" on a PC.
+ *
+ * Links:
+ * ** ClearCore Documentation: https://teknic-inc.github.io/ClearCore-library/
+ * ** ClearCore Manual: https://www.teknic.com/files/downloads/clearcore_user_manual.pdf
+ *
+ * Copyright (c) 2022 Teknic Inc. This work is free to use, copy and distribute under the terms of
+ * the standard MIT permissive software license which can be found at https://opensource.org/licenses/MIT
+ */
+
+#include <Ethernet.h>
+
+#define PORT_NUM 8888
+
+EthernetServer server = EthernetServer(PORT_NUM);
+
+uint32_t lastFrameMs = 0;
+
+void setup() {
+    Serial.begin(9600);
+    uint32_t timeout = 5000;
+    uint32_t startTime = millis();
+    while (!Serial && millis() - startTime < timeout) {
+        continue;
+    }
+
+    // Make sure the physical link is active before continuing
+    while (Ethernet.linkStatus() == LinkOFF) {
+        Serial.println("The Ethernet cable is unplugged...");
+        delay(1000);
+    }
+
+    byte mac[6];
+    if (!Ethernet.begin(mac)) {
+        Serial.println("DHCP configuration was unsuccessful!");
+        while (true) {
+            // TCP will not work without a configured IP address
+            continue;
+        }
+    }
+    Serial.print("Local IP address: ");
+    Serial.println(Ethernet.localIP());
+
+    server.begin();
+}
+
+void loop() {
+    // Take in new clients; the server tracks them from then on.
+    EthernetClient newClient = server.accept();
+    if (newClient.connected()) {
+        Serial.print("Client connected from ");
+        Serial.println(newClient.remoteIP());
+    }
+
+    if (millis() - lastFrameMs >= 100) {
+        lastFrameMs = millis();
+        char frame[64];
+        int length = snprintf(frame, sizeof(frame),
+                              "t=%lu DI6=%d DI7=%d DI8=%d A12=%d\n",
+                              (unsigned long)millis(), digitalRead(DI6),
+                              digitalRead(DI7), digitalRead(DI8),
+                              analogRead(A12));
+
+        EthernetBroadcastResult results[ETHERNET_SERVER_MAX_CLIENTS];
+        server.broadcast((const uint8_t *)frame, length, results,
+                         ETHERNET_SERVER_MAX_CLIENTS);
+        for (uint8_t i = 0; i < ETHERNET_SERVER_MAX_CLIENTS; i++) {
+            // Results past the last client have port 0.
+            if (results[i].port && !results[i].sent) {
+                Serial.print("Skipped slow client ");
+                Serial.print(results[i].ip);
+                Serial.print(':');
+                Serial.println(results[i].port);
+            }
+        }
+    }
+
+    Ethernet.maintain();
+}
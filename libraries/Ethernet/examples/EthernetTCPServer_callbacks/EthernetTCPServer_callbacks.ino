@@ -0,0 +1,150 @@
+/*
+ * Title: EthernetTCPServer_callbacks
+ *
+ * Objective:
+ *    This example demonstrates how to serve several TCP clients at once with
+ *    event callbacks instead of polling the server from loop().
+ *
+ * Description:
+ *    This example configures a ClearCore device to act as a TCP server that
+ *    accepts up to ETHERNET_SERVER_MAX_CLIENTS clients at the same time.
+ *    Callbacks registered with the server are run by Ethernet.maintain() when
+ *    a client connects, sends data, or disconnects. Each connection keeps its
+ *    own message counter in the per-connection context, and every message
+ *    received is answered with "Hello client <n>".
+ *    The partner project, EthernetTcpClientHelloWorld, can be run on one or
+ *    more other ClearCores to act as clients.
+ *
+ * Setup:
+ * 1. Set the usingDhcp boolean as appropriate. If not using DHCP, specify static
+ *    IP and network information.
+ * 2. Ensure the server and clients are connected to communicate on the same
+ *    network.
+ * 3. It may be helpful to use another application to view serial output from
+ *    each device. PuTTY is one such application: https://www.putty.org/
+ *
+ * Links:
+ * ** ClearCore Documentation: https://teknic-inc.github.io/ClearCore-library/
+ * ** ClearCore Manual: https://www.teknic.com/files/downloads/clearcore_user_manual.pdf
+ *
+ * Copyright (c) 2022 Teknic Inc. This work is free to use, copy and distribute under the terms of
+ * the standard MIT permissive software license which can be found at https://opensource.org/licenses/MIT
+ */
+
+#include <SPI.h>
+#include <Ethernet.h>
+
+// MAC address of the ClearCore
+byte mac[] = {};
+
+// The port number on the server over which packets will be sent/received
+#define PORT_NUM 8888
+
+// The maximum number of characters to receive at once
+#define MAX_PACKET_LENGTH 100
+
+// Set usingDhcp to false to use user defined network settings
+bool usingDhcp = true;
+
+EthernetServer server = EthernetServer(PORT_NUM);
+
+// Per-connection state, kept in a fixed pool rather than on the heap
+struct Session {
+    bool inUse;
+    uint32_t messages;
+};
+Session sessions[ETHERNET_SERVER_MAX_CLIENTS];
+
+void clientConnected(EthernetClient &client, void **context) {
+    for (uint8_t i = 0; i < ETHERNET_SERVER_MAX_CLIENTS; i++) {
+        if (!sessions[i].inUse) {
+            sessions[i].inUse = true;
+            sessions[i].messages = 0;
+            *context = &sessions[i];
+            break;
+        }
+    }
+    Serial.print("Client connected from ");
+    Serial.println(client.remoteIP());
+}
+
+void clientData(EthernetClient &client, void **context) {
+    Session *session = (Session *)*context;
+    unsigned char packetReceived[MAX_PACKET_LENGTH + 1];
+    int length = client.read(packetReceived, MAX_PACKET_LENGTH);
+    if (length <= 0) {
+        return;
+    }
+    packetReceived[length] = '\0';
+    Serial.print("Read the following from the client: ");
+    Serial.println((char *)packetReceived);
+
+    session->messages++;
+    client.print("Hello client ");
+    client.println(session->messages);
+    client.flush();
+}
+
+void clientClosed(EthernetClient &client, void **context) {
+    Session *session = (Session *)*context;
+    if (session) {
+        session->inUse = false;
+    }
+    Serial.println("Client disconnected");
+}
+
+void setup() {
+    // Set up serial communication between ClearCore and PC serial terminal
+    Serial.begin(9600);
+    uint32_t timeout = 5000;
+    uint32_t startTime = millis();
+    while (!Serial && millis() - startTime < timeout) {
+        continue;
+    }
+
+    // Make sure the physical link is active before continuing
+    while (Ethernet.linkStatus() == LinkOFF) {
+        Serial.println("The Ethernet cable is unplugged...");
+        delay(1000);
+    }
+
+    if (usingDhcp) {
+        // Use DHCP to configure the local IP address
+        bool dhcpSuccess = Ethernet.begin(mac);
+        if (dhcpSuccess) {
+            Serial.print("DHCP successfully assigned an IP address: ");
+            Serial.println(Ethernet.localIP());
+        }
+        else {
+            Serial.println("DHCP configuration was unsuccessful!");
+            while (true) {
+                // TCP will not work without a configured IP address
+                continue;
+            }
+        }
+    }
+    else {
+        // Configure with a manually assigned IP address
+        IPAddress ip = IPAddress(192, 168, 0, 100);
+        Ethernet.begin(mac, ip);
+        Serial.print("Assigned manual IP address: ");
+        Serial.println(Ethernet.localIP());
+    }
+
+    // Register the event callbacks, then start listening
+    server.onConnect(clientConnected);
+    server.onData(clientData);
+    server.onClose(clientClosed);
+    server.begin();
+
+    Serial.println("Server now listening for client connections...");
+}
+
+void loop() {
+    // Service the network stack and run any server callbacks that are due.
+    // Nothing else is needed to handle the clients.
+    Ethernet.maintain();
+
+    // Light IO-0 while any client is connected
+    digitalWrite(IO0, server.clientCount() > 0);
+}
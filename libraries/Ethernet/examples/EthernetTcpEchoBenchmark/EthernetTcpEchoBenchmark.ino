@@ -0,0 +1,105 @@
+/*
+ * Title: EthernetTcpEchoBenchmark
+ *
+ * Objective:
+ *    This example measures TCP throughput: how fast the ClearCore can take
+ *    in a stream of data and send it back.
+ *
+ * Description:
+ *    A TCP echo server on port 7. Everything a client sends is written
+ *    back to it, a received buffer at a time and only as fast as the
+ *    connection takes it, so the test is limited by the network stack
+ *    rather than by the sketch. One client is served at a time. The rate
+ *    data is echoed at is printed to the USB serial port once a second.
+ *
+ * Setup:
+ * 1. Run the host-side driver from a Linux PC on the same network:
+ *        python3 extras/ethernet_bench.py <ClearCore IP> tcp-echo
+ *    (extras/ is in the Ethernet library's folder). It sends a stream,
+ *    reads it back, and reports the throughput.
+ *
+ * Links:
+ * ** ClearCore Documentation: https://teknic-inc.github.io/ClearCore-library/
+ * ** ClearCore Manual: https://www.teknic.com/files/downloads/clearcore_user_manual.pdf
+ *
+ * Copyright (c) 2020 Teknic Inc. This work is free to use, copy and distribute under the terms of
+ * the standard MIT permissive software license which can be found at https://opensource.org/licenses/MIT
+ */
+
+#include <Ethernet.h>
+
+#define ECHO_PORT 7
+
+EthernetServer server(ECHO_PORT);
+EthernetClient client;
+
+uint32_t echoed = 0;
+uint32_t lastEchoed = 0;
+uint32_t lastReportMs = 0;
+
+void setup() {
+    Serial.begin(9600);
+    uint32_t timeout = 5000;
+    uint32_t startTime = millis();
+    while (!Serial && millis() - startTime < timeout) {
+        continue;
+    }
+
+    // Make sure the physical link is up before continuing.
+    while (Ethernet.linkStatus() == LinkOFF) {
+        Serial.println("The Ethernet cable is unplugged...");
+        delay(1000);
+    }
+
+    byte mac[6];
+    if (!Ethernet.begin(mac)) {
+        Serial.println("DHCP configuration was unsuccessful!");
+        while (true) {
+            // TCP will not work without a configured IP address.
+            continue;
+        }
+    }
+    Serial.print("Local IP: ");
+    Serial.println(Ethernet.localIP());
+
+    server.begin();
+}
+
+void loop() {
+    Ethernet.maintain();
+
+    if (!client.connected()) {
+        client.stop();
+        client = server.accept();
+        // Each write is a whole received buffer; send it at once.
+        client.setNoDelay(true);
+    }
+
+    // Echo straight out of the receive buffers, as much as the connection
+    // has room for. Data that does not fit waits in the receive window,
+    // which holds the sender back.
+    int room = client.availableForWrite();
+    while (room > 0) {
+        EthernetSpan span = client.span();
+        if (!span.length) {
+            break;
+        }
+        size_t count = min(span.length, (size_t)room);
+        client.write(span.data, count);
+        client.consume(count);
+        room -= count;
+        echoed += count;
+    }
+
+    if (millis() - lastReportMs >= 1000) {
+        uint32_t elapsedMs = millis() - lastReportMs;
+        lastReportMs = millis();
+        if (echoed != lastEchoed) {
+            // Bytes per ms is kB/s.
+            Serial.print("Echoing at ");
+            Serial.print((echoed - lastEchoed) / elapsedMs);
+            Serial.println(" kB/s");
+        }
+        lastEchoed = echoed;
+    }
+}
@@ -0,0 +1,108 @@
+/*
+ * Title: EthernetTimeSync
+ *
+ * Objective:
+ *    This example demonstrates how to give several ClearCores a shared
+ *    timebase, so their motion can be coordinated and their logs compared.
+ *
+ * Description:
+ *    One ClearCore is the time server; the others synchronize their clocks
+ *    to it over the network. Load this sketch on every ClearCore, with
+ *    IS_SERVER set to true on one of them and serverIp set to its address
+ *    on the others.
+ *    Every controller pulses IO-0 at the start of each second of its
+ *    synchronized clock, and prints the synchronization statistics to the
+ *    USB serial port once a second. Once the clients have converged (the
+ *    offset stays within a few microseconds), the pulses line up.
+ *
+ * Setup:
+ * 1. Give the time server a fixed address (set serverIp and use it with
+ *    Ethernet.begin(mac, ip) on the server), or look up the address it gets
+ *    from DHCP.
+ * 2. To check the synchronization, connect IO-0 of two controllers to an
+ *    oscilloscope and compare the pulses. A PC running an NTP server (e.g.
+ *    chrony or ntpd) can stand in for the time server, in which case the
+ *    clients synchronize to its wall clock time.
+ *
+ * Links:
+ * ** ClearCore Documentation: https://teknic-inc.github.io/ClearCore-library/
+ * ** ClearCore Manual: https://www.teknic.com/files/downloads/clearcore_user_manual.pdf
+ *
+ * Copyright (c) 2020 Teknic Inc. This work is free to use, copy and distribute under the terms of
+ * the standard MIT permissive software license which can be found at https://opensource.org/licenses/MIT
+ */
+
+#include <Ethernet.h>
+#include <EthernetTimeSync.h>
+
+// Set to true on the controller that is the time server.
+#define IS_SERVER false
+
+// The time server's address.
+IPAddress serverIp(192, 168, 1, 100);
+
+EthernetTimeSync timeSync;
+
+uint32_t lastSecond = 0;
+uint32_t lastReportMs = 0;
+
+void setup() {
+    Serial.begin(9600);
+    uint32_t timeout = 5000;
+    uint32_t startTime = millis();
+    while (!Serial && millis() - startTime < timeout) {
+        continue;
+    }
+
+    // Make sure the physical link is up before continuing.
+    while (Ethernet.linkStatus() == LinkOFF) {
+        Serial.println("The Ethernet cable is unplugged...");
+        delay(1000);
+    }
+
+    byte mac[6];
+    if (IS_SERVER) {
+        Ethernet.begin(mac, serverIp);
+    }
+    else if (!Ethernet.begin(mac)) {
+        Serial.println("DHCP configuration was unsuccessful!");
+        while (true) {
+            // UDP will not work without a configured IP address.
+            continue;
+        }
+    }
+    Serial.print("Local IP: ");
+    Serial.println(Ethernet.localIP());
+
+    // Timestamp datagrams as they arrive rather than when loop() gets to
+    // them.
+    Ethernet.setInterruptService(true);
+
+    pinMode(IO0, OUTPUT);
+
+    timeSync.begin(123);
+    if (!IS_SERVER) {
+        timeSync.sync(serverIp, 123, 1000);
+    }
+}
+
+void loop() {
+    timeSync.service();
+    Ethernet.maintain();
+
+    // Pulse IO-0 for 10 ms at the start of every synchronized second.
+    uint64_t now = timeSync.syncedMicros64();
+    uint32_t second = now / 1000000;
+    if (second != lastSecond) {
+        lastSecond = second;
+        digitalWrite(IO0, HIGH);
+    }
+    else if (now % 1000000 >= 10000) {
+        digitalWrite(IO0, LOW);
+    }
+
+    if (millis() - lastReportMs >= 1000) {
+        lastReportMs = millis();
+        Serial.println(timeSync.stats());
+    }
+}
@@ -0,0 +1,259 @@
+/*
+ * Title: EthernetUdpBlastBenchmark
+ *
+ * Objective:
+ *    This example measures UDP throughput and loss in both directions.
+ *
+ * Description:
+ *    The host-side driver talks to this sketch on UDP port 9001. Every
+ *    datagram starts with a one byte type; numbers are little-endian.
+ *    'Z'                   Zero the receive counters.
+ *    'D' seq(4) ...        A numbered datagram to count. Gaps in the
+ *                          sequence are counted as lost, datagrams that
+ *                          arrive after a later one as reordered, and
+ *                          ones already received as duplicated.
+ *    'R'                   Answered with 'r' followed by the datagrams and
+ *                          bytes received, lost and reordered, the time
+ *                          from the first datagram to the last in us, the
+ *                          datagrams dropped by EthernetUDP because its
+ *                          queue was full or no buffer was free, and the
+ *                          datagrams duplicated.
+ *    'T' count(4) size(2)  Send count numbered 'D' datagrams of size bytes
+ *                          back as fast as possible, then 'E' followed by
+ *                          the count, the time it took in us, and the
+ *                          number of times sendTo() had to be retried.
+ *    The results of each test are also printed to the USB serial port.
+ *
+ * Setup:
+ * 1. Run the host-side driver from a Linux PC on the same network:
+ *        python3 extras/ethernet_bench.py <ClearCore IP> udp-blast
+ *    (extras/ is in the Ethernet library's folder).
+ *
+ * Links:
+ * ** ClearCore Documentation: https://teknic-inc.github.io/ClearCore-library/
+ * ** ClearCore Manual: https://www.teknic.com/files/downloads/clearcore_user_manual.pdf
+ *
+ * Copyright (c) 2020 Teknic Inc. This work is free to use, copy and distribute under the terms of
+ * the standard MIT permissive software license which can be found at https://opensource.org/licenses/MIT
+ */
+
+#include <Ethernet.h>
+
+#define BLAST_PORT 9001
+
+// Largest datagram sent back; one that fits in a single frame.
+#define MAX_DATAGRAM 1472
+
+// Give up on a datagram that cannot be sent for this long, in ms.
+#define SEND_TIMEOUT_MS 100
+
+// How far behind the highest sequence number a late datagram can still be
+// told apart from a duplicate.
+#define SEEN_WINDOW 4096
+
+EthernetUDP udp;
+
+uint32_t received = 0;
+uint32_t receivedBytes = 0;
+uint32_t lost = 0;
+uint32_t reordered = 0;
+uint32_t duplicated = 0;
+uint32_t nextSeq = 0;
+uint32_t firstUs = 0;
+uint32_t lastUs = 0;
+
+uint8_t datagram[MAX_DATAGRAM];
+
+// One bit for each of the last SEEN_WINDOW sequence numbers, set once the
+// datagram has been received.
+uint8_t seen[SEEN_WINDOW / 8];
+
+void putU32(uint8_t *p, uint32_t value) {
+    for (uint8_t i = 0; i < 4; i++) {
+        p[i] = value >> (i * 8);
+    }
+}
+
+uint32_t getU32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// Mark seq as received. Returns whether it had been already.
+bool markSeen(uint32_t seq) {
+    uint8_t &bits = seen[seq / 8 % sizeof(seen)];
+    uint8_t bit = 1 << (seq % 8);
+    bool already = bits & bit;
+    bits |= bit;
+    return already;
+}
+
+void count(const uint8_t *data, int length) {
+    uint32_t seq = getU32(data + 1);
+    if (seq >= nextSeq) {
+        // The window moves on; forget the numbers it leaves behind.
+        if (seq - nextSeq >= SEEN_WINDOW) {
+            memset(seen, 0, sizeof(seen));
+        }
+        else {
+            for (uint32_t skipped = nextSeq; skipped < seq; skipped++) {
+                seen[skipped / 8 % sizeof(seen)] &= ~(1 << (skipped % 8));
+            }
+        }
+        markSeen(seq);
+        lost += seq - nextSeq;
+        nextSeq = seq + 1;
+    }
+    else if (nextSeq - seq < SEEN_WINDOW && markSeen(seq)) {
+        duplicated++;
+        return;
+    }
+    else {
+        // Counted as lost when the gap was seen. One too late to tell may
+        // be a duplicate, so the count is kept from wrapping.
+        reordered++;
+        if (lost) {
+            lost--;
+        }
+    }
+    lastUs = micros();
+    if (!received) {
+        firstUs = lastUs;
+    }
+    received++;
+    receivedBytes += length;
+}
+
+void report() {
+    uint8_t reply[1 + 8 * 4];
+    reply[0] = 'r';
+    putU32(reply + 1, received);
+    putU32(reply + 5, receivedBytes);
+    putU32(reply + 9, lost);
+    putU32(reply + 13, reordered);
+    putU32(reply + 17, lastUs - firstUs);
+    putU32(reply + 21, udp.packetsDroppedQueueFull());
+    putU32(reply + 25, udp.packetsDroppedNoBuffer());
+    putU32(reply + 29, duplicated);
+    udp.sendTo(udp.remoteIP(), udp.remotePort(), reply, sizeof(reply));
+
+    Serial.print("Received ");
+    Serial.print(received);
+    Serial.print(" datagrams, lost ");
+    Serial.print(lost);
+    Serial.print(", reordered ");
+    Serial.print(reordered);
+    Serial.print(", duplicated ");
+    Serial.print(duplicated);
+    if (lastUs != firstUs) {
+        Serial.print(", ");
+        Serial.print((uint64_t)receivedBytes * 1000 / (lastUs - firstUs));
+        Serial.print(" kB/s");
+    }
+    Serial.println();
+}
+
+void blast(IPAddress ip, uint16_t port, uint32_t total, uint16_t size) {
+    size = constrain(size, 5, MAX_DATAGRAM);
+    datagram[0] = 'D';
+    uint32_t retries = 0;
+    uint32_t sent = 0;
+    uint32_t startUs = micros();
+    for (; sent < total; sent++) {
+        putU32(datagram + 1, sent);
+        uint32_t tryMs = millis();
+        // sendTo() fails while every transmit buffer is in use.
+        bool ok;
+        while (!(ok = udp.sendTo(ip, port, datagram, size)) &&
+                millis() - tryMs < SEND_TIMEOUT_MS) {
+            retries++;
+            Ethernet.maintain();
+        }
+        if (!ok) {
+            break;
+        }
+    }
+    uint32_t elapsedUs = micros() - startUs;
+
+    uint8_t end[1 + 3 * 4];
+    end[0] = 'E';
+    putU32(end + 1, sent);
+    putU32(end + 5, elapsedUs);
+    putU32(end + 9, retries);
+    // The end marker may be lost like any other datagram.
+    for (uint8_t i = 0; i < 3; i++) {
+        udp.sendTo(ip, port, end, sizeof(end));
+    }
+
+    Serial.print("Sent ");
+    Serial.print(sent);
+    Serial.print(" datagrams of ");
+    Serial.print(size);
+    Serial.print(" bytes, ");
+    if (elapsedUs) {
+        Serial.print((uint64_t)sent * size * 1000 / elapsedUs);
+    }
+    Serial.print(" kB/s, retries ");
+    Serial.println(retries);
+}
+
+void setup() {
+    Serial.begin(9600);
+    uint32_t timeout = 5000;
+    uint32_t startTime = millis();
+    while (!Serial && millis() - startTime < timeout) {
+        continue;
+    }
+
+    // Make sure the physical link is up before continuing.
+    while (Ethernet.linkStatus() == LinkOFF) {
+        Serial.println("The Ethernet cable is unplugged...");
+        delay(1000);
+    }
+
+    byte mac[6];
+    if (!Ethernet.begin(mac)) {
+        Serial.println("DHCP configuration was unsuccessful!");
+        while (true) {
+            // UDP will not work without a configured IP address.
+            continue;
+        }
+    }
+    Serial.print("Local IP: ");
+    Serial.println(Ethernet.localIP());
+
+    udp.begin(BLAST_PORT);
+    // Absorb bursts between passes through loop().
+    udp.setReceiveQueueDepth(ETHERNET_UDP_RX_QUEUE);
+}
+
+void loop() {
+    Ethernet.maintain();
+
+    const uint8_t *data;
+    int length;
+    while ((length = udp.receive(&data)) > 0) {
+        switch (data[0]) {
+            case 'Z':
+                received = receivedBytes = lost = reordered = nextSeq = 0;
+                duplicated = firstUs = lastUs = 0;
+                memset(seen, 0, sizeof(seen));
+                break;
+            case 'D':
+                if (length >= 5) {
+                    count(data, length);
+                }
+                break;
+            case 'R':
+                report();
+                break;
+            case 'T':
+                if (length >= 7) {
+                    blast(udp.remoteIP(), udp.remotePort(), getU32(data + 1),
+                          data[5] | data[6] << 8);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
@@ -0,0 +1,93 @@
+/*
+ * Title: EthernetUdpCallback
+ *
+ * Objective:
+ *    This example demonstrates how to handle incoming UDP datagrams with a
+ *    callback and how to use the socket's counters to size its receive
+ *    queue.
+ *
+ * Description:
+ *    This example listens on port 8888 for setpoint datagrams, each holding
+ *    one 32-bit value. A callback registered with onPacket() is run from
+ *    Ethernet.maintain() as soon as each datagram arrives and applies the
+ *    setpoint, so no datagram waits for loop() to poll for it.
+ *    Once a second the number of datagrams received and dropped is printed
+ *    to the USB serial port. Drops because the queue was full mean the
+ *    queue depth should be raised (or maintain() called more often); drops
+ *    for lack of a receive buffer mean the network stack itself is short
+ *    of buffers.
+ *
+ * Setup:
+ * 1. Send 4-byte datagrams to port 8888 of the ClearCore, e.g. from a PC.
+ *
+ * Links:
+ * ** ClearCore Documentation: https://teknic-inc.github.io/ClearCore-library/
+ * ** ClearCore Manual: https://www.teknic.com/files/downloads/clearcore_user_manual.pdf
+ *
+ * Copyright (c) 2020 Teknic Inc. This work is free to use, copy and distribute under the terms of
+ * the standard MIT permissive software license which can be found at https://opensource.org/licenses/MIT
+ */
+
+#include <Ethernet.h>
+
+#define LOCAL_PORT 8888
+
+EthernetUDP Udp;
+
+int32_t setpoint = 0;
+uint32_t lastReportMs = 0;
+
+void setpointReceived(EthernetUDP &udp) {
+    const uint8_t *data;
+    int length = udp.receive(&data);
+    if (length == sizeof(setpoint)) {
+        memcpy(&setpoint, data, sizeof(setpoint));
+    }
+}
+
+void setup() {
+    Serial.begin(9600);
+    uint32_t timeout = 5000;
+    uint32_t startTime = millis();
+    while (!Serial && millis() - startTime < timeout) {
+        continue;
+    }
+
+    // Make sure the physical link is up before continuing.
+    while (Ethernet.linkStatus() == LinkOFF) {
+        Serial.println("The Ethernet cable is unplugged...");
+        delay(1000);
+    }
+
+    byte mac[6];
+    if (!Ethernet.begin(mac)) {
+        Serial.println("DHCP configuration was unsuccessful!");
+        while (true) {
+            // UDP will not work without a configured IP address.
+            continue;
+        }
+    }
+    Serial.print("Local IP address: ");
+    Serial.println(Ethernet.localIP());
+
+    Udp.begin(LOCAL_PORT);
+    Udp.setReceiveQueueDepth(8);
+    Udp.onPacket(setpointReceived);
+}
+
+void loop() {
+    // Runs setpointReceived() for every datagram that has arrived.
+    Ethernet.maintain();
+
+    if (millis() - lastReportMs >= 1000) {
+        lastReportMs = millis();
+        Serial.print("Setpoint: ");
+        Serial.print(setpoint);
+        Serial.print(", received: ");
+        Serial.print(Udp.packetsReceived());
+        Serial.print(", dropped (queue full): ");
+        Serial.print(Udp.packetsDroppedQueueFull());
+        Serial.print(", dropped (no buffer): ");
+        Serial.println(Udp.packetsDroppedNoBuffer());
+    }
+}
@@ -0,0 +1,138 @@
+/*
+ * Title: EthernetUdpMulticast
+ *
+ * Objective:
+ *    This example demonstrates how to share data between several ClearCores
+ *    with UDP multicast, so one packet reaches every subscriber.
+ *
+ * Description:
+ *    This example joins the multicast group 239.1.2.3 on port 8888. Every
+ *    second it sends the state of input DI-6 to the group, and it prints each
+ *    packet received from the group to the USB serial port. Load the same
+ *    sketch on each ClearCore; they will all see each other's packets.
+ *
+ *    A second socket on the same port joins the group 239.1.2.4. Only
+ *    sockets that have joined a group receive its packets, so each packet
+ *    is received by one socket or the other, never both. A packet sent to
+ *    the ClearCore's own address is received by the socket started first,
+ *    Udp. A packet starting with "ping" is answered, directly to its
+ *    sender, with the group of the socket that received it followed by the
+ *    packet, which shows which socket got it.
+ *
+ * Requirements:
+ * ** Two or more ClearCores on the same network, or one ClearCore and a PC.
+ *    extras/multicast_check.py in the Ethernet library joins the group from
+ *    a PC, and checks that the sketch's packets arrive and that pings to
+ *    each group, and to the ClearCore, are answered by the right socket
+ *    only:
+ *      python3 multicast_check.py <ClearCore IP address>
+ *    With --stand-in, it runs the same checks against a copy of this sketch
+ *    written in Python on the PC itself.
+ * ** The network switch must forward multicast traffic (most unmanaged
+ *    switches do).
+ *
+ * Links:
+ * ** ClearCore Documentation: https://teknic-inc.github.io/ClearCore-library/
+ * ** ClearCore Manual: https://www.teknic.com/files/downloads/clearcore_user_manual.pdf
+ *
+ * Copyright (c) 2020 Teknic Inc. This work is free to use, copy and distribute under the terms of
+ * the standard MIT permissive software license which can be found at https://opensource.org/licenses/MIT
+ */
+
+#include <Ethernet.h>
+
+// The multicast group and port shared by every ClearCore.
+IPAddress group(239, 1, 2, 3);
+unsigned int groupPort = 8888;
+// A second group on the same port.
+IPAddress otherGroup(239, 1, 2, 4);
+
+// The maximum number of characters to receive from an incoming packet
+#define MAX_PACKET_LENGTH 100
+// Buffer for holding received packets.
+char packetReceived[MAX_PACKET_LENGTH + 1];
+
+// An EthernetUDP instance to let us send and receive packets over UDP
+EthernetUDP Udp;
+// A second socket, for the second group.
+EthernetUDP OtherUdp;
+
+// The last time a packet was sent, in milliseconds.
+unsigned long lastSendTime = 0;
+const unsigned long sendingInterval = 1000;
+
+void setup() {
+    Serial.begin(9600);
+    uint32_t timeout = 5000;
+    uint32_t startTime = millis();
+    while (!Serial && millis() - startTime < timeout) {
+        continue;
+    }
+
+    // Make sure the physical link is up before continuing.
+    while (Ethernet.linkStatus() == LinkOFF) {
+        Serial.println("The Ethernet cable is unplugged...");
+        delay(1000);
+    }
+
+    byte mac[6];
+    if (!Ethernet.begin(mac)) {
+        Serial.println("DHCP configuration was unsuccessful!");
+        while (true) {
+            // UDP will not work without a configured IP address.
+            continue;
+        }
+    }
+    Serial.print("Local IP address: ");
+    Serial.println(Ethernet.localIP());
+
+    if (!Udp.beginMulticast(group, groupPort) ||
+            !OtherUdp.beginMulticast(otherGroup, groupPort)) {
+        Serial.println("Could not join the multicast group!");
+        while (true) {
+            continue;
+        }
+    }
+    Serial.println("Joined the multicast groups.");
+}
+
+// Print a packet received on socket, which has joined groupAddress, and
+// answer it if it is a ping.
+void receive(EthernetUDP &socket, IPAddress &groupAddress) {
+    int packetSize = socket.parsePacket();
+    if (packetSize <= 0) {
+        return;
+    }
+    int length = socket.read(packetReceived, MAX_PACKET_LENGTH);
+    packetReceived[length] = '\0';
+    Serial.print("From ");
+    Serial.print(socket.remoteIP());
+    Serial.print(" to ");
+    Serial.print(groupAddress);
+    Serial.print(": ");
+    Serial.println(packetReceived);
+
+    if (strncmp(packetReceived, "ping", 4) == 0) {
+        socket.beginPacket(socket.remoteIP(), socket.remotePort());
+        socket.print(groupAddress);
+        socket.print(' ');
+        socket.write(packetReceived, length);
+        socket.endPacket();
+    }
+}
+
+void loop() {
+    receive(Udp, group);
+    receive(OtherUdp, otherGroup);
+
+    if (millis() - lastSendTime > sendingInterval) {
+        // Sending to the group address reaches every member.
+        Udp.beginPacket(group, groupPort);
+        Udp.print("DI-6 is ");
+        Udp.print(digitalRead(DI6) ? "on" : "off");
+        Udp.endPacket();
+        lastSendTime = millis();
+    }
+
+    Ethernet.maintain();
+}
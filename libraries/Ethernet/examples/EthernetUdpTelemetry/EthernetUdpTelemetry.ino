@@ -0,0 +1,121 @@
+/*
+ * Title: EthernetUdpTelemetry
+ *
+ * Objective:
+ *    This example demonstrates how to stream UDP datagrams at a high rate
+ *    with the one-shot sendTo() and the copy-free receive().
+ *
+ * Description:
+ *    This example sends a small telemetry record (a sequence number, a
+ *    timestamp and the analog reading of A-12) to a remote host 2000 times
+ *    per second. Each record is a single call to sendTo(), which reuses the
+ *    socket's preallocated transmit buffers rather than allocating one per
+ *    datagram. Any datagram sent back to the ClearCore is picked up with
+ *    receive(), which gives direct access to the received payload, and its
+ *    first byte is used to turn the stream on (1) or off (0).
+ *    Once a second, the number of records sent and failed sends are printed
+ *    to the USB serial port.
+ *
+ * Setup:
+ * 1. Set remoteIp to the address of the PC receiving the records.
+ * 2. A tool such as "socat UDP4-RECVFROM:8888,fork -" on the PC will show
+ *    the records as they arrive.
+ *
+ * Links:
+ * ** ClearCore Documentation: https://teknic-inc.github.io/ClearCore-library/
+ * ** ClearCore Manual: https://www.teknic.com/files/downloads/clearcore_user_manual.pdf
+ *
+ * Copyright (c) 2020 Teknic Inc. This work is free to use, copy and distribute under the terms of
+ * the standard MIT permissive software license which can be found at https://opensource.org/licenses/MIT
+ */
+
+#include <Ethernet.h>
+
+// The address and port the records are sent to.
+IPAddress remoteIp(192, 168, 0, 254);
+#define REMOTE_PORT 8888
+
+// The local port that listens for the on/off command.
+#define LOCAL_PORT 8889
+
+// Time between records, in microseconds (2 kHz).
+#define RECORD_PERIOD_US 500
+
+struct TelemetryRecord {
+    uint32_t sequence;
+    uint32_t timestampUs;
+    uint16_t analog;
+};
+
+EthernetUDP Udp;
+
+bool streaming = true;
+uint32_t sequence = 0;
+uint32_t lastRecordUs = 0;
+uint32_t lastReportMs = 0;
+uint32_t sent = 0;
+uint32_t failed = 0;
+
+void setup() {
+    Serial.begin(9600);
+    uint32_t timeout = 5000;
+    uint32_t startTime = millis();
+    while (!Serial && millis() - startTime < timeout) {
+        continue;
+    }
+
+    // Make sure the physical link is up before continuing.
+    while (Ethernet.linkStatus() == LinkOFF) {
+        Serial.println("The Ethernet cable is unplugged...");
+        delay(1000);
+    }
+
+    byte mac[6];
+    if (!Ethernet.begin(mac)) {
+        Serial.println("DHCP configuration was unsuccessful!");
+        while (true) {
+            // UDP will not work without a configured IP address.
+            continue;
+        }
+    }
+    Serial.print("Local IP address: ");
+    Serial.println(Ethernet.localIP());
+
+    Udp.begin(LOCAL_PORT);
+}
+
+void loop() {
+    // Check for a command without copying it out of the network buffers.
+    const uint8_t *command;
+    if (Udp.receive(&command) > 0) {
+        streaming = command[0] == '1' || command[0] == 1;
+    }
+
+    uint32_t now = micros();
+    if (streaming && now - lastRecordUs >= RECORD_PERIOD_US) {
+        lastRecordUs += RECORD_PERIOD_US;
+        TelemetryRecord record;
+        record.sequence = sequence++;
+        record.timestampUs = now;
+        record.analog = analogRead(A12);
+        if (Udp.sendTo(remoteIp, REMOTE_PORT, (const uint8_t *)&record,
+                       sizeof(record))) {
+            sent++;
+        }
+        else {
+            failed++;
+        }
+    }
+
+    if (millis() - lastReportMs >= 1000) {
+        lastReportMs = millis();
+        Serial.print("Records sent: ");
+        Serial.print(sent);
+        Serial.print(", failed: ");
+        Serial.println(failed);
+        sent = 0;
+        failed = 0;
+    }
+
+    Ethernet.maintain();
+}
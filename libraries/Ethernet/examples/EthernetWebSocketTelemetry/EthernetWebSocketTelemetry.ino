@@ -0,0 +1,162 @@
+/*
+ * Title: EthernetWebSocketTelemetry
+ *
+ * Objective:
+ *    This example demonstrates how to stream live machine data to browsers
+ *    over a WebSocket, so a page can plot it without polling.
+ *
+ * Description:
+ *    A web page kept in flash is served on port 80. It opens a WebSocket to
+ *    port 81 and plots the samples it receives. Every SAMPLE_PERIOD_MS the
+ *    commanded position and HLFB torque of the motor on M-0, the state of
+ *    DI-6 and the reading of A-12 are sampled and pushed to every connected
+ *    browser as one binary message.
+ *    A browser that falls behind (e.g. on a slow network) simply misses
+ *    samples instead of delaying the others. The page can change the sample
+ *    period by sending "period <ms>". The number of messages sent and
+ *    dropped is printed to the USB serial port once a second.
+ *
+ * Setup:
+ * 1. Optionally, connect a ClearPath motor with HLFB set to "ASG-Position
+ *    w/Measured Torque" to M-0, and an analog source to A-12.
+ * 2. Browse to the address printed to the USB serial port.
+ *
+ * Links:
+ * ** ClearCore Documentation: https://teknic-inc.github.io/ClearCore-library/
+ * ** ClearCore Manual: https://www.teknic.com/files/downloads/clearcore_user_manual.pdf
+ *
+ * Copyright (c) 2020 Teknic Inc. This work is free to use, copy and distribute under the terms of
+ * the standard MIT permissive software license which can be found at https://opensource.org/licenses/MIT
+ */
+
+#include <Ethernet.h>
+#include <EthernetHttp.h>
+#include <EthernetWebSocket.h>
+
+// Initial time between samples, in ms.
+#define SAMPLE_PERIOD_MS 20
+
+// One sample, sent as little-endian binary.
+struct __attribute__((packed)) Sample {
+    uint32_t timestampMs;
+    int32_t position;
+    float torque;
+    uint16_t analog;
+    uint8_t input;
+};
+
+// The page, which plots position and torque on a canvas.
+const char indexPage[] =
+    "<!DOCTYPE html>\n"
+    "<html><head><title>ClearCore telemetry</title></head><body>\n"
+    "<canvas id=\"plot\" width=\"800\" height=\"300\"></canvas>\n"
+    "<p id=\"values\"></p>\n"
+    "<script>\n"
+    "var plot = document.getElementById('plot').getContext('2d');\n"
+    "var position = [], torque = [];\n"
+    "var ws = new WebSocket('ws://' + location.hostname + ':81/');\n"
+    "ws.binaryType = 'arraybuffer';\n"
+    "ws.onmessage = function(e) {\n"
+    "  var v = new DataView(e.data);\n"
+    "  position.push(v.getInt32(4, true));\n"
+    "  torque.push(v.getFloat32(8, true));\n"
+    "  if (position.length > 800) { position.shift(); torque.shift(); }\n"
+    "  document.getElementById('values').textContent =\n"
+    "    'DI-6: ' + v.getUint8(14) + ', A-12: ' + v.getUint16(12, true);\n"
+    "};\n"
+    "function draw(values, color, scale) {\n"
+    "  var max = Math.max.apply(null, values.map(Math.abs)) || 1;\n"
+    "  plot.strokeStyle = color;\n"
+    "  plot.beginPath();\n"
+    "  values.forEach(function(y, x) {\n"
+    "    plot.lineTo(x, 150 - y / (scale || max) * 140);\n"
+    "  });\n"
+    "  plot.stroke();\n"
+    "}\n"
+    "setInterval(function() {\n"
+    "  plot.clearRect(0, 0, 800, 300);\n"
+    "  draw(position, 'blue');\n"
+    "  draw(torque, 'red', 100);\n"
+    "}, 50);\n"
+    "</script>\n"
+    "</body></html>\n";
+
+EthernetHttpServer web(80);
+EthernetWebSocketServer telemetry(81);
+
+uint32_t lastReportMs = 0;
+
+size_t takeSample(uint8_t *buffer, size_t size) {
+    Sample sample;
+    sample.timestampMs = millis();
+    sample.position = ConnectorM0.PositionRefCommanded();
+    sample.torque = ConnectorM0.HlfbPercent();
+    sample.analog = analogRead(A12);
+    sample.input = digitalRead(DI6);
+    memcpy(buffer, &sample, sizeof(sample));
+    return sizeof(sample);
+}
+
+void messageReceived(uint8_t client, const uint8_t *data, size_t length,
+                     bool binary) {
+    char text[16];
+    if (binary || length >= sizeof(text)) {
+        return;
+    }
+    memcpy(text, data, length);
+    text[length] = '\0';
+    if (!strncmp(text, "period ", 7)) {
+        uint16_t period = constrain(atoi(text + 7), 1, 1000);
+        telemetry.stream(takeSample, period);
+    }
+}
+
+void setup() {
+    Serial.begin(9600);
+    uint32_t timeout = 5000;
+    uint32_t startTime = millis();
+    while (!Serial && millis() - startTime < timeout) {
+        continue;
+    }
+
+    // Make sure the physical link is up before continuing.
+    while (Ethernet.linkStatus() == LinkOFF) {
+        Serial.println("The Ethernet cable is unplugged...");
+        delay(1000);
+    }
+
+    byte mac[6];
+    if (!Ethernet.begin(mac)) {
+        Serial.println("DHCP configuration was unsuccessful!");
+        while (true) {
+            // TCP will not work without a configured IP address.
+            continue;
+        }
+    }
+    Serial.print("Browse to http://");
+    Serial.println(Ethernet.localIP());
+
+    web.serveStatic("/", (const uint8_t *)indexPage, sizeof(indexPage) - 1,
+                    "text/html");
+    web.begin();
+
+    telemetry.onMessage(messageReceived);
+    telemetry.stream(takeSample, SAMPLE_PERIOD_MS);
+    telemetry.begin();
+}
+
+void loop() {
+    web.service();
+    telemetry.service();
+    Ethernet.maintain();
+
+    if (millis() - lastReportMs >= 1000) {
+        lastReportMs = millis();
+        Serial.print("Browsers: ");
+        Serial.print(telemetry.clientCount());
+        Serial.print(", messages sent: ");
+        Serial.print(telemetry.framesSent());
+        Serial.print(", dropped: ");
+        Serial.println(telemetry.framesDropped());
+    }
+}
@@ -0,0 +1,124 @@
+/*
+ * Title: EthernetWriteStaticBenchmark
+ *
+ * Objective:
+ *    This example compares sending a large constant payload with write(),
+ *    which copies it into the network stack, against writeStatic(), which
+ *    sends it straight from flash.
+ *
+ * Description:
+ *    This example connects to a TCP server and sends a 4 KB constant table
+ *    to it repeatedly for five seconds with write(), then for five seconds
+ *    with writeStatic(). For each method it prints to the USB serial port
+ *    the throughput achieved and the share of time loop() was left with
+ *    (measured by counting idle passes), along with the network stack's
+ *    heap high-water mark, which write() raises with its copies.
+ *
+ * Setup:
+ * 1. Set serverIp and SERVER_PORT to a TCP server that reads and discards
+ *    data, e.g. "socat -u TCP-LISTEN:8888,fork /dev/null" on a PC.
+ *
+ * Links:
+ * ** ClearCore Documentation: https://teknic-inc.github.io/ClearCore-library/
+ * ** ClearCore Manual: https://www.teknic.com/files/downloads/clearcore_user_manual.pdf
+ *
+ * Copyright (c) 2020 Teknic Inc. This work is free to use, copy and distribute under the terms of
+ * the standard MIT permissive software license which can be found at https://opensource.org/licenses/MIT
+ */
+
+#include <Ethernet.h>
+
+// The server to send to.
+IPAddress serverIp(192, 168, 0, 100);
+#define SERVER_PORT 8888
+
+#define TEST_MS 5000
+
+// A constant table, kept in flash.
+#define TABLE_SIZE 4096
+struct Table {
+    uint8_t data[TABLE_SIZE];
+};
+constexpr Table makeTable() {
+    Table table = {};
+    for (uint32_t i = 0; i < TABLE_SIZE; i++) {
+        table.data[i] = 'A' + i % 26;
+    }
+    return table;
+}
+const Table table = makeTable();
+
+EthernetClient client;
+
+void runTest(bool useStatic) {
+    Ethernet.resetStats();
+    uint32_t bytes = 0;
+    uint32_t startMs = millis();
+    uint32_t busyUs = 0;
+    while (millis() - startMs < TEST_MS && client.connected()) {
+        uint32_t start = micros();
+        size_t sent;
+        if (useStatic) {
+            sent = client.writeStatic(table.data, TABLE_SIZE);
+        }
+        else {
+            sent = 0;
+            while (sent < TABLE_SIZE && client.connected()) {
+                sent += client.write(table.data + sent, TABLE_SIZE - sent);
+                Ethernet.maintain();
+            }
+        }
+        busyUs += micros() - start;
+        bytes += sent;
+        Ethernet.maintain();
+    }
+    client.flush();
+    uint32_t elapsedMs = millis() - startMs;
+
+    Serial.print(useStatic ? "writeStatic(): " : "write():       ");
+    Serial.print(bytes / elapsedMs);
+    Serial.print(" kB/s, ");
+    Serial.print(busyUs / 1000 * 100 / elapsedMs);
+    Serial.print("% of the time in the send call, heap high-water mark ");
+    Serial.print(Ethernet.stats().pools[EthernetStats::Heap].max);
+    Serial.println(" bytes");
+}
+
+void setup() {
+    Serial.begin(9600);
+    uint32_t timeout = 5000;
+    uint32_t startTime = millis();
+    while (!Serial && millis() - startTime < timeout) {
+        continue;
+    }
+
+    // Make sure the physical link is up before continuing.
+    while (Ethernet.linkStatus() == LinkOFF) {
+        Serial.println("The Ethernet cable is unplugged...");
+        delay(1000);
+    }
+
+    byte mac[6];
+    if (!Ethernet.begin(mac)) {
+        Serial.println("DHCP configuration was unsuccessful!");
+        while (true) {
+            // TCP will not work without a configured IP address.
+            continue;
+        }
+    }
+
+    if (!client.connect(serverIp, SERVER_PORT)) {
+        Serial.println("Could not connect to the server!");
+        while (true) {
+            continue;
+        }
+    }
+
+    runTest(false);
+    runTest(true);
+    client.stop();
+}
+
+void loop() {
+    // Nothing to do; the benchmark runs once in setup().
+}
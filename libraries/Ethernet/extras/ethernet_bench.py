@@ -0,0 +1,487 @@
+# Host-side driver for the Ethernet benchmark sketches:
+#
+#   tcp-echo      EthernetTcpEchoBenchmark      TCP throughput
+#   udp-blast     EthernetUdpBlastBenchmark     UDP throughput and loss
+#   ping-pong     EthernetPingPongBenchmark     TCP/UDP round-trip latency
+#   connections   EthernetConnectionBenchmark   connection setup time and
+#                                               latency with many clients
+#
+# Load the sketch on a ClearCore, then run e.g.
+#
+#   python3 ethernet_bench.py 192.168.0.100 ping-pong udp
+#
+# The sketches can also be run on a PC, on the loopback interface; see
+# host/Makefile, whose bench-check target runs each test against them and
+# checks that --baseline catches a regression. The echo server is then on
+# port 8007 (see tcp-echo --port).
+#
+# Only the Python 3 standard library is needed. Latencies are reported as
+# percentiles. To catch regressions between releases, save the results of a
+# run with --json and compare later runs against them with --baseline; the
+# script exits with status 1 if any result is worse than the baseline by
+# more than --tolerance percent.
+
+import argparse
+import json
+import math
+import socket
+import struct
+import sys
+import threading
+import time
+
+TCP_ECHO_PORT = 7
+UDP_BLAST_PORT = 9001
+PING_PONG_PORT = 9002
+CONNECTION_PORT = 9003
+
+PERCENTILES = (50, 90, 99, 99.9)
+
+
+# print error and die
+def die(message):
+    print('error: ' + message, file=sys.stderr)
+    sys.exit(2)
+
+
+def percentile(sorted_values, p):
+    """Nearest-rank percentile of an already sorted list."""
+    if not sorted_values:
+        return 0.0
+    rank = max(1, math.ceil(p / 100.0 * len(sorted_values)))
+    return sorted_values[min(rank, len(sorted_values)) - 1]
+
+
+def summarize(results, name, values):
+    """Add the percentiles, minimum and maximum of values to results."""
+    values = sorted(values)
+    if not values:
+        return
+    results[name + '_min'] = values[0]
+    for p in PERCENTILES:
+        results['%s_p%s' % (name, ('%g' % p).replace('.', '_'))] = \
+            percentile(values, p)
+    results[name + '_max'] = values[-1]
+
+
+def recv_exactly(sock, length):
+    data = bytearray()
+    while len(data) < length:
+        chunk = sock.recv(length - len(data))
+        if not chunk:
+            raise ConnectionError('connection closed')
+        data += chunk
+    return bytes(data)
+
+
+def tcp_connect(host, port, timeout):
+    sock = socket.create_connection((host, port), timeout=timeout)
+    sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    return sock
+
+
+def tcp_echo(args):
+    """Stream data to the echo server and read it back."""
+    sock = tcp_connect(args.host, args.port, args.timeout)
+    total = args.bytes
+    chunk = bytes(i % 251 for i in range(args.chunk))
+    errors = []
+
+    def sender():
+        try:
+            left = total
+            while left:
+                count = min(left, len(chunk))
+                sock.sendall(chunk[:count])
+                left -= count
+        except OSError as e:
+            errors.append(e)
+
+    # Throughput over each interval, to show stalls the average would hide.
+    interval = args.interval / 1000.0
+    rates = []
+    received = 0
+    start = time.perf_counter()
+    interval_start = start
+    interval_bytes = 0
+    thread = threading.Thread(target=sender, daemon=True)
+    thread.start()
+    try:
+        while received < total:
+            data = sock.recv(65536)
+            if not data:
+                break
+            now = time.perf_counter()
+            received += len(data)
+            interval_bytes += len(data)
+            if now - interval_start >= interval:
+                rates.append(interval_bytes / (now - interval_start) / 1e6)
+                interval_start = now
+                interval_bytes = 0
+    except socket.timeout:
+        pass
+    elapsed = time.perf_counter() - start
+    thread.join(args.timeout)
+    sock.close()
+    if errors:
+        die('sending failed: %s' % errors[0])
+
+    results = {
+        'bytes': total,
+        'echoed_bytes': received,
+        'echo_mbps': received / elapsed / 1e6 if elapsed else 0.0,
+    }
+    # The lowest interval rates matter, so report them as percentiles from
+    # the bottom: interval_mbps_p10 is exceeded by 90% of the intervals.
+    rates = sorted(rates)
+    if rates:
+        for p in (1, 10, 50):
+            results['interval_mbps_p%d' % p] = percentile(rates, p)
+    return results
+
+
+def udp_socket(args):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4 * 1024 * 1024)
+    sock.connect((args.host, UDP_BLAST_PORT))
+    sock.settimeout(args.timeout)
+    return sock
+
+
+def udp_request(sock, request, reply_type):
+    """Send request until a reply starting with reply_type arrives."""
+    for attempt in range(5):
+        sock.send(request)
+        deadline = time.perf_counter() + 0.5
+        while time.perf_counter() < deadline:
+            try:
+                data = sock.recv(2048)
+            except socket.timeout:
+                break
+            if data[:1] == reply_type:
+                return data
+    die('no answer to %r' % request[:1])
+
+
+def udp_blast_to(args, sock):
+    """Blast numbered datagrams at the ClearCore and ask what arrived."""
+    sock.send(b'Z')
+    time.sleep(0.1)
+    payload = bytes(args.size - 5)
+    gap = 1.0 / args.rate if args.rate else 0.0
+    start = time.perf_counter()
+    for seq in range(args.count):
+        sock.send(b'D' + struct.pack('<I', seq) + payload)
+        if gap:
+            while time.perf_counter() < start + (seq + 1) * gap:
+                pass
+    offered = time.perf_counter() - start
+    # Let the last datagrams through before asking.
+    time.sleep(0.2)
+    reply = udp_request(sock, b'R', b'r')
+    (received, received_bytes, lost, reordered, elapsed_us, dropped_queue,
+     dropped_buffer, duplicated) = struct.unpack('<8I', reply[1:33])
+    return {
+        'sent': args.count,
+        'offered_mbps': args.count * args.size / offered / 1e6,
+        'received': received,
+        'lost_pct': 100.0 * (args.count - received) / args.count,
+        'reordered': reordered,
+        'duplicated': duplicated,
+        'dropped_queue_full': dropped_queue,
+        'dropped_no_buffer': dropped_buffer,
+        'receive_mbps': received_bytes / elapsed_us if elapsed_us else 0.0,
+    }
+
+
+def udp_blast_from(args, sock):
+    """Have the ClearCore blast numbered datagrams back, and count them."""
+    sock.send(b'T' + struct.pack('<IH', args.count, args.size))
+    received = 0
+    received_bytes = 0
+    reordered = 0
+    duplicated = 0
+    seen = set()
+    next_seq = 0
+    first = last = None
+    end = None
+    gaps = []
+    while True:
+        try:
+            data = sock.recv(2048)
+        except socket.timeout:
+            break
+        now = time.perf_counter()
+        if data[:1] == b'E':
+            end = struct.unpack('<3I', data[1:13])
+            break
+        if data[:1] != b'D':
+            continue
+        seq = struct.unpack('<I', data[1:5])[0]
+        if seq in seen:
+            duplicated += 1
+            continue
+        seen.add(seq)
+        if last is not None:
+            gaps.append((now - last) * 1e6)
+        if first is None:
+            first = now
+        last = now
+        received += 1
+        received_bytes += len(data)
+        if seq < next_seq:
+            reordered += 1
+        next_seq = max(next_seq, seq + 1)
+    if end is None:
+        die('the end of the blast was not received')
+    sent, elapsed_us, retries = end
+    results = {
+        'sent': sent,
+        'send_mbps': sent * args.size / elapsed_us if elapsed_us else 0.0,
+        'send_retries': retries,
+        'received': received,
+        'lost_pct': 100.0 * (sent - received) / sent if sent else 0.0,
+        'reordered': reordered,
+        'duplicated': duplicated,
+        'receive_mbps': (received_bytes / (last - first) / 1e6
+                         if received > 1 else 0.0),
+    }
+    summarize(results, 'gap_us', gaps)
+    return results
+
+
+def udp_blast(args):
+    if not 5 <= args.size <= 1472:
+        die('--size must be between 5 and 1472')
+    sock = udp_socket(args)
+    results = {}
+    if args.direction in ('to', 'both'):
+        for key, value in udp_blast_to(args, sock).items():
+            results['to_' + key] = value
+    if args.direction in ('from', 'both'):
+        for key, value in udp_blast_from(args, sock).items():
+            results['from_' + key] = value
+    sock.close()
+    return results
+
+
+def ping_pong(args):
+    """Time request/response round trips."""
+    if args.size < 4:
+        die('--size must be at least 4')
+    padding = bytes(args.size - 4)
+    if args.protocol == 'tcp':
+        sock = tcp_connect(args.host, PING_PONG_PORT, args.timeout)
+    else:
+        sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        sock.connect((args.host, PING_PONG_PORT))
+        sock.settimeout(args.timeout)
+
+    rtts = []
+    lost = 0
+    for seq in range(args.warmup + args.count):
+        request = struct.pack('<I', seq) + padding
+        start = time.perf_counter()
+        if args.protocol == 'tcp':
+            sock.sendall(request)
+            recv_exactly(sock, len(request))
+        else:
+            sock.send(request)
+            try:
+                # Skip late answers to requests already counted as lost.
+                while sock.recv(2048)[:4] != request[:4]:
+                    pass
+            except socket.timeout:
+                lost += 1
+                continue
+        rtt = (time.perf_counter() - start) * 1e6
+        if seq >= args.warmup:
+            rtts.append(rtt)
+        if args.pause:
+            time.sleep(args.pause / 1000.0)
+    sock.close()
+
+    results = {'count': args.count, 'lost': lost}
+    summarize(results, 'rtt_us', rtts)
+    return results
+
+
+def connections(args):
+    """Time connection setup, then round trips with many clients open."""
+    setups = []
+    refused = 0
+    for i in range(args.cycles):
+        start = time.perf_counter()
+        try:
+            sock = tcp_connect(args.host, CONNECTION_PORT, args.timeout)
+            greeting = sock.recv(1)
+        except OSError:
+            refused += 1
+            continue
+        if greeting != b'>':
+            refused += 1
+        else:
+            setups.append((time.perf_counter() - start) * 1e6)
+        sock.close()
+
+    socks = []
+    for i in range(args.concurrent):
+        try:
+            sock = tcp_connect(args.host, CONNECTION_PORT, args.timeout)
+            if sock.recv(1) == b'>':
+                socks.append(sock)
+                continue
+        except OSError:
+            pass
+        refused += 1
+
+    # Requests go to every connection at once, and the answers are
+    # collected in turn, as a host polling several devices would.
+    rtts = []
+    failed = 0
+    request = bytes(args.size)
+    for round_ in range(args.rounds):
+        start = time.perf_counter()
+        for sock in socks:
+            sock.sendall(request)
+        for sock in list(socks):
+            try:
+                recv_exactly(sock, len(request))
+            except OSError:
+                failed += 1
+                socks.remove(sock)
+                continue
+            rtts.append((time.perf_counter() - start) * 1e6)
+    held = len(socks)
+    for sock in socks:
+        sock.close()
+
+    results = {
+        'cycles': args.cycles,
+        'refused': refused,
+        'concurrent': held,
+        'failed': failed,
+    }
+    summarize(results, 'setup_us', setups)
+    summarize(results, 'rtt_us', rtts)
+    return results
+
+
+def worse(key, value, baseline, tolerance):
+    """Whether value is worse than baseline by more than tolerance %."""
+    if not isinstance(value, (int, float)) or \
+            not isinstance(baseline, (int, float)):
+        return False
+    if '_mbps' in key:
+        return value < baseline * (1 - tolerance / 100.0)
+    if '_us' in key or key.endswith('_pct') or \
+            key in ('lost', 'refused', 'failed'):
+        # Allow for a little absolute noise around small values.
+        return value > baseline * (1 + tolerance / 100.0) + 1
+    return False
+
+
+def main():
+    # Options every test takes, after its name.
+    common = argparse.ArgumentParser(add_help=False)
+    common.add_argument('--timeout', type=float, default=2.0,
+                        help='socket timeout in s (default 2)')
+    common.add_argument('--json', metavar='FILE',
+                        help='save the results to FILE')
+    common.add_argument('--baseline', metavar='FILE',
+                        help='compare the results with those saved in FILE')
+    common.add_argument('--tolerance', type=float, default=10.0,
+                        help='percent a result may be worse than the '
+                             'baseline (default 10)')
+
+    parser = argparse.ArgumentParser(
+        description='Drive the ClearCore Ethernet benchmark sketches.')
+    parser.add_argument('host', help='address of the ClearCore')
+    tests = parser.add_subparsers(dest='test')
+    tests.required = True
+
+    test = tests.add_parser('tcp-echo', parents=[common],
+                           help='TCP throughput')
+    test.add_argument('--bytes', type=int, default=16 * 1024 * 1024,
+                      help='bytes to send (default 16 MB)')
+    test.add_argument('--chunk', type=int, default=65536,
+                      help='size of each send (default 65536)')
+    test.add_argument('--port', type=int, default=TCP_ECHO_PORT,
+                      help='port of the echo server (default %d)' %
+                           TCP_ECHO_PORT)
+    test.add_argument('--interval', type=int, default=100,
+                      help='interval the throughput percentiles are '
+                           'measured over, in ms (default 100)')
+    test.set_defaults(run=tcp_echo)
+
+    test = tests.add_parser('udp-blast', parents=[common],
+                           help='UDP throughput and loss')
+    test.add_argument('direction', nargs='?', default='both',
+                      choices=('to', 'from', 'both'),
+                      help='to or from the ClearCore, or both (default)')
+    test.add_argument('--count', type=int, default=10000,
+                      help='datagrams to send (default 10000)')
+    test.add_argument('--size', type=int, default=1024,
+                      help='datagram size in bytes (default 1024)')
+    test.add_argument('--rate', type=float, default=0,
+                      help='datagrams per second sent to the ClearCore '
+                           '(default 0, as fast as possible)')
+    test.set_defaults(run=udp_blast)
+
+    test = tests.add_parser('ping-pong', parents=[common],
+                           help='round-trip latency')
+    test.add_argument('protocol', choices=('udp', 'tcp'))
+    test.add_argument('--count', type=int, default=10000,
+                      help='round trips to time (default 10000)')
+    test.add_argument('--warmup', type=int, default=100,
+                      help='round trips before timing starts (default 100)')
+    test.add_argument('--size', type=int, default=32,
+                      help='request size in bytes (default 32)')
+    test.add_argument('--pause', type=float, default=0,
+                      help='time between round trips in ms (default 0)')
+    test.set_defaults(run=ping_pong)
+
+    test = tests.add_parser('connections', parents=[common],
+                            help='connection setup time, and latency with '
+                                 'many clients')
+    test.add_argument('--cycles', type=int, default=200,
+                      help='connections to open and close (default 200)')
+    test.add_argument('--concurrent', type=int, default=8,
+                      help='connections to hold open at once (default 8)')
+    test.add_argument('--rounds', type=int, default=500,
+                      help='requests on each open connection (default 500)')
+    test.add_argument('--size', type=int, default=32,
+                      help='request size in bytes (default 32)')
+    test.set_defaults(run=connections)
+
+    args = parser.parse_args()
+    results = args.run(args)
+
+    width = max(len(key) for key in results)
+    for key, value in results.items():
+        if isinstance(value, float):
+            value = '%.3f' % value
+        print('%-*s  %s' % (width, key, value))
+
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump({'test': args.test, 'results': results}, f, indent=2)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        if baseline.get('test') != args.test:
+            die('the baseline is for %s' % baseline.get('test'))
+        regressions = [key for key, value in results.items()
+                       if key in baseline['results'] and
+                       worse(key, value, baseline['results'][key],
+                             args.tolerance)]
+        for key in regressions:
+            print('REGRESSION %s: %s (baseline %s)'
+                  % (key, results[key], baseline['results'][key]))
+        if regressions:
+            sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
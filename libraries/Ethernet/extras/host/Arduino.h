@@ -0,0 +1,173 @@
+/*
+ * Just enough of the Arduino core to build the Ethernet examples on a PC.
+ */
+
+#ifndef HOST_ARDUINO_H_
+#define HOST_ARDUINO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+typedef uint8_t byte;
+
+#define OUTPUT 1
+
+template<typename T>
+static inline T min(T a, T b) {
+    return a < b ? a : b;
+}
+
+template<typename T>
+static inline T max(T a, T b) {
+    return a > b ? a : b;
+}
+
+#define constrain(x, low, high) \
+    ((x) < (low) ? (low) : ((x) > (high) ? (high) : (x)))
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+char *itoa(int value, char *text, int base);
+
+// The ClearCore's I/O, which the PC has none of: outputs are ignored,
+// DI-6 changes state every HOST_INPUT_PERIOD_MS so sketches have input
+// changes to report, and other inputs read as off.
+#define HOST_INPUT_PERIOD_MS 500
+
+enum HostPin {
+    IO0,
+    DI6,
+    A12
+};
+
+void pinMode(int pin, int mode);
+int digitalRead(int pin);
+void digitalWrite(int pin, int value);
+int analogRead(int pin);
+
+class Print;
+
+class Printable {
+public:
+    virtual size_t printTo(Print &p) const = 0;
+};
+
+class Print {
+protected:
+    void setWriteError(int err = 1) {
+        (void)err;
+    }
+
+public:
+    virtual size_t write(uint8_t) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+        size_t n = 0;
+        while (size-- && write(*buffer++)) {
+            n++;
+        }
+        return n;
+    }
+    size_t write(const char *str) {
+        return write((const uint8_t *)str, strlen(str));
+    }
+    size_t write(const char *buffer, size_t size) {
+        return write((const uint8_t *)buffer, size);
+    }
+
+    size_t print(const char *str) {
+        return write(str);
+    }
+    size_t print(char c) {
+        return write((uint8_t)c);
+    }
+    size_t print(long n) {
+        char text[24];
+        return write(text, snprintf(text, sizeof(text), "%ld", n));
+    }
+    size_t print(unsigned long n) {
+        char text[24];
+        return write(text, snprintf(text, sizeof(text), "%lu", n));
+    }
+    size_t print(int n) {
+        return print((long)n);
+    }
+    size_t print(unsigned int n) {
+        return print((unsigned long)n);
+    }
+    size_t print(const Printable &x) {
+        return x.printTo(*this);
+    }
+
+    size_t println() {
+        return write("\r\n");
+    }
+    template<typename T>
+    size_t println(T x) {
+        size_t n = print(x);
+        return n + println();
+    }
+    size_t println(const Printable &x) {
+        size_t n = print(x);
+        return n + println();
+    }
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() = 0;
+};
+
+class IPAddress : public Printable {
+public:
+    IPAddress() : m_address() {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+        : m_address{a, b, c, d} {}
+
+    uint8_t operator[](int index) const {
+        return m_address[index];
+    }
+    uint8_t &operator[](int index) {
+        return m_address[index];
+    }
+
+    virtual size_t printTo(Print &p) const {
+        char text[16];
+        return p.write(text, snprintf(text, sizeof(text), "%u.%u.%u.%u",
+                                      m_address[0], m_address[1],
+                                      m_address[2], m_address[3]));
+    }
+
+private:
+    uint8_t m_address[4];
+};
+
+// The USB serial port is standard output.
+class HostSerial : public Print {
+public:
+    void begin(uint32_t baud) {
+        (void)baud;
+    }
+    operator bool() {
+        return true;
+    }
+    virtual size_t write(uint8_t c) {
+        return fwrite(&c, 1, 1, stdout);
+    }
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+        return fwrite(buffer, 1, size, stdout);
+    }
+    using Print::write;
+};
+
+extern HostSerial Serial;
+
+#endif // HOST_ARDUINO_H_
@@ -0,0 +1,47 @@
+/*
+ * Connectors on a PC: each keeps the state last written to it, so what a
+ * master writes reads back as it would on a ClearCore with nothing wired.
+ */
+
+#ifndef HOST_CONNECTOR_H_
+#define HOST_CONNECTOR_H_
+
+#include <stdint.h>
+
+namespace ClearCore {
+
+class Connector {
+public:
+    enum ConnectorModes {
+        INVALID_NONE,
+        INPUT_ANALOG,
+        INPUT_DIGITAL,
+        OUTPUT_ANALOG,
+        OUTPUT_DIGITAL,
+        CPM_MODE_A_DIRECT_B_DIRECT,
+        CPM_MODE_STEP_AND_DIR,
+        CPM_MODE_A_DIRECT_B_PWM,
+        CPM_MODE_A_PWM_B_PWM
+    };
+
+    Connector() : m_state(0) {}
+
+    virtual int16_t State() {
+        return m_state;
+    }
+    virtual bool State(int16_t value) {
+        m_state = value;
+        return true;
+    }
+
+private:
+    int16_t m_state;
+};
+
+extern Connector ConnectorIO0;
+extern Connector ConnectorDI6;
+extern Connector ConnectorA12;
+
+} // ClearCore
+
+#endif // HOST_CONNECTOR_H_
@@ -0,0 +1,270 @@
+/*
+ * The parts of the Ethernet library that the sketches built here use, on
+ * a PC's own TCP/IP stack.
+ *
+ * Sockets are non-blocking, and write() waits for room only as long as it
+ * does on the ClearCore: until all of the data is taken, the connection
+ * closes, or a second passes without progress; availableForWrite() tells
+ * how much it takes at once. Ports below 1024 are moved up by
+ * HOST_PORT_OFFSET so the server can run without privileges; a sketch's
+ * port 80 is port 8080 on the PC. Everything happens on the loopback
+ * interface: connectAsync() connects to 127.0.0.1 whatever address it is
+ * given, so a sketch's broker or server at e.g. 192.168.1.10:1883 is
+ * found at 127.0.0.1:1883.
+ */
+
+#ifndef HOST_ETHERNET_H_
+#define HOST_ETHERNET_H_
+
+#include <Arduino.h>
+
+#define HOST_PORT_OFFSET 8000
+
+// Send buffer of each accepted connection, in bytes. Kept small, like
+// lwIP's, so that a browser that reads slowly soon leaves the server with
+// data it cannot send yet.
+#ifndef HOST_SEND_BUFFER
+#define HOST_SEND_BUFFER 4096
+#endif
+
+// Wait before connecting again after a failed attempt, doubling up to the
+// maximum, in ms.
+#define HOST_CONNECT_BACKOFF_MS 100
+#define HOST_CONNECT_BACKOFF_MAX_MS 2000
+
+enum EthernetAsyncStatus {
+    EthernetAsyncIdle,
+    EthernetAsyncInProgress,
+    EthernetAsyncSuccess,
+    EthernetAsyncFailed
+};
+
+enum EthernetLinkStatus {
+    Unknown,
+    LinkON,
+    LinkOFF
+};
+
+// A contiguous run of received bytes.
+struct EthernetSpan {
+    const uint8_t *data;
+    size_t length;
+};
+
+// Most bytes span() returns at once.
+#define HOST_SPAN_SIZE 1460
+
+class EthernetClient {
+public:
+    EthernetClient() : EthernetClient(-1) {}
+    explicit EthernetClient(int fd)
+        : m_fd(fd),
+          m_connectStatus(EthernetAsyncIdle),
+          m_connectPort(0),
+          m_connectStarted(0),
+          m_connectTimeout(0),
+          m_connectRetryAt(0),
+          m_connectBackoff(0) {}
+
+    // Keeps trying, with backoff, until connected or timeout ms have
+    // passed, as on the ClearCore.
+    void connectAsync(IPAddress ip, uint16_t port, uint32_t timeout = 10000);
+    EthernetAsyncStatus connectStatus();
+
+    size_t write(uint8_t val) {
+        return write(&val, 1);
+    }
+    size_t write(const uint8_t *buf, size_t size);
+    size_t writeStatic(const uint8_t *buf, size_t size);
+    size_t writeStatic(const char *str) {
+        return writeStatic((const uint8_t *)str, strlen(str));
+    }
+    int availableForWrite();
+    void setNoDelay(bool noDelay);
+
+    int available();
+    int read(uint8_t *buf, size_t size);
+    // A copy of the received bytes, as the PC's stack does not lend out its
+    // buffers; valid until the next call to span() or consume().
+    EthernetSpan span();
+    void consume(size_t count);
+
+    void stop();
+    uint8_t connected();
+    IPAddress remoteIP();
+
+    operator bool() {
+        return m_fd >= 0;
+    }
+
+private:
+    bool connectStart();
+
+    int m_fd;
+    EthernetAsyncStatus m_connectStatus;
+    uint16_t m_connectPort;
+    uint32_t m_connectStarted;
+    uint32_t m_connectTimeout;
+    uint32_t m_connectRetryAt;
+    uint32_t m_connectBackoff;
+    uint8_t m_span[HOST_SPAN_SIZE];
+};
+
+// Most clients a callback-driven EthernetServer serves at once; further
+// connections are closed.
+#define ETHERNET_SERVER_MAX_CLIENTS 8
+
+typedef void (*EthernetServerHandler)(EthernetClient &client, void **context);
+
+class EthernetServer {
+public:
+    EthernetServer(uint16_t port)
+        : m_port(port),
+          m_fd(-1),
+          m_onConnect(nullptr),
+          m_onData(nullptr),
+          m_onClose(nullptr),
+          m_clients(),
+          m_contexts(),
+          m_clientCount(0),
+          m_nextService(nullptr) {}
+
+    void begin();
+    EthernetClient accept();
+
+    // The callbacks are run from Ethernet.maintain().
+    void onConnect(EthernetServerHandler handler) {
+        m_onConnect = handler;
+    }
+    void onData(EthernetServerHandler handler) {
+        m_onData = handler;
+    }
+    void onClose(EthernetServerHandler handler) {
+        m_onClose = handler;
+    }
+    uint8_t clientCount() {
+        return m_clientCount;
+    }
+
+private:
+    friend class EthernetClass;
+    void service();
+
+    uint16_t m_port;
+    int m_fd;
+    EthernetServerHandler m_onConnect;
+    EthernetServerHandler m_onData;
+    EthernetServerHandler m_onClose;
+    EthernetClient m_clients[ETHERNET_SERVER_MAX_CLIENTS];
+    void *m_contexts[ETHERNET_SERVER_MAX_CLIENTS];
+    uint8_t m_clientCount;
+    // Servers with callbacks.
+    EthernetServer *m_nextService;
+    static EthernetServer *m_serviceList;
+};
+
+// Largest datagram an EthernetUDP takes, in bytes; one that fits in a
+// single Ethernet frame.
+#define HOST_UDP_PACKET_SIZE 1472
+
+// Datagrams a sketch may ask EthernetUDP to queue. On the PC they queue
+// in the socket's receive buffer instead.
+#define ETHERNET_UDP_RX_QUEUE 16
+
+class EthernetUDP;
+
+typedef void (*EthernetUDPHandler)(EthernetUDP &udp);
+
+// Datagrams on the PC's loopback interface, implemented by host.cpp, or
+// on a simulated link, implemented by time_sync_sim.cpp and
+// setpoint_sim.cpp, which run controllers' clocks and the link between
+// them in simulated time (the PC's clock cannot be made to drift). Each
+// only implements what the library it checks uses.
+class EthernetUDP {
+public:
+    EthernetUDP()
+        : m_port(0),
+          m_packet(),
+          m_length(0),
+          m_timestamp(0),
+          m_remoteIp(),
+          m_remotePort(0),
+          m_fd(-1),
+          m_queued(false),
+          m_onPacket(nullptr),
+          m_nextService(nullptr) {}
+
+    uint8_t begin(uint16_t localPort);
+    void stop();
+    int parsePacket();
+    int read(unsigned char *buffer, size_t len);
+    int receive(const uint8_t **data);
+    int sendTo(IPAddress remoteIp, uint16_t remotePort, const uint8_t *data,
+               size_t length);
+    IPAddress remoteIP() {
+        return m_remoteIp;
+    }
+    uint16_t remotePort() {
+        return m_remotePort;
+    }
+    uint32_t packetTimestamp() {
+        return m_timestamp;
+    }
+
+    // The handler is run from Ethernet.maintain().
+    void onPacket(EthernetUDPHandler handler);
+    void setReceiveQueueDepth(uint8_t depth) {
+        (void)depth;
+    }
+    // The PC's own drops are not counted.
+    uint32_t packetsDroppedQueueFull() {
+        return 0;
+    }
+    uint32_t packetsDroppedNoBuffer() {
+        return 0;
+    }
+
+private:
+    friend class EthernetClass;
+    bool fetch();
+
+    uint16_t m_port;
+    uint8_t m_packet[HOST_UDP_PACKET_SIZE];
+    size_t m_length;
+    uint32_t m_timestamp;
+    IPAddress m_remoteIp;
+    uint16_t m_remotePort;
+    int m_fd;
+    // A datagram has been fetched for the handler but not yet parsed.
+    bool m_queued;
+    EthernetUDPHandler m_onPacket;
+    // Sockets with a handler.
+    EthernetUDP *m_nextService;
+    static EthernetUDP *m_serviceList;
+};
+
+class EthernetClass {
+public:
+    int begin(uint8_t *mac) {
+        (void)mac;
+        return 1;
+    }
+    // Runs the servers' and sockets' callbacks, then waits briefly, so that
+    // loop() does not spin the PC's CPU.
+    int maintain();
+    // Callbacks always run from maintain() on the PC.
+    void setInterruptService(bool enable, uint8_t periodMs = 1) {
+        (void)enable;
+        (void)periodMs;
+    }
+    EthernetLinkStatus linkStatus() {
+        return LinkON;
+    }
+    IPAddress localIP() {
+        return IPAddress(127, 0, 0, 1);
+    }
+};
+
+extern EthernetClass Ethernet;
+
+#endif // HOST_ETHERNET_H_
@@ -0,0 +1,105 @@
+/*
+ * A motor on a PC, with nothing attached: moves finish as soon as they are
+ * commanded, and HLFB reads as asserted with a fixed torque.
+ */
+
+#ifndef HOST_MOTOR_DRIVER_H_
+#define HOST_MOTOR_DRIVER_H_
+
+#include "Connector.h"
+
+// Torque reported by HlfbPercent(), in percent.
+#define HOST_MOTOR_TORQUE 12.5
+
+namespace ClearCore {
+
+class MotorDriver : public Connector {
+public:
+    enum MoveTarget {
+        MOVE_TARGET_ABSOLUTE,
+        MOVE_TARGET_REL_END_POSN
+    };
+    enum HlfbStates {
+        HLFB_DEASSERTED,
+        HLFB_ASSERTED,
+        HLFB_HAS_MEASUREMENT,
+        HLFB_UNKNOWN
+    };
+    enum HlfbModes {
+        HLFB_MODE_STATIC,
+        HLFB_MODE_HAS_PWM,
+        HLFB_MODE_HAS_BIPOLAR_PWM
+    };
+    enum HlfbCarrierFrequency {
+        HLFB_CARRIER_45_HZ,
+        HLFB_CARRIER_482_HZ
+    };
+
+    MotorDriver() : m_position(0), m_velocity(0), m_enable(false) {}
+
+    bool Move(int32_t distance,
+              MoveTarget target = MOVE_TARGET_REL_END_POSN) {
+        m_position = target == MOVE_TARGET_ABSOLUTE ? distance :
+                     m_position + distance;
+        m_velocity = 0;
+        return true;
+    }
+    bool MoveVelocity(int32_t velocity) {
+        m_velocity = velocity;
+        return true;
+    }
+    void MoveStopDecel(int32_t = 0) {
+        m_velocity = 0;
+    }
+    void VelMax(int32_t) {}
+    void AccelMax(int32_t) {}
+    int32_t PositionRefCommanded() {
+        return m_position;
+    }
+    int32_t VelocityRefCommanded() {
+        return m_velocity;
+    }
+    bool StepsComplete() {
+        return !m_velocity;
+    }
+    void EnableRequest(bool enable) {
+        m_enable = enable;
+    }
+    bool EnableRequest() {
+        return m_enable;
+    }
+    HlfbStates HlfbState() {
+        return HLFB_ASSERTED;
+    }
+    float HlfbPercent() {
+        return HOST_MOTOR_TORQUE;
+    }
+    void HlfbMode(HlfbModes) {}
+    void HlfbCarrier(HlfbCarrierFrequency) {}
+
+private:
+    int32_t m_position;
+    int32_t m_velocity;
+    bool m_enable;
+};
+
+class MotorManager {
+public:
+    enum MotorPair {
+        MOTOR_M0M1,
+        MOTOR_M2M3,
+        MOTOR_ALL
+    };
+
+    void MotorModeSet(MotorPair, Connector::ConnectorModes) {}
+};
+
+extern MotorDriver ConnectorM0;
+extern MotorManager MotorMgr;
+
+} // ClearCore
+
+// Sketches use these names without the namespace.
+using namespace ClearCore;
+
+#endif // HOST_MOTOR_DRIVER_H_
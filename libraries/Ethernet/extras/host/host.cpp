@@ -0,0 +1,492 @@
+/*
+ * The Arduino core, the Ethernet library and the ClearCore's connectors
+ * on a PC, for running the examples on the loopback interface. See
+ * Makefile.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <Arduino.h>
+#include <Ethernet.h>
+#include "EthernetService.h"
+#include "MotorDriver.h"
+#include "SdFileSystem.h"
+
+void setup();
+void loop();
+
+HostSerial Serial;
+EthernetClass Ethernet;
+
+static uint64_t nowUs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+uint32_t millis() {
+    return nowUs() / 1000;
+}
+
+uint32_t micros() {
+    return nowUs();
+}
+
+void delay(uint32_t ms) {
+    usleep(ms * 1000);
+}
+
+void delayMicroseconds(uint32_t us) {
+    usleep(us);
+}
+
+char *itoa(int value, char *text, int base) {
+    char digits[34];
+    char *p = digits + sizeof(digits);
+    unsigned int magnitude = value < 0 && base == 10 ? -(unsigned int)value :
+                             (unsigned int)value;
+    *--p = '\0';
+    do {
+        *--p = "0123456789abcdefghijklmnopqrstuvwxyz"[magnitude % base];
+        magnitude /= base;
+    } while (magnitude);
+    if (value < 0 && base == 10) {
+        *--p = '-';
+    }
+    return strcpy(text, p);
+}
+
+void pinMode(int, int) {}
+
+int digitalRead(int pin) {
+    return pin == DI6 && millis() / HOST_INPUT_PERIOD_MS % 2;
+}
+
+void digitalWrite(int, int) {}
+
+int analogRead(int) {
+    return 0;
+}
+
+namespace ClearCore {
+
+Connector ConnectorIO0;
+Connector ConnectorDI6;
+Connector ConnectorA12;
+MotorDriver ConnectorM0;
+MotorManager MotorMgr;
+
+} // ClearCore
+
+// There is no network stack to lock on the PC.
+EthernetLock::EthernetLock() {}
+
+EthernetLock::~EthernetLock() {}
+
+// There is no card either; begin() fails as it does without one.
+class NoCard : public SdSectorDevice {
+public:
+    virtual bool readSector(uint32_t, uint8_t *) {
+        return false;
+    }
+    virtual bool writeSector(uint32_t, const uint8_t *) {
+        return false;
+    }
+    virtual bool readSectors(uint32_t, uint8_t *, uint32_t) {
+        return false;
+    }
+    virtual bool writeSectors(uint32_t, const uint8_t *, uint32_t) {
+        return false;
+    }
+};
+
+static NoCard noCard;
+SdFileSystem SdCardFs(noCard);
+
+bool SdFileSystem::begin(uint32_t) {
+    return mount();
+}
+
+void SdFileSystem::end() {
+    unmount();
+}
+
+// Port 0, for any free port, is left as it is.
+static uint16_t hostPort(uint16_t port) {
+    return port && port < 1024 ? port + HOST_PORT_OFFSET : port;
+}
+
+static struct sockaddr_in loopback(uint16_t port) {
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(hostPort(port));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return address;
+}
+
+static IPAddress ipAddress(const struct sockaddr_in &address) {
+    uint32_t ip = ntohl(address.sin_addr.s_addr);
+    return IPAddress(ip >> 24, ip >> 16, ip >> 8, ip);
+}
+
+void EthernetClient::connectAsync(IPAddress, uint16_t port,
+                                  uint32_t timeout) {
+    stop();
+    m_connectStatus = EthernetAsyncInProgress;
+    m_connectPort = port;
+    m_connectStarted = millis();
+    m_connectTimeout = timeout;
+    m_connectRetryAt = m_connectStarted;
+    m_connectBackoff = HOST_CONNECT_BACKOFF_MS;
+}
+
+EthernetAsyncStatus EthernetClient::connectStatus() {
+    if (m_connectStatus != EthernetAsyncInProgress) {
+        return m_connectStatus;
+    }
+    struct pollfd pfd = {m_fd, POLLOUT, 0};
+    if (m_fd >= 0 && poll(&pfd, 1, 0) == 1) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(m_fd, SOL_SOCKET, SO_ERROR, &error, &length);
+        if (!error) {
+            m_connectStatus = EthernetAsyncSuccess;
+            return m_connectStatus;
+        }
+        close(m_fd);
+        m_fd = -1;
+        m_connectRetryAt = millis() + m_connectBackoff;
+        m_connectBackoff = min(m_connectBackoff * 2,
+                               (uint32_t)HOST_CONNECT_BACKOFF_MAX_MS);
+    }
+
+    if (millis() - m_connectStarted >= m_connectTimeout) {
+        stop();
+        m_connectStatus = EthernetAsyncFailed;
+        return m_connectStatus;
+    }
+    if (m_fd < 0 && (int32_t)(millis() - m_connectRetryAt) >= 0 &&
+            !connectStart()) {
+        m_connectRetryAt = millis() + m_connectBackoff;
+    }
+    return m_connectStatus;
+}
+
+bool EthernetClient::connectStart() {
+    struct sockaddr_in address = loopback(m_connectPort);
+    m_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (m_fd >= 0 &&
+            (!connect(m_fd, (struct sockaddr *)&address, sizeof(address)) ||
+             errno == EINPROGRESS)) {
+        return true;
+    }
+    stop();
+    return false;
+}
+
+// Like the library's, waits until all of the data is taken, the
+// connection closes, or a second passes without progress.
+size_t EthernetClient::write(const uint8_t *buf, size_t size) {
+    size_t sent = 0;
+    uint32_t lastProgress = millis();
+    while (m_fd >= 0 && sent < size &&
+            millis() - lastProgress < 1000) {
+        ssize_t count = send(m_fd, buf + sent, size - sent,
+                             MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (count > 0) {
+            sent += count;
+            lastProgress = millis();
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            break;
+        }
+        struct pollfd pfd = {m_fd, POLLOUT, 0};
+        poll(&pfd, 1, 10);
+    }
+    return sent;
+}
+
+size_t EthernetClient::writeStatic(const uint8_t *buf, size_t size) {
+    return write(buf, size);
+}
+
+void EthernetClient::setNoDelay(bool noDelay) {
+    int on = noDelay;
+    if (m_fd >= 0) {
+        setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+}
+
+int EthernetClient::availableForWrite() {
+    struct pollfd pfd = {m_fd, POLLOUT, 0};
+    int queued;
+    if (m_fd < 0 || poll(&pfd, 1, 0) != 1 || !(pfd.revents & POLLOUT) ||
+            ioctl(m_fd, SIOCOUTQ, &queued)) {
+        return 0;
+    }
+    return queued < HOST_SEND_BUFFER ? HOST_SEND_BUFFER - queued : 0;
+}
+
+int EthernetClient::available() {
+    int count;
+    if (m_fd < 0 || ioctl(m_fd, FIONREAD, &count)) {
+        return 0;
+    }
+    return count;
+}
+
+int EthernetClient::read(uint8_t *buf, size_t size) {
+    if (m_fd < 0) {
+        return -1;
+    }
+    ssize_t count = recv(m_fd, buf, size, MSG_DONTWAIT);
+    return count > 0 ? count : -1;
+}
+
+EthernetSpan EthernetClient::span() {
+    EthernetSpan span = {m_span, 0};
+    ssize_t count = m_fd < 0 ? -1 : recv(m_fd, m_span, sizeof(m_span),
+                                         MSG_PEEK | MSG_DONTWAIT);
+    if (count > 0) {
+        span.length = count;
+    }
+    return span;
+}
+
+void EthernetClient::consume(size_t count) {
+    while (m_fd >= 0 && count) {
+        ssize_t taken = recv(m_fd, m_span, min(count, sizeof(m_span)),
+                             MSG_DONTWAIT);
+        if (taken <= 0) {
+            break;
+        }
+        count -= taken;
+    }
+}
+
+void EthernetClient::stop() {
+    if (m_fd >= 0) {
+        close(m_fd);
+        m_fd = -1;
+    }
+    m_connectStatus = EthernetAsyncIdle;
+}
+
+uint8_t EthernetClient::connected() {
+    if (m_fd < 0) {
+        return false;
+    }
+    uint8_t c;
+    ssize_t count = recv(m_fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return count > 0 ||
+           (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+IPAddress EthernetClient::remoteIP() {
+    struct sockaddr_in address;
+    socklen_t length = sizeof(address);
+    if (m_fd < 0 ||
+            getpeername(m_fd, (struct sockaddr *)&address, &length)) {
+        return IPAddress();
+    }
+    return ipAddress(address);
+}
+
+EthernetServer *EthernetServer::m_serviceList = nullptr;
+
+void EthernetServer::begin() {
+    struct sockaddr_in address = loopback(m_port);
+    int on = 1;
+    m_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (m_fd < 0 ||
+            setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) ||
+            bind(m_fd, (struct sockaddr *)&address, sizeof(address)) ||
+            listen(m_fd, 8)) {
+        perror("listen");
+        exit(2);
+    }
+    printf("Listening on 127.0.0.1:%u\n", hostPort(m_port));
+    m_nextService = m_serviceList;
+    m_serviceList = this;
+}
+
+EthernetClient EthernetServer::accept() {
+    int fd = m_fd < 0 ? -1 : accept4(m_fd, nullptr, nullptr, SOCK_NONBLOCK);
+    if (fd < 0) {
+        return EthernetClient();
+    }
+    int size = HOST_SEND_BUFFER;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    EthernetClient client(fd);
+    // Writes go out as they are made, as they do through lwIP, rather than
+    // waiting on the other end's delayed acknowledgements.
+    client.setNoDelay(true);
+    return client;
+}
+
+// Close connections that have closed, take new ones, and pass on
+// received data.
+void EthernetServer::service() {
+    if (!m_onConnect && !m_onData && !m_onClose) {
+        return;
+    }
+    for (uint8_t i = 0; i < m_clientCount;) {
+        if (m_clients[i].connected()) {
+            i++;
+            continue;
+        }
+        if (m_onClose) {
+            m_onClose(m_clients[i], &m_contexts[i]);
+        }
+        m_clients[i].stop();
+        m_clientCount--;
+        m_clients[i] = m_clients[m_clientCount];
+        m_contexts[i] = m_contexts[m_clientCount];
+    }
+    for (EthernetClient client = accept(); client; client = accept()) {
+        if (m_clientCount == ETHERNET_SERVER_MAX_CLIENTS) {
+            client.stop();
+            continue;
+        }
+        uint8_t i = m_clientCount++;
+        m_clients[i] = client;
+        m_contexts[i] = nullptr;
+        if (m_onConnect) {
+            m_onConnect(m_clients[i], &m_contexts[i]);
+        }
+    }
+    for (uint8_t i = 0; i < m_clientCount; i++) {
+        if (m_onData && m_clients[i].available() > 0) {
+            m_onData(m_clients[i], &m_contexts[i]);
+        }
+    }
+}
+
+EthernetUDP *EthernetUDP::m_serviceList = nullptr;
+
+uint8_t EthernetUDP::begin(uint16_t localPort) {
+    stop();
+    struct sockaddr_in address = loopback(localPort);
+    m_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (m_fd < 0 ||
+            bind(m_fd, (struct sockaddr *)&address, sizeof(address))) {
+        stop();
+        return 0;
+    }
+    m_port = localPort;
+    return 1;
+}
+
+void EthernetUDP::stop() {
+    if (m_fd >= 0) {
+        close(m_fd);
+        m_fd = -1;
+    }
+    m_port = 0;
+    m_length = 0;
+    m_queued = false;
+}
+
+// Take the next datagram from the socket, if one has arrived.
+bool EthernetUDP::fetch() {
+    struct sockaddr_in from;
+    socklen_t length = sizeof(from);
+    ssize_t count = m_fd < 0 ? -1 :
+                    recvfrom(m_fd, m_packet, sizeof(m_packet), MSG_DONTWAIT,
+                             (struct sockaddr *)&from, &length);
+    if (count < 0) {
+        return false;
+    }
+    m_length = count;
+    m_timestamp = micros();
+    m_remoteIp = ipAddress(from);
+    m_remotePort = ntohs(from.sin_port);
+    m_queued = true;
+    return true;
+}
+
+int EthernetUDP::parsePacket() {
+    if (!m_queued && !fetch()) {
+        m_length = 0;
+        return 0;
+    }
+    m_queued = false;
+    return m_length;
+}
+
+int EthernetUDP::read(unsigned char *buffer, size_t len) {
+    len = min(len, m_length);
+    memcpy(buffer, m_packet, len);
+    memmove(m_packet, m_packet + len, m_length - len);
+    m_length -= len;
+    return len;
+}
+
+int EthernetUDP::receive(const uint8_t **data) {
+    if (!parsePacket()) {
+        return 0;
+    }
+    *data = m_packet;
+    return m_length;
+}
+
+// Sent to 127.0.0.1 whatever address is given, from any free port if
+// begin() has not been called.
+int EthernetUDP::sendTo(IPAddress, uint16_t remotePort, const uint8_t *data,
+                        size_t length) {
+    struct sockaddr_in address = loopback(remotePort);
+    if (m_fd < 0 && !begin(0)) {
+        return 0;
+    }
+    ssize_t sent = sendto(m_fd, data, length, MSG_DONTWAIT,
+                          (struct sockaddr *)&address, sizeof(address));
+    return sent == (ssize_t)length;
+}
+
+void EthernetUDP::onPacket(EthernetUDPHandler handler) {
+    m_onPacket = handler;
+    for (EthernetUDP *udp = m_serviceList; udp; udp = udp->m_nextService) {
+        if (udp == this) {
+            return;
+        }
+    }
+    m_nextService = m_serviceList;
+    m_serviceList = this;
+}
+
+int EthernetClass::maintain() {
+    for (EthernetServer *server = EthernetServer::m_serviceList; server;
+            server = server->m_nextService) {
+        server->service();
+    }
+    // As on the ClearCore, a datagram the handler leaves stays queued.
+    for (EthernetUDP *udp = EthernetUDP::m_serviceList; udp;
+            udp = udp->m_nextService) {
+        for (uint8_t i = 0; i < ETHERNET_UDP_RX_QUEUE && udp->m_onPacket &&
+                (udp->m_queued || udp->fetch()); i++) {
+            udp->m_onPacket(*udp);
+            if (udp->m_queued) {
+                break;
+            }
+        }
+    }
+    usleep(100);
+    return 0;
+}
+
+int main() {
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+    setup();
+    for (;;) {
+        loop();
+    }
+}
@@ -0,0 +1,354 @@
+/*
+ * EthernetSetpointStream on a simulated network, for checking its jitter
+ * buffer.
+ *
+ * A host streams setpoints, one per tick of its own clock, over a link that
+ * delays each datagram by a fixed time on the wire plus a random time of up
+ * to a set jitter. The library's own EthernetSetpoint.cpp plays them out to
+ * two motors: a velocity on M-0 (10 times the sequence number) and a
+ * position on M-1 (100 times it). micros() and EthernetUDP are simulated
+ * here, and micros() wraps during each scenario. The scenarios:
+ *
+ *   - a steady stream with jitter below the depth plays every setpoint;
+ *   - setpoints that arrive out of order within the depth are all played;
+ *   - a late, a lost, a duplicated and an early setpoint are each counted
+ *     as such, and a setpoint only missing is an underrun;
+ *   - a gap in the stream holds the motors at their last setpoint, or
+ *     decelerates them to a stop, as set, and playback then resumes;
+ *   - a stream that ends times out, without counting the silence as an
+ *     underrun, and the next datagram starts a new stream;
+ *   - resetting the statistics in that silence leaves nothing counted;
+ *   - playout follows a host clock 1000 ppm fast or slow for a minute, with
+ *     nothing missed and the buffer level staying near the depth on
+ *     average (without following the clock, it would drift by 29).
+ *
+ *   make setpoint_sim
+ *   ./setpoint_sim [-v] [-r seed]
+ *
+ *   -v  print each scenario's statistics
+ *   -r  seed for the jitter (1)
+ *
+ * Prints ok or FAIL for each scenario, with its statistics on failure.
+ * Exits with status 1 if any scenario fails.
+ */
+
+#include <unistd.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include <Arduino.h>
+#include <Ethernet.h>
+#include "EthernetService.h"
+#include "EthernetSetpoint.h"
+
+// Simulated time between calls to loop(), in us.
+#define SIM_LOOP_US 100
+// Delay of every datagram on the wire, in us.
+#define SIM_WIRE_US 300
+#define SIM_PORT 9100
+#define SIM_TICK_US 2000
+#define SIM_DEPTH 4
+// micros() at simulated time 0, 5 s before it wraps.
+#define SIM_START (0xFFFFFFFFULL - 5000000)
+
+HostSerial Serial;
+
+struct Datagram {
+    // Simulated time it reaches the controller, in us.
+    uint64_t arrival;
+    uint32_t seq;
+};
+
+static uint64_t simNow = 0;
+// Datagrams on the link, taken in order of arrival from delivered on.
+static std::vector<Datagram> wire;
+static size_t delivered = 0;
+static std::mt19937 chance(1);
+
+static MotorDriver velocityMotor;
+static MotorDriver positionMotor;
+static bool verbose = false;
+static int failures = 0;
+
+uint32_t micros() {
+    return SIM_START + simNow;
+}
+
+uint32_t millis() {
+    return (SIM_START + simNow) / 1000;
+}
+
+void delay(uint32_t) {}
+
+EthernetLock::EthernetLock() {}
+
+EthernetLock::~EthernetLock() {}
+
+static void put32(uint8_t *p, uint32_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+uint8_t EthernetUDP::begin(uint16_t localPort) {
+    m_port = localPort;
+    return 1;
+}
+
+void EthernetUDP::stop() {
+    m_port = 0;
+}
+
+// Take the next datagram, if it has arrived.
+int EthernetUDP::receive(const uint8_t **data) {
+    if (!m_port || delivered == wire.size() ||
+            wire[delivered].arrival > simNow) {
+        return 0;
+    }
+    const Datagram &d = wire[delivered++];
+    put32(m_packet, d.seq);
+    put32(m_packet + 4, 10 * d.seq);
+    put32(m_packet + 8, 100 * d.seq);
+    m_length = 12;
+    m_timestamp = SIM_START + d.arrival;
+    *data = m_packet;
+    return m_length;
+}
+
+// Start a scenario: no datagrams, motors at rest, and simulated time 0.
+static void reset(EthernetSetpointStream &stream,
+                  EthernetSetpointUnderrun action = SetpointHold) {
+    simNow = 0;
+    wire.clear();
+    delivered = 0;
+    velocityMotor = MotorDriver();
+    positionMotor = MotorDriver();
+    stream.attach(0, velocityMotor, SetpointVelocity);
+    stream.attach(1, positionMotor, SetpointPosition);
+    stream.setUnderrun(action);
+    stream.begin(SIM_PORT, SIM_TICK_US, SIM_DEPTH);
+}
+
+// Send setpoints first to first + count - 1, the first at simulated time
+// at, then one per tick of a host clock ppm fast, each delayed by up to
+// jitterUs beyond the wire.
+static void send(uint32_t first, uint32_t count, uint64_t at,
+                 double ppm = 0, uint32_t jitterUs = 0) {
+    std::uniform_int_distribution<uint32_t> jitter(0, jitterUs);
+    for (uint32_t i = 0; i < count; i++) {
+        Datagram d;
+        d.seq = first + i;
+        d.arrival = at + (uint64_t)(i * SIM_TICK_US / (1 + ppm / 1000000)) +
+                    SIM_WIRE_US + jitter(chance);
+        wire.push_back(d);
+    }
+}
+
+// The datagram carrying seq that is still to be delivered.
+static Datagram *find(uint32_t seq) {
+    for (size_t i = delivered; i < wire.size(); i++) {
+        if (wire[i].seq == seq) {
+            return &wire[i];
+        }
+    }
+    return nullptr;
+}
+
+static void drop(uint32_t seq) {
+    wire.erase(wire.begin() + (find(seq) - &wire[0]));
+}
+
+static bool byArrival(const Datagram &a, const Datagram &b) {
+    return a.arrival < b.arrival;
+}
+
+// Run loop() until simulated time until.
+static void run(EthernetSetpointStream &stream, uint64_t until) {
+    if (!std::is_sorted(wire.begin() + delivered, wire.end(), byArrival)) {
+        std::stable_sort(wire.begin() + delivered, wire.end(), byArrival);
+    }
+    for (; simNow < until; simNow += SIM_LOOP_US) {
+        stream.service();
+    }
+}
+
+// Simulated time halfway through the tick of the nth setpoint of a stream
+// sent from time 0 without jitter.
+static uint64_t during(uint32_t n) {
+    return SIM_WIRE_US + (SIM_DEPTH + n) * SIM_TICK_US + SIM_TICK_US / 2;
+}
+
+static void report(bool ok, const char *what, EthernetSetpointStream &stream) {
+    printf("%-4s %s\n", ok ? "ok" : "FAIL", what);
+    if (!ok || verbose) {
+        printf("     ");
+        Serial.println(stream.stats());
+    }
+    if (!ok) {
+        failures++;
+    }
+}
+
+static void steady() {
+    EthernetSetpointStream stream;
+    reset(stream);
+    send(0, 5000, 0, 0, SIM_TICK_US);
+    run(stream, during(5000 + ETHERNET_SETPOINT_TIMEOUT_TICKS));
+    EthernetSetpointStats stats = stream.stats();
+    bool ok = stats.played == 5000 && !stats.missed && !stats.underruns &&
+              positionMotor.PositionRefCommanded() == 100 * 4999;
+    report(ok, "a steady stream with 2 ms of jitter plays every setpoint",
+           stream);
+}
+
+static void reordered() {
+    EthernetSetpointStream stream;
+    reset(stream);
+    send(0, 1000, 0);
+    // Every tenth setpoint arrives after the two that follow it.
+    for (uint32_t seq = 10; seq < 1000; seq += 10) {
+        find(seq)->arrival += 2 * SIM_TICK_US + SIM_TICK_US / 2;
+    }
+    run(stream, during(999));
+    EthernetSetpointStats stats = stream.stats();
+    bool ok = stats.received == 1000 && stats.played == 1000 &&
+              !stats.missed && !stats.late && !stats.underruns;
+    report(ok, "setpoints reordered within the depth are all played",
+           stream);
+}
+
+static void accounting() {
+    EthernetSetpointStream stream;
+    reset(stream);
+    send(0, 1000, 0);
+    // Arrives three ticks after it was due.
+    find(100)->arrival += (SIM_DEPTH + 3) * SIM_TICK_US;
+    drop(200);
+    Datagram copy = *find(300);
+    copy.arrival += SIM_TICK_US / 2;
+    wire.push_back(copy);
+    // Sent again 40 ticks early, beyond the buffer.
+    copy = *find(500);
+    copy.arrival -= 40 * SIM_TICK_US;
+    wire.push_back(copy);
+    run(stream, during(999));
+    EthernetSetpointStats stats = stream.stats();
+    bool ok = stats.received == 1001 && stats.played == 998 &&
+              stats.missed == 2 && stats.late == 1 && stats.lost == 1 &&
+              stats.duplicates == 1 && stats.early == 1 &&
+              stats.underruns == 2 && !stats.timeouts;
+    report(ok, "late, lost, duplicate and early setpoints are counted",
+           stream);
+}
+
+static void underrun(EthernetSetpointUnderrun action) {
+    EthernetSetpointStream stream;
+    reset(stream, action);
+    send(0, 1000, 0);
+    for (uint32_t seq = 500; seq < 520; seq++) {
+        drop(seq);
+    }
+    run(stream, during(510));
+    int32_t inGap = velocityMotor.VelocityRefCommanded();
+    run(stream, during(530));
+    EthernetSetpointStats stats = stream.stats();
+    bool ok = stats.missed == 20 && stats.lost == 20 &&
+              stats.underruns == 1 && stats.played == 511 &&
+              inGap == (action == SetpointHold ? 10 * 499 : 0) &&
+              velocityMotor.VelocityRefCommanded() == 10 * 530;
+    report(ok, action == SetpointHold ?
+           "a gap holds the last setpoint, then playback resumes" :
+           "a gap decelerates the motors, then playback resumes", stream);
+}
+
+static void timeout() {
+    EthernetSetpointStream stream;
+    reset(stream);
+    send(0, 500, 0);
+    run(stream, during(500 + ETHERNET_SETPOINT_TIMEOUT_TICKS));
+    EthernetSetpointStats ended = stream.stats();
+    int32_t stopped = velocityMotor.VelocityRefCommanded();
+    send(10000, 500, simNow);
+    run(stream, simNow + (SIM_DEPTH + 250) * SIM_TICK_US);
+    EthernetSetpointStats stats = stream.stats();
+    bool ok = !ended.playing && ended.timeouts == 1 && !ended.missed &&
+              !ended.underruns && ended.played == 500 && !stopped &&
+              stats.playing && stats.timeouts == 1 && !stats.missed &&
+              velocityMotor.VelocityRefCommanded() > 10 * 10000;
+    report(ok, "a stream that ends times out, and a new one starts",
+           stream);
+}
+
+static void resetDuringUnderrun() {
+    EthernetSetpointStream stream;
+    reset(stream);
+    send(0, 500, 0);
+    run(stream, during(500 + ETHERNET_SETPOINT_TIMEOUT_TICKS / 2));
+    stream.resetStats();
+    run(stream, during(500 + ETHERNET_SETPOINT_TIMEOUT_TICKS + 10));
+    EthernetSetpointStats stats = stream.stats();
+    bool ok = !stats.playing && stats.timeouts == 1 && !stats.missed &&
+              !stats.underruns && !stats.played;
+    report(ok, "statistics reset before a timeout count nothing missed",
+           stream);
+}
+
+static void slewing(double ppm) {
+    EthernetSetpointStream stream;
+    reset(stream);
+    send(0, 30000, 0, ppm, SIM_TICK_US / 2);
+    // The level varies with the jitter; its average shows the drift. Ticks
+    // are only slewed once the level leaves a band around the depth, and
+    // it is sampled after a tick has taken a setpoint, so it sits up to two
+    // below the depth or one above.
+    double levels = 0;
+    uint32_t samples = 0;
+    for (uint32_t n = 1000; n < 29000; n += 10) {
+        run(stream, during(n));
+        levels += stream.stats().level;
+        samples++;
+    }
+    double level = levels / samples;
+    EthernetSetpointStats stats = stream.stats();
+    bool ok = stats.playing && !stats.missed && !stats.early &&
+              level >= SIM_DEPTH - 2 && level <= SIM_DEPTH + 1;
+    report(ok, ppm > 0 ? "playout follows a host clock 1000 ppm fast" :
+           "playout follows a host clock 1000 ppm slow", stream);
+    if (verbose) {
+        printf("     average level %.2f\n", level);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int option;
+    while ((option = getopt(argc, argv, "vr:")) != -1) {
+        switch (option) {
+            case 'v':
+                verbose = true;
+                break;
+            case 'r':
+                chance.seed(atoi(optarg));
+                break;
+            default:
+                return 2;
+        }
+    }
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+
+    steady();
+    reordered();
+    accounting();
+    underrun(SetpointHold);
+    underrun(SetpointDecelerate);
+    timeout();
+    resetDuringUnderrun();
+    slewing(1000);
+    slewing(-1000);
+
+    if (failures) {
+        printf("%d scenarios failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,293 @@
+/*
+ * EthernetTimeSync on a simulated network, for checking the clock loop's
+ * gains and how closely a client follows its server.
+ *
+ * A time server and a client, each running the library's own
+ * EthernetTimeSync.cpp, are connected by a link that delays each datagram
+ * by a fixed time on the wire plus a random queueing time, and loses some
+ * of them. The client's crystal runs fast of the server's by a set number
+ * of ppm. micros(), millis() and EthernetUDP are simulated here, so hours
+ * of synchronization take seconds, and datagrams are timestamped as they
+ * arrive, as with Ethernet.setInterruptService(). Both micros() counters
+ * wrap during the default run.
+ *
+ *   make time_sync_sim
+ *   ./time_sync_sim [-d ppm] [-l percent] [-w us] [-j us] [-p ms] [-t s]
+ *                   [-s s] [-e us] [-r seed]
+ *
+ *   -d  client crystal error relative to the server's, in ppm (47)
+ *   -l  datagrams lost, in percent (10)
+ *   -w  delay on the wire each way, in us (50)
+ *   -j  mean queueing delay each way, exponentially distributed, in us
+ *       (20)
+ *   -p  poll interval, in ms (1000)
+ *   -t  simulated time, in s (7200)
+ *   -s  settling time left out of the summary, in s (60)
+ *   -e  largest offset allowed after settling, in us (50)
+ *   -r  seed for the delays and losses (1)
+ *
+ * Every ten simulated minutes the client's offset from the server and its
+ * statistics are printed. The summary gives the largest and RMS offset
+ * after settling and the drift the client estimated against the actual
+ * one. Exits with status 1 if the offset goes beyond the limit after
+ * settling, or the clock is stepped after settling.
+ *
+ * The loop's gains can be tried with e.g.
+ *
+ *   make -B time_sync_sim CPPFLAGS="-DTIME_KP_PERCENT=40 -DTIME_KI_PERCENT=10"
+ */
+
+#include <math.h>
+#include <unistd.h>
+#include <random>
+#include <Arduino.h>
+#include <Ethernet.h>
+#include "EthernetService.h"
+#include "EthernetTimeSync.h"
+
+// Simulated time between calls to each controller's loop(), in us.
+#define SIM_LOOP_US 200
+// Time between progress reports, in s.
+#define SIM_REPORT_S 600
+// Datagrams the link holds at once.
+#define SIM_LINK_SIZE 16
+
+HostSerial Serial;
+
+struct Node {
+    IPAddress ip;
+    // micros() at simulated time 0, and its rate in us per simulated us.
+    uint64_t start;
+    double rate;
+    EthernetTimeSync timeSync;
+};
+
+struct Datagram {
+    bool used;
+    IPAddress from;
+    uint16_t fromPort;
+    IPAddress to;
+    uint16_t toPort;
+    // Simulated time it reaches the receiver, in us.
+    uint64_t arrival;
+    uint8_t data[HOST_UDP_PACKET_SIZE];
+    size_t length;
+};
+
+static Node server;
+static Node client;
+// The controller whose code is running, and the simulated time, in us.
+static Node *current = &server;
+static uint64_t simNow = 0;
+
+static Datagram wire[SIM_LINK_SIZE];
+static std::mt19937 chance(1);
+static double lossPercent = 10;
+static uint32_t wireUs = 50;
+static double queueUs = 20;
+
+static uint64_t localMicros(const Node &node, uint64_t at) {
+    return node.start + (uint64_t)(at * node.rate);
+}
+
+uint32_t micros() {
+    return localMicros(*current, simNow);
+}
+
+uint32_t millis() {
+    return localMicros(*current, simNow) / 1000;
+}
+
+void delay(uint32_t) {}
+
+EthernetLock::EthernetLock() {}
+
+EthernetLock::~EthernetLock() {}
+
+static bool sameIp(IPAddress a, IPAddress b) {
+    return a[0] == b[0] && a[1] == b[1] && a[2] == b[2] && a[3] == b[3];
+}
+
+uint8_t EthernetUDP::begin(uint16_t localPort) {
+    m_port = localPort;
+    return 1;
+}
+
+void EthernetUDP::stop() {
+    m_port = 0;
+}
+
+// Take the datagram for this socket that arrived first, if any has.
+int EthernetUDP::parsePacket() {
+    Datagram *next = nullptr;
+    for (Datagram &d : wire) {
+        if (d.used && sameIp(d.to, current->ip) && d.toPort == m_port &&
+                d.arrival <= simNow &&
+                (!next || d.arrival < next->arrival)) {
+            next = &d;
+        }
+    }
+    if (!m_port || !next) {
+        m_length = 0;
+        return 0;
+    }
+    next->used = false;
+    memcpy(m_packet, next->data, next->length);
+    m_length = next->length;
+    m_timestamp = localMicros(*current, next->arrival);
+    m_remoteIp = next->from;
+    m_remotePort = next->fromPort;
+    return m_length;
+}
+
+int EthernetUDP::read(unsigned char *buffer, size_t len) {
+    len = min(len, m_length);
+    memcpy(buffer, m_packet, len);
+    m_length = 0;
+    return len;
+}
+
+int EthernetUDP::sendTo(IPAddress remoteIp, uint16_t remotePort,
+                        const uint8_t *data, size_t length) {
+    if (!m_port || length > HOST_UDP_PACKET_SIZE) {
+        return 0;
+    }
+    // A lost datagram was still sent, as far as the sender knows.
+    if (std::uniform_real_distribution<double>(0, 100)(chance) <
+            lossPercent) {
+        return 1;
+    }
+    for (Datagram &d : wire) {
+        if (!d.used) {
+            d.used = true;
+            d.from = current->ip;
+            d.fromPort = m_port;
+            d.to = remoteIp;
+            d.toPort = remotePort;
+            d.arrival = simNow + wireUs;
+            if (queueUs > 0) {
+                d.arrival += (uint64_t)std::exponential_distribution<double>(
+                                 1 / queueUs)(chance);
+            }
+            memcpy(d.data, data, length);
+            d.length = length;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// The client's synchronized clock minus the server's, in us.
+static int64_t offsetNow() {
+    current = &server;
+    uint64_t serverTime = server.timeSync.syncedMicros64();
+    current = &client;
+    uint64_t clientTime = client.timeSync.syncedMicros64();
+    return (int64_t)(clientTime - serverTime);
+}
+
+int main(int argc, char *argv[]) {
+    double driftPpm = 47;
+    uint32_t pollMs = 1000;
+    uint32_t durationS = 7200;
+    uint32_t settleS = 60;
+    uint32_t limitUs = 50;
+    int option;
+    while ((option = getopt(argc, argv, "d:l:w:j:p:t:s:e:r:")) != -1) {
+        switch (option) {
+            case 'd':
+                driftPpm = atof(optarg);
+                break;
+            case 'l':
+                lossPercent = atof(optarg);
+                break;
+            case 'w':
+                wireUs = atoi(optarg);
+                break;
+            case 'j':
+                queueUs = atof(optarg);
+                break;
+            case 'p':
+                pollMs = atoi(optarg);
+                break;
+            case 't':
+                durationS = atoi(optarg);
+                break;
+            case 's':
+                settleS = atoi(optarg);
+                break;
+            case 'e':
+                limitUs = atoi(optarg);
+                break;
+            case 'r':
+                chance.seed(atoi(optarg));
+                break;
+            default:
+                return 2;
+        }
+    }
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+
+    // Start both micros() counters close to wrapping, at different times.
+    server.ip = IPAddress(192, 168, 1, 100);
+    server.start = 0xFFFFFFFFULL - 300000000;
+    server.rate = 1;
+    client.ip = IPAddress(192, 168, 1, 101);
+    client.start = 0xFFFFFFFFULL - 1500000000;
+    client.rate = 1 + driftPpm / 1000000;
+
+    current = &server;
+    server.timeSync.begin(123);
+    current = &client;
+    client.timeSync.begin(123);
+    client.timeSync.sync(server.ip, 123, pollMs);
+
+    printf("Client %+.3f ppm, %.0f%% lost, %u us + %.0f us queueing each "
+           "way, polled every %u ms\n", driftPpm, lossPercent, wireUs,
+           queueUs, pollMs);
+
+    int64_t largest = 0;
+    double squares = 0;
+    uint32_t measured = 0;
+    uint32_t settledSteps = 0;
+    for (uint64_t second = 0; second <= durationS; second++) {
+        for (; simNow < second * 1000000; simNow += SIM_LOOP_US) {
+            current = &server;
+            server.timeSync.service();
+            current = &client;
+            client.timeSync.service();
+        }
+        int64_t offset = offsetNow();
+        EthernetTimeStats stats = client.timeSync.stats();
+        if (second == settleS) {
+            settledSteps = stats.steps;
+        }
+        if (second >= settleS && stats.synced) {
+            largest = max(largest, offset < 0 ? -offset : offset);
+            squares += (double)offset * offset;
+            measured++;
+        }
+        if (second % SIM_REPORT_S == 0) {
+            printf("%5u s: offset %lld us; ", (unsigned)second,
+                   (long long)offset);
+            Serial.println(stats);
+        }
+    }
+
+    EthernetTimeStats stats = client.timeSync.stats();
+    settledSteps = stats.steps - settledSteps;
+    // The server's rate relative to the client's micros().
+    double actualPpb = (1 / client.rate - 1) * 1e9;
+    printf("After %u s: offset at most %lld us, RMS %.2f us; steps %u; "
+           "drift %ld ppb, actual %.0f ppb\n", settleS, (long long)largest,
+           measured ? sqrt(squares / measured) : 0.0, settledSteps,
+           (long)stats.driftPpb, actualPpb);
+
+    if (!measured || largest > limitUs || settledSteps) {
+        printf("FAIL: offset beyond %u us or clock stepped after settling\n",
+               limitUs);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,393 @@
+# Host-side check for the EthernetHttpServer sketch.
+#
+# Checks that responses are framed correctly (Content-Length, chunked
+# bodies, HEAD, errors), that requests with a bad Content-Length are
+# refused, that connections are kept open between requests and answer
+# pipelined requests in order, and that a browser which stops reading does
+# not hold up the others. Then measures requests per second
+# and latency over several keep-alive connections at once.
+#
+# Load the sketch on a ClearCore, then run
+#
+#   python3 http_check.py 192.168.0.100
+#
+# The sketch can also be run on a PC, on the loopback interface; see
+# host/Makefile, whose check target runs this script against it.
+#
+# Only the Python 3 standard library is needed. Exits with status 1 if any
+# check fails.
+
+import argparse
+import math
+import socket
+import sys
+import threading
+import time
+
+PERCENTILES = (50, 90, 99)
+
+
+# print error and die
+def die(message):
+    print('error: ' + message, file=sys.stderr)
+    sys.exit(2)
+
+
+def percentile(sorted_values, p):
+    """Nearest-rank percentile of an already sorted list."""
+    if not sorted_values:
+        return 0.0
+    rank = max(1, math.ceil(p / 100.0 * len(sorted_values)))
+    return sorted_values[min(rank, len(sorted_values)) - 1]
+
+
+class Closed(Exception):
+    pass
+
+
+class Connection:
+    """A connection to the server that reads responses off it one by one."""
+
+    def __init__(self, args, rcvbuf=None):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        if rcvbuf:
+            self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, rcvbuf)
+        self.sock.settimeout(args.timeout)
+        self.sock.connect((args.host, args.port))
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.data = b''
+
+    def close(self):
+        self.sock.close()
+
+    def send(self, request):
+        self.sock.sendall(request)
+
+    def fill(self):
+        chunk = self.sock.recv(65536)
+        if not chunk:
+            raise Closed()
+        self.data += chunk
+
+    def line(self):
+        while b'\r\n' not in self.data:
+            self.fill()
+        line, self.data = self.data.split(b'\r\n', 1)
+        return line
+
+    def take(self, length):
+        while len(self.data) < length:
+            self.fill()
+        taken, self.data = self.data[:length], self.data[length:]
+        return taken
+
+    def closed(self):
+        """Whether the server has closed the connection."""
+        try:
+            while True:
+                self.fill()
+        except Closed:
+            return True
+        except socket.timeout:
+            return False
+
+    def response(self, head=False):
+        """Read a response: (status, headers with lower case names, body)."""
+        status = self.line().split(b' ', 2)
+        headers = {}
+        while True:
+            line = self.line()
+            if not line:
+                break
+            name, value = line.split(b':', 1)
+            headers[name.strip().lower().decode()] = value.strip().decode()
+        body = b''
+        if head:
+            pass
+        elif 'content-length' in headers:
+            body = self.take(int(headers['content-length']))
+        elif headers.get('transfer-encoding') == 'chunked':
+            while True:
+                size = int(self.line().split(b';')[0], 16)
+                chunk = self.take(size + 2)
+                if size == 0:
+                    break
+                body += chunk[:-2]
+        else:
+            # Ended by closing the connection.
+            try:
+                while True:
+                    self.fill()
+            except Closed:
+                pass
+            body, self.data = self.data, b''
+        return int(status[1]), headers, body
+
+
+def request(path, method='GET', version='1.1', headers=''):
+    return ('%s %s HTTP/%s\r\nHost: clearcore\r\n%s\r\n' %
+            (method, path, version, headers)).encode()
+
+
+class Checks:
+    def __init__(self):
+        self.failures = 0
+
+    def report(self, ok, what, detail=''):
+        print('%-4s %s%s' % ('ok' if ok else 'FAIL', what,
+                             ' (%s)' % detail if detail else ''))
+        if not ok:
+            self.failures += 1
+
+
+def check_framing(checks, args):
+    conn = Connection(args)
+    try:
+        conn.send(request('/'))
+        status, headers, page = conn.response()
+        checks.report(status == 200 and page.startswith(b'<!DOCTYPE html>')
+                      and page.endswith(b'</html>\n'),
+                      'GET / sends the page with its Content-Length',
+                      '%d, %d bytes' % (status, len(page)))
+
+        conn.send(request('/', method='HEAD'))
+        status, headers, body = conn.response(head=True)
+        checks.report(status == 200 and
+                      headers.get('content-length') == str(len(page)),
+                      'HEAD / gives the length without the body',
+                      'Content-Length %s' % headers.get('content-length'))
+
+        conn.send(request('/api/status'))
+        status, headers, body = conn.response()
+        checks.report(status == 200 and
+                      headers.get('transfer-encoding') == 'chunked' and
+                      body.startswith(b'{"di6": ') and body.endswith(b'}'),
+                      'GET /api/status sends JSON in chunks', repr(body))
+
+        conn.send(request('/api/output?on=0'))
+        status, headers, body = conn.response()
+        checks.report(status == 200 and body == b'IO-0 is off\r\n',
+                      'GET /api/output?on=0 reads the query', repr(body))
+
+        for path, method, expected in (('/api/output', 'GET', 400),
+                                       ('/nothing', 'GET', 404),
+                                       ('/api/status', 'POST', 405),
+                                       ('/files/none.htm', 'GET', 404)):
+            conn.send(request(path, method=method))
+            status, headers, body = conn.response()
+            checks.report(status == expected and
+                          body.startswith(b'%d ' % expected),
+                          '%s %s is answered with %d' %
+                          (method, path, expected), '%d' % status)
+    except (Closed, socket.timeout, ValueError) as e:
+        checks.report(False, 'framing', 'connection failed: %r' % e)
+    finally:
+        conn.close()
+
+
+def check_content_length(checks, args):
+    # A bad request closes the connection, so each gets its own. Lengths
+    # near 2^32 must not wrap around the size check.
+    form = 'Content-Type: application/x-www-form-urlencoded\r\n'
+    for length, expected in (('-1', 400), ('4294967295', 413),
+                             ('4294967296', 400), ('12abc', 400),
+                             ('', 400), ('99999', 413)):
+        conn = Connection(args)
+        try:
+            conn.send(request('/api/output', headers=form +
+                              'Content-Length: %s\r\n' % length))
+            status, headers, body = conn.response()
+            checks.report(status == expected,
+                          'Content-Length "%s" is answered with %d' %
+                          (length, expected), '%d' % status)
+        except (Closed, socket.timeout, ConnectionError, ValueError) as e:
+            checks.report(False, 'Content-Length "%s" is answered with %d' %
+                          (length, expected), 'connection failed: %r' % e)
+        finally:
+            conn.close()
+
+    conn = Connection(args)
+    try:
+        conn.send(request('/api/status'))
+        status, headers, body = conn.response()
+        checks.report(status == 200,
+                      'the server still answers after bad lengths',
+                      '%d' % status)
+    except (Closed, socket.timeout, ConnectionError, ValueError) as e:
+        checks.report(False, 'the server still answers after bad lengths',
+                      'connection failed: %r' % e)
+    finally:
+        conn.close()
+
+
+def check_connections(checks, args):
+    conn = Connection(args)
+    count = 0
+    try:
+        for count in range(1, 51):
+            conn.send(request('/api/status'))
+            status, headers, body = conn.response()
+            if status != 200 or headers.get('connection') != 'keep-alive':
+                break
+    except (Closed, socket.timeout, ValueError):
+        pass
+    finally:
+        conn.close()
+    checks.report(count == 50, '50 requests on one keep-alive connection',
+                  '%d answered' % count)
+
+    conn = Connection(args)
+    statuses = []
+    try:
+        conn.send(request('/') + request('/nothing') +
+                  request('/api/output?on=1'))
+        for i in range(3):
+            statuses.append(conn.response()[0])
+    except (Closed, socket.timeout, ValueError):
+        pass
+    finally:
+        conn.close()
+    checks.report(statuses == [200, 404, 200],
+                  'pipelined requests are answered in order',
+                  ' '.join(str(s) for s in statuses))
+
+    conn = Connection(args)
+    try:
+        conn.send(request('/', version='1.0'))
+        status, headers, body = conn.response()
+        closed = conn.closed()
+        checks.report(status == 200 and headers.get('connection') == 'close'
+                      and closed, 'HTTP/1.0 connections are closed',
+                      'Connection: %s' % headers.get('connection'))
+
+        conn = Connection(args)
+        conn.send(request('/api/status', version='1.0'))
+        status, headers, body = conn.response()
+        checks.report(status == 200 and body.endswith(b'}'),
+                      'HTTP/1.0 unknown length body is ended by closing',
+                      repr(body))
+    except (Closed, socket.timeout, ValueError) as e:
+        checks.report(False, 'HTTP/1.0', 'connection failed: %r' % e)
+    finally:
+        conn.close()
+
+
+def check_slow_reader(checks, args):
+    """A browser that never reads must not hold up another one."""
+    slow = Connection(args, rcvbuf=4096)
+    try:
+        # Far more responses than fit in the buffers between the two.
+        slow.send(request('/') * 200)
+        time.sleep(0.2)
+        latencies = []
+        conn = Connection(args)
+        try:
+            for i in range(20):
+                start = time.monotonic()
+                conn.send(request('/api/status'))
+                status, headers, body = conn.response()
+                latencies.append(time.monotonic() - start)
+        finally:
+            conn.close()
+        worst = max(latencies) * 1000
+        checks.report(worst < args.slow_limit,
+                      'a browser that stops reading does not hold up others',
+                      'slowest response %.1f ms' % worst)
+
+        # The slow browser's responses all arrive once it reads them.
+        answered = 0
+        for i in range(200):
+            status, headers, body = slow.response()
+            answered += status == 200
+        checks.report(answered == 200,
+                      'the browser that stopped reading gets every response',
+                      '%d of 200' % answered)
+    except (Closed, socket.timeout, ValueError) as e:
+        checks.report(False, 'slow reader', 'connection failed: %r' % e)
+    finally:
+        slow.close()
+
+
+def throughput(checks, args):
+    """Requests per second over concurrent keep-alive connections."""
+    latencies = []
+    errors = []
+    lock = threading.Lock()
+
+    def client():
+        mine = []
+        try:
+            conn = Connection(args)
+            try:
+                for i in range(args.requests):
+                    start = time.monotonic()
+                    conn.send(request(args.path))
+                    status, headers, body = conn.response()
+                    mine.append(time.monotonic() - start)
+                    if status != 200:
+                        raise ValueError('status %d' % status)
+            finally:
+                conn.close()
+        except (OSError, Closed, ValueError) as e:
+            errors.append(e)
+        with lock:
+            latencies.extend(mine)
+
+    threads = [threading.Thread(target=client)
+               for i in range(args.concurrent)]
+    start = time.monotonic()
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    elapsed = time.monotonic() - start
+
+    checks.report(not errors, '%d connections of %d requests to %s' %
+                  (args.concurrent, args.requests, args.path),
+                  '%d failed: %r' % (len(errors), errors[0]) if errors
+                  else '')
+    latencies.sort()
+    print('     %.0f requests/s, latency %s ms' %
+          (len(latencies) / elapsed,
+           ', '.join('p%g %.2f' % (p, percentile(latencies, p) * 1000)
+                     for p in PERCENTILES)))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Check the EthernetHttpServer sketch from a PC.')
+    parser.add_argument('host', help='address of the ClearCore')
+    parser.add_argument('--port', type=int, default=80,
+                        help='port of the server (default 80)')
+    parser.add_argument('--timeout', type=float, default=3.0,
+                        help='seconds to wait for a response (default 3)')
+    parser.add_argument('--concurrent', type=int, default=4,
+                        help='connections for the throughput test '
+                             '(default 4, the sketch\'s limit)')
+    parser.add_argument('--requests', type=int, default=250,
+                        help='requests per connection (default 250)')
+    parser.add_argument('--path', default='/',
+                        help='path to request for the throughput test '
+                             '(default /)')
+    parser.add_argument('--slow-limit', type=float, default=200,
+                        help='slowest response, in ms, allowed while '
+                             'another browser stops reading (default 200)')
+    args = parser.parse_args()
+
+    checks = Checks()
+    try:
+        check_framing(checks, args)
+        check_content_length(checks, args)
+        check_connections(checks, args)
+        check_slow_reader(checks, args)
+        throughput(checks, args)
+    except OSError as e:
+        die(str(e))
+
+    if checks.failures:
+        print('%d checks failed' % checks.failures)
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,480 @@
+# Host-side Modbus TCP client for the EthernetModbusServer sketch.
+#
+# Checks every supported function code (1-6, 15 and 16) against the
+# sketch's register map, the exception codes for bad requests, the rules
+# for 32-bit values, and that pipelined requests are all answered in order.
+# Then measures transactions per second over several connections, with and
+# without pipelining.
+#
+# Load the sketch on a ClearCore, then run
+#
+#   python3 modbus_check.py 192.168.0.100
+#
+# The sketch can also be run on a PC, on the loopback interface; see
+# host/Makefile, whose check target runs this script against it.
+#
+# The checks write coil 0 and holding registers 2-5 (the motor's velocity
+# and acceleration limits) and 7, and put back what was there. Nothing is
+# written that moves the motor. Only the Python 3 standard library is
+# needed. Exits with status 1 if any check fails.
+
+import argparse
+import math
+import socket
+import struct
+import sys
+import threading
+import time
+
+PORT = 502
+UNIT = 1
+PERCENTILES = (50, 90, 99)
+
+# Exception codes.
+ILLEGAL_FUNCTION = 1
+ILLEGAL_ADDRESS = 2
+ILLEGAL_VALUE = 3
+
+# The sketch's register map: how many addresses are bound in each table.
+COILS = 1
+DISCRETE_INPUTS = 2
+INPUT_REGISTERS = 5
+HOLDING_REGISTERS = 8
+# Holding registers of the motor's velocity limit and a general purpose
+# register.
+VELOCITY_LIMIT = 2
+GENERAL = 7
+
+
+# print error and die
+def die(message):
+    print('error: ' + message, file=sys.stderr)
+    sys.exit(2)
+
+
+def percentile(sorted_values, p):
+    """Nearest-rank percentile of an already sorted list."""
+    if not sorted_values:
+        return 0.0
+    rank = max(1, math.ceil(p / 100.0 * len(sorted_values)))
+    return sorted_values[min(rank, len(sorted_values)) - 1]
+
+
+class Closed(Exception):
+    pass
+
+
+class ModbusException(Exception):
+    """An exception response."""
+
+    def __init__(self, function, code):
+        Exception.__init__(self, 'function %d exception %d' %
+                           (function, code))
+        self.code = code
+
+
+class Master:
+    """A Modbus TCP connection."""
+
+    def __init__(self, args):
+        self.sock = socket.create_connection((args.host, args.port),
+                                             args.timeout)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.transaction = 0
+        self.data = b''
+
+    def close(self):
+        self.sock.close()
+
+    def adu(self, pdu, transaction=None, protocol=0):
+        """Frame a request PDU; returns (transaction, bytes)."""
+        if transaction is None:
+            self.transaction = (self.transaction + 1) & 0xFFFF
+            transaction = self.transaction
+        return transaction, struct.pack('>HHHB', transaction, protocol,
+                                        len(pdu) + 1, UNIT) + pdu
+
+    def take(self, length):
+        while len(self.data) < length:
+            chunk = self.sock.recv(65536)
+            if not chunk:
+                raise Closed()
+            self.data += chunk
+        taken, self.data = self.data[:length], self.data[length:]
+        return taken
+
+    def response(self):
+        """Read a response: (transaction, unit, PDU)."""
+        transaction, protocol, length, unit = \
+            struct.unpack('>HHHB', self.take(7))
+        if protocol != 0 or length < 2:
+            raise ValueError('bad MBAP header')
+        return transaction, unit, self.take(length - 1)
+
+    def request(self, pdu):
+        """Send a request and return its response PDU. An exception
+        response raises ModbusException."""
+        transaction, adu = self.adu(pdu)
+        self.sock.sendall(adu)
+        answered, unit, response = self.response()
+        if answered != transaction or unit != UNIT:
+            raise ValueError('response to transaction %d, unit %d' %
+                             (answered, unit))
+        if response[0] == pdu[0] | 0x80 and len(response) == 2:
+            raise ModbusException(pdu[0], response[1])
+        if response[0] != pdu[0]:
+            raise ValueError('response for function %d' % response[0])
+        return response
+
+    def read_bits(self, function, start, count):
+        response = self.request(struct.pack('>BHH', function, start, count))
+        if response[1] != (count + 7) // 8 or \
+                len(response) != 2 + response[1]:
+            raise ValueError('wrong byte count')
+        return [response[2 + i // 8] >> (i % 8) & 1 for i in range(count)]
+
+    def read_registers(self, function, start, count):
+        response = self.request(struct.pack('>BHH', function, start, count))
+        if response[1] != count * 2 or len(response) != 2 + count * 2:
+            raise ValueError('wrong byte count')
+        return list(struct.unpack('>%dH' % count, response[2:]))
+
+    def write_coil(self, address, value):
+        pdu = struct.pack('>BHH', 5, address, 0xFF00 if value else 0)
+        if self.request(pdu) != pdu:
+            raise ValueError('response is not an echo of the request')
+
+    def write_register(self, address, value):
+        pdu = struct.pack('>BHH', 6, address, value)
+        if self.request(pdu) != pdu:
+            raise ValueError('response is not an echo of the request')
+
+    def write_coils(self, start, values):
+        packed = bytearray((len(values) + 7) // 8)
+        for i, value in enumerate(values):
+            packed[i // 8] |= bool(value) << (i % 8)
+        pdu = struct.pack('>BHHB', 15, start, len(values), len(packed))
+        if self.request(pdu + bytes(packed)) != pdu[:5]:
+            raise ValueError('response does not echo the address and count')
+
+    def write_registers(self, start, values):
+        pdu = struct.pack('>BHHB%dH' % len(values), 16, start, len(values),
+                          len(values) * 2, *values)
+        if self.request(pdu) != pdu[:5]:
+            raise ValueError('response does not echo the address and count')
+
+
+def words(value):
+    """A 32-bit value as two registers, high word first."""
+    value &= 0xFFFFFFFF
+    return [value >> 16, value & 0xFFFF]
+
+
+class Checks:
+    def __init__(self):
+        self.failures = 0
+
+    def report(self, ok, what, detail=''):
+        print('%-4s %s%s' % ('ok' if ok else 'FAIL', what,
+                             ' (%s)' % detail if detail else ''))
+        if not ok:
+            self.failures += 1
+
+    def run(self, what, check):
+        """Run check(), which returns (ok, detail), and report it."""
+        try:
+            ok, detail = check()
+        except (ModbusException, ValueError, Closed, socket.timeout) as e:
+            ok, detail = False, repr(e)
+        self.report(ok, what, detail)
+
+    def exception(self, master, what, pdu, code):
+        """Check that pdu is answered with exception code."""
+        def check():
+            try:
+                master.request(pdu)
+            except ModbusException as e:
+                return e.code == code, 'exception %d' % e.code
+            return False, 'answered normally'
+        self.run('%s gives exception %d' % (what, code), check)
+
+
+def check_functions(checks, master):
+    def coils():
+        saved = master.read_bits(1, 0, COILS)
+        master.write_coil(0, 1)
+        on = master.read_bits(1, 0, COILS)
+        master.write_coil(0, 0)
+        off = master.read_bits(1, 0, COILS)
+        master.write_coil(0, saved[0])
+        return on == [1] and off == [0], 'read %s %s' % (on, off)
+    checks.run('1 Read Coils and 5 Write Single Coil', coils)
+
+    def multiple_coils():
+        saved = master.read_bits(1, 0, COILS)
+        master.write_coils(0, [1])
+        on = master.read_bits(1, 0, COILS)
+        master.write_coils(0, saved)
+        return on == [1], 'read %s' % on
+    checks.run('15 Write Multiple Coils', multiple_coils)
+
+    def discrete_inputs():
+        bits = master.read_bits(2, 0, DISCRETE_INPUTS)
+        return len(bits) == DISCRETE_INPUTS, 'read %s' % bits
+    checks.run('2 Read Discrete Inputs', discrete_inputs)
+
+    def input_registers():
+        registers = master.read_registers(4, 0, INPUT_REGISTERS)
+        # Register 4 counts the masters connected, this one included.
+        return registers[4] >= 1, 'read %s' % registers
+    checks.run('4 Read Input Registers', input_registers)
+
+    def holding_registers():
+        saved = master.read_registers(3, GENERAL, 1)[0]
+        master.write_register(GENERAL, 0x1234)
+        single = master.read_registers(3, GENERAL, 1)[0]
+        master.write_registers(GENERAL, [0xBEEF])
+        multiple = master.read_registers(3, GENERAL, 1)[0]
+        master.write_register(GENERAL, saved)
+        registers = master.read_registers(3, 0, HOLDING_REGISTERS)
+        return single == 0x1234 and multiple == 0xBEEF and \
+            registers[GENERAL] == saved, \
+            'read 0x%04x 0x%04x' % (single, multiple)
+    checks.run('3 Read Holding Registers, 6 Write Single Register and '
+               '16 Write Multiple Registers', holding_registers)
+
+
+def check_exceptions(checks, master):
+    for function in (7, 8, 17, 43, 0x7F):
+        checks.exception(master, 'function %d' % function,
+                         struct.pack('>BHH', function, 0, 1),
+                         ILLEGAL_FUNCTION)
+
+    checks.exception(master, 'reading an unbound coil',
+                     struct.pack('>BHH', 1, COILS, 1), ILLEGAL_ADDRESS)
+    checks.exception(master, 'reading past the bound inputs',
+                     struct.pack('>BHH', 2, 0, DISCRETE_INPUTS + 1),
+                     ILLEGAL_ADDRESS)
+    checks.exception(master, 'reading an unbound input register',
+                     struct.pack('>BHH', 4, INPUT_REGISTERS, 1),
+                     ILLEGAL_ADDRESS)
+    checks.exception(master, 'reading past the end of the table',
+                     struct.pack('>BHH', 3, 0xFFFF, 2), ILLEGAL_ADDRESS)
+    checks.exception(master, 'writing an unbound coil',
+                     struct.pack('>BHH', 5, COILS, 0xFF00), ILLEGAL_ADDRESS)
+    checks.exception(master, 'writing an unbound register',
+                     struct.pack('>BHH', 6, HOLDING_REGISTERS, 1),
+                     ILLEGAL_ADDRESS)
+
+    checks.exception(master, 'reading 0 registers',
+                     struct.pack('>BHH', 3, 0, 0), ILLEGAL_VALUE)
+    checks.exception(master, 'reading 126 registers',
+                     struct.pack('>BHH', 3, 0, 126), ILLEGAL_VALUE)
+    checks.exception(master, 'reading 2001 coils',
+                     struct.pack('>BHH', 1, 0, 2001), ILLEGAL_VALUE)
+    checks.exception(master, 'writing a coil with 0x1234',
+                     struct.pack('>BHH', 5, 0, 0x1234), ILLEGAL_VALUE)
+    checks.exception(master, 'a byte count that does not match',
+                     struct.pack('>BHHBH', 16, GENERAL, 1, 4, 0),
+                     ILLEGAL_VALUE)
+    checks.exception(master, 'a request with bytes missing',
+                     struct.pack('>BH', 3, 0), ILLEGAL_VALUE)
+
+    def still_connected():
+        value = master.read_registers(3, GENERAL, 1)
+        return True, 'read %s' % value
+    checks.run('the connection carries on after exceptions', still_connected)
+
+
+def check_wide(checks, master):
+    """32-bit values are written whole, by one request covering both
+    words; reads may take either word."""
+    saved = master.read_registers(3, VELOCITY_LIMIT, 4)
+
+    def write_whole():
+        master.write_registers(VELOCITY_LIMIT, words(0x00012345) +
+                               words(0x00FEDCBA))
+        registers = master.read_registers(3, VELOCITY_LIMIT, 4)
+        return registers == words(0x00012345) + words(0x00FEDCBA), \
+            'read %s' % ['0x%04x' % r for r in registers]
+    checks.run('32-bit values are written and read high word first',
+               write_whole)
+
+    def read_one_word():
+        high = master.read_registers(3, VELOCITY_LIMIT, 1)
+        low = master.read_registers(3, VELOCITY_LIMIT + 1, 1)
+        return high + low == words(0x00012345), 'read %s %s' % (high, low)
+    checks.run('either word of a 32-bit value can be read alone',
+               read_one_word)
+
+    checks.exception(master, 'writing one word with function 6',
+                     struct.pack('>BHH', 6, VELOCITY_LIMIT, 1),
+                     ILLEGAL_ADDRESS)
+    checks.exception(master, 'writing only the high word',
+                     struct.pack('>BHHBH', 16, VELOCITY_LIMIT, 1, 2, 1),
+                     ILLEGAL_ADDRESS)
+    checks.exception(master, 'writing only the low word',
+                     struct.pack('>BHHBH', 16, VELOCITY_LIMIT + 1, 1, 2, 1),
+                     ILLEGAL_ADDRESS)
+    checks.exception(master, 'writing across two 32-bit values',
+                     struct.pack('>BHHBHH', 16, VELOCITY_LIMIT + 1, 2, 4,
+                                 1, 1), ILLEGAL_ADDRESS)
+
+    def untouched():
+        registers = master.read_registers(3, VELOCITY_LIMIT, 4)
+        return registers == words(0x00012345) + words(0x00FEDCBA), \
+            'read %s' % ['0x%04x' % r for r in registers]
+    checks.run('rejected writes leave 32-bit values unchanged', untouched)
+
+    try:
+        master.write_registers(VELOCITY_LIMIT, saved)
+    except (ModbusException, ValueError, Closed, socket.timeout):
+        pass
+
+
+def check_pipelining(checks, args):
+    """Requests sent without waiting are all answered, in order."""
+    master = Master(args)
+    try:
+        requests = []
+        for i in range(args.depth):
+            if i % 5 == 4:
+                pdu = struct.pack('>BHH', 3, 0xFFFF, 1)
+                expected = bytes([0x83, ILLEGAL_ADDRESS])
+            else:
+                pdu = struct.pack('>BHH', 4, 0, 4)
+                expected = None
+            requests.append(master.adu(pdu, transaction=1000 + i) +
+                            (expected,))
+        master.sock.sendall(b''.join(adu for t, adu, e in requests))
+        answered = 0
+        for transaction, adu, expected in requests:
+            got, unit, pdu = master.response()
+            if got != transaction or unit != UNIT or \
+                    (expected and pdu != expected) or \
+                    (not expected and pdu[:2] != b'\x04\x08'):
+                break
+            answered += 1
+        checks.report(answered == args.depth,
+                      '%d pipelined requests are answered in order' %
+                      args.depth, '%d answered' % answered)
+    except (ValueError, Closed, socket.timeout) as e:
+        checks.report(False, 'pipelined requests', repr(e))
+    finally:
+        master.close()
+
+    master = Master(args)
+    try:
+        master.sock.sendall(master.adu(struct.pack('>BHH', 4, 0, 1),
+                                       protocol=1)[1])
+        closed = False
+        try:
+            closed = not master.sock.recv(1)
+        except ConnectionResetError:
+            closed = True
+        checks.report(closed, 'a request that is not Modbus closes the '
+                              'connection')
+    except socket.timeout:
+        checks.report(False, 'a request that is not Modbus closes the '
+                             'connection', 'still open')
+    finally:
+        master.close()
+
+
+def throughput(checks, args, depth):
+    """Transactions per second over concurrent connections, each keeping
+    depth requests outstanding."""
+    latencies = []
+    errors = []
+    lock = threading.Lock()
+    pdu = struct.pack('>BHH', 4, 0, INPUT_REGISTERS)
+
+    def client():
+        mine = []
+        try:
+            master = Master(args)
+            try:
+                sent = {}
+                done = 0
+                while done < args.transactions:
+                    while len(sent) < depth and \
+                            done + len(sent) < args.transactions:
+                        transaction, adu = master.adu(pdu)
+                        sent[transaction] = time.monotonic()
+                        master.sock.sendall(adu)
+                    transaction, unit, response = master.response()
+                    if transaction not in sent or \
+                            response[:2] != b'\x04\x0a':
+                        raise ValueError('bad response')
+                    mine.append(time.monotonic() - sent.pop(transaction))
+                    done += 1
+            finally:
+                master.close()
+        except (OSError, ValueError, Closed) as e:
+            errors.append(e)
+        with lock:
+            latencies.extend(mine)
+
+    threads = [threading.Thread(target=client)
+               for i in range(args.concurrent)]
+    start = time.monotonic()
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    elapsed = time.monotonic() - start
+
+    checks.report(not errors, '%d connections of %d transactions, %d '
+                              'outstanding' %
+                  (args.concurrent, args.transactions, depth),
+                  '%d failed: %r' % (len(errors), errors[0]) if errors
+                  else '')
+    latencies.sort()
+    print('     %.0f transactions/s, latency %s ms' %
+          (len(latencies) / elapsed,
+           ', '.join('p%g %.2f' % (p, percentile(latencies, p) * 1000)
+                     for p in PERCENTILES)))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Check the EthernetModbusServer sketch from a PC.')
+    parser.add_argument('host', help='address of the ClearCore')
+    parser.add_argument('--port', type=int, default=PORT,
+                        help='port of the server (default %d)' % PORT)
+    parser.add_argument('--timeout', type=float, default=3.0,
+                        help='seconds to wait for a response (default 3)')
+    parser.add_argument('--depth', type=int, default=8,
+                        help='requests kept outstanding when pipelining '
+                             '(default 8)')
+    parser.add_argument('--concurrent', type=int, default=4,
+                        help='connections for the throughput test '
+                             '(default 4, the sketch\'s limit)')
+    parser.add_argument('--transactions', type=int, default=2000,
+                        help='transactions per connection (default 2000)')
+    args = parser.parse_args()
+    if args.depth < 1:
+        die('--depth must be at least 1')
+
+    checks = Checks()
+    try:
+        master = Master(args)
+        try:
+            check_functions(checks, master)
+            check_exceptions(checks, master)
+            check_wide(checks, master)
+        finally:
+            master.close()
+        check_pipelining(checks, args)
+        throughput(checks, args, 1)
+        throughput(checks, args, args.depth)
+    except OSError as e:
+        die(str(e))
+
+    if checks.failures:
+        print('%d checks failed' % checks.failures)
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
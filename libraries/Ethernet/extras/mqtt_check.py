@@ -0,0 +1,539 @@
+# Broker stand-in for checking the EthernetMqttTelemetry sketch.
+#
+# Runs a small MQTT broker (3.1.1 and 5) for the sketch to connect to, and
+# checks that:
+#
+#   - it connects with a clean session and subscribes to its commands,
+#   - commands published to it are acknowledged,
+#   - a PUBLISH whose topic runs past the end of the packet is ignored,
+#     and the sketch carries on,
+#   - each period's telemetry messages arrive together, in one segment,
+#   - with MQTT 5, topics are sent by alias up to the limit the broker
+#     announces, and the aliases are set up again on each connection,
+#   - after the broker drops the connection, the sketch reconnects,
+#     subscribes again and first resends the QoS 1 message that was not
+#     acknowledged, with the DUP flag set and the same packet identifier.
+#
+# Set brokerIp in the sketch to the address of the PC, load it on a
+# ClearCore, then run
+#
+#   python3 mqtt_check.py
+#
+# and change DI-6 a few times while it runs: the sketch publishes DI-6 with
+# QoS 1, and the resend check is skipped if it does not change. The sketch
+# can also be run on a PC, where it connects to 127.0.0.1 and DI-6 changes
+# by itself; see host/Makefile, whose check target runs this script against
+# it with both protocol versions.
+#
+# Only the Python 3 standard library is needed. Exits with status 1 if any
+# check fails.
+
+import argparse
+import socket
+import struct
+import sys
+import time
+
+PORT = 1883
+CLIENT_ID = 'clearcore'
+TELEMETRY = ('clearcore/m0/position', 'clearcore/m0/torque',
+             'clearcore/a12')
+INPUT_TOPIC = 'clearcore/di6'
+COMMAND_FILTER = 'clearcore/cmd/#'
+COMMAND_TOPIC = 'clearcore/cmd/io0'
+COMMAND_ID = 77
+# Topic Alias Maximum announced to MQTT 5 clients: fewer than the sketch's
+# telemetry topics, so that some are sent by alias and some are not.
+ALIAS_MAX = 2
+
+CONNECT = 1
+CONNACK = 2
+PUBLISH = 3
+PUBACK = 4
+SUBSCRIBE = 8
+SUBACK = 9
+PINGREQ = 12
+PINGRESP = 13
+DISCONNECT = 14
+
+PROP_TOPIC_ALIAS = 0x23
+PROP_TOPIC_ALIAS_MAX = 0x22
+
+
+# print error and die
+def die(message):
+    print('error: ' + message, file=sys.stderr)
+    sys.exit(2)
+
+
+class Closed(Exception):
+    pass
+
+
+def put_length(length):
+    """Encode a variable byte integer."""
+    out = bytearray()
+    while True:
+        digit = length & 0x7F
+        length >>= 7
+        out.append(digit | (0x80 if length else 0))
+        if not length:
+            return bytes(out)
+
+
+def get_length(data, offset):
+    """Decode a variable byte integer at offset: (value, size), or None if
+    it is not all there."""
+    value = 0
+    for i in range(4):
+        if offset + i >= len(data):
+            return None
+        value |= (data[offset + i] & 0x7F) << (7 * i)
+        if not data[offset + i] & 0x80:
+            return value, i + 1
+    raise ValueError('malformed remaining length')
+
+
+def put_string(text):
+    text = text.encode()
+    return struct.pack('>H', len(text)) + text
+
+
+def get_string(body, offset):
+    length = struct.unpack_from('>H', body, offset)[0]
+    return body[offset + 2:offset + 2 + length].decode(), offset + 2 + length
+
+
+def properties(body, offset):
+    """Skip MQTT 5 properties at offset: (the properties as bytes, offset
+    after them)."""
+    length, size = get_length(body, offset)
+    start = offset + size
+    return body[start:start + length], start + length
+
+
+def topic_alias(props):
+    """The Topic Alias property in props, or None."""
+    i = 0
+    while i < len(props):
+        if props[i] == PROP_TOPIC_ALIAS:
+            return struct.unpack_from('>H', props, i + 1)[0]
+        # Only the properties a client puts on PUBLISH are expected here.
+        if props[i] in (0x01,):
+            i += 2
+        elif props[i] in (0x02,):
+            i += 5
+        elif props[i] in (0x03, 0x08, 0x09):
+            i += 3 + struct.unpack_from('>H', props, i + 1)[0]
+        else:
+            raise ValueError('unexpected property 0x%02x' % props[i])
+    return None
+
+
+def packet(kind, flags, body):
+    return bytes([kind << 4 | flags]) + put_length(len(body)) + body
+
+
+class Publish:
+    """A PUBLISH from the sketch, and the segments it arrived in."""
+
+    def __init__(self, flags, body, version, chunks):
+        self.dup = bool(flags & 0x08)
+        self.qos = flags >> 1 & 0x03
+        self.retain = bool(flags & 0x01)
+        self.topic, offset = get_string(body, 0)
+        # Whether the topic was sent, rather than left to its alias.
+        self.named = bool(self.topic)
+        self.packet_id = None
+        if self.qos:
+            self.packet_id = struct.unpack_from('>H', body, offset)[0]
+            offset += 2
+        self.alias = None
+        if version == 5:
+            props, offset = properties(body, offset)
+            self.alias = topic_alias(props)
+        self.payload = body[offset:]
+        self.chunks = chunks
+
+
+class Connection:
+    """One connection from the sketch, with the broker's side of it."""
+
+    def __init__(self, sock):
+        self.sock = sock
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.data = b''
+        # Stream offset of data[0], and the stream offset each segment
+        # received ends at, with its number.
+        self.consumed = 0
+        self.marks = []
+        self.chunk = 0
+        self.version = 4
+        self.aliases = {}
+        self.publishes = []
+        self.subscriptions = []
+        self.pubacks = []
+        self.alias_errors = []
+        self.hold = False
+        self.held = None
+
+    def close(self):
+        self.sock.close()
+
+    def send(self, data):
+        self.sock.sendall(data)
+
+    def chunk_of(self, offset):
+        for end, chunk in self.marks:
+            if offset < end:
+                return chunk
+        return None
+
+    def next(self, timeout):
+        """The next packet, (type, flags, body, chunks), or None if none
+        arrives within timeout. chunks are the segments it came in."""
+        deadline = time.monotonic() + timeout
+        while True:
+            if len(self.data) >= 2:
+                decoded = get_length(self.data, 1)
+                if decoded:
+                    length, size = decoded
+                    total = 1 + size + length
+                    if len(self.data) >= total:
+                        header = self.data[0]
+                        body = self.data[1 + size:total]
+                        chunks = (self.chunk_of(self.consumed),
+                                  self.chunk_of(self.consumed + total - 1))
+                        self.data = self.data[total:]
+                        self.consumed += total
+                        self.marks = [m for m in self.marks
+                                      if m[0] > self.consumed]
+                        return header >> 4, header & 0x0F, body, chunks
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                return None
+            self.sock.settimeout(remaining)
+            try:
+                received = self.sock.recv(65536)
+            except socket.timeout:
+                return None
+            if not received:
+                raise Closed()
+            self.data += received
+            self.chunk += 1
+            self.marks.append((self.consumed + len(self.data), self.chunk))
+
+    def handshake(self, timeout):
+        """Read CONNECT and answer it: (protocol level, connect flags,
+        client id)."""
+        got = self.next(timeout)
+        if not got or got[0] != CONNECT:
+            raise ValueError('expected CONNECT, got %r' % (got,))
+        body = got[2]
+        name, offset = get_string(body, 0)
+        level, flags = body[offset], body[offset + 1]
+        offset += 4
+        if name != 'MQTT' or level not in (4, 5):
+            raise ValueError('protocol %s level %d' % (name, level))
+        self.version = level
+        if level == 5:
+            props, offset = properties(body, offset)
+        client_id, offset = get_string(body, offset)
+
+        if level == 5:
+            props = bytes([PROP_TOPIC_ALIAS_MAX]) + struct.pack('>H',
+                                                                ALIAS_MAX)
+            self.send(packet(CONNACK, 0, b'\x00\x00' +
+                             put_length(len(props)) + props))
+        else:
+            self.send(packet(CONNACK, 0, b'\x00\x00'))
+        return level, flags, client_id
+
+    def serve(self, duration):
+        """Act as the broker for duration seconds."""
+        deadline = time.monotonic() + duration
+        while True:
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                return
+            got = self.next(remaining)
+            if got:
+                self.handle(*got)
+
+    def handle(self, kind, flags, body, chunks):
+        if kind == PUBLISH:
+            publish = Publish(flags, body, self.version, chunks)
+            self.resolve(publish)
+            self.publishes.append(publish)
+            if publish.qos == 1:
+                if self.hold and publish.topic == INPUT_TOPIC and \
+                        not self.held:
+                    # Left unacknowledged; the caller drops the
+                    # connection.
+                    self.held = publish
+                else:
+                    self.send(packet(PUBACK, 0,
+                                     struct.pack('>H', publish.packet_id)))
+        elif kind == SUBSCRIBE:
+            packet_id = struct.unpack_from('>H', body, 0)[0]
+            offset = 2
+            if self.version == 5:
+                props, offset = properties(body, offset)
+            topic, offset = get_string(body, offset)
+            qos = body[offset] & 0x03
+            self.subscriptions.append((topic, qos))
+            reason = b'\x00' if self.version == 5 else b''
+            self.send(packet(SUBACK, 0, struct.pack('>H', packet_id) +
+                             reason + bytes([qos])))
+            if topic == COMMAND_FILTER:
+                self.send(packet(PUBLISH, 0x02, put_string(COMMAND_TOPIC) +
+                                 struct.pack('>H', COMMAND_ID) +
+                                 (b'\x00' if self.version == 5 else b'') +
+                                 b'1'))
+        elif kind == PUBACK:
+            self.pubacks.append(struct.unpack_from('>H', body, 0)[0])
+        elif kind == PINGREQ:
+            self.send(packet(PINGRESP, 0, b''))
+        elif kind == DISCONNECT:
+            raise Closed()
+
+    def resolve(self, publish):
+        """Fill in the topic of a PUBLISH sent by alias."""
+        alias = publish.alias
+        if alias is None:
+            return
+        if alias < 1 or alias > ALIAS_MAX:
+            self.alias_errors.append('alias %d is out of range' % alias)
+        elif publish.topic:
+            self.aliases[alias] = publish.topic
+        elif alias in self.aliases:
+            publish.topic = self.aliases[alias]
+        else:
+            error = 'alias %d used before being set up' % alias
+            if error not in self.alias_errors:
+                self.alias_errors.append(error)
+
+
+class Checks:
+    def __init__(self):
+        self.failures = 0
+
+    def report(self, ok, what, detail=''):
+        print('%-4s %s%s' % ('ok' if ok else 'FAIL', what,
+                             ' (%s)' % detail if detail else ''))
+        if not ok:
+            self.failures += 1
+
+    def skip(self, what, why):
+        print('skip %s (%s)' % (what, why))
+
+
+def accept(server, args):
+    server.settimeout(args.connect_timeout)
+    try:
+        sock, address = server.accept()
+    except socket.timeout:
+        return None
+    return Connection(sock)
+
+
+def check_handshake(checks, conn, args, label):
+    level, flags, client_id = conn.handshake(args.timeout)
+    checks.report(flags & 0x02 and client_id == CLIENT_ID,
+                  '%s with a clean session as %s' % (label, CLIENT_ID),
+                  'MQTT %s, flags 0x%02x, id %r' %
+                  ('3.1.1' if level == 4 else '5', flags, client_id))
+
+
+def check_subscribed(checks, conn, label):
+    checks.report((COMMAND_FILTER, 1) in conn.subscriptions,
+                  '%s to %s with QoS 1' % (label, COMMAND_FILTER),
+                  ', '.join('%s QoS %d' % s for s in conn.subscriptions) or
+                  'no SUBSCRIBE')
+
+
+def check_malformed(checks, conn):
+    """Send a PUBLISH whose topic length runs past the end of it."""
+    conn.send(packet(PUBLISH, 0x00, struct.pack('>H', 0xFFFF) +
+                     COMMAND_TOPIC.encode()))
+    # A good command afterwards shows the sketch is still reading.
+    packet_id = COMMAND_ID + 1
+    conn.send(packet(PUBLISH, 0x02, put_string(COMMAND_TOPIC) +
+                     struct.pack('>H', packet_id) +
+                     (b'\x00' if conn.version == 5 else b'') + b'0'))
+    conn.serve(1.0)
+    checks.report(packet_id in conn.pubacks,
+                  'a PUBLISH with its topic past its end is ignored',
+                  'next command %s' % ('acknowledged' if packet_id in
+                                       conn.pubacks else 'not acknowledged'))
+
+
+def check_telemetry(checks, conn, duration):
+    telemetry = [p for p in conn.publishes if p.topic in TELEMETRY]
+    counts = [sum(p.topic == t for p in telemetry) for t in TELEMETRY]
+    checks.report(all(counts) and all(p.qos == 0 for p in telemetry),
+                  'telemetry is published with QoS 0',
+                  '%s messages/s' % ', '.join('%.1f' % (c / duration)
+                                              for c in counts))
+
+    # A period's messages are published one after the other, position
+    # first.
+    periods = 0
+    together = 0
+    for i in range(len(telemetry) - 2):
+        batch = telemetry[i:i + 3]
+        if tuple(p.topic for p in batch) != TELEMETRY:
+            continue
+        periods += 1
+        chunks = set(c for p in batch for c in p.chunks)
+        together += len(chunks) == 1
+    checks.report(periods and together >= 0.9 * periods,
+                  'each period\'s telemetry arrives in one segment',
+                  '%d of %d periods' % (together, periods))
+
+
+def check_aliases(checks, conn, label):
+    if conn.version != 5:
+        by_alias = [p for p in conn.publishes if p.alias is not None]
+        checks.report(not by_alias, 'MQTT 3.1.1 topics are sent in full',
+                      '%d sent by alias' % len(by_alias))
+        return
+
+    # The sketch registers the telemetry topics first, so the first
+    # ALIAS_MAX of them get aliases and the rest do not.
+    wrong = list(conn.alias_errors)
+    for i, topic in enumerate(TELEMETRY):
+        sent = [p for p in conn.publishes if p.topic == topic]
+        if not sent:
+            continue
+        if i >= ALIAS_MAX:
+            if any(p.alias is not None for p in sent):
+                wrong.append('%s has an alias past the limit' % topic)
+            continue
+        # The topic is sent in full once per connection, with its alias,
+        # and by the alias alone after that.
+        if sent[0].alias != i + 1 or not sent[0].named:
+            wrong.append('%s is not set up as alias %d' % (topic, i + 1))
+        if any(p.alias != i + 1 or p.named for p in sent[1:]):
+            wrong.append('%s is not sent by its alias' % topic)
+    wire = [p for p in conn.publishes if p.alias is not None]
+    checks.report(not wrong, '%s topic aliases, at most %d' %
+                  (label, ALIAS_MAX),
+                  '; '.join(wrong) if wrong else
+                  '%d messages sent by alias' % len(wire))
+
+
+def check_input(checks, conn):
+    inputs = [p for p in conn.publishes if p.topic == INPUT_TOPIC]
+    if not inputs:
+        checks.skip('DI-6 changes are published with QoS 1',
+                    'DI-6 did not change')
+        return
+    alternate = all(a.payload != b.payload
+                    for a, b in zip(inputs, inputs[1:]))
+    checks.report(all(p.qos == 1 for p in inputs) and alternate,
+                  'DI-6 changes are published with QoS 1',
+                  '%d changes' % len(inputs))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Check the EthernetMqttTelemetry sketch from a PC, by '
+                    'standing in for its broker.')
+    parser.add_argument('--listen', default='',
+                        help='address to listen on (default all)')
+    parser.add_argument('--port', type=int, default=PORT,
+                        help='port to listen on (default %d)' % PORT)
+    parser.add_argument('--connect-timeout', type=float, default=30.0,
+                        help='seconds to wait for the sketch to connect '
+                             '(default 30)')
+    parser.add_argument('--timeout', type=float, default=3.0,
+                        help='seconds to wait for a packet (default 3)')
+    parser.add_argument('--duration', type=float, default=3.0,
+                        help='seconds to collect telemetry for '
+                             '(default 3)')
+    parser.add_argument('--input-wait', type=float, default=5.0,
+                        help='seconds to wait for a DI-6 change before '
+                             'dropping the connection (default 5)')
+    args = parser.parse_args()
+
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    try:
+        server.bind((args.listen, args.port))
+        server.listen(1)
+    except OSError as e:
+        die('cannot listen on port %d: %s' % (args.port, e))
+
+    checks = Checks()
+    conn = None
+    try:
+        conn = accept(server, args)
+        if not conn:
+            die('the sketch did not connect within %g s' %
+                args.connect_timeout)
+        check_handshake(checks, conn, args, 'connects')
+        conn.serve(args.duration)
+        check_subscribed(checks, conn, 'subscribes')
+        checks.report(COMMAND_ID in conn.pubacks,
+                      'a QoS 1 command is acknowledged',
+                      'PUBACK for %s' % (conn.pubacks or 'none'))
+        check_malformed(checks, conn)
+        check_telemetry(checks, conn, args.duration)
+        check_aliases(checks, conn, 'uses')
+        check_input(checks, conn)
+
+        # Hold back the acknowledgement of the next DI-6 change and drop
+        # the connection.
+        conn.hold = True
+        deadline = time.monotonic() + args.input_wait
+        while not conn.held and time.monotonic() < deadline:
+            conn.serve(0.05)
+        held = conn.held
+        conn.close()
+        dropped = time.monotonic()
+
+        conn = accept(server, args)
+        if not conn:
+            checks.report(False, 'reconnects after the broker drops the '
+                                 'connection',
+                          'not within %g s' % args.connect_timeout)
+        else:
+            check_handshake(checks, conn, args, 'reconnects after %.1f s' %
+                            (time.monotonic() - dropped))
+            conn.serve(1.0)
+            check_subscribed(checks, conn, 'subscribes again')
+            check_aliases(checks, conn, 'sets up')
+            resent = [p for p in conn.publishes if p.qos == 1]
+            if not held:
+                checks.skip('resends the unacknowledged message',
+                            'DI-6 did not change')
+            else:
+                first = resent[0] if resent else None
+                checks.report(first is not None and first.dup and
+                              first.packet_id == held.packet_id and
+                              first.payload == held.payload,
+                              'first resends the unacknowledged message '
+                              'with DUP set',
+                              'packet %d %r, first QoS 1 after reconnecting '
+                              '%s' % (held.packet_id, held.payload,
+                                      'packet %d %r%s' %
+                                      (first.packet_id, first.payload,
+                                       ' DUP' if first.dup else '')
+                                      if first else 'none'))
+    except (Closed, ValueError, struct.error) as e:
+        checks.report(False, 'the sketch keeps to the protocol', repr(e))
+    except OSError as e:
+        die(str(e))
+    finally:
+        if conn:
+            conn.close()
+        server.close()
+
+    if checks.failures:
+        print('%d checks failed' % checks.failures)
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,274 @@
+# Host-side check for the EthernetUdpMulticast sketch.
+#
+# Joins the sketch's multicast group and checks that:
+#
+#   - the packets the sketch sends to the group arrive,
+#   - a ping sent to each of the sketch's two groups is answered once, by
+#     the socket that joined that group and not by the other one, though
+#     both sockets are on the same port,
+#   - a ping sent to a group the sketch has not joined is not answered, and
+#   - a ping sent to the sketch's own address is answered once, by the
+#     socket started first.
+#
+# Load the sketch on a ClearCore, then run
+#
+#   python3 multicast_check.py 192.168.0.100
+#
+# If the PC has several interfaces, give the address of the one on the
+# ClearCore's network with --interface. With --stand-in instead of an
+# address, the checks run against a copy of the sketch written in Python,
+# on the loopback interface; use it to check the script, or the PC's own
+# multicast set-up, without a ClearCore. The stand-in needs Linux.
+#
+# Only the Python 3 standard library is needed. Exits with status 1 if any
+# check fails.
+
+import argparse
+import socket
+import struct
+import sys
+import threading
+import time
+
+GROUP = '239.1.2.3'
+OTHER_GROUP = '239.1.2.4'
+UNJOINED_GROUP = '239.1.2.5'
+PORT = 8888
+# Linux's value, for Pythons that do not define it.
+IP_PKTINFO = getattr(socket, 'IP_PKTINFO', 8)
+
+
+# print error and die
+def die(message):
+    print('error: ' + message, file=sys.stderr)
+    sys.exit(2)
+
+
+def group_socket(group, port, interface):
+    """A socket that has joined group and only receives what is sent to it.
+
+    Binding to the group address, rather than to any address, keeps out
+    packets sent to the port for other groups the host has joined.
+    """
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    if hasattr(socket, 'SO_REUSEPORT'):
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEPORT, 1)
+    sock.bind((group, port))
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP,
+                    socket.inet_aton(group) + socket.inet_aton(interface))
+    return sock
+
+
+def sender_socket(interface):
+    """A socket that sends to groups from interface, and gets answers."""
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_IF,
+                    socket.inet_aton(interface))
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL,
+                    struct.pack('b', 1))
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_LOOP,
+                    struct.pack('b', 1))
+    sock.bind((interface, 0))
+    return sock
+
+
+class StandIn:
+    """The EthernetUdpMulticast sketch, on the host.
+
+    Two sockets on one port, each joined to one group, sorted out the way
+    EthernetUDP does it: the port has one socket in the stack, and each
+    datagram goes by its destination address to the sockets that joined
+    that group, or to the socket started first if it was not multicast.
+    Pings are answered directly to their sender with the group of the
+    socket that received them.
+    """
+
+    def __init__(self, interface, port):
+        self.port_socket = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.port_socket.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR,
+                                    1)
+        if hasattr(socket, 'SO_REUSEPORT'):
+            self.port_socket.setsockopt(socket.SOL_SOCKET,
+                                        socket.SO_REUSEPORT, 1)
+        self.port_socket.setsockopt(socket.IPPROTO_IP, IP_PKTINFO, 1)
+        self.port_socket.bind(('', port))
+        # The sketch's sockets, in the order they were started.
+        self.sockets = (GROUP, OTHER_GROUP)
+        for group in self.sockets:
+            self.port_socket.setsockopt(
+                socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP,
+                socket.inet_aton(group) + socket.inet_aton(interface))
+        self.sender = sender_socket(interface)
+        self.port = port
+        self.running = True
+        self.thread = threading.Thread(target=self.run, daemon=True)
+        self.thread.start()
+
+    def receivers(self, dest):
+        """The groups of the sockets a datagram sent to dest goes to."""
+        if socket.inet_aton(dest)[0] & 0xF0 == 0xE0:
+            return [group for group in self.sockets if group == dest]
+        return self.sockets[:1]
+
+    def run(self):
+        self.port_socket.settimeout(0.05)
+        last_send = 0
+        while self.running:
+            try:
+                data, ancillary, flags, sender = \
+                    self.port_socket.recvmsg(2048, 64)
+            except socket.timeout:
+                data = None
+            if data is not None and data.startswith(b'ping'):
+                dest = None
+                for level, kind, value in ancillary:
+                    if level == socket.IPPROTO_IP and kind == IP_PKTINFO:
+                        # struct in_pktinfo: index, local address, then
+                        # the header's destination address.
+                        dest = socket.inet_ntoa(value[8:12])
+                for group in self.receivers(dest) if dest else ():
+                    self.sender.sendto(group.encode() + b' ' + data, sender)
+            if time.monotonic() - last_send >= 1.0:
+                self.sender.sendto(b'DI-6 is off', (GROUP, self.port))
+                last_send = time.monotonic()
+
+    def stop(self):
+        self.running = False
+        self.thread.join()
+        self.port_socket.close()
+
+
+class Checks:
+    def __init__(self):
+        self.failures = 0
+
+    def report(self, ok, what, detail=''):
+        print('%-4s %s%s' % ('ok' if ok else 'FAIL', what,
+                             ' (%s)' % detail if detail else ''))
+        if not ok:
+            self.failures += 1
+
+
+def check_announcements(checks, args, source):
+    """Wait for the sketch's own packets to the group."""
+    sock = group_socket(GROUP, args.port, args.interface)
+    sock.settimeout(0.2)
+    deadline = time.monotonic() + args.timeout
+    packet = None
+    try:
+        while time.monotonic() < deadline and packet is None:
+            try:
+                data, sender = sock.recvfrom(2048)
+            except socket.timeout:
+                continue
+            if data.startswith(b'DI-6 is ') and \
+                    (source is None or sender[0] == source):
+                packet = (data, sender)
+    finally:
+        sock.close()
+    checks.report(packet is not None, 'packets sent to %s arrive' % GROUP,
+                  '%r from %s' % (packet[0], packet[1][0]) if packet
+                  else 'none within %g s' % args.timeout)
+
+
+def ping(args, sock, address, number):
+    """Send a ping to address and collect the answers to it."""
+    payload = b'ping %d' % number
+    sock.sendto(payload, (address, args.port))
+    answers = []
+    deadline = time.monotonic() + args.wait
+    while time.monotonic() < deadline:
+        sock.settimeout(max(0.01, deadline - time.monotonic()))
+        try:
+            data, sender = sock.recvfrom(2048)
+        except socket.timeout:
+            break
+        if data.endswith(b' ' + payload):
+            answers.append(data[:-len(payload) - 1].decode(errors='replace'))
+    return answers
+
+
+def check_filtering(checks, args, address):
+    """Ping each group and the sketch, and check which socket answers."""
+    sock = sender_socket(args.interface)
+    number = 0
+    try:
+        for target, expected in ((GROUP, [GROUP]),
+                                 (OTHER_GROUP, [OTHER_GROUP]),
+                                 (UNJOINED_GROUP, []),
+                                 (address, [GROUP])):
+            # A lost datagram is not a filtering fault, so a missing answer
+            # is retried; a wrong or extra answer is not.
+            for attempt in range(args.retries):
+                number += 1
+                answers = ping(args, sock, target, number)
+                if answers:
+                    break
+            if target == address:
+                what = 'ping to %s is answered by the first socket only' % \
+                    target
+            elif expected:
+                what = 'ping to %s is answered by its socket only' % target
+            else:
+                what = 'ping to %s (not joined) is not answered' % target
+            checks.report(answers == expected, what,
+                          'answered by %s' % (', '.join(answers) or 'none'))
+    finally:
+        sock.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Check the EthernetUdpMulticast sketch from a PC.')
+    parser.add_argument('host', nargs='?',
+                        help='address of the ClearCore; its packets are '
+                             'only accepted from this address')
+    parser.add_argument('--stand-in', action='store_true',
+                        help='check a stand-in for the sketch on this host '
+                             'instead of a ClearCore')
+    parser.add_argument('--interface', default=None,
+                        help='address of the local interface to use '
+                             '(default any, or 127.0.0.1 with --stand-in)')
+    parser.add_argument('--port', type=int, default=PORT,
+                        help='port of the groups (default %d)' % PORT)
+    parser.add_argument('--timeout', type=float, default=3.0,
+                        help='seconds to wait for the sketch\'s packets '
+                             '(default 3)')
+    parser.add_argument('--wait', type=float, default=0.5,
+                        help='seconds to collect answers to a ping '
+                             '(default 0.5)')
+    parser.add_argument('--retries', type=int, default=3,
+                        help='pings to send to a group before giving up on '
+                             'an answer (default 3)')
+    args = parser.parse_args()
+    if args.stand_in == (args.host is not None):
+        die('give either the address of the ClearCore or --stand-in')
+    if args.interface is None:
+        args.interface = '127.0.0.1' if args.stand_in else '0.0.0.0'
+
+    stand_in = None
+    try:
+        if args.stand_in:
+            stand_in = StandIn(args.interface, args.port)
+    except OSError as e:
+        die('cannot start the stand-in: %s' % e)
+
+    checks = Checks()
+    try:
+        check_announcements(checks, args, args.host)
+        check_filtering(checks, args,
+                        args.interface if args.stand_in else args.host)
+    except OSError as e:
+        die(str(e))
+    finally:
+        if stand_in:
+            stand_in.stop()
+
+    if checks.failures:
+        print('%d checks failed' % checks.failures)
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,129 @@
+/*
+ * Title: DirectoryIndexBenchmark
+ *
+ * Objective:
+ *    This example demonstrates how the SD directory index speeds up opening
+ *    files on a card that holds many of them.
+ *
+ * Description:
+ *    This example creates 1,000 small files (P0000.TXT through P0999.TXT) in
+ *    the root directory of the SD card if they are not already there. It then
+ *    opens every file twice, first by walking the directory and then using
+ *    the hashed directory index, and prints the time taken by each pass to
+ *    the USB serial port. Finally it removes one file and re-creates it to
+ *    show that the index is kept up to date.
+ *    The same benchmark runs on a PC, on a disk image in place of the card:
+ *    build libraries/SD/extras/host with make and run sd_index_bench. It
+ *    also counts the sectors each pass reads.
+ *
+ * Requirements:
+ * ** A FAT32 formatted micro SD card installed in the ClearCore. (The root
+ *    directory of a FAT16 card cannot hold 1,000 files.)
+ *
+ * Links:
+ * ** ClearCore Documentation: https://teknic-inc.github.io/ClearCore-library/
+ * ** ClearCore Manual: https://www.teknic.com/files/downloads/clearcore_user_manual.pdf
+ *
+ *
+ * Copyright (c) 2020 Teknic Inc. This work is free to use, copy and distribute under the terms of
+ * the standard MIT permissive software license which can be found at https://opensource.org/licenses/MIT
+ */
+#include <SdFileSystem.h>
+
+#define fileCount 1000
+
+// About one and a half index slots per file on the card.
+#define indexSlots (fileCount * 3 / 2 + 64)
+
+SdIndexEntry indexTable[indexSlots];
+
+void fileName(uint16_t i, char *name) {
+    sprintf(name, "P%04u.TXT", i);
+}
+
+// Open every file once and return the time taken in milliseconds, or 0 if
+// any file could not be opened.
+uint32_t openAll() {
+    char name[13];
+    uint32_t start = millis();
+    for (uint16_t i = 0; i < fileCount; i++) {
+        fileName(i, name);
+        SdFsFile file = SdCardFs.open(name);
+        if (!file) {
+            Serial.print("Could not open ");
+            Serial.println(name);
+            return 0;
+        }
+        file.close();
+    }
+    return millis() - start;
+}
+
+void setup() {
+    Serial.begin(9600);
+    uint32_t timeout = 5000;
+    uint32_t startTime = millis();
+    while (!Serial && millis() - startTime < timeout) {
+        continue;
+    }
+
+    if (!SdCardFs.begin()) {
+        Serial.println("SD card initialization failed!");
+        while (true) {
+            continue;
+        }
+    }
+
+    Serial.println("Creating files...");
+    char name[13];
+    for (uint16_t i = 0; i < fileCount; i++) {
+        fileName(i, name);
+        if (SdCardFs.exists(name)) {
+            continue;
+        }
+        SdFsFile file = SdCardFs.open(name, SD_FILE_WRITE);
+        if (!file) {
+            Serial.print("Could not create ");
+            Serial.println(name);
+            while (true) {
+                continue;
+            }
+        }
+        file.println(i);
+        file.close();
+    }
+
+    Serial.print("Without index: ");
+    Serial.print(openAll());
+    Serial.println(" ms");
+
+    uint32_t start = millis();
+    if (!SdCardFs.indexBuffer(indexTable, indexSlots)) {
+        Serial.println("Index table is too small for this card.");
+        while (true) {
+            continue;
+        }
+    }
+    Serial.print("Index built in ");
+    Serial.print(millis() - start);
+    Serial.println(" ms");
+
+    Serial.print("With index: ");
+    Serial.print(openAll());
+    Serial.println(" ms");
+
+    // The index follows files being removed and created.
+    fileName(fileCount / 2, name);
+    SdCardFs.remove(name);
+    Serial.print(name);
+    Serial.println(SdCardFs.exists(name) ? " still exists!" : " removed.");
+    SdFsFile file = SdCardFs.open(name, SD_FILE_WRITE);
+    file.println(fileCount / 2);
+    file.close();
+    Serial.print(name);
+    Serial.println(SdCardFs.exists(name) ? " re-created." : " is missing!");
+}
+
+void loop() {
+    // Nothing happens after setup
+}
@@ -0,0 +1,107 @@
+/*
+ * Title: HighRateLogger
+ *
+ * Objective:
+ *    This example demonstrates how to log binary data to the SD card at a
+ *    high, fixed rate without stalling the rest of the program.
+ *
+ * Description:
+ *    This example samples the commanded position and HLFB state of the motor
+ *    on M-0 and the voltage on A-12 once every millisecond for 30 seconds and
+ *    logs each sample as a fixed-size binary record to LOG.BIN on the SD
+ *    card. The log file is pre-allocated up front and full buffers of records
+ *    are written to the card in the background, so loop() never waits on the
+ *    card. Any samples that cannot be buffered are counted as dropped.
+ *
+ * Requirements:
+ * ** A micro SD card installed in the ClearCore.
+ * ** Optional: A motor connected to M-0 and an analog source on A-12.
+ *
+ * Links:
+ * ** ClearCore Documentation: https://teknic-inc.github.io/ClearCore-library/
+ * ** ClearCore Manual: https://www.teknic.com/files/downloads/clearcore_user_manual.pdf
+ *
+ *
+ * Copyright (c) 2020 Teknic Inc. This work is free to use, copy and distribute under the terms of
+ * the standard MIT permissive software license which can be found at https://opensource.org/licenses/MIT
+ */
+#include <SdLogger.h>
+
+// Sample period and logging duration.
+#define samplePeriodUs 1000
+#define logDurationMs 30000
+
+// One log record. Keep records a fixed size so the file can be decoded
+// on a PC as an array of these structures.
+struct Sample {
+    uint32_t timestampUs;
+    int32_t position;
+    uint16_t analog;
+    uint8_t hlfb;
+    uint8_t reserved;
+};
+
+SdLogger logger;
+
+uint32_t lastSampleUs;
+uint32_t startMs;
+
+void setup() {
+    Serial.begin(9600);
+    uint32_t timeout = 5000;
+    uint32_t startTime = millis();
+    while (!Serial && millis() - startTime < timeout) {
+        continue;
+    }
+
+    if (!SdCardFs.begin()) {
+        Serial.println("SD card initialization failed!");
+        while (true) {
+            continue;
+        }
+    }
+
+    // Reserve room for the whole run.
+    uint32_t maxBytes = (uint32_t)sizeof(Sample) *
+                        (logDurationMs * 1000UL / samplePeriodUs);
+    if (!logger.begin("LOG.BIN", maxBytes)) {
+        Serial.println("Could not create LOG.BIN");
+        while (true) {
+            continue;
+        }
+    }
+    Serial.println("Logging...");
+
+    startMs = millis();
+    lastSampleUs = micros();
+}
+
+void loop() {
+    if (logger.active()) {
+        uint32_t now = micros();
+        if (now - lastSampleUs >= samplePeriodUs) {
+            lastSampleUs += samplePeriodUs;
+
+            Sample sample;
+            sample.timestampUs = now;
+            sample.position = ConnectorM0.PositionRefCommanded();
+            sample.analog = analogRead(A12);
+            sample.hlfb = ConnectorM0.HlfbState();
+            sample.reserved = 0;
+            logger.log(sample);
+        }
+
+        // Move buffered records to the card. This never blocks.
+        logger.service();
+
+        if (millis() - startMs >= logDurationMs) {
+            bool ok = logger.end();
+            Serial.print("Logging ");
+            Serial.println(ok ? "complete." : "failed!");
+            Serial.print("Records logged: ");
+            Serial.println(logger.recordsLogged());
+            Serial.print("Records dropped: ");
+            Serial.println(logger.recordsDropped());
+        }
+    }
+}
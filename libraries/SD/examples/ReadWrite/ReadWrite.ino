@@ -69,9 +69,12 @@ void setup() {
     if (myFile) {
         Serial.println("test.txt:");
 
-        // Read from the file until there's nothing else in it:
-        while (myFile.available()) {
-            Serial.write(myFile.read());
+        // Read from the file until there's nothing else in it. Reading a
+        // block at a time is much faster than reading a byte at a time.
+        uint8_t buf[64];
+        int n;
+        while ((n = myFile.read(buf, sizeof(buf))) > 0) {
+            Serial.write(buf, n);
         }
         // Close the file:
         myFile.close();
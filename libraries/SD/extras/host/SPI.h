@@ -0,0 +1,23 @@
+/*
+ * Declarations SdBlockDevice.h needs. The card driver itself is not built
+ * on a PC.
+ */
+
+#ifndef HOST_SPI_H_
+#define HOST_SPI_H_
+
+#include <Arduino.h>
+
+#define MAX_SPI 24000000
+
+class SPISettings {
+public:
+    SPISettings() {}
+};
+
+class SPIClass {
+public:
+    uint8_t transfer(uint8_t data);
+};
+
+#endif // HOST_SPI_H_
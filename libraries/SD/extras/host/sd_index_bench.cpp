@@ -0,0 +1,328 @@
+/*
+ * Directory index benchmark on a PC.
+ *
+ * Runs SdFileSystem on a FAT32 disk image instead of a card: creates 1,000
+ * files (P0000.TXT to P0999.TXT) in the root directory, then times open(),
+ * exists() and remove() and re-create of every file, first walking the
+ * directory and then with the hashed directory index, along with building
+ * the index. Sector reads and writes are counted as well as the time taken,
+ * since on a card the number of sectors read is what sets the cost.
+ *
+ * Usage: sd_index_bench [-n files] [image]
+ *
+ * The image (sd_index_bench.img by default) is created and formatted if it
+ * does not exist. An image of a real card, e.g. made with dd, can be used
+ * instead; files that are missing from it are created.
+ *
+ * Exits with status 1 if any operation gives a wrong result.
+ */
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "SdFileSystem.h"
+
+// Sectors in a new image: 64 MiB, enough clusters of one sector for FAT32.
+#define IMAGE_SECTORS 131072
+#define RESERVED_SECTORS 32
+
+static void put16(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    put16(p, v);
+    put16(p + 2, v >> 16);
+}
+
+// Sectors kept in an image file.
+class ImageDevice : public SdSectorDevice {
+public:
+    ImageDevice() : m_file(nullptr), reads(0), writes(0) {}
+
+    bool open(const char *path) {
+        m_file = fopen(path, "r+b");
+        return m_file != nullptr;
+    }
+
+    // Create an empty FAT32 volume, without a partition table.
+    bool create(const char *path) {
+        m_file = fopen(path, "w+b");
+        if (!m_file) {
+            return false;
+        }
+        uint8_t zero = 0;
+        if (fseek(m_file, (long)IMAGE_SECTORS * SD_SECTOR_SIZE - 1,
+                  SEEK_SET) || fwrite(&zero, 1, 1, m_file) != 1) {
+            return false;
+        }
+
+        // Each FAT must have room for every cluster of the data area after
+        // it.
+        uint32_t fatSectors = 1;
+        uint32_t clusters;
+        for (;;) {
+            clusters = IMAGE_SECTORS - RESERVED_SECTORS - 2 * fatSectors;
+            uint32_t needed = ((clusters + 2) * 4 + SD_SECTOR_SIZE - 1) /
+                              SD_SECTOR_SIZE;
+            if (needed <= fatSectors) {
+                break;
+            }
+            fatSectors = needed;
+        }
+
+        uint8_t sector[SD_SECTOR_SIZE] = {};
+        memcpy(sector, "\xEB\x58\x90MSWIN4.1", 11);
+        put16(sector + 11, SD_SECTOR_SIZE);
+        sector[13] = 1;
+        put16(sector + 14, RESERVED_SECTORS);
+        sector[16] = 2;
+        sector[21] = 0xF8;
+        put16(sector + 24, 63);
+        put16(sector + 26, 255);
+        put32(sector + 32, IMAGE_SECTORS);
+        put32(sector + 36, fatSectors);
+        put32(sector + 44, 2);
+        put16(sector + 48, 1);
+        put16(sector + 50, 6);
+        sector[64] = 0x80;
+        sector[66] = 0x29;
+        memcpy(sector + 71, "NO NAME    FAT32   ", 19);
+        put16(sector + 510, 0xAA55);
+        if (!writeSector(0, sector) || !writeSector(6, sector)) {
+            return false;
+        }
+
+        memset(sector, 0, sizeof(sector));
+        put32(sector, 0x41615252);
+        put32(sector + 484, 0x61417272);
+        // The root directory has cluster 2.
+        put32(sector + 488, clusters - 1);
+        put32(sector + 492, 3);
+        put32(sector + 508, 0xAA550000);
+        if (!writeSector(1, sector) || !writeSector(7, sector)) {
+            return false;
+        }
+
+        memset(sector, 0, sizeof(sector));
+        put32(sector, 0x0FFFFFF8);
+        put32(sector + 4, 0x0FFFFFFF);
+        put32(sector + 8, 0x0FFFFFFF);
+        for (uint8_t i = 0; i < 2; i++) {
+            if (!writeSector(RESERVED_SECTORS + i * fatSectors, sector)) {
+                return false;
+            }
+        }
+        reads = 0;
+        writes = 0;
+        return true;
+    }
+
+    virtual bool readSector(uint32_t sector, uint8_t *dst) {
+        return readSectors(sector, dst, 1);
+    }
+    virtual bool writeSector(uint32_t sector, const uint8_t *src) {
+        return writeSectors(sector, src, 1);
+    }
+    virtual bool readSectors(uint32_t sector, uint8_t *dst, uint32_t count) {
+        reads += count;
+        return !fseek(m_file, (long)sector * SD_SECTOR_SIZE, SEEK_SET) &&
+               fread(dst, SD_SECTOR_SIZE, count, m_file) == count;
+    }
+    virtual bool writeSectors(uint32_t sector, const uint8_t *src,
+                              uint32_t count) {
+        writes += count;
+        return !fseek(m_file, (long)sector * SD_SECTOR_SIZE, SEEK_SET) &&
+               fwrite(src, SD_SECTOR_SIZE, count, m_file) == count;
+    }
+
+    void close() {
+        if (m_file) {
+            fclose(m_file);
+            m_file = nullptr;
+        }
+    }
+
+private:
+    FILE *m_file;
+
+public:
+    uint32_t reads;
+    uint32_t writes;
+};
+
+static ImageDevice image;
+static SdFileSystem fs(image);
+static int fileCount = 1000;
+static int failures = 0;
+
+static void fileName(int i, char *name) {
+    snprintf(name, 16, "P%04d.TXT", i);
+}
+
+static void fail(const char *what, const char *name) {
+    if (failures++ < 10) {
+        fprintf(stderr, "%s failed for %s\n", what, name);
+    }
+}
+
+static bool create(const char *name, int i) {
+    SdFsFile file = fs.open(name, SD_FILE_WRITE);
+    if (!file) {
+        return false;
+    }
+    char text[16];
+    snprintf(text, sizeof(text), "%d\r\n", i);
+    file.write(text);
+    file.close();
+    return true;
+}
+
+// Time one pass of an operation over the files, and count the sectors it
+// moves.
+class Pass {
+public:
+    explicit Pass(const char *label)
+        : m_label(label),
+          m_reads(image.reads),
+          m_writes(image.writes),
+          m_start(std::chrono::steady_clock::now()) {}
+
+    void report(int operations) {
+        double ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - m_start).count();
+        uint32_t reads = image.reads - m_reads;
+        uint32_t writes = image.writes - m_writes;
+        printf("  %-16s %9.2f ms %9.2f us/op %8u reads %7.1f/op "
+               "%7u writes\n", m_label, ms, ms * 1000 / operations, reads,
+               (double)reads / operations, writes);
+    }
+
+private:
+    const char *m_label;
+    uint32_t m_reads;
+    uint32_t m_writes;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+static void runPasses() {
+    char name[16];
+
+    Pass open("open");
+    for (int i = 0; i < fileCount; i++) {
+        fileName(i, name);
+        SdFsFile file = fs.open(name);
+        if (!file || file.size() == 0) {
+            fail("open", name);
+        }
+        file.close();
+    }
+    open.report(fileCount);
+
+    Pass exists("exists");
+    for (int i = 0; i < fileCount; i++) {
+        fileName(i, name);
+        if (!fs.exists(name)) {
+            fail("exists", name);
+        }
+    }
+    fileName(fileCount, name);
+    if (fs.exists(name)) {
+        fail("exists (absent file)", name);
+    }
+    exists.report(fileCount + 1);
+
+    // Every tenth file, so the entries freed are spread over the
+    // directory and re-used in place.
+    int removed = 0;
+    Pass remove("remove+create");
+    for (int i = 0; i < fileCount; i += 10, removed++) {
+        fileName(i, name);
+        if (!fs.remove(name) || fs.exists(name)) {
+            fail("remove", name);
+        }
+        if (!create(name, i)) {
+            fail("re-create", name);
+        }
+    }
+    remove.report(removed);
+}
+
+int main(int argc, char **argv) {
+    const char *path = "sd_index_bench.img";
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            fileCount = atoi(argv[++i]);
+        }
+        else if (argv[i][0] == '-' || i != argc - 1) {
+            fprintf(stderr, "usage: %s [-n files] [image]\n", argv[0]);
+            return 2;
+        }
+        else {
+            path = argv[i];
+        }
+    }
+    if (fileCount < 1 || fileCount > 9999) {
+        fprintf(stderr, "files must be 1 to 9999\n");
+        return 2;
+    }
+
+    if (!image.open(path)) {
+        printf("Creating %s\n", path);
+        if (!image.create(path)) {
+            fprintf(stderr, "cannot create %s\n", path);
+            return 2;
+        }
+    }
+    if (!fs.mount()) {
+        fprintf(stderr, "no FAT16/FAT32 volume in %s\n", path);
+        return 2;
+    }
+
+    char name[16];
+    int created = 0;
+    for (int i = 0; i < fileCount; i++) {
+        fileName(i, name);
+        if (fs.exists(name)) {
+            continue;
+        }
+        if (!create(name, i)) {
+            fprintf(stderr, "cannot create %s\n", name);
+            return 2;
+        }
+        created++;
+    }
+    fs.sync();
+    printf("%d files (%d created), FAT%u, %u byte clusters\n\n", fileCount,
+           created, fs.fatType(), (unsigned)fs.clusterSize());
+
+    printf("Without index:\n");
+    runPasses();
+
+    // About one and a half slots per entry, as in the sketch.
+    std::vector<SdIndexEntry> table(fileCount * 3 / 2 + 64);
+    Pass build("build");
+    if (!fs.indexBuffer(table.data(), table.size())) {
+        fprintf(stderr, "index table too small\n");
+        return 2;
+    }
+    printf("\nIndex:\n");
+    build.report(1);
+
+    printf("\nWith index:\n");
+    runPasses();
+    if (!fs.indexed()) {
+        fail("keeping the index", "the volume");
+    }
+
+    fs.unmount();
+    image.close();
+    if (failures) {
+        printf("\n%d failures\n", failures);
+        return 1;
+    }
+    return 0;
+}